@@ -0,0 +1,242 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "leveldb/cache.h"
+#include "leveldb/env.h"
+#include "util/coding.h"
+#include "util/random.h"
+
+// Comma-separated list of caches to compare, each under the same load
+//      lru     -- NewLRUCache(cache_size), or
+//                 NewShardedLRUCache(cache_size, shard_bits) if
+//                 --shard_bits is set
+//      slru    -- NewSLRUCache(cache_size)
+//      clock   -- NewClockCache(cache_size, value_size)
+static const char* FLAGS_caches = "lru,slru,clock";
+
+// Number of concurrent threads looking up entries
+static int FLAGS_threads = 16;
+
+// Number of bits of the number of shards of the LRU cache.  Negative
+// means the default of 16 shards.
+static int FLAGS_shard_bits = -1;
+
+// Capacity of the cache in bytes
+static int FLAGS_cache_size = 64 << 20;
+
+// Charge of every entry, like the size of a block
+static int FLAGS_value_size = 4096;
+
+// Number of distinct keys.  If negative, 90% of the entries that fit in the
+// cache, so that almost every lookup is a hit once the cache is warm.
+static int FLAGS_num_keys = -1;
+
+// Number of lookups done by each thread
+static int FLAGS_lookups = 1000000;
+
+// Fraction of the lookups that are for keys used only once, like the
+// blocks read by a long scan.  They miss and are inserted.  The hit ratio
+// is reported for the other lookups only.
+static double FLAGS_scan_ratio = 0.0;
+
+namespace leveldb {
+
+namespace {
+
+// Block cache style keys: a cache id followed by a block offset.
+void EncodeKey(uint64_t k, char* buf) {
+  EncodeFixed64(buf, 1);
+  EncodeFixed64(buf + 8, k * FLAGS_value_size);
+}
+
+void DeleteValue(const Slice& key, void* value) {}
+
+class CacheBench {
+ public:
+  CacheBench() : num_keys_(FLAGS_num_keys) {
+    if (num_keys_ < 0) {
+      num_keys_ = static_cast<int>(
+          static_cast<int64_t>(FLAGS_cache_size) / FLAGS_value_size * 9 / 10);
+    }
+    if (num_keys_ < 1) {
+      num_keys_ = 1;
+    }
+  }
+
+  void Run() {
+    std::fprintf(stdout, "Threads:    %d\n", FLAGS_threads);
+    std::fprintf(stdout, "Cache size: %d MB\n", FLAGS_cache_size >> 20);
+    std::fprintf(stdout, "Entries:    %d keys of charge %d\n", num_keys_,
+                 FLAGS_value_size);
+    std::fprintf(stdout, "Lookups:    %d per thread, %.0f%% scanning\n",
+                 FLAGS_lookups, FLAGS_scan_ratio * 100);
+    std::fprintf(stdout, "------------------------------------------------\n");
+
+    const char* caches = FLAGS_caches;
+    while (caches != nullptr) {
+      const char* sep = std::strchr(caches, ',');
+      Slice name;
+      if (sep == nullptr) {
+        name = caches;
+        caches = nullptr;
+      } else {
+        name = Slice(caches, sep - caches);
+        caches = sep + 1;
+      }
+
+      Cache* cache = nullptr;
+      if (name == Slice("lru")) {
+        cache = FLAGS_shard_bits < 0
+                    ? NewLRUCache(FLAGS_cache_size)
+                    : NewShardedLRUCache(FLAGS_cache_size, FLAGS_shard_bits);
+      } else if (name == Slice("slru")) {
+        cache = NewSLRUCache(FLAGS_cache_size);
+      } else if (name == Slice("clock")) {
+        cache = NewClockCache(FLAGS_cache_size, FLAGS_value_size);
+      } else if (!name.empty()) {
+        std::fprintf(stderr, "unknown cache '%s'\n", name.ToString().c_str());
+      }
+      if (cache != nullptr) {
+        RunCache(name, cache);
+        delete cache;
+      }
+    }
+  }
+
+ private:
+  void RunCache(const Slice& name, Cache* cache) {
+    // Warm the cache with every key, looking each up once as well
+    char key[16];
+    for (int i = 0; i < num_keys_; i++) {
+      EncodeKey(i, key);
+      cache->Release(cache->Insert(Slice(key, sizeof(key)), nullptr,
+                                   FLAGS_value_size, &DeleteValue));
+      cache->Release(cache->Lookup(Slice(key, sizeof(key))));
+    }
+
+    const uint32_t scan_threshold =
+        static_cast<uint32_t>(FLAGS_scan_ratio * 1000000);
+    std::atomic<int> ready(0);
+    std::atomic<bool> start(false);
+    std::atomic<int64_t> hits(0);
+    std::atomic<int64_t> lookups(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < FLAGS_threads; t++) {
+      threads.emplace_back([&, t] {
+        Random rnd(1000 + t);
+        char key[16];
+        int64_t thread_hits = 0;
+        int64_t thread_lookups = 0;
+        // Keys used only once, past those of the other threads
+        uint64_t scan_key =
+            num_keys_ + static_cast<uint64_t>(t) * FLAGS_lookups;
+        ready.fetch_add(1);
+        while (!start.load(std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+        for (int i = 0; i < FLAGS_lookups; i++) {
+          const bool scan = rnd.Uniform(1000000) < scan_threshold;
+          EncodeKey(scan ? scan_key++ : rnd.Uniform(num_keys_), key);
+          const Slice k(key, sizeof(key));
+          Cache::Handle* handle = cache->Lookup(k);
+          if (!scan) {
+            thread_lookups++;
+          }
+          if (handle != nullptr) {
+            thread_hits += scan ? 0 : 1;
+          } else {
+            handle = cache->Insert(k, nullptr, FLAGS_value_size, &DeleteValue);
+          }
+          cache->Release(handle);
+        }
+        hits.fetch_add(thread_hits);
+        lookups.fetch_add(thread_lookups);
+      });
+    }
+    while (ready.load() < FLAGS_threads) {
+      std::this_thread::yield();
+    }
+
+    const uint64_t start_micros = Env::Default()->NowMicros();
+    start.store(true, std::memory_order_release);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    const double seconds =
+        (Env::Default()->NowMicros() - start_micros) * 1e-6;
+
+    const double ops = static_cast<double>(FLAGS_lookups) * FLAGS_threads;
+    std::fprintf(stdout,
+                 "%-8s : %11.3f micros/op; %8.2f Mops/s; %5.1f%% hits",
+                 name.ToString().c_str(), seconds * 1e6 / ops,
+                 ops / seconds * 1e-6,
+                 100.0 * hits.load() / std::max<int64_t>(lookups.load(), 1));
+
+    // Spread of the lookups over the shards, for caches that count them
+    std::vector<Cache::ShardStats> stats;
+    cache->GetShardStats(&stats);
+    if (!stats.empty()) {
+      uint64_t min_lookups = UINT64_MAX;
+      uint64_t max_lookups = 0;
+      for (const Cache::ShardStats& shard : stats) {
+        min_lookups = std::min(min_lookups, shard.hits + shard.misses);
+        max_lookups = std::max(max_lookups, shard.hits + shard.misses);
+      }
+      std::fprintf(stdout, "; %llu-%llu lookups per shard",
+                   static_cast<unsigned long long>(min_lookups),
+                   static_cast<unsigned long long>(max_lookups));
+    }
+    std::fprintf(stdout, "\n");
+    std::fflush(stdout);
+  }
+
+  int num_keys_;
+};
+
+}  // namespace
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    double d;
+    int n;
+    char junk;
+    if (leveldb::Slice(argv[i]).starts_with("--caches=")) {
+      FLAGS_caches = argv[i] + strlen("--caches=");
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--shard_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_shard_bits = n;
+    } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--value_size=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_value_size = n;
+    } else if (sscanf(argv[i], "--num_keys=%d%c", &n, &junk) == 1) {
+      FLAGS_num_keys = n;
+    } else if (sscanf(argv[i], "--lookups=%d%c", &n, &junk) == 1) {
+      FLAGS_lookups = n;
+    } else if (sscanf(argv[i], "--scan_ratio=%lf%c", &d, &junk) == 1 &&
+               d >= 0 && d <= 1) {
+      FLAGS_scan_ratio = d;
+    } else {
+      std::fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      std::exit(1);
+    }
+  }
+
+  leveldb::CacheBench benchmark;
+  benchmark.Run();
+  return 0;
+}
@@ -6,11 +6,18 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <string>
+#include <vector>
 
+#include "db/dbformat.h"
+#include "db/memtable.h"
 #include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/persistent_cache.h"
+#include "leveldb/rate_limiter.h"
+#include "leveldb/slice_transform.h"
 #include "leveldb/write_batch.h"
 #include "port/port.h"
 #include "util/crc32c.h"
@@ -31,14 +38,18 @@
 //      readseq       -- read N times sequentially
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
+//      multireadrandom -- read N times in random order, 100 keys per MultiGet
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
-//      seekrandom    -- N random seeks
+//      seekrandom    -- N random seeks, each followed by --seek_nexts Next()s
 //      open          -- cost of opening a DB
 //      crc32c        -- repeated crc32c of 4K of data
+//      memtablefill  -- write N values per thread in random key order into
+//                       one memtable shared by all threads, bypassing the DB
 //   Meta operations:
 //      compact     -- Compact the entire DB
 //      stats       -- Print DB stats
+//      cachestats  -- Print block cache stats
 //      sstables    -- Print sstable info
 //      heapprofile -- Dump a heap profile (if supported by this port)
 static const char* FLAGS_benchmarks =
@@ -90,10 +101,42 @@ static int FLAGS_max_file_size = 0;
 // (initialized to default value by "main")
 static int FLAGS_block_size = 0;
 
+// If true, data blocks carry a hash index (see
+// Options::data_block_hash_index).
+static bool FLAGS_data_block_hash_index = false;
+
 // Number of bytes to use as a cache of uncompressed data.
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// Part of the cache reserved for index and filter blocks (see
+// NewLRUCache(capacity, high_pri_pool_ratio)).
+static double FLAGS_cache_high_pri_pool_ratio = 0.0;
+
+// Number of bits of the number of shards of the cache (see
+// NewShardedLRUCache(capacity, num_shard_bits)).  Negative means 16
+// shards.
+static int FLAGS_cache_shard_bits = -1;
+
+// If true, keep index and filter blocks in the cache (see
+// Options::cache_index_and_filter_blocks).
+static bool FLAGS_cache_index_and_filter_blocks = false;
+
+// Number of bytes to use as a cache of individual key-value rows.
+// Zero or negative means no row cache.
+static int FLAGS_row_cache_size = 0;
+
+// Number of bytes to use as a second tier cache of blocks as they are
+// stored in the files.  Zero or negative means no such cache.
+static int FLAGS_compressed_cache_size = 0;
+
+// Directory of a persistent cache of blocks (see Options::persistent_cache),
+// which is kept across runs.  Null means no persistent cache.
+static const char* FLAGS_persistent_cache_path = nullptr;
+
+// Capacity of the persistent cache in megabytes.
+static int FLAGS_persistent_cache_mb = 1024;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
@@ -101,6 +144,36 @@ static int FLAGS_open_files = 0;
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
 
+// If true, use a cache-line-blocked bloom filter (see
+// NewBlockedBloomFilterPolicy()).
+static bool FLAGS_blocked_bloom = false;
+
+// If true, build one filter per table (see Options::full_filter).
+static bool FLAGS_full_filter = false;
+
+// If true, partition the index and filter of each table (see
+// Options::partition_index_and_filters).
+static bool FLAGS_partition_index_and_filters = false;
+
+// Approximate size of index partitions (use default if == 0)
+static int FLAGS_metadata_block_size = 0;
+
+// Length of the key prefixes added to the filters (see
+// Options::prefix_extractor).  seekrandom then seeks with
+// ReadOptions::prefix_same_as_start.  Zero means no prefix extractor.
+static int FLAGS_prefix_size = 0;
+
+// Bytes that readseq reads ahead (see ReadOptions::readahead_size).
+// Zero means adaptive readahead.
+static int FLAGS_readahead_size = 0;
+
+// Number of keys seekrandom reads after each seek.
+static int FLAGS_seek_nexts = 0;
+
+// If true, seekrandom bounds each scan of --seek_nexts keys with
+// ReadOptions::iterate_upper_bound.
+static bool FLAGS_iterate_upper_bound = false;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -109,6 +182,28 @@ static bool FLAGS_use_existing_db = false;
 // If true, reuse existing log/MANIFEST files when re-opening a database.
 static bool FLAGS_reuse_logs = false;
 
+// If true, overlap the log write of one batch group with the memtable
+// insert of the previous one.  Use together with --threads.
+static bool FLAGS_pipelined_write = false;
+
+// If true, the writers of a batch group insert into the memtable in
+// parallel.  Use together with --threads.
+static bool FLAGS_concurrent_memtable_write = false;
+
+// If greater than zero, cap the write bandwidth of memtable and table
+// compactions to this many MB per second.
+static int FLAGS_rate_limit_mb = 0;
+
+// Number of compactions that may run at the same time.
+static int FLAGS_max_background_compactions = 0;
+
+// Number of threads dedicated to memtable compactions (0 shares the
+// compaction threads).
+static int FLAGS_max_background_flushes = 0;
+
+// Number of threads that work on a single level-0 compaction.
+static int FLAGS_max_subcompactions = 0;
+
 // Use the db with the following name.
 static const char* FLAGS_db = nullptr;
 
@@ -313,8 +408,14 @@ struct ThreadState {
 class Benchmark {
  private:
   Cache* cache_;
+  Cache* row_cache_;
+  Cache* compressed_cache_;
+  PersistentCache* persistent_cache_;
   const FilterPolicy* filter_policy_;
+  const SliceTransform* prefix_extractor_;
+  RateLimiter* rate_limiter_;
   DB* db_;
+  MemTable* memtable_;  // Shared by the threads of memtablefill
   int num_;
   int value_size_;
   int entries_per_batch_;
@@ -402,11 +503,34 @@ class Benchmark {
 
  public:
   Benchmark()
-      : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : nullptr),
-        filter_policy_(FLAGS_bloom_bits >= 0
-                           ? NewBloomFilterPolicy(FLAGS_bloom_bits)
-                           : nullptr),
+      : cache_(FLAGS_cache_size < 0 ? nullptr
+               : FLAGS_cache_shard_bits < 0
+                   ? NewLRUCache(FLAGS_cache_size,
+                                 FLAGS_cache_high_pri_pool_ratio)
+                   : NewShardedLRUCache(FLAGS_cache_size,
+                                        FLAGS_cache_shard_bits,
+                                        FLAGS_cache_high_pri_pool_ratio)),
+        row_cache_(FLAGS_row_cache_size > 0
+                       ? NewLRUCache(FLAGS_row_cache_size)
+                       : nullptr),
+        compressed_cache_(FLAGS_compressed_cache_size > 0
+                              ? NewLRUCache(FLAGS_compressed_cache_size)
+                              : nullptr),
+        persistent_cache_(nullptr),
+        filter_policy_(FLAGS_bloom_bits < 0 ? nullptr
+                       : FLAGS_blocked_bloom
+                           ? NewBlockedBloomFilterPolicy(FLAGS_bloom_bits)
+                           : NewBloomFilterPolicy(FLAGS_bloom_bits)),
+        prefix_extractor_(FLAGS_prefix_size > 0
+                              ? NewFixedPrefixTransform(FLAGS_prefix_size)
+                              : nullptr),
+        rate_limiter_(FLAGS_rate_limit_mb > 0
+                          ? NewGenericRateLimiter(
+                                static_cast<int64_t>(FLAGS_rate_limit_mb)
+                                << 20)
+                          : nullptr),
         db_(nullptr),
+        memtable_(nullptr),
         num_(FLAGS_num),
         value_size_(FLAGS_value_size),
         entries_per_batch_(1),
@@ -422,12 +546,28 @@ class Benchmark {
     if (!FLAGS_use_existing_db) {
       DestroyDB(FLAGS_db, Options());
     }
+    if (FLAGS_persistent_cache_path != nullptr) {
+      Status s = NewFilePersistentCache(
+          g_env, FLAGS_persistent_cache_path,
+          static_cast<uint64_t>(FLAGS_persistent_cache_mb) << 20,
+          &persistent_cache_);
+      if (!s.ok()) {
+        std::fprintf(stderr, "persistent cache error: %s\n",
+                     s.ToString().c_str());
+        std::exit(1);
+      }
+    }
   }
 
   ~Benchmark() {
     delete db_;
     delete cache_;
+    delete row_cache_;
+    delete compressed_cache_;
+    delete persistent_cache_;
     delete filter_policy_;
+    delete prefix_extractor_;
+    delete rate_limiter_;
   }
 
   void Run() {
@@ -490,6 +630,9 @@ class Benchmark {
         method = &Benchmark::ReadReverse;
       } else if (name == Slice("readrandom")) {
         method = &Benchmark::ReadRandom;
+      } else if (name == Slice("multireadrandom")) {
+        entries_per_batch_ = 100;
+        method = &Benchmark::MultiReadRandom;
       } else if (name == Slice("readmissing")) {
         method = &Benchmark::ReadMissing;
       } else if (name == Slice("seekrandom")) {
@@ -510,6 +653,10 @@ class Benchmark {
         method = &Benchmark::Compact;
       } else if (name == Slice("crc32c")) {
         method = &Benchmark::Crc32c;
+      } else if (name == Slice("memtablefill")) {
+        method = &Benchmark::MemTableFill;
+        memtable_ = new MemTable(InternalKeyComparator(BytewiseComparator()));
+        memtable_->Ref();
       } else if (name == Slice("snappycomp")) {
         method = &Benchmark::SnappyCompress;
       } else if (name == Slice("snappyuncomp")) {
@@ -518,6 +665,8 @@ class Benchmark {
         HeapProfile();
       } else if (name == Slice("stats")) {
         PrintStats("leveldb.stats");
+      } else if (name == Slice("cachestats")) {
+        PrintStats("leveldb.block-cache-stats");
       } else if (name == Slice("sstables")) {
         PrintStats("leveldb.sstables");
       } else {
@@ -543,6 +692,10 @@ class Benchmark {
       if (method != nullptr) {
         RunBenchmark(num_threads, name, method);
       }
+      if (memtable_ != nullptr) {
+        memtable_->Unref();
+        memtable_ = nullptr;
+      }
     }
   }
 
@@ -638,6 +791,23 @@ class Benchmark {
     thread->stats.AddMessage(label);
   }
 
+  void MemTableFill(ThreadState* thread) {
+    RandomGenerator gen;
+    int64_t bytes = 0;
+    // Each thread uses a range of sequence numbers of its own
+    const SequenceNumber base = static_cast<SequenceNumber>(thread->tid) * num_;
+    for (int i = 0; i < num_; i++) {
+      const int k = thread->rand.Next() % FLAGS_num;
+      char key[100];
+      std::snprintf(key, sizeof(key), "%016d", k);
+      memtable_->AddConcurrently(base + i + 1, kTypeValue, key,
+                                 gen.Generate(value_size_));
+      bytes += value_size_ + strlen(key);
+      thread->stats.FinishedSingleOp();
+    }
+    thread->stats.AddBytes(bytes);
+  }
+
   void SnappyCompress(ThreadState* thread) {
     RandomGenerator gen;
     Slice input = gen.Generate(Options().block_size);
@@ -691,12 +861,27 @@ class Benchmark {
     options.env = g_env;
     options.create_if_missing = !FLAGS_use_existing_db;
     options.block_cache = cache_;
+    options.row_cache = row_cache_;
+    options.compressed_block_cache = compressed_cache_;
+    options.persistent_cache = persistent_cache_;
     options.write_buffer_size = FLAGS_write_buffer_size;
     options.max_file_size = FLAGS_max_file_size;
     options.block_size = FLAGS_block_size;
+    options.data_block_hash_index = FLAGS_data_block_hash_index;
     options.max_open_files = FLAGS_open_files;
     options.filter_policy = filter_policy_;
+    options.full_filter = FLAGS_full_filter;
+    options.partition_index_and_filters = FLAGS_partition_index_and_filters;
+    options.metadata_block_size = FLAGS_metadata_block_size;
+    options.cache_index_and_filter_blocks = FLAGS_cache_index_and_filter_blocks;
+    options.prefix_extractor = prefix_extractor_;
     options.reuse_logs = FLAGS_reuse_logs;
+    options.enable_pipelined_write = FLAGS_pipelined_write;
+    options.allow_concurrent_memtable_write = FLAGS_concurrent_memtable_write;
+    options.rate_limiter = rate_limiter_;
+    options.max_background_compactions = FLAGS_max_background_compactions;
+    options.max_background_flushes = FLAGS_max_background_flushes;
+    options.max_subcompactions = FLAGS_max_subcompactions;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       std::fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -747,7 +932,9 @@ class Benchmark {
   }
 
   void ReadSequential(ThreadState* thread) {
-    Iterator* iter = db_->NewIterator(ReadOptions());
+    ReadOptions options;
+    options.readahead_size = FLAGS_readahead_size;
+    Iterator* iter = db_->NewIterator(options);
     int i = 0;
     int64_t bytes = 0;
     for (iter->SeekToFirst(); i < reads_ && iter->Valid(); iter->Next()) {
@@ -790,6 +977,33 @@ class Benchmark {
     thread->stats.AddMessage(msg);
   }
 
+  void MultiReadRandom(ThreadState* thread) {
+    ReadOptions options;
+    std::vector<std::string> key_storage(entries_per_batch_);
+    std::vector<Slice> keys(entries_per_batch_);
+    std::vector<std::string> values;
+    int found = 0;
+    for (int i = 0; i < reads_; i += entries_per_batch_) {
+      for (int j = 0; j < entries_per_batch_; j++) {
+        char key[100];
+        const int k = thread->rand.Next() % FLAGS_num;
+        std::snprintf(key, sizeof(key), "%016d", k);
+        key_storage[j] = key;
+        keys[j] = key_storage[j];
+      }
+      std::vector<Status> statuses = db_->MultiGet(options, keys, &values);
+      for (const Status& s : statuses) {
+        if (s.ok()) {
+          found++;
+        }
+        thread->stats.FinishedSingleOp();
+      }
+    }
+    char msg[100];
+    std::snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadMissing(ThreadState* thread) {
     ReadOptions options;
     std::string value;
@@ -817,19 +1031,33 @@ class Benchmark {
 
   void SeekRandom(ThreadState* thread) {
     ReadOptions options;
+    options.prefix_same_as_start = (prefix_extractor_ != nullptr);
+    char limit[100];
+    Slice upper_bound;
+    if (FLAGS_iterate_upper_bound) {
+      options.iterate_upper_bound = &upper_bound;
+    }
     int found = 0;
+    int64_t bytes = 0;
     for (int i = 0; i < reads_; i++) {
-      Iterator* iter = db_->NewIterator(options);
       char key[100];
       const int k = thread->rand.Next() % FLAGS_num;
       std::snprintf(key, sizeof(key), "%016d", k);
+      std::snprintf(limit, sizeof(limit), "%016d", k + FLAGS_seek_nexts + 1);
+      upper_bound = limit;
+      Iterator* iter = db_->NewIterator(options);
       iter->Seek(key);
       if (iter->Valid() && iter->key() == key) found++;
+      for (int j = 0; j < FLAGS_seek_nexts && iter->Valid(); j++) {
+        bytes += iter->key().size() + iter->value().size();
+        iter->Next();
+      }
       delete iter;
       thread->stats.FinishedSingleOp();
     }
     char msg[100];
     std::snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddBytes(bytes);
     thread->stats.AddMessage(msg);
   }
 
@@ -927,7 +1155,18 @@ int main(int argc, char** argv) {
   FLAGS_write_buffer_size = leveldb::Options().write_buffer_size;
   FLAGS_max_file_size = leveldb::Options().max_file_size;
   FLAGS_block_size = leveldb::Options().block_size;
+  FLAGS_data_block_hash_index = leveldb::Options().data_block_hash_index;
   FLAGS_open_files = leveldb::Options().max_open_files;
+  FLAGS_full_filter = leveldb::Options().full_filter;
+  FLAGS_partition_index_and_filters =
+      leveldb::Options().partition_index_and_filters;
+  FLAGS_metadata_block_size = leveldb::Options().metadata_block_size;
+  FLAGS_cache_index_and_filter_blocks =
+      leveldb::Options().cache_index_and_filter_blocks;
+  FLAGS_max_background_compactions =
+      leveldb::Options().max_background_compactions;
+  FLAGS_max_background_flushes = leveldb::Options().max_background_flushes;
+  FLAGS_max_subcompactions = leveldb::Options().max_subcompactions;
   std::string default_db_path;
 
   for (int i = 1; i < argc; i++) {
@@ -947,6 +1186,23 @@ int main(int argc, char** argv) {
     } else if (sscanf(argv[i], "--reuse_logs=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_reuse_logs = n;
+    } else if (sscanf(argv[i], "--pipelined_write=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_pipelined_write = n;
+    } else if (sscanf(argv[i], "--concurrent_memtable_write=%d%c", &n,
+                      &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_concurrent_memtable_write = n;
+    } else if (sscanf(argv[i], "--rate_limit_mb=%d%c", &n, &junk) == 1) {
+      FLAGS_rate_limit_mb = n;
+    } else if (sscanf(argv[i], "--max_background_compactions=%d%c", &n,
+                      &junk) == 1) {
+      FLAGS_max_background_compactions = n;
+    } else if (sscanf(argv[i], "--max_background_flushes=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_max_background_flushes = n;
+    } else if (sscanf(argv[i], "--max_subcompactions=%d%c", &n, &junk) == 1) {
+      FLAGS_max_subcompactions = n;
     } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
       FLAGS_num = n;
     } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
@@ -961,10 +1217,55 @@ int main(int argc, char** argv) {
       FLAGS_max_file_size = n;
     } else if (sscanf(argv[i], "--block_size=%d%c", &n, &junk) == 1) {
       FLAGS_block_size = n;
+    } else if (sscanf(argv[i], "--data_block_hash_index=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_data_block_hash_index = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--cache_high_pri_pool_ratio=%lf%c", &d,
+                      &junk) == 1) {
+      FLAGS_cache_high_pri_pool_ratio = d;
+    } else if (sscanf(argv[i], "--cache_shard_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_cache_shard_bits = n;
+    } else if (sscanf(argv[i], "--cache_index_and_filter_blocks=%d%c", &n,
+                      &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_cache_index_and_filter_blocks = n;
+    } else if (sscanf(argv[i], "--row_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_row_cache_size = n;
+    } else if (sscanf(argv[i], "--compressed_cache_size=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_compressed_cache_size = n;
+    } else if (strncmp(argv[i], "--persistent_cache_path=", 24) == 0) {
+      FLAGS_persistent_cache_path = argv[i] + 24;
+    } else if (sscanf(argv[i], "--persistent_cache_mb=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_persistent_cache_mb = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
+    } else if (sscanf(argv[i], "--blocked_bloom=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_blocked_bloom = n;
+    } else if (sscanf(argv[i], "--full_filter=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_full_filter = n;
+    } else if (sscanf(argv[i], "--partition_index_and_filters=%d%c", &n,
+                      &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_partition_index_and_filters = n;
+    } else if (sscanf(argv[i], "--metadata_block_size=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_metadata_block_size = n;
+    } else if (sscanf(argv[i], "--prefix_size=%d%c", &n, &junk) == 1) {
+      FLAGS_prefix_size = n;
+    } else if (sscanf(argv[i], "--readahead_size=%d%c", &n, &junk) == 1) {
+      FLAGS_readahead_size = n;
+    } else if (sscanf(argv[i], "--seek_nexts=%d%c", &n, &junk) == 1) {
+      FLAGS_seek_nexts = n;
+    } else if (sscanf(argv[i], "--iterate_upper_bound=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_iterate_upper_bound = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
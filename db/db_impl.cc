@@ -8,6 +8,7 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <set>
 #include <string>
 #include <vector>
@@ -34,6 +35,8 @@
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/rate_limited_file.h"
+#include "util/thread_local.h"
 
 namespace leveldb {
 
@@ -42,15 +45,34 @@ const int kNumNonTableCacheFiles = 10;
 // Information kept for every waiting writer
 struct DBImpl::Writer {
   explicit Writer(port::Mutex* mu)
-      : batch(nullptr), sync(false), done(false), cv(mu) {}
+      : batch(nullptr),
+        sync(false),
+        done(false),
+        last_sequence(0),
+        insert_group(nullptr),
+        cv(mu) {}
 
   Status status;
   WriteBatch* batch;
   bool sync;
   bool done;
+  SequenceNumber last_sequence;  // Set for group leaders in pipelined mode
+  MemTableInsertGroup* insert_group;  // Non-null while batch must be applied
   port::CondVar cv;
 };
 
+// State shared by the members of a batch group that apply their batches
+// to the memtable concurrently.
+struct DBImpl::MemTableInsertGroup {
+  MemTableInsertGroup(MemTable* m, port::CondVar* cv)
+      : mem(m), leader_cv(cv), pending(0) {}
+
+  MemTable* const mem;
+  port::CondVar* const leader_cv;  // Signalled once pending drops to zero
+  int pending;    // Followers that have not finished their insert yet
+  Status status;  // First error reported by a follower
+};
+
 struct DBImpl::CompactionState {
   // Files produced by compaction
   struct Output {
@@ -64,6 +86,8 @@ struct DBImpl::CompactionState {
   explicit CompactionState(Compaction* c)
       : compaction(c),
         smallest_snapshot(0),
+        start(nullptr),
+        limit(nullptr),
         outfile(nullptr),
         builder(nullptr),
         total_bytes(0) {}
@@ -76,6 +100,13 @@ struct DBImpl::CompactionState {
   // we can drop all entries for the same key with sequence numbers < S.
   SequenceNumber smallest_snapshot;
 
+  // Range of user keys [*start, *limit) compacted by this state, where
+  // null means unbounded.  Narrower than the whole compaction only for
+  // subcompactions.
+  const std::string* start;
+  const std::string* limit;
+  Compaction::KeyState key_state;
+
   std::vector<Output> outputs;
 
   // State kept for output being generated
@@ -85,6 +116,59 @@ struct DBImpl::CompactionState {
   uint64_t total_bytes;
 };
 
+// The key ranges of a level-0 compaction other than the first one.  They
+// are compacted by work items scheduled in the Env's kLow thread pool, and
+// by the compaction's own thread, which takes over the ranges that no work
+// item has picked up once it is done with the first range.  So the
+// compaction never waits for work items that are queued behind other
+// work.  Reference counted, since those work items may only run after the
+// compaction is over.
+struct DBImpl::SubcompactionJobs {
+  SubcompactionJobs(DBImpl* db, const std::vector<CompactionState*>& ranges,
+                    int refs)
+      : db(db),
+        ranges(ranges),
+        statuses(ranges.size()),
+        cv(&mu),
+        next(0),
+        running(0),
+        refs(refs) {}
+
+  // Compact the ranges that nobody has picked up yet.
+  void Run() {
+    MutexLock l(&mu);
+    while (next < ranges.size()) {
+      const size_t i = next++;
+      running++;
+      mu.Unlock();
+      Status s = db->DoSubcompactionWork(ranges[i], nullptr);
+      mu.Lock();
+      statuses[i] = s;
+      running--;
+      cv.SignalAll();
+    }
+  }
+
+  void Unref() {
+    mu.Lock();
+    const bool last = (--refs == 0);
+    mu.Unlock();
+    if (last) {
+      delete this;
+    }
+  }
+
+  DBImpl* const db;
+  const std::vector<CompactionState*> ranges;
+  std::vector<Status> statuses GUARDED_BY(mu);
+
+  port::Mutex mu;
+  port::CondVar cv;
+  size_t next GUARDED_BY(mu);  // Index of the next range to pick up
+  int running GUARDED_BY(mu);  // Number of ranges being compacted
+  int refs GUARDED_BY(mu);
+};
+
 // Fix user-supplied options to be reasonable
 template <class T, class V>
 static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
@@ -94,12 +178,25 @@ static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
 Options SanitizeOptions(const std::string& dbname,
                         const InternalKeyComparator* icmp,
                         const InternalFilterPolicy* ipolicy,
+                        const InternalKeySliceTransform* iprefix,
                         const Options& src) {
   Options result = src;
   result.comparator = icmp;
   result.filter_policy = (src.filter_policy != nullptr) ? ipolicy : nullptr;
+  result.prefix_extractor =
+      (src.prefix_extractor != nullptr) ? iprefix : nullptr;
+  if (std::strcmp(icmp->user_comparator()->Name(),
+                  BytewiseComparator()->Name()) != 0) {
+    // The hash index would miss keys that compare equal to the key looked
+    // up without having the same bytes
+    result.data_block_hash_index = false;
+  }
   ClipToRange(&result.max_open_files, 64 + kNumNonTableCacheFiles, 50000);
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
+  ClipToRange(&result.max_write_buffer_number, 2, 64);
+  ClipToRange(&result.max_background_compactions, 1, 64);
+  ClipToRange(&result.max_subcompactions, 1, 64);
+  ClipToRange(&result.max_background_flushes, 0, 64);
   ClipToRange(&result.max_file_size, 1 << 20, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
   if (result.info_log == nullptr) {
@@ -113,7 +210,9 @@ Options SanitizeOptions(const std::string& dbname,
     }
   }
   if (result.block_cache == nullptr) {
-    result.block_cache = NewLRUCache(8 << 20);
+    result.block_cache = result.cache_index_and_filter_blocks
+                             ? NewLRUCache(8 << 20, 0.5)
+                             : NewLRUCache(8 << 20);
   }
   return result;
 }
@@ -127,8 +226,10 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
       internal_filter_policy_(raw_options.filter_policy),
+      internal_prefix_extractor_(raw_options.prefix_extractor),
       options_(SanitizeOptions(dbname, &internal_comparator_,
-                               &internal_filter_policy_, raw_options)),
+                               &internal_filter_policy_,
+                               &internal_prefix_extractor_, raw_options)),
       owns_info_log_(options_.info_log != raw_options.info_log),
       owns_cache_(options_.block_cache != raw_options.block_cache),
       dbname_(dbname),
@@ -137,26 +238,54 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       shutting_down_(false),
       background_work_finished_signal_(&mutex_),
       mem_(nullptr),
-      imm_(nullptr),
       has_imm_(false),
       logfile_(nullptr),
       logfile_number_(0),
       log_(nullptr),
       seed_(0),
+      super_version_(nullptr),
+      cached_super_version_(new ThreadLocalPtr(&ReleaseCachedSuperVersion)),
       tmp_batch_(new WriteBatch),
-      background_compaction_scheduled_(false),
+      memtable_writers_drained_signal_(&mutex_),
+      write_controller_(options_.delayed_write_rate),
+      write_stall_l0_files_(0),
+      write_stall_pending_bytes_(0),
+      background_compactions_scheduled_(0),
+      background_compactions_queued_(0),
+      background_flush_scheduled_(false),
+      memtable_compaction_running_(false),
+      applying_edit_(false),
+      edit_applied_signal_(&mutex_),
       manual_compaction_(nullptr),
       versions_(new VersionSet(dbname_, &options_, table_cache_,
-                               &internal_comparator_)) {}
+                               &internal_comparator_)) {
+  // Only one level-0 compaction runs at a time, so at most that many
+  // subcompactions run alongside the other compactions.
+  env_->EnsureBackgroundThreads(options_.max_background_compactions +
+                                    options_.max_subcompactions - 1,
+                                Env::kLow);
+  if (options_.max_background_flushes > 0) {
+    env_->EnsureBackgroundThreads(options_.max_background_flushes, Env::kHigh);
+  }
+}
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish.
   mutex_.Lock();
   shutting_down_.store(true, std::memory_order_release);
-  while (background_compaction_scheduled_) {
+  while (background_compactions_scheduled_ > 0 ||
+         background_flush_scheduled_) {
     background_work_finished_signal_.Wait();
   }
+  if (super_version_ != nullptr) {
+    DropCachedSuperVersions();
+    if (super_version_->Unref()) {
+      CleanupSuperVersion(super_version_);
+    }
+    super_version_ = nullptr;
+  }
   mutex_.Unlock();
+  delete cached_super_version_;
 
   if (db_lock_ != nullptr) {
     env_->UnlockFile(db_lock_);
@@ -164,7 +293,9 @@ DBImpl::~DBImpl() {
 
   delete versions_;
   if (mem_ != nullptr) mem_->Unref();
-  if (imm_ != nullptr) imm_->Unref();
+  for (const ImmutableMemTable& imm : imm_) {
+    imm.mem->Unref();
+  }
   delete tmp_batch_;
   delete log_;
   delete logfile_;
@@ -433,7 +564,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     WriteBatchInternal::SetContents(&batch, record);
 
     if (mem == nullptr) {
-      mem = new MemTable(internal_comparator_);
+      mem = NewMemTable();
       mem->Ref();
     }
     status = WriteBatchInternal::InsertInto(&batch, mem);
@@ -450,7 +581,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
       compactions++;
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, nullptr);
+      uint64_t file_number;
+      status = WriteLevel0Table({mem}, edit, nullptr, &file_number);
+      pending_outputs_.erase(file_number);
       mem->Unref();
       mem = nullptr;
       if (!status.ok()) {
@@ -479,7 +612,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
         mem = nullptr;
       } else {
         // mem can be nullptr if lognum exists but was empty.
-        mem_ = new MemTable(internal_comparator_);
+        mem_ = NewMemTable();
         mem_->Ref();
       }
     }
@@ -489,7 +622,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     // mem did not get reused; compact it.
     if (status.ok()) {
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, nullptr);
+      uint64_t file_number;
+      status = WriteLevel0Table({mem}, edit, nullptr, &file_number);
+      pending_outputs_.erase(file_number);
     }
     mem->Unref();
   }
@@ -497,16 +632,30 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   return status;
 }
 
-Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+Status DBImpl::WriteLevel0Table(const std::vector<MemTable*>& mems,
+                                VersionEdit* edit, Version* base,
+                                uint64_t* file_number) {
   mutex_.AssertHeld();
+  assert(!mems.empty());
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
   meta.number = versions_->NewFileNumber();
+  *file_number = meta.number;
   pending_outputs_.insert(meta.number);
-  Iterator* iter = mem->NewIterator();
-  Log(options_.info_log, "Level-0 table #%llu: started",
-      (unsigned long long)meta.number);
+  Iterator* iter;
+  if (mems.size() == 1) {
+    iter = mems[0]->NewIterator();
+  } else {
+    // Entries in different memtables never share a sequence number, so
+    // merging them yields a valid table.
+    std::vector<Iterator*> list;
+    for (MemTable* mem : mems) {
+      list.push_back(mem->NewIterator());
+    }
+    iter = NewMergingIterator(&internal_comparator_, &list[0], list.size());
+  }
+  Log(options_.info_log, "Level-0 table #%llu: started (%d memtables)",
+      (unsigned long long)meta.number, static_cast<int>(mems.size()));
 
   Status s;
   {
@@ -519,7 +668,6 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long)meta.number, (unsigned long long)meta.file_size,
       s.ToString().c_str());
   delete iter;
-  pending_outputs_.erase(meta.number);
 
   // Note that if file_size is zero, the file has been deleted and
   // should not be added to the manifest.
@@ -528,7 +676,15 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
     const Slice min_user_key = meta.smallest.user_key();
     const Slice max_user_key = meta.largest.user_key();
     if (base != nullptr) {
-      level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+      // Compactions may have installed newer versions than "base" while
+      // the table was being built, so place it according to the latest.
+      level = versions_->current()->PickLevelForMemTableOutput(min_user_key,
+                                                               max_user_key);
+    }
+    if (level > 0) {
+      // Keep compactions from writing an overlapping range to the same
+      // level until the edit has been applied.
+      versions_->RegisterMemTableOutput(level, meta.smallest, meta.largest);
     }
     edit->AddFile(level, meta.number, meta.file_size, meta.smallest,
                   meta.largest);
@@ -543,13 +699,23 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
 
 void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
-  assert(imm_ != nullptr);
-
-  // Save the contents of the memtable as a new Table
+  assert(!imm_.empty());
+  assert(!memtable_compaction_running_);
+  memtable_compaction_running_ = true;
+
+  // Save the contents of all queued memtables as a single new Table.
+  // Memtables retired while we are writing stay queued for the next round.
+  const size_t num_flushed = imm_.size();
+  std::vector<MemTable*> mems;
+  for (const ImmutableMemTable& imm : imm_) {
+    mems.push_back(imm.mem);
+  }
+  const uint64_t next_log_number = imm_.back().next_log_number;
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  uint64_t file_number;
+  Status s = WriteLevel0Table(mems, &edit, base, &file_number);
   base->Unref();
 
   if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
@@ -559,15 +725,21 @@ void DBImpl::CompactMemTable() {
   // Replace immutable memtable with the generated Table
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
-    edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
+    edit.SetLogNumber(next_log_number);  // Earlier logs no longer needed
+    s = LogAndApply(&edit);
   }
+  pending_outputs_.erase(file_number);
+  versions_->ReleaseMemTableOutput();
+  memtable_compaction_running_ = false;
 
   if (s.ok()) {
     // Commit to the new state
-    imm_->Unref();
-    imm_ = nullptr;
-    has_imm_.store(false, std::memory_order_release);
+    for (size_t i = 0; i < num_flushed; i++) {
+      imm_[i].mem->Unref();
+    }
+    imm_.erase(imm_.begin(), imm_.begin() + num_flushed);
+    has_imm_.store(!imm_.empty(), std::memory_order_release);
+    InstallSuperVersion();
     RemoveObsoleteFiles();
   } else {
     RecordBackgroundError(s);
@@ -601,6 +773,7 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,
   ManualCompaction manual;
   manual.level = level;
   manual.done = false;
+  manual.in_progress = false;
   if (begin == nullptr) {
     manual.begin = nullptr;
   } else {
@@ -624,6 +797,10 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,
       background_work_finished_signal_.Wait();
     }
   }
+  // A background thread may still be working on my manual compaction.
+  while (manual.in_progress) {
+    background_work_finished_signal_.Wait();
+  }
   if (manual_compaction_ == &manual) {
     // Cancel my manual compaction since we aborted early for some reason.
     manual_compaction_ = nullptr;
@@ -636,10 +813,10 @@ Status DBImpl::TEST_CompactMemTable() {
   if (s.ok()) {
     // Wait until the compaction completes
     MutexLock l(&mutex_);
-    while (imm_ != nullptr && bg_error_.ok()) {
+    while (!imm_.empty() && bg_error_.ok()) {
       background_work_finished_signal_.Wait();
     }
-    if (imm_ != nullptr) {
+    if (!imm_.empty()) {
       s = bg_error_;
     }
   }
@@ -654,19 +831,48 @@ void DBImpl::RecordBackgroundError(const Status& s) {
   }
 }
 
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  while (applying_edit_) {
+    edit_applied_signal_.Wait();
+  }
+  applying_edit_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  applying_edit_ = false;
+  edit_applied_signal_.SignalAll();
+  return s;
+}
+
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (background_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.load(std::memory_order_acquire)) {
+  if (shutting_down_.load(std::memory_order_acquire)) {
     // DB is being deleted; no more background compactions
+    return;
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == nullptr && manual_compaction_ == nullptr &&
-             !versions_->NeedsCompaction()) {
+    return;
+  }
+
+  const bool needs_flush = !imm_.empty() && !memtable_compaction_running_;
+  if (options_.max_background_flushes > 0) {
+    if (needs_flush && !background_flush_scheduled_) {
+      background_flush_scheduled_ = true;
+      env_->ScheduleWithPriority(&DBImpl::BGFlushWork, this, Env::kHigh);
+    }
+  }
+
+  if (background_compactions_queued_ > 0) {
+    // Already scheduled.  Once it has picked its work it will schedule
+    // another one if there is more to do.
+  } else if (background_compactions_scheduled_ >=
+             options_.max_background_compactions) {
+    // All compaction threads are busy
+  } else if (!(needs_flush && options_.max_background_flushes == 0) &&
+             manual_compaction_ == nullptr && !versions_->NeedsCompaction()) {
     // No work to be done
   } else {
-    background_compaction_scheduled_ = true;
+    background_compactions_scheduled_++;
+    background_compactions_queued_++;
     env_->Schedule(&DBImpl::BGWork, this);
   }
 }
@@ -675,38 +881,76 @@ void DBImpl::BGWork(void* db) {
   reinterpret_cast<DBImpl*>(db)->BackgroundCall();
 }
 
+void DBImpl::BGFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(background_compaction_scheduled_);
+  assert(background_compactions_scheduled_ > 0);
+  assert(background_compactions_queued_ > 0);
+  background_compactions_queued_--;
+  bool did_work = false;
   if (shutting_down_.load(std::memory_order_acquire)) {
     // No more background work when shutting down.
   } else if (!bg_error_.ok()) {
     // No more background work after a background error.
   } else {
-    BackgroundCompaction();
+    did_work = BackgroundCompaction();
   }
 
-  background_compaction_scheduled_ = false;
+  background_compactions_scheduled_--;
 
   // Previous compaction may have produced too many files in a level,
-  // so reschedule another compaction if needed.
+  // so reschedule another compaction if needed.  A call that found
+  // nothing it could run does not reschedule, or it would spin until
+  // the running compactions finish; they reschedule when they are done.
+  if (did_work) {
+    MaybeScheduleCompaction();
+  }
+  background_work_finished_signal_.SignalAll();
+}
+
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(background_flush_scheduled_);
+  if (shutting_down_.load(std::memory_order_acquire)) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (!imm_.empty() && !memtable_compaction_running_) {
+    CompactMemTable();
+  }
+
+  background_flush_scheduled_ = false;
+
+  // The new level-0 file may call for a compaction, and more memtables
+  // may have filled up in the meantime.
   MaybeScheduleCompaction();
   background_work_finished_signal_.SignalAll();
 }
 
-void DBImpl::BackgroundCompaction() {
+bool DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != nullptr) {
+  if (options_.max_background_flushes == 0 && !imm_.empty() &&
+      !memtable_compaction_running_) {
     CompactMemTable();
-    return;
+    return true;
   }
 
   Compaction* c;
-  bool is_manual = (manual_compaction_ != nullptr);
+  ManualCompaction* m = manual_compaction_;
+  const bool is_manual = (m != nullptr);
   InternalKey manual_end;
   if (is_manual) {
-    ManualCompaction* m = manual_compaction_;
+    if (m->in_progress || versions_->NumRunningCompactions() > 0 ||
+        memtable_compaction_running_) {
+      // Manual compactions run on their own; the background work that is
+      // running now reschedules once it is done.
+      return false;
+    }
+    m->in_progress = true;
     c = versions_->CompactRange(m->level, m->begin, m->end);
     m->done = (c == nullptr);
     if (c != nullptr) {
@@ -719,6 +963,15 @@ void DBImpl::BackgroundCompaction() {
         (m->done ? "(end)" : manual_end.DebugString().c_str()));
   } else {
     c = versions_->PickCompaction();
+    if (c == nullptr) {
+      return false;
+    }
+  }
+
+  // Let another thread pick up any other compaction that can run in
+  // parallel with this one.
+  if (c != nullptr) {
+    MaybeScheduleCompaction();
   }
 
   Status status;
@@ -731,8 +984,10 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->RemoveFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size, f->smallest,
                        f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
-    if (!status.ok()) {
+    status = LogAndApply(c->edit());
+    if (status.ok()) {
+      InstallSuperVersion();
+    } else {
       RecordBackgroundError(status);
     }
     VersionSet::LevelSummaryStorage tmp;
@@ -740,6 +995,7 @@ void DBImpl::BackgroundCompaction() {
         static_cast<unsigned long long>(f->number), c->level() + 1,
         static_cast<unsigned long long>(f->file_size),
         status.ToString().c_str(), versions_->LevelSummary(&tmp));
+    versions_->ReleaseCompaction(c);
   } else {
     CompactionState* compact = new CompactionState(c);
     status = DoCompactionWork(compact);
@@ -747,6 +1003,7 @@ void DBImpl::BackgroundCompaction() {
       RecordBackgroundError(status);
     }
     CleanupCompaction(compact);
+    versions_->ReleaseCompaction(c);
     c->ReleaseInputs();
     RemoveObsoleteFiles();
   }
@@ -761,7 +1018,7 @@ void DBImpl::BackgroundCompaction() {
   }
 
   if (is_manual) {
-    ManualCompaction* m = manual_compaction_;
+    m->in_progress = false;
     if (!status.ok()) {
       m->done = true;
     }
@@ -773,6 +1030,7 @@ void DBImpl::BackgroundCompaction() {
     }
     manual_compaction_ = nullptr;
   }
+  return true;
 }
 
 void DBImpl::CleanupCompaction(CompactionState* compact) {
@@ -812,6 +1070,8 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname, &compact->outfile);
   if (s.ok()) {
+    compact->outfile = MaybeRateLimit(compact->outfile, options_.rate_limiter,
+                                      RateLimiter::kLow);
     compact->builder = new TableBuilder(options_, compact->outfile);
   }
   return s;
@@ -881,7 +1141,11 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
                                          out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  Status s = LogAndApply(compact->compaction->edit());
+  if (s.ok()) {
+    InstallSuperVersion();
+  }
+  return s;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
@@ -902,40 +1166,143 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     compact->smallest_snapshot = snapshots_.oldest()->sequence_number();
   }
 
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
-
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
 
-  input->SeekToFirst();
+  // Level-0 compactions cannot run alongside each other, so spread their
+  // work over several threads by splitting the key range.  Every range
+  // gets its own input iterator and output files.  Finding the ranges
+  // may read the index of every input table.
+  std::vector<std::string> boundaries;
+  if (compact->compaction->level() == 0 && options_.max_subcompactions > 1) {
+    versions_->GetCompactionBoundaries(
+        compact->compaction, options_.max_subcompactions, &boundaries);
+  }
+  std::vector<CompactionState*> subcompactions;
+  for (size_t i = 0; i < boundaries.size(); i++) {
+    CompactionState* sub = new CompactionState(compact->compaction);
+    sub->smallest_snapshot = compact->smallest_snapshot;
+    sub->start = &boundaries[i];
+    sub->limit = (i + 1 < boundaries.size()) ? &boundaries[i + 1] : nullptr;
+    subcompactions.push_back(sub);
+  }
+  if (!boundaries.empty()) {
+    compact->limit = &boundaries[0];
+    Log(options_.info_log, "Compacting in %d subcompactions",
+        static_cast<int>(boundaries.size() + 1));
+  }
+
+  SubcompactionJobs* jobs = nullptr;
+  if (!subcompactions.empty()) {
+    const int num_items = static_cast<int>(subcompactions.size());
+    jobs = new SubcompactionJobs(this, subcompactions, num_items + 1);
+    for (int i = 0; i < num_items; i++) {
+      env_->Schedule(&DBImpl::BGSubcompactionWork, jobs);
+    }
+  }
+
+  // The first range is compacted by this thread, which also keeps
+  // flushing memtables in the meantime.
+  Status status = DoSubcompactionWork(compact, &imm_micros);
+
+  if (jobs != nullptr) {
+    jobs->Run();
+    jobs->mu.Lock();
+    while (jobs->running > 0) {
+      jobs->cv.Wait();
+    }
+    for (size_t i = 0; i < jobs->statuses.size(); i++) {
+      if (status.ok()) {
+        status = jobs->statuses[i];
+      }
+    }
+    jobs->mu.Unlock();
+    jobs->Unref();
+  }
+
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+
+  mutex_.Lock();
+  // Gather all outputs, in key order, so that they are installed (or
+  // cleaned up) together.
+  for (CompactionState* sub : subcompactions) {
+    compact->outputs.insert(compact->outputs.end(), sub->outputs.begin(),
+                            sub->outputs.end());
+    compact->total_bytes += sub->total_bytes;
+    sub->outputs.clear();
+    CleanupCompaction(sub);
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+  stats_[compact->compaction->level() + 1].Add(stats);
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log, "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+void DBImpl::BGSubcompactionWork(void* jobs) {
+  SubcompactionJobs* const j = reinterpret_cast<SubcompactionJobs*>(jobs);
+  j->Run();
+  j->Unref();
+}
+
+Status DBImpl::DoSubcompactionWork(CompactionState* compact,
+                                   int64_t* imm_micros) {
+  const Comparator* const ucmp = user_comparator();
+  Iterator* input = versions_->MakeInputIterator(compact->compaction);
+  if (compact->start != nullptr) {
+    InternalKey start(*compact->start, kMaxSequenceNumber, kValueTypeForSeek);
+    input->Seek(start.Encode());
+  } else {
+    input->SeekToFirst();
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   while (input->Valid() && !shutting_down_.load(std::memory_order_acquire)) {
-    // Prioritize immutable compaction work
-    if (has_imm_.load(std::memory_order_relaxed)) {
+    // Prioritize immutable compaction work, unless it has threads of its own
+    if (imm_micros != nullptr && options_.max_background_flushes == 0 &&
+        has_imm_.load(std::memory_order_relaxed)) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
-      if (imm_ != nullptr) {
+      if (!imm_.empty() && !memtable_compaction_running_) {
         CompactMemTable();
         // Wake up MakeRoomForWrite() if necessary.
         background_work_finished_signal_.SignalAll();
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      *imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
+    if (compact->limit != nullptr &&
+        ucmp->Compare(ExtractUserKey(key), *compact->limit) >= 0) {
+      // The rest belongs to the next subcompaction
+      break;
+    }
+    if (compact->compaction->ShouldStopBefore(key, &compact->key_state) &&
         compact->builder != nullptr) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
         break;
       }
     }
-
     // Handle key/value, add to state, etc.
     bool drop = false;
     if (!ParseInternalKey(key, &ikey)) {
@@ -958,7 +1325,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         drop = true;  // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                       &compact->key_state)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -977,7 +1345,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         "%d smallest_snapshot: %d",
         ikey.user_key.ToString().c_str(),
         (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
+        compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                               &compact->key_state),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
@@ -1018,81 +1387,135 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     status = input->status();
   }
   delete input;
-  input = nullptr;
+  return status;
+}
 
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
-    }
-  }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
+namespace {
+
+// Marks the cached super version of a thread that is reading from it
+int super_version_in_use;
+void* const kSuperVersionInUse = &super_version_in_use;
+
+}  // anonymous namespace
+
+void DBImpl::InstallSuperVersion() {
+  mutex_.AssertHeld();
+  SuperVersion* sv = new SuperVersion;
+  sv->mem = mem_;
+  sv->mem->Ref();
+  for (auto it = imm_.rbegin(); it != imm_.rend(); ++it) {
+    sv->imm.push_back(it->mem);
+    it->mem->Ref();
+  }
+  sv->current = versions_->current();
+  sv->current->Ref();
+  sv->Ref();
+
+  SuperVersion* old = super_version_;
+  super_version_ = sv;
+  DropCachedSuperVersions();
+  if (old != nullptr && old->Unref()) {
+    CleanupSuperVersion(old);
   }
+}
 
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
+void DBImpl::DropCachedSuperVersions() {
+  mutex_.AssertHeld();
+  // Threads that are reading from their copy drop it themselves when
+  // ReturnSuperVersion() finds it gone.
+  std::vector<void*> cached;
+  cached_super_version_->Scrape(&cached, nullptr);
+  for (void* ptr : cached) {
+    if (ptr != kSuperVersionInUse) {
+      SuperVersion* sv = reinterpret_cast<SuperVersion*>(ptr);
+      if (sv->Unref()) {
+        CleanupSuperVersion(sv);
+      }
+    }
+  }
+}
 
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
+DBImpl::SuperVersion* DBImpl::GetAndRefSuperVersion() {
+  void* ptr = cached_super_version_->Swap(kSuperVersionInUse);
+  assert(ptr != kSuperVersionInUse);
+  if (ptr != nullptr) {
+    return reinterpret_cast<SuperVersion*>(ptr);
   }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
+  // The cached copy is outdated or there is none yet
+  MutexLock l(&mutex_);
+  SuperVersion* sv = super_version_;
+  sv->Ref();
+  return sv;
+}
+
+void DBImpl::ReturnSuperVersion(SuperVersion* sv) {
+  void* expected = kSuperVersionInUse;
+  if (!cached_super_version_->CompareAndSwap(sv, expected)) {
+    // A newer super version was installed while we were reading
+    assert(expected == nullptr);
+    UnrefSuperVersion(sv);
   }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log, "compacted to: %s", versions_->LevelSummary(&tmp));
-  return status;
 }
 
-namespace {
+void DBImpl::UnrefSuperVersion(SuperVersion* sv) {
+  if (sv->Unref()) {
+    MutexLock l(&mutex_);
+    CleanupSuperVersion(sv);
+  }
+}
 
-struct IterState {
-  port::Mutex* const mu;
-  Version* const version GUARDED_BY(mu);
-  MemTable* const mem GUARDED_BY(mu);
-  MemTable* const imm GUARDED_BY(mu);
+void DBImpl::CleanupSuperVersion(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  sv->mem->Unref();
+  for (MemTable* imm : sv->imm) {
+    imm->Unref();
+  }
+  sv->current->Unref();
+  delete sv;
+}
 
-  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, Version* version)
-      : mu(mutex), version(version), mem(mem), imm(imm) {}
-};
+void DBImpl::ReleaseCachedSuperVersion(void* ptr) {
+  if (ptr != kSuperVersionInUse) {
+    // Cached copies are dropped before super_version_ drops its own
+    // reference, so this is never the last one and needs no mutex_.
+    const bool last = reinterpret_cast<SuperVersion*>(ptr)->Unref();
+    assert(!last);
+    (void)last;
+  }
+}
 
-static void CleanupIteratorState(void* arg1, void* arg2) {
-  IterState* state = reinterpret_cast<IterState*>(arg1);
-  state->mu->Lock();
-  state->mem->Unref();
-  if (state->imm != nullptr) state->imm->Unref();
-  state->version->Unref();
-  state->mu->Unlock();
-  delete state;
+SequenceNumber DBImpl::LastSequence() const {
+  return versions_->LastSequence();
 }
 
-}  // anonymous namespace
+void DBImpl::CleanupIterator(void* db, void* sv) {
+  reinterpret_cast<DBImpl*>(db)->UnrefSuperVersion(
+      reinterpret_cast<SuperVersion*>(sv));
+}
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
                                       uint32_t* seed) {
-  mutex_.Lock();
-  *latest_snapshot = versions_->LastSequence();
+  // The iterator keeps its own reference to the super version
+  SuperVersion* sv = GetAndRefSuperVersion();
+  sv->Ref();
+  ReturnSuperVersion(sv);
+  *latest_snapshot = LastSequence();
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
-  list.push_back(mem_->NewIterator());
-  mem_->Ref();
-  if (imm_ != nullptr) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  const bool prefix_seek = options.prefix_same_as_start;
+  list.push_back(sv->mem->NewIterator(prefix_seek));
+  for (MemTable* imm : sv->imm) {
+    list.push_back(imm->NewIterator(prefix_seek));
   }
-  versions_->current()->AddIterators(options, &list);
+  sv->current->AddIterators(options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
 
-  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
-  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
+  internal_iter->RegisterCleanup(&DBImpl::CleanupIterator, this, sv);
 
-  *seed = ++seed_;
-  mutex_.Unlock();
+  *seed = seed_.fetch_add(1, std::memory_order_relaxed) + 1;
   return internal_iter;
 }
 
@@ -1109,49 +1532,139 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
 
 Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    std::string* value) {
+  // Values found in memtables are copied straight into *value.
+  PinnableSlice pinnable(value);
+  Status s = Get(options, key, &pinnable);
+  if (s.ok() && pinnable.IsPinned()) {
+    value->assign(pinnable.data(), pinnable.size());
+  }
+  return s;
+}
+
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   PinnableSlice* value) {
+  value->Reset();
   Status s;
-  MutexLock l(&mutex_);
+  // Take the super version first: the writes up to the sequence number
+  // read after it are all in its memtables or newer ones.
+  SuperVersion* sv = GetAndRefSuperVersion();
   SequenceNumber snapshot;
   if (options.snapshot != nullptr) {
     snapshot =
         static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
   } else {
-    snapshot = versions_->LastSequence();
+    snapshot = LastSequence();
   }
 
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  mem->Ref();
-  if (imm != nullptr) imm->Ref();
-  current->Ref();
-
-  bool have_stat_update = false;
+  // First look in the memtable, then in the immutable memtables from
+  // newest to oldest.
   Version::GetStats stats;
+  stats.seek_file = nullptr;
+  LookupKey lkey(key, snapshot);
+  bool done = sv->mem->Get(lkey, value->GetSelf(), &s);
+  for (size_t i = 0; !done && i < sv->imm.size(); i++) {
+    done = sv->imm[i]->Get(lkey, value->GetSelf(), &s);
+  }
+  if (done) {
+    if (s.ok()) {
+      value->PinSelf();
+    }
+  } else {
+    s = sv->current->Get(options, lkey, value, &stats);
+  }
 
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
-      // Done
+  // Only reads that were charged a seek need the lock
+  if (stats.seek_file != nullptr) {
+    MutexLock l(&mutex_);
+    if (sv->current->UpdateStats(stats)) {
+      MaybeScheduleCompaction();
+    }
+  }
+  ReturnSuperVersion(sv);
+  return s;
+}
+
+std::vector<Status> DBImpl::MultiGet(const ReadOptions& options,
+                                     const std::vector<Slice>& keys,
+                                     std::vector<std::string>* values) {
+  const size_t n = keys.size();
+  std::vector<Status> statuses(n);
+  values->clear();
+  values->resize(n);
+
+  SuperVersion* sv = GetAndRefSuperVersion();
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot =
+        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  } else {
+    snapshot = LastSequence();
+  }
+
+  // Keys that are not in the memtables, in key order
+  std::vector<LookupKey*> table_keys;
+  std::vector<std::string*> table_values;
+  std::vector<size_t> table_indexes;
+  std::vector<Version::GetStats> stats;
+
+  // Look up the keys in order, so that the keys that are in the same
+  // table file or block are next to each other.
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  const Comparator* ucmp = user_comparator();
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return ucmp->Compare(keys[a], keys[b]) < 0;
+  });
+
+  for (size_t i : order) {
+    LookupKey* lkey = new LookupKey(keys[i], snapshot);
+    std::string* value = &(*values)[i];
+    bool done = sv->mem->Get(*lkey, value, &statuses[i]);
+    for (size_t j = 0; !done && j < sv->imm.size(); j++) {
+      done = sv->imm[j]->Get(*lkey, value, &statuses[i]);
+    }
+    if (done) {
+      delete lkey;
     } else {
-      s = current->Get(options, lkey, value, &stats);
-      have_stat_update = true;
+      table_keys.push_back(lkey);
+      table_values.push_back(value);
+      table_indexes.push_back(i);
     }
-    mutex_.Lock();
   }
 
-  if (have_stat_update && current->UpdateStats(stats)) {
-    MaybeScheduleCompaction();
+  if (!table_keys.empty()) {
+    std::vector<Status> table_statuses(table_keys.size());
+    stats.resize(table_keys.size());
+    sv->current->MultiGet(options, table_keys.size(), table_keys.data(),
+                          table_values.data(), table_statuses.data(),
+                          stats.data());
+    for (size_t j = 0; j < table_keys.size(); j++) {
+      statuses[table_indexes[j]] = table_statuses[j];
+      delete table_keys[j];
+    }
   }
-  mem->Unref();
-  if (imm != nullptr) imm->Unref();
-  current->Unref();
-  return s;
+
+  // Only reads that were charged a seek need the lock
+  bool charged = false;
+  for (const Version::GetStats& s : stats) {
+    charged = charged || s.seek_file != nullptr;
+  }
+  if (charged) {
+    MutexLock l(&mutex_);
+    bool schedule_compaction = false;
+    for (const Version::GetStats& s : stats) {
+      if (sv->current->UpdateStats(s)) {
+        schedule_compaction = true;
+      }
+    }
+    if (schedule_compaction) {
+      MaybeScheduleCompaction();
+    }
+  }
+  ReturnSuperVersion(sv);
+  return statuses;
 }
 
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
@@ -1163,7 +1676,19 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
                             ? static_cast<const SnapshotImpl*>(options.snapshot)
                                   ->sequence_number()
                             : latest_snapshot),
-                       seed);
+                       seed,
+                       options.prefix_same_as_start
+                           ? internal_prefix_extractor_.user_transform()
+                           : nullptr,
+                       options.iterate_lower_bound, options.iterate_upper_bound);
+}
+
+MemTable* DBImpl::NewMemTable() const {
+  // The prefix bloom filter gets about a bit for every 8 bytes of the
+  // write buffer.
+  return new MemTable(internal_comparator_,
+                      internal_prefix_extractor_.user_transform(),
+                      options_.write_buffer_size / 8);
 }
 
 void DBImpl::RecordReadSample(Slice key) {
@@ -1193,6 +1718,10 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
 }
 
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
+  if (options_.enable_pipelined_write) {
+    return PipelinedWrite(options, updates);
+  }
+
   Writer w(&mutex_);
   w.batch = updates;
   w.sync = options.sync;
@@ -1201,6 +1730,10 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   MutexLock l(&mutex_);
   writers_.push_back(&w);
   while (!w.done && &w != writers_.front()) {
+    if (w.insert_group != nullptr) {
+      InsertMemberConcurrently(&w);
+      continue;
+    }
     w.cv.Wait();
   }
   if (w.done) {
@@ -1212,10 +1745,20 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   uint64_t last_sequence = versions_->LastSequence();
   Writer* last_writer = &w;
   if (status.ok() && updates != nullptr) {  // nullptr batch is for compactions
-    WriteBatch* write_batch = BuildBatchGroup(&last_writer);
+    WriteBatch* write_batch = BuildBatchGroup(&last_writer, tmp_batch_);
+    ChargeBatchGroup(updates, write_batch);
     WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);
     last_sequence += WriteBatchInternal::Count(write_batch);
 
+    // Only groups made of several batches are worth spreading out.
+    std::vector<Writer*> members;
+    if (options_.allow_concurrent_memtable_write && write_batch != updates) {
+      for (Writer* member : writers_) {
+        members.push_back(member);
+        if (member == last_writer) break;
+      }
+    }
+
     // Add to log and apply to memtable.  We can release the lock
     // during this phase since &w is currently responsible for logging
     // and protects against concurrent loggers and concurrent writes
@@ -1230,7 +1773,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
           sync_error = true;
         }
       }
-      if (status.ok()) {
+      if (status.ok() && members.empty()) {
         status = WriteBatchInternal::InsertInto(write_batch, mem_);
       }
       mutex_.Lock();
@@ -1241,6 +1784,9 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
         RecordBackgroundError(status);
       }
     }
+    if (status.ok() && !members.empty()) {
+      status = InsertGroupConcurrently(members, write_batch, mem_);
+    }
     if (write_batch == tmp_batch_) tmp_batch_->Clear();
 
     versions_->SetLastSequence(last_sequence);
@@ -1265,9 +1811,172 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   return status;
 }
 
+Status DBImpl::PipelinedWrite(const WriteOptions& options,
+                              WriteBatch* updates) {
+  Writer w(&mutex_);
+  w.batch = updates;
+  w.sync = options.sync;
+  w.done = false;
+
+  MutexLock l(&mutex_);
+  writers_.push_back(&w);
+  // Followers are removed from writers_ before they are done, so the queue
+  // may be empty while they wait here.
+  while (!w.done && (writers_.empty() || &w != writers_.front())) {
+    if (w.insert_group != nullptr) {
+      InsertMemberConcurrently(&w);
+      continue;
+    }
+    w.cv.Wait();
+  }
+  if (w.done) {
+    return w.status;
+  }
+
+  // May temporarily unlock and wait.
+  Status status = MakeRoomForWrite(updates == nullptr);
+  Writer* last_writer = &w;
+  WriteBatch group_batch;
+  WriteBatch* write_batch = nullptr;
+  if (status.ok() && updates != nullptr) {  // nullptr batch is for compactions
+    // Groups still in the memtable stage have been assigned sequence
+    // numbers that are not reflected in LastSequence() yet.
+    w.last_sequence = memtable_writers_.empty()
+                          ? versions_->LastSequence()
+                          : memtable_writers_.back()->last_sequence;
+    write_batch = BuildBatchGroup(&last_writer, &group_batch);
+    ChargeBatchGroup(updates, write_batch);
+    WriteBatchInternal::SetSequence(write_batch, w.last_sequence + 1);
+    w.last_sequence += WriteBatchInternal::Count(write_batch);
+
+    // Add to log.  &w is responsible for logging until it leaves the
+    // front of writers_, so no other thread touches log_ meanwhile.
+    {
+      mutex_.Unlock();
+      status = log_->AddRecord(WriteBatchInternal::Contents(write_batch));
+      bool sync_error = false;
+      if (status.ok() && options.sync) {
+        status = logfile_->Sync();
+        if (!status.ok()) {
+          sync_error = true;
+        }
+      }
+      mutex_.Lock();
+      if (sync_error) {
+        // See the comment in Write().
+        RecordBackgroundError(status);
+      }
+    }
+  }
+
+  // Release the members of the group from writers_ so that the next group
+  // can start its log write.  They stay blocked until their batch has been
+  // applied to the memtable.
+  std::vector<Writer*> group;
+  while (true) {
+    Writer* ready = writers_.front();
+    writers_.pop_front();
+    if (ready != &w) {
+      group.push_back(ready);
+    }
+    if (ready == last_writer) break;
+  }
+  const bool apply = status.ok() && write_batch != nullptr;
+  if (apply) {
+    memtable_writers_.push_back(&w);
+  }
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+
+  if (apply) {
+    // Apply groups to the memtable in log order so that LastSequence()
+    // never exposes a sequence number whose predecessors are missing.
+    while (memtable_writers_.front() != &w) {
+      w.cv.Wait();
+    }
+    if (options_.allow_concurrent_memtable_write && write_batch != updates) {
+      std::vector<Writer*> members;
+      members.push_back(&w);
+      members.insert(members.end(), group.begin(), group.end());
+      status = InsertGroupConcurrently(members, write_batch, mem_);
+    } else {
+      MemTable* mem = mem_;
+      mutex_.Unlock();
+      status = WriteBatchInternal::InsertInto(write_batch, mem);
+      mutex_.Lock();
+    }
+    versions_->SetLastSequence(w.last_sequence);
+    memtable_writers_.pop_front();
+    if (memtable_writers_.empty()) {
+      memtable_writers_drained_signal_.SignalAll();
+    } else {
+      memtable_writers_.front()->cv.Signal();
+    }
+  }
+
+  for (Writer* ready : group) {
+    ready->status = status;
+    ready->done = true;
+    ready->cv.Signal();
+  }
+  return status;
+}
+
+Status DBImpl::InsertGroupConcurrently(const std::vector<Writer*>& members,
+                                       const WriteBatch* group_batch,
+                                       MemTable* mem) {
+  mutex_.AssertHeld();
+  Writer* leader = members[0];
+  MemTableInsertGroup insert_group(mem, &leader->cv);
+
+  // Give every batch the sequence numbers it was assigned inside
+  // group_batch, then hand the non-empty ones to their owners.
+  SequenceNumber sequence = WriteBatchInternal::Sequence(group_batch);
+  for (Writer* member : members) {
+    if (member->batch == nullptr) continue;
+    WriteBatchInternal::SetSequence(member->batch, sequence);
+    sequence += WriteBatchInternal::Count(member->batch);
+    if (member != leader) {
+      member->insert_group = &insert_group;
+      insert_group.pending++;
+      member->cv.Signal();
+    }
+  }
+
+  mutex_.Unlock();
+  Status status =
+      WriteBatchInternal::InsertIntoConcurrently(leader->batch, mem);
+  mutex_.Lock();
+  while (insert_group.pending > 0) {
+    leader->cv.Wait();
+  }
+  if (status.ok()) {
+    status = insert_group.status;
+  }
+  return status;
+}
+
+void DBImpl::InsertMemberConcurrently(Writer* w) {
+  mutex_.AssertHeld();
+  MemTableInsertGroup* insert_group = w->insert_group;
+  w->insert_group = nullptr;
+  mutex_.Unlock();
+  Status s = WriteBatchInternal::InsertIntoConcurrently(w->batch,
+                                                        insert_group->mem);
+  mutex_.Lock();
+  if (!s.ok() && insert_group->status.ok()) {
+    insert_group->status = s;
+  }
+  if (--insert_group->pending == 0) {
+    insert_group->leader_cv->Signal();
+  }
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-null batch
-WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
+WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer,
+                                    WriteBatch* tmp_batch) {
   mutex_.AssertHeld();
   assert(!writers_.empty());
   Writer* first = writers_.front();
@@ -1304,7 +2013,7 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
       // Append to *result
       if (result == first->batch) {
         // Switch to temporary batch instead of disturbing caller's batch
-        result = tmp_batch_;
+        result = tmp_batch;
         assert(WriteBatchInternal::Count(result) == 0);
         WriteBatchInternal::Append(result, first->batch);
       }
@@ -1315,6 +2024,16 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   return result;
 }
 
+void DBImpl::ChargeBatchGroup(const WriteBatch* leader_batch,
+                               const WriteBatch* group_batch) {
+  mutex_.AssertHeld();
+  if (group_batch != leader_batch) {
+    write_controller_.AddDebt(env_->NowMicros(),
+                              WriteBatchInternal::ByteSize(group_batch) -
+                                  WriteBatchInternal::ByteSize(leader_batch));
+  }
+}
+
 // REQUIRES: mutex_ is held
 // REQUIRES: this thread is currently at the front of the writer queue
 Status DBImpl::MakeRoomForWrite(bool force) {
@@ -1323,35 +2042,53 @@ Status DBImpl::MakeRoomForWrite(bool force) {
   bool allow_delay = !force;
   Status s;
   while (true) {
+    if (allow_delay) {
+      UpdateWriteController();
+    }
     if (!bg_error_.ok()) {
       // Yield previous error
       s = bg_error_;
       break;
-    } else if (allow_delay && versions_->NumLevelFiles(0) >=
-                                  config::kL0_SlowdownWritesTrigger) {
+    } else if (allow_delay && write_controller_.IsDelayed()) {
       // We are getting close to hitting a hard limit on the number of
-      // L0 files.  Rather than delaying a single write by several
-      // seconds when we hit the hard limit, start delaying each
-      // individual write by 1ms to reduce latency variance.  Also,
-      // this delay hands over some CPU to the compaction thread in
-      // case it is sharing the same core as the writer.
-      mutex_.Unlock();
-      env_->SleepForMicroseconds(1000);
+      // L0 files, or compactions are falling behind.  Rather than
+      // delaying a single write by several seconds when we hit the hard
+      // limit, pace writes to the controller's rate to reduce latency
+      // variance.  Also, this delay hands over some CPU to the
+      // compaction thread in case it is sharing the same core as the
+      // writer.
+      // The group is built after this, so charge the leader's own batch
+      // here and the rest of the group once it is built (see
+      // ChargeBatchGroup()).
+      const WriteBatch* batch = writers_.front()->batch;
+      const uint64_t delay = write_controller_.GetDelay(
+          env_->NowMicros(),
+          batch != nullptr ? WriteBatchInternal::ByteSize(batch) : 0);
       allow_delay = false;  // Do not delay a single write more than once
-      mutex_.Lock();
+      if (delay > 0) {
+        mutex_.Unlock();
+        env_->SleepForMicroseconds(static_cast<int>(
+            std::min(delay, WriteController::kMaxSleepMicros)));
+        mutex_.Lock();
+      }
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
       break;
-    } else if (imm_ != nullptr) {
-      // We have filled up the current memtable, but the previous
-      // one is still being compacted, so we wait.
+    } else if (imm_.size() + 1 >= static_cast<size_t>(
+                                        options_.max_write_buffer_number)) {
+      // We have filled up the current memtable, but there is no room
+      // to queue it until earlier ones have been compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
       background_work_finished_signal_.Wait();
     } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
       background_work_finished_signal_.Wait();
+    } else if (!memtable_writers_.empty()) {
+      // Pipelined writes are still being applied to mem_; let them finish
+      // before it is queued in imm_.
+      memtable_writers_drained_signal_.Wait();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
@@ -1368,10 +2105,11 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       logfile_ = lfile;
       logfile_number_ = new_log_number;
       log_ = new log::Writer(lfile);
-      imm_ = mem_;
+      imm_.push_back(ImmutableMemTable{mem_, new_log_number});
       has_imm_.store(true, std::memory_order_release);
-      mem_ = new MemTable(internal_comparator_);
+      mem_ = NewMemTable();
       mem_->Ref();
+      InstallSuperVersion();
       force = false;  // Do not force another compaction if have room
       MaybeScheduleCompaction();
     }
@@ -1379,6 +2117,45 @@ Status DBImpl::MakeRoomForWrite(bool force) {
   return s;
 }
 
+void DBImpl::UpdateWriteController() {
+  mutex_.AssertHeld();
+  const int l0_files = versions_->NumLevelFiles(0);
+  const uint64_t pending_bytes = versions_->EstimatedPendingCompactionBytes();
+  const uint64_t pending_limit = options_.soft_pending_compaction_bytes_limit;
+  if (l0_files == write_stall_l0_files_ &&
+      pending_bytes == write_stall_pending_bytes_) {
+    return;  // Nothing changed since the last adjustment
+  }
+
+  if (l0_files < config::kL0_SlowdownWritesTrigger &&
+      (pending_limit == 0 || pending_bytes < pending_limit)) {
+    if (write_controller_.IsDelayed()) {
+      Log(options_.info_log, "Compactions caught up; no longer delaying\n");
+      write_controller_.ClearDelay();
+    }
+  } else if (!write_controller_.IsDelayed()) {
+    write_controller_.SetDelayedWriteRate(
+        write_controller_.max_delayed_write_rate());
+    Log(options_.info_log,
+        "Delaying writes to %llu bytes/s (%d L0 files, %llu pending bytes)\n",
+        static_cast<unsigned long long>(write_controller_.delayed_write_rate()),
+        l0_files, static_cast<unsigned long long>(pending_bytes));
+  } else {
+    // Slow down further while the backlog grows, and speed back up as
+    // compactions make progress.
+    uint64_t rate = write_controller_.delayed_write_rate();
+    if (l0_files > write_stall_l0_files_ ||
+        pending_bytes > write_stall_pending_bytes_) {
+      rate = rate / 5 * 4;
+    } else {
+      rate = rate / 4 * 5;
+    }
+    write_controller_.SetDelayedWriteRate(rate);
+  }
+  write_stall_l0_files_ = l0_files;
+  write_stall_pending_bytes_ = pending_bytes;
+}
+
 bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   value->clear();
 
@@ -1420,22 +2197,92 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
       }
     }
     return true;
+  } else if (in == "num-immutable-mem-table") {
+    char buf[50];
+    std::snprintf(buf, sizeof(buf), "%d", static_cast<int>(imm_.size()));
+    *value = buf;
+    return true;
+  } else if (in == "delayed-write-rate") {
+    const uint64_t rate = write_controller_.delayed_write_rate();
+    char buf[50];
+    std::snprintf(buf, sizeof(buf), "%llu",
+                  static_cast<unsigned long long>(rate));
+    *value = buf;
+    return true;
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
   } else if (in == "approximate-memory-usage") {
     size_t total_usage = options_.block_cache->TotalCharge();
+    if (options_.compressed_block_cache != nullptr) {
+      total_usage += options_.compressed_block_cache->TotalCharge();
+    }
     if (mem_) {
       total_usage += mem_->ApproximateMemoryUsage();
     }
-    if (imm_) {
-      total_usage += imm_->ApproximateMemoryUsage();
+    for (const ImmutableMemTable& imm : imm_) {
+      total_usage += imm.mem->ApproximateMemoryUsage();
     }
     char buf[50];
     std::snprintf(buf, sizeof(buf), "%llu",
                   static_cast<unsigned long long>(total_usage));
     value->append(buf);
     return true;
+  } else if (in == "compressed-block-cache") {
+    Cache* cache = options_.compressed_block_cache;
+    if (cache == nullptr) {
+      return false;
+    }
+    std::vector<Cache::ShardStats> shards;
+    cache->GetShardStats(&shards);
+    char buf[200];
+    if (!shards.empty()) {
+      uint64_t hits = 0;
+      uint64_t misses = 0;
+      for (const Cache::ShardStats& shard : shards) {
+        hits += shard.hits;
+        misses += shard.misses;
+      }
+      std::snprintf(buf, sizeof(buf), "hits: %llu\nmisses: %llu\n",
+                    static_cast<unsigned long long>(hits),
+                    static_cast<unsigned long long>(misses));
+      value->append(buf);
+    }
+    std::snprintf(buf, sizeof(buf), "usage: %llu\n",
+                  static_cast<unsigned long long>(cache->TotalCharge()));
+    value->append(buf);
+    return true;
+  } else if (in == "block-cache-stats") {
+    char buf[200];
+    value->append("Type          Hits     Misses    Inserts\n");
+    const BlockCacheStats& stats = table_cache_->block_cache_stats();
+    for (int t = 0; t < BlockCacheStats::kNumBlockTypes; t++) {
+      const BlockCacheStats::Counts& counts = stats.counts[t];
+      std::snprintf(
+          buf, sizeof(buf), "%-6s %11llu %10llu %10llu\n",
+          BlockCacheStats::BlockTypeName(
+              static_cast<BlockCacheStats::BlockType>(t)),
+          static_cast<unsigned long long>(counts.hits.load()),
+          static_cast<unsigned long long>(counts.misses.load()),
+          static_cast<unsigned long long>(counts.inserts.load()));
+      value->append(buf);
+    }
+
+    std::vector<Cache::ShardStats> shards;
+    options_.block_cache->GetShardStats(&shards);
+    if (!shards.empty()) {
+      value->append("Shard         Hits     Misses    Inserts  Evictions\n");
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+      std::snprintf(buf, sizeof(buf), "%5d %12llu %10llu %10llu %10llu\n",
+                    static_cast<int>(i),
+                    static_cast<unsigned long long>(shards[i].hits),
+                    static_cast<unsigned long long>(shards[i].misses),
+                    static_cast<unsigned long long>(shards[i].inserts),
+                    static_cast<unsigned long long>(shards[i].evictions));
+      value->append(buf);
+    }
+    return true;
   }
 
   return false;
@@ -1473,6 +2320,38 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+std::vector<Status> DB::MultiGet(const ReadOptions& options,
+                                 const std::vector<Slice>& keys,
+                                 std::vector<std::string>* values) {
+  // Read all keys from the same snapshot.
+  ReadOptions snapshot_options = options;
+  const Snapshot* snapshot = nullptr;
+  if (options.snapshot == nullptr) {
+    snapshot = GetSnapshot();
+    snapshot_options.snapshot = snapshot;
+  }
+  values->clear();
+  values->resize(keys.size());
+  std::vector<Status> statuses(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    statuses[i] = Get(snapshot_options, keys[i], &(*values)[i]);
+  }
+  if (snapshot != nullptr) {
+    ReleaseSnapshot(snapshot);
+  }
+  return statuses;
+}
+
+Status DB::Get(const ReadOptions& options, const Slice& key,
+               PinnableSlice* value) {
+  value->Reset();
+  Status s = Get(options, key, value->GetSelf());
+  if (s.ok()) {
+    value->PinSelf();
+  }
+  return s;
+}
+
 DB::~DB() = default;
 
 Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
@@ -1495,16 +2374,17 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
       impl->logfile_ = lfile;
       impl->logfile_number_ = new_log_number;
       impl->log_ = new log::Writer(lfile);
-      impl->mem_ = new MemTable(impl->internal_comparator_);
+      impl->mem_ = impl->NewMemTable();
       impl->mem_->Ref();
     }
   }
   if (s.ok() && save_manifest) {
     edit.SetPrevLogNumber(0);  // No older logs needed after recovery.
     edit.SetLogNumber(impl->logfile_number_);
-    s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
+    s = impl->LogAndApply(&edit);
   }
   if (s.ok()) {
+    impl->InstallSuperVersion();
     impl->RemoveObsoleteFiles();
     impl->MaybeScheduleCompaction();
   }
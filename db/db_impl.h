@@ -9,10 +9,12 @@
 #include <deque>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
+#include "db/write_controller.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "port/port.h"
@@ -22,6 +24,7 @@ namespace leveldb {
 
 class MemTable;
 class TableCache;
+class ThreadLocalPtr;
 class Version;
 class VersionEdit;
 class VersionSet;
@@ -42,6 +45,11 @@ class DBImpl : public DB {
   Status Write(const WriteOptions& options, WriteBatch* updates) override;
   Status Get(const ReadOptions& options, const Slice& key,
              std::string* value) override;
+  Status Get(const ReadOptions& options, const Slice& key,
+             PinnableSlice* value) override;
+  std::vector<Status> MultiGet(const ReadOptions& options,
+                               const std::vector<Slice>& keys,
+                               std::vector<std::string>* values) override;
   Iterator* NewIterator(const ReadOptions&) override;
   const Snapshot* GetSnapshot() override;
   void ReleaseSnapshot(const Snapshot* snapshot) override;
@@ -74,12 +82,15 @@ class DBImpl : public DB {
  private:
   friend class DB;
   struct CompactionState;
+  struct SubcompactionJobs;
   struct Writer;
+  struct MemTableInsertGroup;
 
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
     bool done;
+    bool in_progress;          // Picked up by a background thread
     const InternalKey* begin;  // null means beginning of key range
     const InternalKey* end;    // null means end of key range
     InternalKey tmp_storage;   // Used to keep track of compaction progress
@@ -101,10 +112,59 @@ class DBImpl : public DB {
     int64_t bytes_written;
   };
 
+  // A view of mem_, imm_ and the current version that reads use without
+  // holding mutex_.  It holds a reference to each of them, which it drops
+  // under mutex_ once it is no longer referenced itself.
+  struct SuperVersion {
+    SuperVersion() : refs(0) {}
+
+    void Ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+    // Drop a reference and return true if it was the last one.
+    bool Unref() { return refs.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+
+    MemTable* mem;
+    std::vector<MemTable*> imm;  // Newest first
+    Version* current;
+    std::atomic<int> refs;
+  };
+
+  // Replace super_version_ with a view of the current mem_, imm_ and
+  // version.  Must be called whenever any of them changes.
+  void InstallSuperVersion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Drop the super versions cached by all threads.
+  void DropCachedSuperVersions() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Return a referenced super_version_, normally the one the calling
+  // thread cached on its last read, so that no lock is needed.  The
+  // caller must hand it back to ReturnSuperVersion().
+  SuperVersion* GetAndRefSuperVersion() LOCKS_EXCLUDED(mutex_);
+
+  // Cache "sv" for the next read of the calling thread, or drop the
+  // reference to it if a newer one has been installed since.
+  void ReturnSuperVersion(SuperVersion* sv) LOCKS_EXCLUDED(mutex_);
+
+  // Drop a reference to "sv", and delete it if that was the last one.
+  void UnrefSuperVersion(SuperVersion* sv) LOCKS_EXCLUDED(mutex_);
+  void CleanupSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Handler for the cached super versions of exiting threads.
+  static void ReleaseCachedSuperVersion(void* ptr);
+
+  // Cleanup function of the iterators that NewInternalIterator() returns.
+  static void CleanupIterator(void* db, void* sv);
+
+  // Return the last sequence number, which needs no lock.
+  SequenceNumber LastSequence() const NO_THREAD_SAFETY_ANALYSIS;
+
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot,
                                 uint32_t* seed);
 
+  // Return a new, empty memtable.
+  MemTable* NewMemTable() const;
+
   Status NewDB();
 
   // Recover the descriptor from persistent storage.  May do a significant
@@ -118,34 +178,84 @@ class DBImpl : public DB {
   // Delete any unneeded files and stale in-memory entries.
   void RemoveObsoleteFiles() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  // Compact the in-memory write buffer to disk.  Switches to a new
-  // log-file/memtable and writes a new descriptor iff successful.
-  // Errors are recorded in bg_error_.
+  // Compact all immutable memtables that are currently queued in imm_
+  // to a single level-0 table, and drop them and their log files
+  // iff successful.  Errors are recorded in bg_error_.
+  // REQUIRES: no other memtable compaction is running.
   void CompactMemTable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Apply *edit to versions_.  Background threads take turns, since
+  // VersionSet::LogAndApply() must not be called concurrently.
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  // Write the merged contents of "mems" to a single new table numbered
+  // *file_number.  The number stays in pending_outputs_, so that the table
+  // is not deleted before *edit is applied; the caller must erase it.
+  Status WriteLevel0Table(const std::vector<MemTable*>& mems,
+                          VersionEdit* edit, Version* base,
+                          uint64_t* file_number)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
-  WriteBatch* BuildBatchGroup(Writer** last_writer)
+
+  // Start, adjust or stop throttling writes based on the number of
+  // level-0 files and the compaction backlog of the current version.
+  void UpdateWriteController() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  WriteBatch* BuildBatchGroup(Writer** last_writer, WriteBatch* tmp_batch)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Charge the write controller for the batches that BuildBatchGroup()
+  // added to "leader_batch" to form "group_batch".
+  void ChargeBatchGroup(const WriteBatch* leader_batch,
+                        const WriteBatch* group_batch)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Write path used when options_.enable_pipelined_write is set.  The
+  // leader of a batch group gives up the head of writers_ as soon as its
+  // log record is written, and applies the group to the memtable from
+  // memtable_writers_, in the same order as the log.
+  Status PipelinedWrite(const WriteOptions& options, WriteBatch* updates);
+
+  // Apply the batch group led by members[0] to "mem", with every member
+  // inserting its own batch from its own thread.  group_batch is the
+  // combined batch that was written to the log.  May temporarily unlock.
+  Status InsertGroupConcurrently(const std::vector<Writer*>& members,
+                                 const WriteBatch* group_batch, MemTable* mem)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Run the part of InsertGroupConcurrently() assigned to follower "w".
+  void InsertMemberConcurrently(Writer* w) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   void RecordBackgroundError(const Status& s);
 
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
+  static void BGFlushWork(void* db);
   void BackgroundCall();
-  void BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void BackgroundFlushCall();
+
+  // Run one memtable compaction or compaction, if there is one that can
+  // run alongside the background work that is already running.  Returns
+  // false if nothing was done.
+  bool BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Compact the key range of *compact into new output files.  If
+  // imm_micros is non-null, queued memtables are compacted along the way
+  // and the time spent on them is added to *imm_micros.
+  // REQUIRES: mutex_ is not held.
+  Status DoSubcompactionWork(CompactionState* compact, int64_t* imm_micros);
+  static void BGSubcompactionWork(void* jobs);
+
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
   Status InstallCompactionResults(CompactionState* compact)
@@ -159,6 +269,7 @@ class DBImpl : public DB {
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
   const InternalFilterPolicy internal_filter_policy_;
+  const InternalKeySliceTransform internal_prefix_extractor_;
   const Options options_;  // options_.comparator == &internal_comparator_
   const bool owns_info_log_;
   const bool owns_cache_;
@@ -175,25 +286,64 @@ class DBImpl : public DB {
   std::atomic<bool> shutting_down_;
   port::CondVar background_work_finished_signal_ GUARDED_BY(mutex_);
   MemTable* mem_;
-  MemTable* imm_ GUARDED_BY(mutex_);  // Memtable being compacted
-  std::atomic<bool> has_imm_;         // So bg thread can detect non-null imm_
+
+  // An immutable memtable waiting to be compacted, along with the number
+  // of the log file that was started when it was retired.  Once the
+  // memtable is on disk, only that log and newer ones are needed.
+  struct ImmutableMemTable {
+    MemTable* mem;
+    uint64_t next_log_number;
+  };
+  std::vector<ImmutableMemTable> imm_ GUARDED_BY(mutex_);  // Oldest first
+  std::atomic<bool> has_imm_;  // So bg thread can detect non-empty imm_
   WritableFile* logfile_;
   uint64_t logfile_number_ GUARDED_BY(mutex_);
   log::Writer* log_;
-  uint32_t seed_ GUARDED_BY(mutex_);  // For sampling.
+  std::atomic<uint32_t> seed_;  // For sampling.
+
+  // The view of mem_, imm_ and current that reads use, and a copy of it
+  // cached by each thread.  A thread's copy is nullptr if it is outdated
+  // and kSuperVersionInUse while the thread reads from it.
+  SuperVersion* super_version_ GUARDED_BY(mutex_);
+  ThreadLocalPtr* const cached_super_version_;
 
   // Queue of writers.
   std::deque<Writer*> writers_ GUARDED_BY(mutex_);
   WriteBatch* tmp_batch_ GUARDED_BY(mutex_);
 
+  // Leaders of batch groups whose log record has been written but whose
+  // memtable insert has not completed yet (pipelined writes only).
+  std::deque<Writer*> memtable_writers_ GUARDED_BY(mutex_);
+  port::CondVar memtable_writers_drained_signal_ GUARDED_BY(mutex_);
+
+  // Paces writes while compactions are falling behind.  The level-0 file
+  // count and compaction backlog it last reacted to are kept so that it
+  // can tell whether the backlog is growing or shrinking.
+  WriteController write_controller_ GUARDED_BY(mutex_);
+  int write_stall_l0_files_ GUARDED_BY(mutex_);
+  uint64_t write_stall_pending_bytes_ GUARDED_BY(mutex_);
+
   SnapshotList snapshots_ GUARDED_BY(mutex_);
 
   // Set of table files to protect from deletion because they are
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_ GUARDED_BY(mutex_);
 
-  // Has a background compaction been scheduled or is running?
-  bool background_compaction_scheduled_ GUARDED_BY(mutex_);
+  // Number of compaction jobs scheduled in the kLow priority pool,
+  // including those running, and the number that have not started yet.
+  int background_compactions_scheduled_ GUARDED_BY(mutex_);
+  int background_compactions_queued_ GUARDED_BY(mutex_);
+
+  // Has a memtable compaction job been scheduled in the kHigh priority
+  // pool or is it running?  Only used if options_.max_background_flushes > 0.
+  bool background_flush_scheduled_ GUARDED_BY(mutex_);
+
+  // Is some thread inside CompactMemTable()?
+  bool memtable_compaction_running_ GUARDED_BY(mutex_);
+
+  // Is some thread inside LogAndApply()?
+  bool applying_edit_ GUARDED_BY(mutex_);
+  port::CondVar edit_applied_signal_ GUARDED_BY(mutex_);
 
   ManualCompaction* manual_compaction_ GUARDED_BY(mutex_);
 
@@ -210,6 +360,7 @@ class DBImpl : public DB {
 Options SanitizeOptions(const std::string& db,
                         const InternalKeyComparator* icmp,
                         const InternalFilterPolicy* ipolicy,
+                        const InternalKeySliceTransform* iprefix,
                         const Options& src);
 
 }  // namespace leveldb
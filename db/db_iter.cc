@@ -9,6 +9,7 @@
 #include "db/filename.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "leveldb/slice_transform.h"
 #include "port/port.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
@@ -46,7 +47,8 @@ class DBIter : public Iterator {
   enum Direction { kForward, kReverse };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+         uint32_t seed, const SliceTransform* prefix_extractor,
+         const Slice* lower_bound, const Slice* upper_bound)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
@@ -54,7 +56,11 @@ class DBIter : public Iterator {
         direction_(kForward),
         valid_(false),
         rnd_(seed),
-        bytes_until_read_sampling_(RandomCompactionPeriod()) {}
+        bytes_until_read_sampling_(RandomCompactionPeriod()),
+        prefix_extractor_(prefix_extractor),
+        prefix_active_(false),
+        lower_bound_(lower_bound),
+        upper_bound_(upper_bound) {}
 
   DBIter(const DBIter&) = delete;
   DBIter& operator=(const DBIter&) = delete;
@@ -101,6 +107,22 @@ class DBIter : public Iterator {
     }
   }
 
+  // Return true iff "user_key" has the prefix of the last Seek() target.
+  bool HasSeekPrefix(const Slice& user_key) const {
+    return prefix_extractor_->InDomain(user_key) &&
+           prefix_extractor_->Transform(user_key) == Slice(prefix_);
+  }
+
+  bool BeforeLowerBound(const Slice& user_key) const {
+    return lower_bound_ != nullptr &&
+           user_comparator_->Compare(user_key, *lower_bound_) < 0;
+  }
+
+  bool PastUpperBound(const Slice& user_key) const {
+    return upper_bound_ != nullptr &&
+           user_comparator_->Compare(user_key, *upper_bound_) >= 0;
+  }
+
   // Picks the number of bytes that can be read until a compaction is scheduled.
   size_t RandomCompactionPeriod() {
     return rnd_.Uniform(2 * config::kReadBytesPeriod);
@@ -117,6 +139,16 @@ class DBIter : public Iterator {
   bool valid_;
   Random rnd_;
   size_t bytes_until_read_sampling_;
+
+  // Set for prefix_same_as_start iterators.  While prefix_active_, the
+  // iterator stops at the end of the keys with prefix prefix_.
+  const SliceTransform* const prefix_extractor_;
+  std::string prefix_;
+  bool prefix_active_;
+
+  // ReadOptions::iterate_lower_bound and iterate_upper_bound
+  const Slice* const lower_bound_;
+  const Slice* const upper_bound_;
 };
 
 inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
@@ -180,7 +212,16 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   assert(direction_ == kForward);
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+    const bool parsed = ParseKey(&ikey);
+    if (parsed && prefix_active_ && !HasSeekPrefix(ikey.user_key)) {
+      // Keys with the same prefix are adjacent, so no more keys have it.
+      break;
+    }
+    if (parsed && PastUpperBound(ikey.user_key)) {
+      // Stop before the deleted keys beyond the bound, too
+      break;
+    }
+    if (parsed && ikey.sequence <= sequence_) {
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -209,6 +250,14 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
 void DBIter::Prev() {
   assert(valid_);
 
+  if (prefix_active_) {
+    // The children skipped by the Seek() cannot be moved backwards.
+    status_ = Status::NotSupported("Prev() after a prefix Seek()");
+    valid_ = false;
+    saved_key_.clear();
+    return;
+  }
+
   if (direction_ == kForward) {  // Switch directions?
     // iter_ is pointing at the current entry.  Scan backwards until
     // the key changes so we can use the normal reverse scanning code.
@@ -240,7 +289,11 @@ void DBIter::FindPrevUserEntry() {
   if (iter_->Valid()) {
     do {
       ParsedInternalKey ikey;
-      if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+      const bool parsed = ParseKey(&ikey);
+      if (parsed && BeforeLowerBound(ikey.user_key)) {
+        break;
+      }
+      if (parsed && ikey.sequence <= sequence_) {
         if ((value_type != kTypeDeletion) &&
             user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
           // We encountered a non-deleted value in entries for previous keys,
@@ -275,7 +328,15 @@ void DBIter::FindPrevUserEntry() {
   }
 }
 
-void DBIter::Seek(const Slice& target) {
+void DBIter::Seek(const Slice& user_target) {
+  const Slice target =
+      BeforeLowerBound(user_target) ? *lower_bound_ : user_target;
+  prefix_active_ =
+      prefix_extractor_ != nullptr && prefix_extractor_->InDomain(target);
+  if (prefix_active_) {
+    Slice prefix = prefix_extractor_->Transform(target);
+    prefix_.assign(prefix.data(), prefix.size());
+  }
   direction_ = kForward;
   ClearSavedValue();
   saved_key_.clear();
@@ -290,9 +351,17 @@ void DBIter::Seek(const Slice& target) {
 }
 
 void DBIter::SeekToFirst() {
+  prefix_active_ = false;
   direction_ = kForward;
   ClearSavedValue();
-  iter_->SeekToFirst();
+  if (lower_bound_ != nullptr) {
+    saved_key_.clear();
+    AppendInternalKey(&saved_key_, ParsedInternalKey(*lower_bound_, sequence_,
+                                                     kValueTypeForSeek));
+    iter_->Seek(saved_key_);
+  } else {
+    iter_->SeekToFirst();
+  }
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
   } else {
@@ -301,9 +370,25 @@ void DBIter::SeekToFirst() {
 }
 
 void DBIter::SeekToLast() {
+  prefix_active_ = false;
   direction_ = kReverse;
   ClearSavedValue();
-  iter_->SeekToLast();
+  if (upper_bound_ != nullptr) {
+    // Find the last entry before all entries for the bound
+    saved_key_.clear();
+    AppendInternalKey(&saved_key_,
+                      ParsedInternalKey(*upper_bound_, kMaxSequenceNumber,
+                                        kValueTypeForSeek));
+    iter_->Seek(saved_key_);
+    saved_key_.clear();
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+  } else {
+    iter_->SeekToLast();
+  }
   FindPrevUserEntry();
 }
 
@@ -311,8 +396,11 @@ void DBIter::SeekToLast() {
 
 Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+                        uint32_t seed,
+                        const SliceTransform* prefix_extractor,
+                        const Slice* lower_bound, const Slice* upper_bound) {
+  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed,
+                    prefix_extractor, lower_bound, upper_bound);
 }
 
 }  // namespace leveldb
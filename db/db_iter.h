@@ -16,10 +16,16 @@ class DBImpl;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  If "prefix_extractor" is non-null, a
+// Seek() only yields the keys with the prefix of its target.  If
+// "lower_bound" or "upper_bound" is non-null, only the user keys in
+// [*lower_bound, *upper_bound) are yielded.
 Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed);
+                        uint32_t seed,
+                        const SliceTransform* prefix_extractor = nullptr,
+                        const Slice* lower_bound = nullptr,
+                        const Slice* upper_bound = nullptr);
 
 }  // namespace leveldb
 
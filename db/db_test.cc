@@ -6,7 +6,10 @@
 
 #include <atomic>
 #include <cinttypes>
+#include <cstring>
+#include <map>
 #include <string>
+#include <thread>
 
 #include "gtest/gtest.h"
 #include "third_party/benchmark/include/benchmark/benchmark.h"
@@ -17,6 +20,9 @@
 #include "leveldb/cache.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/persistent_cache.h"
+#include "leveldb/rate_limiter.h"
+#include "leveldb/slice_transform.h"
 #include "leveldb/table.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
@@ -122,6 +128,14 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  // Copy what is read from table files into the caller's buffer, as a
+  // file that is not memory-mapped does, so that blocks can be cached.
+  bool copy_random_reads_;
+
+  // Work passed to Schedule() is held back while this is true, until
+  // ReleaseScheduledWork() is called.
+  std::atomic<bool> hold_scheduled_work_;
+
   explicit SpecialEnv(Env* base)
       : EnvWrapper(base),
         delay_data_sync_(false),
@@ -130,7 +144,33 @@ class SpecialEnv : public EnvWrapper {
         non_writable_(false),
         manifest_sync_error_(false),
         manifest_write_error_(false),
-        count_random_reads_(false) {}
+        count_random_reads_(false),
+        copy_random_reads_(false),
+        hold_scheduled_work_(false) {}
+
+  void Schedule(void (*function)(void*), void* arg) override {
+    {
+      MutexLock l(&held_work_mu_);
+      if (hold_scheduled_work_.load(std::memory_order_acquire)) {
+        held_work_.emplace_back(function, arg);
+        return;
+      }
+    }
+    target()->Schedule(function, arg);
+  }
+
+  // Stop holding back work and schedule the work held so far.
+  void ReleaseScheduledWork() {
+    std::vector<std::pair<void (*)(void*), void*>> work;
+    {
+      MutexLock l(&held_work_mu_);
+      hold_scheduled_work_.store(false, std::memory_order_release);
+      work.swap(held_work_);
+    }
+    for (size_t i = 0; i < work.size(); i++) {
+      target()->Schedule(work[i].first, work[i].second);
+    }
+  }
 
   Status NewWritableFile(const std::string& f, WritableFile** r) {
     class DataFile : public WritableFile {
@@ -207,25 +247,41 @@ class SpecialEnv : public EnvWrapper {
     class CountingFile : public RandomAccessFile {
      private:
       RandomAccessFile* target_;
-      AtomicCounter* counter_;
+      AtomicCounter* counter_;  // Null if reads are not counted
+      const bool copy_;
 
      public:
-      CountingFile(RandomAccessFile* target, AtomicCounter* counter)
-          : target_(target), counter_(counter) {}
+      CountingFile(RandomAccessFile* target, AtomicCounter* counter,
+                   bool copy)
+          : target_(target), counter_(counter), copy_(copy) {}
       ~CountingFile() override { delete target_; }
       Status Read(uint64_t offset, size_t n, Slice* result,
                   char* scratch) const override {
-        counter_->Increment();
-        return target_->Read(offset, n, result, scratch);
+        if (counter_ != nullptr) {
+          counter_->Increment();
+        }
+        Status s = target_->Read(offset, n, result, scratch);
+        if (s.ok() && copy_ && result->data() != scratch) {
+          std::memcpy(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
       }
     };
 
     Status s = target()->NewRandomAccessFile(f, r);
-    if (s.ok() && count_random_reads_) {
-      *r = new CountingFile(*r, &random_read_counter_);
+    if (s.ok() && (count_random_reads_ || copy_random_reads_)) {
+      *r = new CountingFile(
+          *r, count_random_reads_ ? &random_read_counter_ : nullptr,
+          copy_random_reads_);
     }
     return s;
   }
+
+ private:
+  port::Mutex held_work_mu_;
+  std::vector<std::pair<void (*)(void*), void*>> held_work_
+      GUARDED_BY(held_work_mu_);
 };
 
 class DBTest : public testing::Test {
@@ -238,6 +294,8 @@ class DBTest : public testing::Test {
 
   DBTest() : env_(new SpecialEnv(Env::Default())), option_config_(kDefault) {
     filter_policy_ = NewBloomFilterPolicy(10);
+    blocked_filter_policy_ = NewBlockedBloomFilterPolicy(10);
+    row_cache_ = NewLRUCache(1 << 20);
     dbname_ = testing::TempDir() + "db_test";
     DestroyDB(dbname_, Options());
     db_ = nullptr;
@@ -249,6 +307,8 @@ class DBTest : public testing::Test {
     DestroyDB(dbname_, Options());
     delete env_;
     delete filter_policy_;
+    delete blocked_filter_policy_;
+    delete row_cache_;
   }
 
   // Switch to a fresh database with the next option configuration to
@@ -274,9 +334,35 @@ class DBTest : public testing::Test {
       case kFilter:
         options.filter_policy = filter_policy_;
         break;
+      case kFullFilter:
+        options.filter_policy = blocked_filter_policy_;
+        options.full_filter = true;
+        break;
+      case kPartitionedIndex:
+        options.filter_policy = filter_policy_;
+        options.partition_index_and_filters = true;
+        options.metadata_block_size = 256;
+        break;
+      case kDataBlockHashIndex:
+        options.data_block_hash_index = true;
+        break;
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kPipelinedWrite:
+        options.enable_pipelined_write = true;
+        break;
+      case kConcurrentMemTableWrite:
+        options.allow_concurrent_memtable_write = true;
+        break;
+      case kParallelCompactions:
+        options.max_background_compactions = 4;
+        options.max_background_flushes = 1;
+        options.max_subcompactions = 4;
+        break;
+      case kRowCache:
+        options.row_cache = row_cache_;
+        break;
       default:
         break;
     }
@@ -335,6 +421,33 @@ class DBTest : public testing::Test {
     return result;
   }
 
+  // Look up "keys" with one MultiGet() and return the results, formatted
+  // like Get() does, separated by commas.
+  std::string MultiGet(const std::vector<std::string>& keys,
+                       const Snapshot* snapshot = nullptr) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::vector<Slice> key_slices(keys.begin(), keys.end());
+    std::vector<std::string> values;
+    std::vector<Status> statuses = db_->MultiGet(options, key_slices, &values);
+    EXPECT_EQ(keys.size(), statuses.size());
+    EXPECT_EQ(keys.size(), values.size());
+    std::string result;
+    for (size_t i = 0; i < statuses.size(); i++) {
+      if (i > 0) {
+        result += ",";
+      }
+      if (statuses[i].IsNotFound()) {
+        result += "NOT_FOUND";
+      } else if (!statuses[i].ok()) {
+        result += statuses[i].ToString();
+      } else {
+        result += values[i];
+      }
+    }
+    return result;
+  }
+
   // Return a string that contains all key,value pairs in order,
   // formatted like "(k1->v1)(k2->v2)".
   std::string Contents() {
@@ -531,11 +644,31 @@ class DBTest : public testing::Test {
     return files_renamed;
   }
 
+  // Fills two levels of tables filtered by "filter_policy", which is
+  // deleted afterwards, and checks that lookups of present keys rarely
+  // read more than one table and lookups of missing keys rarely read any.
+  void CheckFilterReads(const FilterPolicy* filter_policy, bool full_filter);
+
  private:
   // Sequence of option configurations to try
-  enum OptionConfig { kDefault, kReuse, kFilter, kUncompressed, kEnd };
+  enum OptionConfig {
+    kDefault,
+    kReuse,
+    kFilter,
+    kFullFilter,
+    kPartitionedIndex,
+    kDataBlockHashIndex,
+    kUncompressed,
+    kPipelinedWrite,
+    kConcurrentMemTableWrite,
+    kParallelCompactions,
+    kRowCache,
+    kEnd
+  };
 
   const FilterPolicy* filter_policy_;
+  const FilterPolicy* blocked_filter_policy_;
+  Cache* row_cache_;
   int option_config_;
 };
 
@@ -608,6 +741,93 @@ TEST_F(DBTest, GetFromImmutableLayer) {
   } while (ChangeOptions());
 }
 
+TEST_F(DBTest, GetFromMultipleImmutableMemTables) {
+  do {
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.write_buffer_size = 100000;  // Small write buffer
+    options.max_write_buffer_number = 4;
+    Reopen(&options);
+
+    // Block sync calls so that the first memtable compaction stalls and
+    // later memtables queue up behind it.
+    env_->delay_data_sync_.store(true, std::memory_order_release);
+    ASSERT_LEVELDB_OK(Put("foo", "v1"));
+    Put("k1", std::string(100000, 'x'));  // Fill memtable.
+    ASSERT_LEVELDB_OK(Put("foo", "v2"));  // Goes to second memtable.
+    Put("k2", std::string(100000, 'y'));  // Fill it too.
+    ASSERT_LEVELDB_OK(Put("bar", "v3"));  // Goes to third memtable.
+    Put("k3", std::string(100000, 'z'));  // Fill it too.
+    ASSERT_LEVELDB_OK(Put("baz", "v4"));  // Goes to fourth memtable.
+
+    std::string num;
+    ASSERT_TRUE(db_->GetProperty("leveldb.num-immutable-mem-table", &num));
+    ASSERT_EQ("3", num);
+    ASSERT_EQ("v2", Get("foo"));
+    ASSERT_EQ("v3", Get("bar"));
+    ASSERT_EQ(std::string(100000, 'x'), Get("k1"));
+
+    // Release sync calls and wait for the queue to drain.  The memtables
+    // that queued up behind the stalled compaction are compacted together.
+    env_->delay_data_sync_.store(false, std::memory_order_release);
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_TRUE(db_->GetProperty("leveldb.num-immutable-mem-table", &num));
+    ASSERT_EQ("0", num);
+    ASSERT_LE(TotalTableFiles(), 3);
+    ASSERT_EQ("v2", Get("foo"));
+    ASSERT_EQ(std::string(100000, 'y'), Get("k2"));
+
+    Reopen(&options);
+    ASSERT_EQ("v2", Get("foo"));
+    ASSERT_EQ("v3", Get("bar"));
+    ASSERT_EQ("v4", Get("baz"));
+  } while (ChangeOptions());
+}
+
+TEST_F(DBTest, ReadsAcrossSuperVersions) {
+  do {
+    // A read caches the view of the memtables and tables it used, which
+    // must not hide later writes, memtable switches and compactions
+    ASSERT_LEVELDB_OK(Put("foo", "v1"));
+    ASSERT_EQ("v1", Get("foo"));
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    ASSERT_LEVELDB_OK(Put("foo", "v2"));
+    ASSERT_EQ("v2", Get("foo"));
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_LEVELDB_OK(Put("foo", "v3"));
+    ASSERT_EQ("v3", Get("foo"));
+    Compact("a", "z");
+    ASSERT_EQ("v3", Get("foo"));
+
+    // Iterators keep the view they were created with
+    iter->SeekToFirst();
+    ASSERT_EQ("foo->v1", IterStatus(iter));
+    delete iter;
+
+    // Threads that exit with a cached view release it
+    std::atomic<int> bad_reads(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&] {
+        for (int i = 0; i < 100; i++) {
+          if (Get("foo") != "v3") {
+            bad_reads.fetch_add(1);
+          }
+        }
+      });
+    }
+    for (int i = 0; i < 10; i++) {
+      ASSERT_LEVELDB_OK(Put("bar" + std::to_string(i), "v"));
+      ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    ASSERT_EQ(0, bad_reads.load());
+    ASSERT_EQ("v3", Get("foo"));
+  } while (ChangeOptions());
+}
+
 TEST_F(DBTest, GetFromVersions) {
   do {
     ASSERT_LEVELDB_OK(Put("foo", "v1"));
@@ -616,6 +836,81 @@ TEST_F(DBTest, GetFromVersions) {
   } while (ChangeOptions());
 }
 
+TEST_F(DBTest, GetPinned) {
+  do {
+    const std::string big1(10000, '1');
+    const std::string big2(10000, '2');
+    ASSERT_LEVELDB_OK(Put("foo", big1));
+    PinnableSlice value;
+    ASSERT_LEVELDB_OK(db_->Get(ReadOptions(), "foo", &value));
+    ASSERT_FALSE(value.IsPinned());  // Memtable values are copied
+    ASSERT_EQ(big1, value.ToString());
+
+    ASSERT_LEVELDB_OK(Put("bar", "b"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_TRUE(db_->Get(ReadOptions(), "missing", &value).IsNotFound());
+    ASSERT_EQ("", value.ToString());
+
+    // Values from tables stay valid while their files are compacted away,
+    // whether or not their blocks are cached.
+    for (bool fill_cache : {true, false}) {
+      ReadOptions options;
+      options.fill_cache = fill_cache;
+      PinnableSlice pinned;
+      ASSERT_LEVELDB_OK(db_->Get(options, "foo", &pinned));
+      ASSERT_TRUE(pinned.IsPinned());
+      ASSERT_EQ(big1, pinned.ToString());
+
+      ASSERT_LEVELDB_OK(Put("foo", big2));
+      dbfull()->TEST_CompactMemTable();
+      dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+      ASSERT_LEVELDB_OK(db_->Get(options, "foo", &value));
+      ASSERT_EQ(big2, value.ToString());
+      ASSERT_EQ(big1, pinned.ToString());
+
+      // Moving a pinned slice moves the pin.
+      value = std::move(pinned);
+      ASSERT_TRUE(value.IsPinned());
+      ASSERT_FALSE(pinned.IsPinned());
+      ASSERT_EQ(big1, value.ToString());
+      value.Reset();
+      ASSERT_EQ("", value.ToString());
+      ASSERT_LEVELDB_OK(Put("foo", big1));
+      dbfull()->TEST_CompactMemTable();
+    }
+
+    ASSERT_LEVELDB_OK(Delete("foo"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_TRUE(db_->Get(ReadOptions(), "foo", &value).IsNotFound());
+  } while (ChangeOptions());
+}
+
+TEST_F(DBTest, MultiGet) {
+  do {
+    ASSERT_LEVELDB_OK(Put("a", "va1"));
+    ASSERT_LEVELDB_OK(Put("c", "vc"));
+    ASSERT_LEVELDB_OK(Put("e", "ve1"));
+    ASSERT_LEVELDB_OK(Put("g", "vg"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_LEVELDB_OK(Put("a", "va2"));
+    ASSERT_LEVELDB_OK(Delete("c"));
+    dbfull()->TEST_CompactMemTable();
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_LEVELDB_OK(Put("b", "vb"));
+    ASSERT_LEVELDB_OK(Put("e", "ve2"));
+
+    const std::vector<std::string> keys = {"g", "a", "b", "c", "d",
+                                           "e", "f", "a", "z"};
+    ASSERT_EQ("vg,va2,vb,NOT_FOUND,NOT_FOUND,ve2,NOT_FOUND,va2,NOT_FOUND",
+              MultiGet(keys));
+    ASSERT_EQ(
+        "vg,va2,NOT_FOUND,NOT_FOUND,NOT_FOUND,ve1,NOT_FOUND,va2,NOT_FOUND",
+        MultiGet(keys, snapshot));
+    ASSERT_EQ("", MultiGet({}));
+    db_->ReleaseSnapshot(snapshot);
+  } while (ChangeOptions());
+}
+
 TEST_F(DBTest, GetMemUsage) {
   do {
     ASSERT_LEVELDB_OK(Put("foo", "v1"));
@@ -627,6 +922,53 @@ TEST_F(DBTest, GetMemUsage) {
   } while (ChangeOptions());
 }
 
+TEST_F(DBTest, GetDelayedWriteRate) {
+  do {
+    std::string val;
+    ASSERT_TRUE(db_->GetProperty("leveldb.delayed-write-rate", &val));
+    ASSERT_EQ("0", val);
+    for (int i = 0; i < 100; i++) {
+      ASSERT_LEVELDB_OK(Put("key" + std::to_string(i), std::string(1000, 'v')));
+    }
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+    ASSERT_TRUE(db_->GetProperty("leveldb.delayed-write-rate", &val));
+    ASSERT_EQ("0", val);
+  } while (ChangeOptions());
+}
+
+TEST_F(DBTest, DelayedWriteRateAtL0SlowdownTrigger) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  // Flushes are scheduled with kHigh priority, so they are not held back
+  // with the compactions.
+  options.max_background_flushes = 1;
+  Reopen(&options);
+
+  env_->hold_scheduled_work_.store(true, std::memory_order_release);
+  while (NumTableFilesAtLevel(0) < config::kL0_SlowdownWritesTrigger) {
+    // Each file spans the same key range, so that once level-0 has a file
+    // the next ones stay there too.
+    ASSERT_LEVELDB_OK(Put("a", "va"));
+    ASSERT_LEVELDB_OK(Put("z", "vz"));
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+  std::string val;
+  ASSERT_TRUE(db_->GetProperty("leveldb.delayed-write-rate", &val));
+  ASSERT_EQ("0", val);
+
+  // The next write notices the level-0 backlog and throttles writes
+  ASSERT_LEVELDB_OK(Put("b", "vb"));
+  ASSERT_TRUE(db_->GetProperty("leveldb.delayed-write-rate", &val));
+  ASSERT_EQ(std::to_string(options.delayed_write_rate), val);
+
+  env_->ReleaseScheduledWork();
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_LEVELDB_OK(Put("c", "vc"));
+  ASSERT_TRUE(db_->GetProperty("leveldb.delayed-write-rate", &val));
+  ASSERT_EQ("0", val);
+}
+
 TEST_F(DBTest, GetSnapshot) {
   do {
     // Try with both a short key and a long key
@@ -1105,6 +1447,327 @@ TEST_F(DBTest, CompactionsGenerateMultipleFiles) {
   }
 }
 
+TEST_F(DBTest, RateLimitedBackgroundWrites) {
+  RateLimiter* limiter = NewGenericRateLimiter(100 << 20);
+  Options options = CurrentOptions();
+  options.rate_limiter = limiter;
+  Reopen(&options);
+
+  // Two overlapping memtable compactions, so that there is real work
+  // left for the table compactions below.
+  Random rnd(301);
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 20; i++) {
+      ASSERT_LEVELDB_OK(Put(Key(i), RandomString(&rnd, 10000)));
+    }
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+  const int64_t flushed = limiter->GetTotalBytesThrough(RateLimiter::kHigh);
+  ASSERT_GT(flushed, 2 * 20 * 10000);
+  ASSERT_EQ(0, limiter->GetTotalBytesThrough(RateLimiter::kLow));
+
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  dbfull()->TEST_CompactRange(1, nullptr, nullptr);
+  ASSERT_GT(limiter->GetTotalBytesThrough(RateLimiter::kLow), 20 * 10000);
+  ASSERT_EQ(flushed, limiter->GetTotalBytesThrough(RateLimiter::kHigh));
+
+  Close();
+  delete limiter;
+}
+
+TEST_F(DBTest, MultiGetMatchesGet) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000;  // Small write buffer
+  Reopen(&options);
+
+  // Spread many overwritten keys over many files, levels and blocks.
+  Random rnd(301);
+  for (int i = 0; i < 5000; i++) {
+    const int k = rnd.Uniform(2000);
+    if (rnd.OneIn(10)) {
+      ASSERT_LEVELDB_OK(Delete(Key(k)));
+    } else {
+      ASSERT_LEVELDB_OK(Put(Key(k), RandomString(&rnd, 100)));
+    }
+  }
+  ASSERT_GT(TotalTableFiles(), 1);
+
+  for (int round = 0; round < 10; round++) {
+    std::vector<std::string> keys;
+    std::string expected;
+    for (int i = 0; i < 200; i++) {
+      keys.push_back(Key(rnd.Uniform(2200)));
+      expected += (i > 0 ? "," : "") + Get(keys.back());
+    }
+    ASSERT_EQ(expected, MultiGet(keys));
+  }
+}
+
+TEST_F(DBTest, Subcompactions) {
+  Options options = CurrentOptions();
+  options.max_subcompactions = 4;
+  Reopen(&options);
+
+  // The first two tables end up in levels 2 and 1, and the ones after
+  // them in level 0, since they overlap.
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  const int kRanges[][2] = {
+      {0, 200}, {0, 200}, {0, 100}, {50, 150}, {100, 200}};
+  for (const auto& range : kRanges) {
+    for (int i = range[0]; i < range[1]; i++) {
+      model[Key(i)] = RandomString(&rnd, 1000);
+      ASSERT_LEVELDB_OK(Put(Key(i), model[Key(i)]));
+    }
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ("3,1,1", FilesPerLevel());
+
+  // Each key range of the level-0 compaction gets its own output.
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_GT(NumTableFilesAtLevel(1), 1);
+  for (const auto& kv : model) {
+    ASSERT_EQ(kv.second, Get(kv.first));
+  }
+
+  Reopen(&options);
+  for (const auto& kv : model) {
+    ASSERT_EQ(kv.second, Get(kv.first));
+  }
+}
+
+TEST_F(DBTest, RowCache) {
+  Cache* row_cache = NewLRUCache(1 << 20);
+  Options options = CurrentOptions();
+  options.row_cache = row_cache;
+  Reopen(&options);
+
+  ASSERT_LEVELDB_OK(Put("foo", "v1"));
+  ASSERT_LEVELDB_OK(Put("bar", "b1"));
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ(0, row_cache->TotalCharge());
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_EQ("NOT_FOUND", Get("missing"));
+  ASSERT_GT(row_cache->TotalCharge(), 0);
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_EQ("b1,v1,NOT_FOUND", MultiGet({"bar", "foo", "missing"}));
+
+  // Rows are keyed by file, so newer files are never shadowed by
+  // cached rows of older ones, and snapshot reads bypass the cache.
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_LEVELDB_OK(Put("foo", "v2"));
+  ASSERT_LEVELDB_OK(Delete("bar"));
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_EQ("v2", Get("foo"));
+  ASSERT_EQ("NOT_FOUND", Get("bar"));
+  ASSERT_EQ("v1", Get("foo", snapshot));
+  ASSERT_EQ("b1", Get("bar", snapshot));
+  db_->ReleaseSnapshot(snapshot);
+
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  ASSERT_EQ("v2", Get("foo"));
+  ASSERT_EQ("NOT_FOUND", Get("bar"));
+  ASSERT_EQ("NOT_FOUND,v2", MultiGet({"bar", "foo"}));
+
+  Close();
+  delete row_cache;
+}
+
+TEST_F(DBTest, CompressedBlockCache) {
+  std::string property;
+  ASSERT_TRUE(!db_->GetProperty("leveldb.compressed-block-cache", &property));
+
+  env_->count_random_reads_ = true;
+  env_->copy_random_reads_ = true;  // Blocks of mmap-ed files are not cached
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.block_cache = NewLRUCache(0);  // Every block misses it
+  options.compressed_block_cache = NewLRUCache(1 << 20);
+  DestroyAndReopen(&options);
+
+  const int N = 1000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i) + std::string(100, 'v')));
+  }
+  Compact("a", "z");
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_data_sync_.store(true, std::memory_order_release);
+
+  // Neither do reads that are not to fill the caches.
+  ReadOptions no_fill;
+  no_fill.fill_cache = false;
+  std::string value;
+  ASSERT_LEVELDB_OK(db_->Get(no_fill, Key(0), &value));
+  ASSERT_EQ(0, options.compressed_block_cache->TotalCharge());
+
+  // Compactions do not fill the cache, so the first reads of the blocks
+  // go to the files, and later ones are served from the cache.
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i) + std::string(100, 'v'), Get(Key(i)));
+  }
+  ASSERT_GT(env_->random_read_counter_.Read(), 0);
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i) + std::string(100, 'v'), Get(Key(i)));
+  }
+  ASSERT_EQ(Key(1) + std::string(100, 'v') + "," + Key(500) +
+                std::string(100, 'v'),
+            MultiGet({Key(1), Key(500)}));
+  ASSERT_EQ(0, env_->random_read_counter_.Read());
+
+  ASSERT_TRUE(db_->GetProperty("leveldb.compressed-block-cache", &property));
+  unsigned long long hits, misses, usage;
+  ASSERT_EQ(3, std::sscanf(property.c_str(), "hits: %llu\nmisses: %llu\n"
+                                             "usage: %llu\n",
+                           &hits, &misses, &usage));
+  ASSERT_GE(hits, N);
+  ASSERT_GT(misses, 0);
+  ASSERT_EQ(options.compressed_block_cache->TotalCharge(), usage);
+
+  env_->delay_data_sync_.store(false, std::memory_order_release);
+  Close();
+  delete options.block_cache;
+  delete options.compressed_block_cache;
+}
+
+TEST_F(DBTest, PersistentCache) {
+  const std::string cache_path = dbname_ + "_persistent_cache";
+  auto destroy_cache = [&]() {
+    std::vector<std::string> children;
+    env_->GetChildren(cache_path, &children);
+    for (const std::string& child : children) {
+      env_->RemoveFile(cache_path + "/" + child);
+    }
+    env_->RemoveDir(cache_path);
+  };
+  destroy_cache();
+
+  // The cache is not given env_, so that its own reads are not counted.
+  PersistentCache* cache;
+  ASSERT_LEVELDB_OK(
+      NewFilePersistentCache(Env::Default(), cache_path, 1 << 20, &cache));
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.block_cache = NewLRUCache(0);  // Every block misses it
+  options.persistent_cache = cache;
+  DestroyAndReopen(&options);
+
+  const int N = 1000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i) + std::string(100, 'v')));
+  }
+  Compact("a", "z");
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_data_sync_.store(true, std::memory_order_release);
+
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i) + std::string(100, 'v'), Get(Key(i)));
+  }
+  // Only the first read of each block goes to the file
+  const int file_reads = env_->random_read_counter_.Read();
+  ASSERT_GT(file_reads, 0);
+  ASSERT_LT(file_reads, N / 10);
+  ASSERT_GT(cache->TotalSize(), 0);
+
+  // The blocks are still cached after the DB and the cache are reopened,
+  // so only opening the tables reads their files.
+  Close();
+  delete cache;
+  ASSERT_LEVELDB_OK(
+      NewFilePersistentCache(Env::Default(), cache_path, 1 << 20, &cache));
+  options.persistent_cache = cache;
+  options.create_if_missing = false;
+  Reopen(&options);
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i) + std::string(100, 'v'), Get(Key(i)));
+  }
+  ASSERT_EQ(Key(1) + std::string(100, 'v') + "," + Key(500) +
+                std::string(100, 'v'),
+            MultiGet({Key(1), Key(500)}));
+  ASSERT_LT(env_->random_read_counter_.Read(), file_reads);
+
+  env_->delay_data_sync_.store(false, std::memory_order_release);
+  Close();
+  delete options.block_cache;
+  delete cache;
+  destroy_cache();
+}
+
+TEST_F(DBTest, BlockCacheStats) {
+  env_->copy_random_reads_ = true;  // Blocks of mmap-ed files are not cached
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.block_cache = NewShardedLRUCache(1 << 20, 2);
+  options.cache_index_and_filter_blocks = true;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  DestroyAndReopen(&options);
+
+  const int N = 1000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i) + std::string(100, 'v')));
+  }
+  Compact("a", "z");
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < N; i++) {
+      ASSERT_EQ(Key(i) + std::string(100, 'v'), Get(Key(i)));
+    }
+  }
+
+  std::string property;
+  ASSERT_TRUE(db_->GetProperty("leveldb.block-cache-stats", &property));
+  std::map<std::string, std::vector<unsigned long long>> rows;
+  Slice input(property);
+  while (!input.empty()) {
+    const char* newline = std::strchr(input.data(), '\n');
+    ASSERT_TRUE(newline != nullptr);
+    std::string line(input.data(), newline - input.data());
+    input.remove_prefix(line.size() + 1);
+    char name[20];
+    unsigned long long c[4] = {0, 0, 0, 0};
+    const int n = std::sscanf(line.c_str(), "%19s %llu %llu %llu %llu", name,
+                              &c[0], &c[1], &c[2], &c[3]);
+    if (n >= 4) {
+      rows[name] = std::vector<unsigned long long>(c, c + n - 1);
+    }
+  }
+
+  // Type rows hold hits, misses and inserts.  The filter and the index are
+  // read through the cache on every lookup, and each data block is read
+  // from its file once.
+  ASSERT_EQ(3, rows["index"].size());
+  ASSERT_GE(rows["index"][0], 2 * N - 10);
+  ASSERT_GT(rows["filter"][0], 0);
+  ASSERT_GT(rows["filter"][2], 0);
+  ASSERT_GT(rows["data"][0], N);
+  ASSERT_GT(rows["data"][1], 0);
+  ASSERT_EQ(rows["data"][1], rows["data"][2]);
+
+  // Shard rows hold hits, misses, inserts and evictions
+  uint64_t shard_hits = 0;
+  for (const std::string shard : {"0", "1", "2", "3"}) {
+    ASSERT_EQ(4, rows[shard].size()) << shard;
+    shard_hits += rows[shard][0];
+    ASSERT_EQ(0, rows[shard][3]);
+  }
+  ASSERT_EQ(0, rows.count("4"));
+  ASSERT_EQ(rows["index"][0] + rows["filter"][0] + rows["data"][0],
+            shard_hits);
+
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
 TEST_F(DBTest, RepeatedWritesToSameKey) {
   Options options = CurrentOptions();
   options.env = env_;
@@ -1587,6 +2250,47 @@ TEST_F(DBTest, CustomComparator) {
   }
 }
 
+TEST_F(DBTest, DataBlockHashIndexCustomComparator) {
+  // Keys that differ only in the case of their letters are equal, so the
+  // hash index of their bytes must not be used.
+  class CaseInsensitiveComparator : public Comparator {
+   public:
+    const char* Name() const override {
+      return "test.CaseInsensitiveComparator";
+    }
+    int Compare(const Slice& a, const Slice& b) const override {
+      return Slice(ToLower(a)).compare(Slice(ToLower(b)));
+    }
+    void FindShortestSeparator(std::string*, const Slice&) const override {}
+    void FindShortSuccessor(std::string*) const override {}
+
+   private:
+    static std::string ToLower(const Slice& x) {
+      std::string result = x.ToString();
+      for (char& c : result) {
+        if (c >= 'A' && c <= 'Z') {
+          c = c - 'A' + 'a';
+        }
+      }
+      return result;
+    }
+  };
+  CaseInsensitiveComparator cmp;
+  Options options = CurrentOptions();
+  options.create_if_missing = true;
+  options.comparator = &cmp;
+  options.filter_policy = nullptr;  // Cannot use bloom filters
+  options.data_block_hash_index = true;
+  DestroyAndReopen(&options);
+  ASSERT_LEVELDB_OK(Put("Key", "v1"));
+  ASSERT_LEVELDB_OK(Put("other", "v2"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("v1", Get("Key"));
+  ASSERT_EQ("v1", Get("KEY"));
+  ASSERT_EQ("v2", Get("OTHER"));
+  ASSERT_EQ("NOT_FOUND", Get("missing"));
+}
+
 TEST_F(DBTest, ManualCompaction) {
   ASSERT_EQ(config::kMaxMemCompactLevel, 2)
       << "Need to update this test to match kMaxMemCompactLevel";
@@ -1875,12 +2579,14 @@ TEST_F(DBTest, FilesDeletedAfterCompaction) {
   ASSERT_EQ(CountFiles(), num_files);
 }
 
-TEST_F(DBTest, BloomFilter) {
+void DBTest::CheckFilterReads(const FilterPolicy* filter_policy,
+                              bool full_filter) {
   env_->count_random_reads_ = true;
   Options options = CurrentOptions();
   options.env = env_;
   options.block_cache = NewLRUCache(0);  // Prevent cache hits
-  options.filter_policy = NewBloomFilterPolicy(10);
+  options.filter_policy = filter_policy;
+  options.full_filter = full_filter;
   Reopen(&options);
 
   // Populate multiple layers
@@ -1922,6 +2628,432 @@ TEST_F(DBTest, BloomFilter) {
   delete options.filter_policy;
 }
 
+TEST_F(DBTest, BloomFilter) {
+  CheckFilterReads(NewBloomFilterPolicy(10), false);
+}
+
+TEST_F(DBTest, FullFilter) {
+  CheckFilterReads(NewBlockedBloomFilterPolicy(10), true);
+}
+
+TEST_F(DBTest, PartitionedIndexAndFilters) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.block_size = 256;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.partition_index_and_filters = true;
+  options.metadata_block_size = 256;
+  DestroyAndReopen(&options);
+
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i)));
+  }
+  Compact("a", "z");
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_data_sync_.store(true, std::memory_order_release);
+
+  // A present key needs at most a filter partition, an index partition
+  // and a data block.
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i), Get(Key(i)));
+  }
+  int reads = env_->random_read_counter_.Read();
+  std::fprintf(stderr, "%d present => %d reads\n", N, reads);
+  ASSERT_LE(reads, 3 * N);
+
+  // A missing key rarely needs more than its filter partition
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+  }
+  reads = env_->random_read_counter_.Read();
+  std::fprintf(stderr, "%d missing => %d reads\n", N, reads);
+  ASSERT_LE(reads, N + 2 * (3 * N / 100));
+
+  // Iteration goes through all of the index partitions
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(Key(count), iter->key().ToString());
+    count++;
+  }
+  ASSERT_LEVELDB_OK(iter->status());
+  ASSERT_EQ(N, count);
+  iter->Seek(Key(N / 2) + ".missing");
+  ASSERT_EQ(Key(N / 2 + 1), iter->key().ToString());
+  delete iter;
+
+  env_->delay_data_sync_.store(false, std::memory_order_release);
+  Close();
+  delete options.filter_policy;
+}
+
+TEST_F(DBTest, CacheIndexAndFilterBlocks) {
+  env_->count_random_reads_ = true;
+  env_->copy_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.cache_index_and_filter_blocks = true;
+  options.block_cache = NewLRUCache(1 << 20, 0.5);
+  DestroyAndReopen(&options);
+
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i) + std::string(100, 'v')));
+  }
+  Compact("a", "z");
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_data_sync_.store(true, std::memory_order_release);
+
+  // The index and filter blocks of the open tables are in the cache
+  ASSERT_GT(options.block_cache->TotalCharge(), 0);
+
+  // Scanning more data than the cache holds does not evict them, so
+  // missing keys are ruled out without reads
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  ASSERT_LEVELDB_OK(iter->status());
+  ASSERT_EQ(N, count);
+  delete iter;
+  env_->random_read_counter_.Reset();
+  ASSERT_EQ("NOT_FOUND", Get(Key(0) + ".missing"));
+  ASSERT_EQ(0, env_->random_read_counter_.Read());
+  for (int i = 1; i < N; i++) {
+    ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+  }
+  int reads = env_->random_read_counter_.Read();
+  std::fprintf(stderr, "%d missing => %d reads\n", N, reads);
+  ASSERT_LE(reads, 3 * N / 100);
+
+  // Lookups read whatever was evicted again
+  Close();
+  delete options.block_cache;
+  options.block_cache = NewLRUCache(0);
+  Reopen(&options);
+  for (int i = 0; i < N; i += 10) {
+    ASSERT_EQ(Key(i) + std::string(100, 'v'), Get(Key(i)));
+    ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+  }
+
+  env_->delay_data_sync_.store(false, std::memory_order_release);
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
+TEST_F(DBTest, Readahead) {
+  env_->count_random_reads_ = true;
+  env_->copy_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.create_if_missing = true;
+  options.compression = kNoCompression;
+  DestroyAndReopen(&options);
+
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_LEVELDB_OK(Put(Key(i), Key(i) + std::string(100, 'v')));
+  }
+  Compact("a", "z");
+
+  // A scan reads the blocks of each table in order, so after a few reads
+  // it reads ahead of them
+  env_->random_read_counter_.Reset();
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(Key(count), iter->key().ToString());
+    count++;
+  }
+  ASSERT_LEVELDB_OK(iter->status());
+  ASSERT_EQ(N, count);
+  delete iter;
+  const int blocks = N * 110 / 4096;
+  int reads = env_->random_read_counter_.Read();
+  std::fprintf(stderr, "%d blocks => %d reads\n", blocks, reads);
+  ASSERT_LE(reads, blocks / 10);
+
+  // Unless the blocks are already cached
+  env_->random_read_counter_.Reset();
+  iter = db_->NewIterator(ReadOptions());
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+  }
+  ASSERT_LEVELDB_OK(iter->status());
+  delete iter;
+  ASSERT_EQ(0, env_->random_read_counter_.Read());
+}
+
+static std::string PrefixKey(int prefix, int i) {
+  char buf[100];
+  std::snprintf(buf, sizeof(buf), "p%03d-%03d", prefix, i);
+  return std::string(buf);
+}
+
+TEST_F(DBTest, PrefixSeek) {
+  env_->count_random_reads_ = true;
+  do {
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.block_cache = NewLRUCache(0);  // Prevent cache hits
+    const FilterPolicy* bloom = nullptr;
+    if (options.filter_policy == nullptr) {
+      bloom = NewBloomFilterPolicy(10);
+      options.filter_policy = bloom;
+    }
+    options.prefix_extractor = NewFixedPrefixTransform(5);  // "pNNN-"
+    Reopen(&options);
+
+    // Every third prefix is missing.  Populate a level, level-0 and the
+    // memtable.
+    for (int p = 0; p < 100; p++) {
+      if (p % 3 == 0) continue;
+      for (int i = 0; i < 10; i++) {
+        ASSERT_LEVELDB_OK(Put(PrefixKey(p, i), "v"));
+      }
+      if (p == 50) {
+        Compact("a", "z");
+      } else if (p == 80) {
+        dbfull()->TEST_CompactMemTable();
+      }
+    }
+
+    ReadOptions ropts;
+    ropts.prefix_same_as_start = true;
+    Iterator* iter = db_->NewIterator(ropts);
+
+    // A seek stops at the end of the prefix
+    for (int p : {1, 52, 85}) {
+      int count = 0;
+      for (iter->Seek(PrefixKey(p, 0)); iter->Valid(); iter->Next()) {
+        ASSERT_EQ(PrefixKey(p, count), iter->key().ToString());
+        count++;
+      }
+      ASSERT_LEVELDB_OK(iter->status());
+      ASSERT_EQ(10, count);
+    }
+    iter->Seek(PrefixKey(52, 4));
+    ASSERT_EQ(PrefixKey(52, 4), IterStatus(iter).substr(0, 8));
+    iter->Seek(PrefixKey(52, 10));
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+
+    // Prev() is not supported after a prefix seek
+    iter->Seek(PrefixKey(52, 4));
+    iter->Prev();
+    ASSERT_TRUE(!iter->Valid());
+    ASSERT_TRUE(iter->status().IsNotSupportedError());
+    delete iter;
+
+    // Keys without a prefix are not limited
+    iter = db_->NewIterator(ropts);
+    iter->Seek("p");
+    ASSERT_EQ(PrefixKey(1, 0), IterStatus(iter).substr(0, 8));
+    iter->SeekToFirst();
+    ASSERT_EQ(PrefixKey(1, 0), IterStatus(iter).substr(0, 8));
+    iter->Prev();
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+
+    // Seeking to a missing prefix reads no data block.  Only partitioned
+    // filters need reads, of one or two partitions per table.
+    dbfull()->TEST_CompactMemTable();
+    iter = db_->NewIterator(ropts);
+    iter->SeekToFirst();  // Opens all tables
+    env_->random_read_counter_.Reset();
+    int seeks = 0;
+    for (int p = 3; p < 100; p += 3) {
+      iter->Seek(PrefixKey(p, 0));
+      ASSERT_EQ("(invalid)", IterStatus(iter));
+      seeks++;
+    }
+    const int prefix_reads = env_->random_read_counter_.Read();
+    delete iter;
+    if (options.partition_index_and_filters) {
+      std::fprintf(stderr, "%d prefix seeks => %d reads\n", seeks,
+                   prefix_reads);
+      ASSERT_LE(prefix_reads, 2 * TotalTableFiles() * seeks);
+    } else {
+      ASSERT_EQ(0, prefix_reads);
+    }
+
+    // Without prefix_same_as_start, a seek goes on to the next prefix
+    iter = db_->NewIterator(ReadOptions());
+    iter->Seek(PrefixKey(3, 0));
+    ASSERT_EQ(PrefixKey(4, 0), IterStatus(iter).substr(0, 8));
+    delete iter;
+
+    Close();
+    delete options.block_cache;
+    delete bloom;
+    delete options.prefix_extractor;
+  } while (ChangeOptions());
+}
+
+// Return the user keys "iter" yields moving forward from its position.
+static std::string ForwardKeys(Iterator* iter) {
+  std::string result;
+  for (; iter->Valid(); iter->Next()) {
+    result += iter->key().ToString().substr(3) + " ";
+  }
+  return result;
+}
+
+TEST_F(DBTest, IterateBounds) {
+  do {
+    // Keys 0..99 with 40..59 deleted, spread over a level, level-0 and
+    // the memtable
+    for (int i = 0; i < 100; i++) {
+      ASSERT_LEVELDB_OK(Put(Key(i), "v" + std::to_string(i)));
+      if (i == 49) {
+        Compact("a", "z");
+      }
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 40; i < 60; i++) {
+      ASSERT_LEVELDB_OK(Delete(Key(i)));
+    }
+
+    const std::string lower = Key(20);
+    const std::string upper = Key(70);
+    const Slice lower_bound(lower);
+    const Slice upper_bound(upper);
+    ReadOptions ropts;
+    ropts.iterate_lower_bound = &lower_bound;
+    ropts.iterate_upper_bound = &upper_bound;
+    Iterator* iter = db_->NewIterator(ropts);
+
+    std::string expected;
+    for (int i = 20; i < 70; i++) {
+      if (i < 40 || i >= 60) {
+        expected += Key(i).substr(3) + " ";
+      }
+    }
+    iter->SeekToFirst();
+    ASSERT_EQ(expected, ForwardKeys(iter));
+    int count = 0;
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      count++;
+    }
+    ASSERT_EQ(30, count);
+
+    iter->Seek(Key(5));
+    ASSERT_EQ(Key(20) + "->v20", IterStatus(iter));
+    iter->Seek(Key(45));
+    ASSERT_EQ(Key(60) + "->v60", IterStatus(iter));
+    iter->Seek(Key(70));
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+
+    // Changing direction at the bounds
+    iter->SeekToFirst();
+    iter->Next();
+    ASSERT_EQ(Key(21) + "->v21", IterStatus(iter));
+    iter->Prev();
+    ASSERT_EQ(Key(20) + "->v20", IterStatus(iter));
+    iter->Prev();
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+    iter->SeekToLast();
+    ASSERT_EQ(Key(69) + "->v69", IterStatus(iter));
+    iter->Prev();
+    ASSERT_EQ(Key(68) + "->v68", IterStatus(iter));
+    iter->Next();
+    iter->Next();
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+
+    // Bounds that hold only deleted keys
+    const std::string deleted_lower = Key(45);
+    const std::string deleted_upper = Key(55);
+    const Slice deleted_lower_bound(deleted_lower);
+    const Slice deleted_upper_bound(deleted_upper);
+    ropts.iterate_lower_bound = &deleted_lower_bound;
+    ropts.iterate_upper_bound = &deleted_upper_bound;
+    iter = db_->NewIterator(ropts);
+    iter->SeekToFirst();
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+    iter->SeekToLast();
+    ASSERT_EQ("(invalid)", IterStatus(iter));
+    delete iter;
+
+    // Only an upper bound
+    ropts.iterate_lower_bound = nullptr;
+    ropts.iterate_upper_bound = &upper_bound;
+    iter = db_->NewIterator(ropts);
+    iter->SeekToFirst();
+    ASSERT_EQ(Key(0) + "->v0", IterStatus(iter));
+    iter->SeekToLast();
+    ASSERT_EQ(Key(69) + "->v69", IterStatus(iter));
+    delete iter;
+  } while (ChangeOptions());
+}
+
+TEST_F(DBTest, IterateBoundsSkipFiles) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  Reopen(&options);
+
+  // Four tables with 100 keys each
+  for (int t = 0; t < 4; t++) {
+    for (int i = 0; i < 100; i++) {
+      ASSERT_LEVELDB_OK(Put(Key(t * 100 + i), std::string(100, 'v')));
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_EQ(4, TotalTableFiles());
+
+  // Return the number of reads a scan of [Key(from), Key(to)) takes,
+  // after a Reopen() closes all tables.
+  auto count_reads = [&](int from, int to, bool bounded) {
+    Reopen(&options);
+    const std::string lower = Key(from);
+    const std::string upper = Key(to);
+    const Slice lower_bound(lower);
+    const Slice upper_bound(upper);
+    ReadOptions ropts;
+    if (bounded) {
+      ropts.iterate_lower_bound = &lower_bound;
+      ropts.iterate_upper_bound = &upper_bound;
+    }
+    env_->random_read_counter_.Reset();
+    Iterator* iter = db_->NewIterator(ropts);
+    int count = 0;
+    for (iter->Seek(lower); iter->Valid() && iter->key().compare(upper) < 0;
+         iter->Next()) {
+      count++;
+    }
+    EXPECT_LEVELDB_OK(iter->status());
+    delete iter;
+    EXPECT_EQ(std::max(0, std::min(to, 400) - from), count);
+    return env_->random_read_counter_.Read();
+  };
+
+  // The bounded scan does not open the table after the bounds
+  const int unbounded = count_reads(100, 200, false);
+  const int bounded = count_reads(100, 200, true);
+  std::fprintf(stderr, "scan of one table: %d reads, %d with bounds\n",
+               unbounded, bounded);
+  ASSERT_LT(bounded, unbounded);
+
+  // Or any table if none holds keys in the bounds
+  ASSERT_EQ(0, count_reads(1000, 2000, true));
+
+  Close();
+  delete options.block_cache;
+}
+
 // Multi-threaded test:
 namespace {
 
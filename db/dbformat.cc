@@ -106,20 +106,49 @@ const char* InternalFilterPolicy::Name() const { return user_policy_->Name(); }
 
 void InternalFilterPolicy::CreateFilter(const Slice* keys, int n,
                                         std::string* dst) const {
+  CreateFilterWithPrefixes(keys, n, nullptr, 0, dst);
+}
+
+void InternalFilterPolicy::CreateFilterWithPrefixes(const Slice* keys, int n,
+                                                    const Slice* prefixes,
+                                                    int m,
+                                                    std::string* dst) const {
   // We rely on the fact that the code in table.cc does not mind us
   // adjusting keys[].
+  // Adjacent duplicates, i.e. versions of the same user key, are dropped.
   Slice* mkey = const_cast<Slice*>(keys);
+  int num_user_keys = 0;
   for (int i = 0; i < n; i++) {
-    mkey[i] = ExtractUserKey(keys[i]);
-    // TODO(sanjay): Suppress dups?
+    Slice user_key = ExtractUserKey(keys[i]);
+    if (num_user_keys == 0 || user_key != mkey[num_user_keys - 1]) {
+      mkey[num_user_keys++] = user_key;
+    }
   }
-  user_policy_->CreateFilter(keys, n, dst);
+  user_policy_->CreateFilterWithPrefixes(keys, num_user_keys, prefixes, m,
+                                         dst);
 }
 
 bool InternalFilterPolicy::KeyMayMatch(const Slice& key, const Slice& f) const {
   return user_policy_->KeyMayMatch(ExtractUserKey(key), f);
 }
 
+bool InternalFilterPolicy::PrefixMayMatch(const Slice& prefix,
+                                          const Slice& f) const {
+  return user_policy_->PrefixMayMatch(prefix, f);
+}
+
+const char* InternalKeySliceTransform::Name() const {
+  return user_transform_->Name();
+}
+
+bool InternalKeySliceTransform::InDomain(const Slice& key) const {
+  return user_transform_->InDomain(ExtractUserKey(key));
+}
+
+Slice InternalKeySliceTransform::Transform(const Slice& key) const {
+  return user_transform_->Transform(ExtractUserKey(key));
+}
+
 LookupKey::LookupKey(const Slice& user_key, SequenceNumber s) {
   // 用户键大小
   size_t usize = user_key.size();
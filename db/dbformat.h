@@ -13,6 +13,7 @@
 #include "leveldb/db.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/slice.h"
+#include "leveldb/slice_transform.h"
 #include "leveldb/table_builder.h"
 #include "util/coding.h"
 #include "util/logging.h"
@@ -130,6 +131,27 @@ class InternalFilterPolicy : public FilterPolicy {
   const char* Name() const override;
   void CreateFilter(const Slice* keys, int n, std::string* dst) const override;
   bool KeyMayMatch(const Slice& key, const Slice& filter) const override;
+  // The prefixes are prefixes of user keys already, and are passed on to
+  // the user policy as they are.
+  void CreateFilterWithPrefixes(const Slice* keys, int n, const Slice* prefixes,
+                                int m, std::string* dst) const override;
+  bool PrefixMayMatch(const Slice& prefix, const Slice& filter) const override;
+};
+
+// Prefix extractor wrapper that converts from the internal key format to
+// the user key format.  The prefix of an internal key is the prefix of its
+// user key.
+class InternalKeySliceTransform : public SliceTransform {
+ private:
+  const SliceTransform* const user_transform_;
+
+ public:
+  explicit InternalKeySliceTransform(const SliceTransform* t)
+      : user_transform_(t) {}
+  const char* Name() const override;
+  bool InDomain(const Slice& key) const override;
+  Slice Transform(const Slice& key) const override;
+  const SliceTransform* user_transform() const { return user_transform_; }
 };
 
 // Modules in this directory should keep internal keys wrapped inside
@@ -3,13 +3,71 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "db/memtable.h"
+
+#include <atomic>
+
 #include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "leveldb/slice_transform.h"
 #include "util/coding.h"
+#include "util/hash.h"
 
 namespace leveldb {
+
+// A bloom filter of fixed size that keys can be added to while it is read,
+// also by concurrent memtable writers.
+class PrefixBloom {
+ public:
+  explicit PrefixBloom(size_t bits)
+      : num_bits_(((bits + 63) / 64) * 64),
+        words_(new std::atomic<uint64_t>[num_bits_ / 64]) {
+    for (size_t i = 0; i < num_bits_ / 64; i++) {
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  ~PrefixBloom() { delete[] words_; }
+
+  size_t ApproximateMemoryUsage() const { return num_bits_ / 8; }
+
+  void Add(const Slice& key) {
+    uint32_t h = BloomHash(key);
+    const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
+    for (int j = 0; j < kNumProbes; j++) {
+      const size_t bitpos = h % num_bits_;
+      words_[bitpos / 64].fetch_or(uint64_t{1} << (bitpos % 64),
+                                   std::memory_order_relaxed);
+      h += delta;
+    }
+  }
+
+  bool MayContain(const Slice& key) const {
+    uint32_t h = BloomHash(key);
+    const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
+    for (int j = 0; j < kNumProbes; j++) {
+      const size_t bitpos = h % num_bits_;
+      if ((words_[bitpos / 64].load(std::memory_order_relaxed) &
+           (uint64_t{1} << (bitpos % 64))) == 0) {
+        return false;
+      }
+      h += delta;
+    }
+    return true;
+  }
+
+ private:
+  static constexpr int kNumProbes = 6;
+
+  static uint32_t BloomHash(const Slice& key) {
+    return Hash(key.data(), key.size(), 0xbc9f1d34);
+  }
+
+  const size_t num_bits_;
+  std::atomic<uint64_t>* const words_;
+};
+
 // TODO: GetLengthPrefixedSlice是干嘛的？
 static Slice GetLengthPrefixedSlice(const char* data) {
   uint32_t len;
@@ -19,12 +77,29 @@ static Slice GetLengthPrefixedSlice(const char* data) {
 }
 // Memtable的四个核心，comparator做比较，arena做内存管理, refs做引用计数，table做底层实现（跳表）
 // TODO: 这里的疑惑点是为什么table已经使用了comparator_，外部还要再使用一次？
-MemTable::MemTable(const InternalKeyComparator& comparator)
-    : comparator_(comparator), refs_(0), table_(comparator_, &arena_) {}
+MemTable::MemTable(const InternalKeyComparator& comparator,
+                   const SliceTransform* prefix_extractor,
+                   size_t prefix_bloom_bits)
+    : comparator_(comparator),
+      refs_(0),
+      table_(comparator_, &arena_),
+      prefix_extractor_(prefix_extractor),
+      prefix_bloom_(prefix_extractor != nullptr && prefix_bloom_bits > 0
+                        ? new PrefixBloom(prefix_bloom_bits)
+                        : nullptr) {}
 
-MemTable::~MemTable() { assert(refs_ == 0); }
+MemTable::~MemTable() {
+  assert(refs_ == 0);
+  delete prefix_bloom_;
+}
 
-size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
+size_t MemTable::ApproximateMemoryUsage() {
+  size_t usage = arena_.MemoryUsage();
+  if (prefix_bloom_ != nullptr) {
+    usage += prefix_bloom_->ApproximateMemoryUsage();
+  }
+  return usage;
+}
 
 int MemTable::KeyComparator::operator()(const char* aptr,
                                         const char* bptr) const {
@@ -48,17 +123,41 @@ static const char* EncodeKey(std::string* scratch, const Slice& target) {
 // MemTable中存储的key是InternalKey，value是用户指定的值
 class MemTableIterator : public Iterator {
  public:
-  explicit MemTableIterator(MemTable::Table* table) : iter_(table) {}
+  // If "prefix_bloom" is non-null, Seek() consults it.
+  MemTableIterator(MemTable::Table* table,
+                   const SliceTransform* prefix_extractor,
+                   const PrefixBloom* prefix_bloom)
+      : iter_(table),
+        prefix_extractor_(prefix_extractor),
+        prefix_bloom_(prefix_bloom),
+        filtered_(false) {}
 
   MemTableIterator(const MemTableIterator&) = delete;
   MemTableIterator& operator=(const MemTableIterator&) = delete;
 
   ~MemTableIterator() override = default;
 
-  bool Valid() const override { return iter_.Valid(); }
-  void Seek(const Slice& k) override { iter_.Seek(EncodeKey(&tmp_, k)); }
-  void SeekToFirst() override { iter_.SeekToFirst(); }
-  void SeekToLast() override { iter_.SeekToLast(); }
+  bool Valid() const override { return !filtered_ && iter_.Valid(); }
+  void Seek(const Slice& k) override {
+    if (prefix_bloom_ != nullptr) {
+      Slice user_key = ExtractUserKey(k);
+      filtered_ = prefix_extractor_->InDomain(user_key) &&
+                  !prefix_bloom_->MayContain(
+                      prefix_extractor_->Transform(user_key));
+      if (filtered_) {
+        return;
+      }
+    }
+    iter_.Seek(EncodeKey(&tmp_, k));
+  }
+  void SeekToFirst() override {
+    filtered_ = false;
+    iter_.SeekToFirst();
+  }
+  void SeekToLast() override {
+    filtered_ = false;
+    iter_.SeekToLast();
+  }
   void Next() override { iter_.Next(); }
   void Prev() override { iter_.Prev(); }
   // TODO: 原来GetLengthPrefixedSlice用在这里，用于获取memtable的key
@@ -76,12 +175,30 @@ class MemTableIterator : public Iterator {
   MemTable::Table::Iterator iter_;
   // 由于SkipList的键是const char*，所以需要一个临时缓存做类型转换
   std::string tmp_;  // For passing to EncodeKey
+  const SliceTransform* const prefix_extractor_;
+  const PrefixBloom* const prefix_bloom_;
+  bool filtered_;  // Seek() found that no key has the target's prefix
 };
 
-Iterator* MemTable::NewIterator() { return new MemTableIterator(&table_); }
-// add方法的前置知识：SequenceNumber，ValueType
-void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
-                   const Slice& value) {
+Iterator* MemTable::NewIterator(bool prefix_seek) {
+  return new MemTableIterator(&table_, prefix_extractor_,
+                              prefix_seek ? prefix_bloom_ : nullptr);
+}
+
+void MemTable::AddPrefix(const Slice& key) {
+  if (prefix_bloom_ != nullptr && prefix_extractor_->InDomain(key)) {
+    prefix_bloom_->Add(prefix_extractor_->Transform(key));
+  }
+}
+
+size_t MemTable::EncodedLength(const Slice& key, const Slice& value) {
+  size_t internal_key_size = key.size() + 8;
+  return VarintLength(internal_key_size) + internal_key_size +
+         VarintLength(value.size()) + value.size();
+}
+
+void MemTable::EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                           const Slice& key, const Slice& value) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
@@ -91,12 +208,6 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   size_t val_size = value.size();
   // 多出来的8个字节用来存储序列号和值类型
   size_t internal_key_size = key_size + 8;
-  // 存储空间大小，主要有key的长度, key的内容, value的长度, value的内容
-  const size_t encoded_len = VarintLength(internal_key_size) +
-                             internal_key_size + VarintLength(val_size) +
-                             val_size;
-  // 分配存储的buffer
-  char* buf = arena_.Allocate(encoded_len);
   // 将key的长度编码
   char* p = EncodeVarint32(buf, internal_key_size);
   // 拷贝key的内容
@@ -110,10 +221,27 @@ void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
   p = EncodeVarint32(p, val_size);
   // 拷贝value的内容
   std::memcpy(p, value.data(), val_size);
-  assert(p + val_size == buf + encoded_len);
+  assert(p + val_size == buf + EncodedLength(key, value));
+}
+
+// add方法的前置知识：SequenceNumber，ValueType
+void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
+                   const Slice& value) {
+  // 分配存储的buffer
+  char* buf = arena_.Allocate(EncodedLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
+  AddPrefix(key);
   // 将组装的内容插入到跳表中
   table_.Insert(buf);
 }
+
+void MemTable::AddConcurrently(SequenceNumber s, ValueType type,
+                               const Slice& key, const Slice& value) {
+  char* buf = arena_.AllocateConcurrently(EncodedLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
+  AddPrefix(key);
+  table_.InsertConcurrently(buf);
+}
 // get方法的前置知识：LookupKey
 bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
   // 根据传入的LookupmKey得到在emtable中存储的key, 然后调用Skip list::Iterator的Seek函数查找
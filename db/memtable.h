@@ -22,12 +22,18 @@ namespace leveldb {
 // TODO: InternalKeyComparator类是什么
 class InternalKeyComparator;
 class MemTableIterator;
+class PrefixBloom;
 
 class MemTable {
  public:
   // MemTables are reference counted.  The initial reference count
   // is zero and the caller must call Ref() at least once.
-  explicit MemTable(const InternalKeyComparator& comparator);
+  //
+  // If "prefix_extractor" is non-null, the memtable keeps a bloom filter
+  // of prefix_bloom_bits bits on the prefixes of its user keys.
+  explicit MemTable(const InternalKeyComparator& comparator,
+                    const SliceTransform* prefix_extractor = nullptr,
+                    size_t prefix_bloom_bits = 0);
 
   MemTable(const MemTable&) = delete;
   MemTable& operator=(const MemTable&) = delete;
@@ -55,8 +61,11 @@ class MemTable {
   // while the returned iterator is live.  The keys returned by this
   // iterator are internal keys encoded by AppendInternalKey in the
   // db/format.{h,cc} module.
+  //
+  // If "prefix_seek" is true, a Seek() to a target whose prefix the
+  // memtable's bloom filter rules out leaves the iterator invalid.
   // 迭代器用于访问table内部数据，必须保证调用时时live的。
-  Iterator* NewIterator();
+  Iterator* NewIterator(bool prefix_seek = false);
 
   // Add an entry into memtable that maps key to value at the
   // specified sequence number and with the specified type.
@@ -65,6 +74,11 @@ class MemTable {
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
            const Slice& value);
 
+  // Same as Add(), but safe to call from several threads at once.
+  // REQUIRES: no concurrent call to Add().
+  void AddConcurrently(SequenceNumber seq, ValueType type, const Slice& key,
+                       const Slice& value);
+
   // If memtable contains a value for key, store it in *value and return true.
   // If memtable contains a deletion for key, store a NotFound() error
   // in *status and return true.
@@ -83,13 +97,25 @@ class MemTable {
   };
 
   typedef SkipList<const char*, KeyComparator> Table;
+
+  // Number of bytes needed to encode the entry passed to Add().
+  static size_t EncodedLength(const Slice& key, const Slice& value);
+
+  // Encode an entry passed to Add() into buf[0,EncodedLength(key, value)).
+  static void EncodeEntry(char* buf, SequenceNumber seq, ValueType type,
+                          const Slice& key, const Slice& value);
   // 析构函数
   ~MemTable();  // Private since only Unref() should be used to delete it
 
+  // Add the prefix of user key "key", if it has one, to prefix_bloom_.
+  void AddPrefix(const Slice& key);
+
   KeyComparator comparator_;
   int refs_;
   Arena arena_;
   Table table_;
+  const SliceTransform* const prefix_extractor_;
+  PrefixBloom* const prefix_bloom_;  // Null if there is no prefix_extractor_
 };
 
 }  // namespace leveldb
@@ -365,6 +365,69 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+// Several threads calling InsertConcurrently() on disjoint key sets.
+struct ConcurrentInsertState {
+  SkipList<Key, Comparator>* list;
+  int id;
+  int num_threads;
+  int keys_per_thread;
+  std::atomic<int>* remaining;
+};
+
+static void ConcurrentInserter(void* arg) {
+  ConcurrentInsertState* state = reinterpret_cast<ConcurrentInsertState*>(arg);
+  Random rnd(1000 + state->id);
+  for (int i = 0; i < state->keys_per_thread; i++) {
+    // Spread each thread's keys over the whole key space so that inserts
+    // race on the same links.
+    Key k = static_cast<Key>(rnd.Next() % 1000000) * state->num_threads +
+            state->id;
+    if (!state->list->Contains(k)) {
+      state->list->InsertConcurrently(k);
+    }
+  }
+  state->remaining->fetch_sub(1, std::memory_order_release);
+}
+
+TEST(SkipTest, InsertConcurrently) {
+  const int kThreads = 4;
+  const int kKeysPerThread = 20000;
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  std::atomic<int> remaining(kThreads);
+  ConcurrentInsertState states[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    states[i].list = &list;
+    states[i].id = i;
+    states[i].num_threads = kThreads;
+    states[i].keys_per_thread = kKeysPerThread;
+    states[i].remaining = &remaining;
+    Env::Default()->StartThread(ConcurrentInserter, &states[i]);
+  }
+  while (remaining.load(std::memory_order_acquire) > 0) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+
+  // Replay each thread's key sequence to build the expected contents.
+  std::set<Key> expected;
+  for (int i = 0; i < kThreads; i++) {
+    Random rnd(1000 + i);
+    for (int j = 0; j < kKeysPerThread; j++) {
+      expected.insert(static_cast<Key>(rnd.Next() % 1000000) * kThreads + i);
+    }
+  }
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (Key k : expected) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -4,6 +4,8 @@
 
 #include "db/table_cache.h"
 
+#include <vector>
+
 #include "db/filename.h"
 #include "leveldb/env.h"
 #include "leveldb/table.h"
@@ -29,12 +31,92 @@ static void UnrefEntry(void* arg1, void* arg2) {
   cache->Release(h);
 }
 
+// Passes on the entry that a table lookup finds, after adding a reference
+// to the table to its value: the value may point into the file's memory.
+struct TablePinner {
+  void* arg;
+  void (*handle_result)(void*, const Slice&, PinnableSlice*);
+  Cache* cache;
+  Slice key;  // Of the table in cache
+};
+
+static void PinTable(void* arg, const Slice& k, PinnableSlice* v) {
+  TablePinner* pinner = reinterpret_cast<TablePinner*>(arg);
+  Cache::Handle* handle = pinner->cache->Lookup(pinner->key);
+  if (handle != nullptr) {
+    v->RegisterCleanup(&UnrefEntry, pinner->cache, handle);
+  } else {
+    // The table was evicted, so it may be closed once the lookup is done.
+    v->GetSelf()->assign(v->data(), v->size());
+    v->PinSelf();
+  }
+  (*pinner->handle_result)(pinner->arg, k, v);
+}
+
+// Passes on the entry that a table lookup finds, and also records it in
+// "row" in the format of a row cache entry: the length-prefixed internal
+// key followed by the value.  "row" stays empty if nothing is found.
+struct RowSaver {
+  void* arg;
+  void (*handle_result)(void*, const Slice&, const Slice&);
+  void (*handle_pinned_result)(void*, const Slice&, PinnableSlice*);
+  std::string row;
+};
+
+static void SaveRow(void* arg, const Slice& k, const Slice& v) {
+  RowSaver* saver = reinterpret_cast<RowSaver*>(arg);
+  PutLengthPrefixedSlice(&saver->row, k);
+  saver->row.append(v.data(), v.size());
+  (*saver->handle_result)(saver->arg, k, v);
+}
+
+static void SavePinnedRow(void* arg, const Slice& k, PinnableSlice* v) {
+  RowSaver* saver = reinterpret_cast<RowSaver*>(arg);
+  PutLengthPrefixedSlice(&saver->row, k);
+  saver->row.append(v->data(), v->size());
+  (*saver->handle_pinned_result)(saver->arg, k, v);
+}
+
+// Repeat the call of handle_result that produced "row", if any.
+static void ReplayRow(const std::string& row, void* arg,
+                      void (*handle_result)(void*, const Slice&,
+                                            const Slice&)) {
+  Slice input(row);
+  Slice k;
+  if (GetLengthPrefixedSlice(&input, &k)) {
+    (*handle_result)(arg, k, input);
+  }
+}
+
+// Like ReplayRow(), but passes on a value that pins the row cache entry
+// "row_handle" of row_cache, and releases the entry when it is unpinned.
+static void ReplayPinnedRow(Cache* row_cache, Cache::Handle* row_handle,
+                            void* arg,
+                            void (*handle_result)(void*, const Slice&,
+                                                  PinnableSlice*)) {
+  Slice input(*reinterpret_cast<std::string*>(row_cache->Value(row_handle)));
+  Slice k;
+  if (GetLengthPrefixedSlice(&input, &k)) {
+    PinnableSlice value;
+    value.PinSlice(input, &UnrefEntry, row_cache, row_handle);
+    (*handle_result)(arg, k, &value);
+  } else {
+    row_cache->Release(row_handle);
+  }
+}
+
+static void DeleteRow(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
 TableCache::TableCache(const std::string& dbname, const Options& options,
                        int entries)
     : env_(options.env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {}
+      cache_(NewLRUCache(entries)),
+      row_cache_id_(options.row_cache != nullptr ? options.row_cache->NewId()
+                                                 : 0) {}
 
 TableCache::~TableCache() { delete cache_; }
 
@@ -57,7 +139,8 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       }
     }
     if (s.ok()) {
-      s = Table::Open(options_, file, file_size, &table);
+      s = Table::InternalOpen(options_, file, file_size, &file_number,
+                              &block_cache_stats_, &table);
     }
 
     if (!s.ok()) {
@@ -97,20 +180,159 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   return result;
 }
 
+Cache* TableCache::RowCacheFor(const ReadOptions& options) const {
+  // A lookup without a snapshot reads as of a sequence number that is
+  // larger than any in the table, so it always finds the same entry.
+  // Lookups at a snapshot may find older ones.
+  return options.snapshot == nullptr ? options_.row_cache : nullptr;
+}
+
+void TableCache::RowCacheKey(uint64_t file_number, const Slice& k,
+                             std::string* row_key) const {
+  row_key->clear();
+  PutFixed64(row_key, row_cache_id_);
+  PutFixed64(row_key, file_number);
+  const Slice user_key = ExtractUserKey(k);
+  row_key->append(user_key.data(), user_key.size());
+}
+
+void TableCache::InsertRow(Cache* row_cache, const std::string& row_key,
+                           const std::string& row) {
+  Cache::Handle* handle = row_cache->Insert(
+      row_key, new std::string(row), row_key.size() + row.size(), &DeleteRow);
+  row_cache->Release(handle);
+}
+
 Status TableCache::Get(const ReadOptions& options, uint64_t file_number,
                        uint64_t file_size, const Slice& k, void* arg,
                        void (*handle_result)(void*, const Slice&,
-                                             const Slice&)) {
+                                             PinnableSlice*)) {
+  Cache* row_cache = RowCacheFor(options);
+  std::string row_key;
+  if (row_cache != nullptr) {
+    RowCacheKey(file_number, k, &row_key);
+    Cache::Handle* row_handle = row_cache->Lookup(row_key);
+    if (row_handle != nullptr) {
+      ReplayPinnedRow(row_cache, row_handle, arg, handle_result);
+      return Status::OK();
+    }
+  }
+
   Cache::Handle* handle = nullptr;
   Status s = FindTable(file_number, file_size, &handle);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-    s = t->InternalGet(options, k, arg, handle_result);
+    char buf[sizeof(file_number)];
+    EncodeFixed64(buf, file_number);
+    TablePinner pinner;
+    pinner.arg = arg;
+    pinner.handle_result = handle_result;
+    pinner.cache = cache_;
+    pinner.key = Slice(buf, sizeof(buf));
+    if (row_cache == nullptr) {
+      s = t->InternalGet(options, k, &pinner, &PinTable);
+    } else {
+      RowSaver saver;
+      saver.arg = arg;
+      saver.handle_result = nullptr;
+      saver.handle_pinned_result = handle_result;
+      pinner.arg = &saver;
+      pinner.handle_result = &SavePinnedRow;
+      s = t->InternalGet(options, k, &pinner, &PinTable);
+      if (s.ok() && options.fill_cache) {
+        InsertRow(row_cache, row_key, saver.row);
+      }
+    }
     cache_->Release(handle);
   }
   return s;
 }
 
+void TableCache::MultiGet(const ReadOptions& options, uint64_t file_number,
+                          uint64_t file_size, size_t n, const Slice* keys,
+                          void* const* args,
+                          void (*handle_result)(void*, const Slice&,
+                                                const Slice&),
+                          Status* statuses) {
+  Cache* row_cache = RowCacheFor(options);
+  if (row_cache == nullptr) {
+    Cache::Handle* handle = nullptr;
+    Status s = FindTable(file_number, file_size, &handle);
+    if (s.ok()) {
+      Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+      t->InternalMultiGet(options, n, keys, args, handle_result, statuses);
+      cache_->Release(handle);
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        statuses[i] = s;
+      }
+    }
+    return;
+  }
+
+  // Serve the keys that the row cache has, and look up the others in the
+  // table together.
+  std::vector<std::string> row_keys(n);
+  std::vector<size_t> misses;
+  for (size_t i = 0; i < n; i++) {
+    RowCacheKey(file_number, keys[i], &row_keys[i]);
+    Cache::Handle* row_handle = row_cache->Lookup(row_keys[i]);
+    if (row_handle != nullptr) {
+      ReplayRow(*reinterpret_cast<std::string*>(row_cache->Value(row_handle)),
+                args[i], handle_result);
+      row_cache->Release(row_handle);
+      statuses[i] = Status::OK();
+    } else {
+      misses.push_back(i);
+    }
+  }
+  if (misses.empty()) {
+    return;
+  }
+
+  Cache::Handle* handle = nullptr;
+  Status s = FindTable(file_number, file_size, &handle);
+  if (!s.ok()) {
+    for (size_t i : misses) {
+      statuses[i] = s;
+    }
+    return;
+  }
+  std::vector<RowSaver> savers(misses.size());
+  std::vector<Slice> miss_keys;
+  std::vector<void*> miss_args;
+  for (size_t j = 0; j < misses.size(); j++) {
+    savers[j].arg = args[misses[j]];
+    savers[j].handle_result = handle_result;
+    savers[j].handle_pinned_result = nullptr;
+    miss_keys.push_back(keys[misses[j]]);
+    miss_args.push_back(&savers[j]);
+  }
+  std::vector<Status> miss_statuses(misses.size());
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  t->InternalMultiGet(options, misses.size(), miss_keys.data(),
+                      miss_args.data(), &SaveRow, miss_statuses.data());
+  cache_->Release(handle);
+  for (size_t j = 0; j < misses.size(); j++) {
+    statuses[misses[j]] = miss_statuses[j];
+    if (miss_statuses[j].ok() && options.fill_cache) {
+      InsertRow(row_cache, row_keys[misses[j]], savers[j].row);
+    }
+  }
+}
+
+bool TableCache::PrefixMayMatch(uint64_t file_number, uint64_t file_size,
+                                const Slice& target) {
+  Cache::Handle* handle = nullptr;
+  if (!FindTable(file_number, file_size, &handle).ok()) {
+    return true;  // Let the table iterator report the error
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  const bool may_match = t->PrefixMayMatch(target);
+  cache_->Release(handle);
+  return may_match;
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
@@ -12,8 +12,10 @@
 
 #include "db/dbformat.h"
 #include "leveldb/cache.h"
+#include "leveldb/pinnable_slice.h"
 #include "leveldb/table.h"
 #include "port/port.h"
+#include "table/block_cache_stats.h"
 
 namespace leveldb {
 
@@ -35,21 +37,61 @@ class TableCache {
                         uint64_t file_size, Table** tableptr = nullptr);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value).  found_value pins
+  // the cached block or row that holds it, and handle_result may move it
+  // elsewhere to keep it.
   Status Get(const ReadOptions& options, uint64_t file_number,
              uint64_t file_size, const Slice& k, void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, PinnableSlice*));
+
+  // Call Get() for each of the n internal keys in keys[], which must be
+  // sorted, with args[i] as the argument for keys[i].  Stores the status
+  // of each lookup in statuses[i].
+  void MultiGet(const ReadOptions& options, uint64_t file_number,
+                uint64_t file_size, size_t n, const Slice* keys,
+                void* const* args,
+                void (*handle_result)(void*, const Slice&, const Slice&),
+                Status* statuses);
+
+  // Return false if the filter of the specified file shows that it holds
+  // no key >= internal key "target" with the prefix of "target" (see
+  // Table::PrefixMayMatch()).
+  bool PrefixMayMatch(uint64_t file_number, uint64_t file_size,
+                      const Slice& target);
 
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
+  // Counts of the block cache lookups and inserts of the tables.
+  const BlockCacheStats& block_cache_stats() const {
+    return block_cache_stats_;
+  }
+
  private:
   Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
 
+  // Return the row cache that lookups with "options" may use, or null.
+  Cache* RowCacheFor(const ReadOptions& options) const;
+
+  // Set *row_key to the row cache key of internal key "k" in the
+  // specified file.
+  void RowCacheKey(uint64_t file_number, const Slice& k,
+                   std::string* row_key) const;
+
+  // Store "row", as built by a lookup, in row_cache under "row_key".
+  static void InsertRow(Cache* row_cache, const std::string& row_key,
+                        const std::string& row);
+
   Env* const env_;
   const std::string dbname_;
   const Options& options_;
   Cache* cache_;
+
+  // Distinguishes the rows of this DB in options_.row_cache, which may be
+  // shared with other DBs.
+  const uint64_t row_cache_id_;
+
+  BlockCacheStats block_cache_stats_;
 };
 
 }  // namespace leveldb
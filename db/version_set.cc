@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <utility>
 
 #include "db/filename.h"
 #include "db/log_reader.h"
@@ -160,19 +161,60 @@ bool SomeFileOverlapsRange(const InternalKeyComparator& icmp,
 // is the largest key that occurs in the file, and value() is an
 // 16-byte value containing the file number and file size, both
 // encoded using EncodeFixed64.
+//
+// If "prefix_check" is non-null, Seek() skips the whole level if the
+// filter of the file it lands in rules out the prefix of the target (see
+// ReadOptions::prefix_same_as_start).  Files that hold no user key in
+// ["lower_bound", "upper_bound") are left out of the level (see
+// ReadOptions::iterate_lower_bound).
 class Version::LevelFileNumIterator : public Iterator {
  public:
   LevelFileNumIterator(const InternalKeyComparator& icmp,
-                       const std::vector<FileMetaData*>* flist)
-      : icmp_(icmp), flist_(flist), index_(flist->size()) {  // Marks as invalid
+                       const std::vector<FileMetaData*>* flist,
+                       TableCache* prefix_check = nullptr,
+                       const Slice* lower_bound = nullptr,
+                       const Slice* upper_bound = nullptr)
+      : icmp_(icmp),
+        flist_(flist),
+        prefix_check_(prefix_check),
+        begin_(0),
+        end_(flist->size()) {
+    if (lower_bound != nullptr) {
+      InternalKey lower(*lower_bound, kMaxSequenceNumber, kValueTypeForSeek);
+      begin_ = FindFile(icmp_, *flist_, lower.Encode());
+    }
+    if (upper_bound != nullptr) {
+      InternalKey upper(*upper_bound, kMaxSequenceNumber, kValueTypeForSeek);
+      end_ = FindFile(icmp_, *flist_, upper.Encode());
+      if (end_ < flist_->size() &&
+          icmp_.user_comparator()->Compare(
+              (*flist_)[end_]->smallest.user_key(), *upper_bound) < 0) {
+        end_++;  // The file spans the bound
+      }
+    }
+    if (end_ < begin_) {
+      end_ = begin_;
+    }
+    index_ = end_;  // Marks as invalid
   }
-  bool Valid() const override { return index_ < flist_->size(); }
+  bool Valid() const override { return index_ < end_; }
   void Seek(const Slice& target) override {
-    index_ = FindFile(icmp_, *flist_, target);
+    index_ = std::max<uint32_t>(FindFile(icmp_, *flist_, target), begin_);
+    if (index_ > end_) {
+      index_ = end_;  // Marks as invalid
+    }
+    if (prefix_check_ != nullptr && Valid()) {
+      // Keys with the same prefix are adjacent, so if there are any >=
+      // target, the first one is in this file.
+      const FileMetaData* f = (*flist_)[index_];
+      if (!prefix_check_->PrefixMayMatch(f->number, f->file_size, target)) {
+        index_ = end_;  // Marks as invalid
+      }
+    }
   }
-  void SeekToFirst() override { index_ = 0; }
+  void SeekToFirst() override { index_ = begin_; }
   void SeekToLast() override {
-    index_ = flist_->empty() ? 0 : flist_->size() - 1;
+    index_ = (begin_ == end_) ? end_ : end_ - 1;
   }
   void Next() override {
     assert(Valid());
@@ -180,8 +222,8 @@ class Version::LevelFileNumIterator : public Iterator {
   }
   void Prev() override {
     assert(Valid());
-    if (index_ == 0) {
-      index_ = flist_->size();  // Marks as invalid
+    if (index_ == begin_) {
+      index_ = end_;  // Marks as invalid
     } else {
       index_--;
     }
@@ -198,9 +240,16 @@ class Version::LevelFileNumIterator : public Iterator {
   }
   Status status() const override { return Status::OK(); }
 
+  // Return true if the level holds no file in the bounds.
+  bool Empty() const { return begin_ == end_; }
+
  private:
   const InternalKeyComparator icmp_;
   const std::vector<FileMetaData*>* const flist_;
+  TableCache* const prefix_check_;
+  // The files in the bounds are [begin_, end_)
+  uint32_t begin_;
+  uint32_t end_;
   uint32_t index_;
 
   // Backing store for value().  Holds the file number and size.
@@ -221,17 +270,38 @@ static Iterator* GetFileIterator(void* arg, const ReadOptions& options,
 
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
-  return NewTwoLevelIterator(
-      new LevelFileNumIterator(vset_->icmp_, &files_[level]), &GetFileIterator,
-      vset_->table_cache_, options);
+  TableCache* prefix_check = nullptr;
+  if (options.prefix_same_as_start &&
+      vset_->options_->prefix_extractor != nullptr) {
+    prefix_check = vset_->table_cache_;
+  }
+  LevelFileNumIterator* files = new LevelFileNumIterator(
+      vset_->icmp_, &files_[level], prefix_check, options.iterate_lower_bound,
+      options.iterate_upper_bound);
+  if (files->Empty()) {
+    delete files;
+    return nullptr;
+  }
+  return NewTwoLevelIterator(files, &GetFileIterator, vset_->table_cache_,
+                             options);
 }
 
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
-  // Merge all level zero files together since they may overlap
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  const Slice* upper_bound = options.iterate_upper_bound;
+
+  // Merge all level zero files together since they may overlap.  Skip
+  // the ones that hold no key in the bounds.
   for (size_t i = 0; i < files_[0].size(); i++) {
-    iters->push_back(vset_->table_cache_->NewIterator(
-        options, files_[0][i]->number, files_[0][i]->file_size));
+    FileMetaData* f = files_[0][i];
+    if (AfterFile(ucmp, options.iterate_lower_bound, f) ||
+        (upper_bound != nullptr &&
+         ucmp->Compare(*upper_bound, f->smallest.user_key()) <= 0)) {
+      continue;
+    }
+    iters->push_back(
+        vset_->table_cache_->NewIterator(options, f->number, f->file_size));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
@@ -239,7 +309,10 @@ void Version::AddIterators(const ReadOptions& options,
   // lazily.
   for (int level = 1; level < config::kNumLevels; level++) {
     if (!files_[level].empty()) {
-      iters->push_back(NewConcatenatingIterator(options, level));
+      Iterator* iter = NewConcatenatingIterator(options, level);
+      if (iter != nullptr) {
+        iters->push_back(iter);
+      }
     }
   }
 }
@@ -256,22 +329,34 @@ struct Saver {
   SaverState state;
   const Comparator* ucmp;
   Slice user_key;
-  std::string* value;
+  std::string* value;      // Used by SaveValue()
+  PinnableSlice* pinned;   // Used by SavePinnedValue()
 };
 }  // namespace
-static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
-  Saver* s = reinterpret_cast<Saver*>(arg);
+// Sets s->state from the entry with key "ikey".  Returns true iff it is
+// the value that is looked for.
+static bool CheckSavedKey(Saver* s, const Slice& ikey) {
   ParsedInternalKey parsed_key;
   if (!ParseInternalKey(ikey, &parsed_key)) {
     s->state = kCorrupt;
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
       s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
-      if (s->state == kFound) {
-        s->value->assign(v.data(), v.size());
-      }
     }
   }
+  return s->state == kFound;
+}
+static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
+  Saver* s = reinterpret_cast<Saver*>(arg);
+  if (CheckSavedKey(s, ikey)) {
+    s->value->assign(v.data(), v.size());
+  }
+}
+static void SavePinnedValue(void* arg, const Slice& ikey, PinnableSlice* v) {
+  Saver* s = reinterpret_cast<Saver*>(arg);
+  if (CheckSavedKey(s, ikey)) {
+    *s->pinned = std::move(*v);
+  }
 }
 
 static bool NewestFirst(FileMetaData* a, FileMetaData* b) {
@@ -322,7 +407,7 @@ void Version::ForEachOverlapping(Slice user_key, Slice internal_key, void* arg,
 }
 
 Status Version::Get(const ReadOptions& options, const LookupKey& k,
-                    std::string* value, GetStats* stats) {
+                    PinnableSlice* value, GetStats* stats) {
   stats->seek_file = nullptr;
   stats->seek_file_level = -1;
 
@@ -353,7 +438,8 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
 
       state->s = state->vset->table_cache_->Get(*state->options, f->number,
                                                 f->file_size, state->ikey,
-                                                &state->saver, SaveValue);
+                                                &state->saver,
+                                                SavePinnedValue);
       if (!state->s.ok()) {
         state->found = true;
         return false;
@@ -392,13 +478,153 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
   state.saver.state = kNotFound;
   state.saver.ucmp = vset_->icmp_.user_comparator();
   state.saver.user_key = k.user_key();
-  state.saver.value = value;
+  state.saver.value = nullptr;
+  state.saver.pinned = value;
 
   ForEachOverlapping(state.saver.user_key, state.ikey, &state, &State::Match);
 
   return state.found ? state.s : Status::NotFound(Slice());
 }
 
+void Version::MultiGet(const ReadOptions& options, size_t n,
+                       const LookupKey* const* keys, std::string* const* values,
+                       Status* statuses, GetStats* stats) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+
+  struct KeyState {
+    Saver saver;
+    FileMetaData* last_file_read;
+    int last_file_read_level;
+  };
+  std::vector<KeyState> state(n);
+  std::vector<size_t> pending;  // Keys not resolved yet, in key order
+  for (size_t i = 0; i < n; i++) {
+    stats[i].seek_file = nullptr;
+    stats[i].seek_file_level = -1;
+    statuses[i] = Status::NotFound(Slice());
+    state[i].saver.ucmp = ucmp;
+    state[i].saver.user_key = keys[i]->user_key();
+    state[i].saver.value = values[i];
+    state[i].saver.pinned = nullptr;
+    state[i].last_file_read = nullptr;
+    state[i].last_file_read_level = -1;
+    pending.push_back(i);
+  }
+
+  // Look up the keys batch[] in "f" together.  Keys that are found,
+  // deleted or fail are resolved and are not looked up any further.
+  std::vector<bool> resolved(n, false);
+  std::vector<Slice> ikeys;
+  std::vector<void*> args;
+  std::vector<Status> file_statuses;
+  auto search_file = [&](int level, FileMetaData* f,
+                         const std::vector<size_t>& batch) {
+    ikeys.clear();
+    args.clear();
+    for (size_t i : batch) {
+      KeyState* ks = &state[i];
+      if (stats[i].seek_file == nullptr && ks->last_file_read != nullptr) {
+        // We have had more than one seek for this read.  Charge the 1st file.
+        stats[i].seek_file = ks->last_file_read;
+        stats[i].seek_file_level = ks->last_file_read_level;
+      }
+      ks->last_file_read = f;
+      ks->last_file_read_level = level;
+      ks->saver.state = kNotFound;
+      ikeys.push_back(keys[i]->internal_key());
+      args.push_back(&ks->saver);
+    }
+    file_statuses.resize(batch.size());
+    vset_->table_cache_->MultiGet(options, f->number, f->file_size,
+                                  batch.size(), ikeys.data(), args.data(),
+                                  SaveValue, file_statuses.data());
+    for (size_t j = 0; j < batch.size(); j++) {
+      const size_t i = batch[j];
+      if (!file_statuses[j].ok()) {
+        statuses[i] = file_statuses[j];
+        resolved[i] = true;
+        continue;
+      }
+      switch (state[i].saver.state) {
+        case kNotFound:
+          break;  // Keep searching in other files
+        case kFound:
+          statuses[i] = Status::OK();
+          resolved[i] = true;
+          break;
+        case kDeleted:
+          resolved[i] = true;
+          break;
+        case kCorrupt:
+          statuses[i] =
+              Status::Corruption("corrupted key for ", state[i].saver.user_key);
+          resolved[i] = true;
+          break;
+      }
+    }
+  };
+  auto remove_resolved = [&]() {
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [&](size_t i) { return resolved[i]; }),
+                  pending.end());
+  };
+
+  // Search level-0 in order from newest to oldest.
+  std::vector<FileMetaData*> tmp(files_[0]);
+  std::sort(tmp.begin(), tmp.end(), NewestFirst);
+  std::vector<size_t> batch;
+  for (size_t f = 0; f < tmp.size() && !pending.empty(); f++) {
+    batch.clear();
+    for (size_t i : pending) {
+      const Slice user_key = keys[i]->user_key();
+      if (ucmp->Compare(user_key, tmp[f]->smallest.user_key()) >= 0 &&
+          ucmp->Compare(user_key, tmp[f]->largest.user_key()) <= 0) {
+        batch.push_back(i);
+      }
+    }
+    if (!batch.empty()) {
+      search_file(0, tmp[f], batch);
+      remove_resolved();
+    }
+  }
+
+  // Search other levels.  Since the keys are sorted, the keys that fall
+  // into the same file are next to each other.
+  for (int level = 1; level < config::kNumLevels && !pending.empty();
+       level++) {
+    const size_t num_files = files_[level].size();
+    if (num_files == 0) continue;
+
+    size_t batch_file = num_files;
+    batch.clear();
+    for (size_t i : pending) {
+      // Binary search to find earliest index whose largest key >= key.
+      uint32_t index =
+          FindFile(vset_->icmp_, files_[level], keys[i]->internal_key());
+      if (index < num_files &&
+          ucmp->Compare(keys[i]->user_key(),
+                        files_[level][index]->smallest.user_key()) < 0) {
+        // All of the file is past any data for this key
+        index = num_files;
+      }
+      if (index != batch_file) {
+        if (!batch.empty()) {
+          search_file(level, files_[level][batch_file], batch);
+        }
+        batch.clear();
+        batch_file = index;
+      }
+      if (index < num_files) {
+        batch.push_back(i);
+      }
+    }
+    if (!batch.empty()) {
+      search_file(level, files_[level][batch_file], batch);
+    }
+    remove_resolved();
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
   if (f != nullptr) {
@@ -477,7 +703,9 @@ int Version::PickLevelForMemTableOutput(const Slice& smallest_user_key,
     InternalKey limit(largest_user_key, 0, static_cast<ValueType>(0));
     std::vector<FileMetaData*> overlaps;
     while (level < config::kMaxMemCompactLevel) {
-      if (OverlapInLevel(level + 1, &smallest_user_key, &largest_user_key)) {
+      if (OverlapInLevel(level + 1, &smallest_user_key, &largest_user_key) ||
+          vset_->OutputRangeInUse(level + 1, smallest_user_key,
+                                  largest_user_key)) {
         break;
       }
       if (level + 2 < config::kNumLevels) {
@@ -746,7 +974,8 @@ VersionSet::VersionSet(const std::string& dbname, const Options* options,
       descriptor_file_(nullptr),
       descriptor_log_(nullptr),
       dummy_versions_(this),
-      current_(nullptr) {
+      current_(nullptr),
+      memtable_output_level_(-1) {
   AppendVersion(new Version(this));
 }
 
@@ -787,7 +1016,7 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   edit->SetNextFile(next_file_number_);
-  edit->SetLastSequence(last_sequence_);
+  edit->SetLastSequence(LastSequence());
 
   Version* v = new Version(this);
   {
@@ -1027,6 +1256,7 @@ void VersionSet::Finalize(Version* v) {
   // Precomputed best level for next compaction
   int best_level = -1;
   double best_score = -1;
+  uint64_t pending_bytes = 0;
 
   for (int level = 0; level < config::kNumLevels - 1; level++) {
     double score;
@@ -1044,13 +1274,20 @@ void VersionSet::Finalize(Version* v) {
       // overwrites/deletions).
       score = v->files_[level].size() /
               static_cast<double>(config::kL0_CompactionTrigger);
+      if (score >= 1) {
+        pending_bytes += TotalFileSize(v->files_[level]);
+      }
     } else {
       // Compute the ratio of current size to size limit.
       const uint64_t level_bytes = TotalFileSize(v->files_[level]);
-      score =
-          static_cast<double>(level_bytes) / MaxBytesForLevel(options_, level);
+      const double max_bytes = MaxBytesForLevel(options_, level);
+      score = static_cast<double>(level_bytes) / max_bytes;
+      if (score > 1) {
+        pending_bytes += level_bytes - static_cast<uint64_t>(max_bytes);
+      }
     }
 
+    v->level_scores_[level] = score;
     if (score > best_score) {
       best_level = level;
       best_score = score;
@@ -1059,6 +1296,7 @@ void VersionSet::Finalize(Version* v) {
 
   v->compaction_level_ = best_level;
   v->compaction_score_ = best_score;
+  v->pending_compaction_bytes_ = pending_bytes;
 }
 
 Status VersionSet::WriteSnapshot(log::Writer* log) {
@@ -1114,33 +1352,95 @@ uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
   for (int level = 0; level < config::kNumLevels; level++) {
     const std::vector<FileMetaData*>& files = v->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
-      if (icmp_.Compare(files[i]->largest, ikey) <= 0) {
-        // Entire file is before "ikey", so just add the file size
-        result += files[i]->file_size;
-      } else if (icmp_.Compare(files[i]->smallest, ikey) > 0) {
-        // Entire file is after "ikey", so ignore
-        if (level > 0) {
-          // Files other than level 0 are sorted by meta->smallest, so
-          // no further files in this level will contain data for
-          // "ikey".
-          break;
-        }
-      } else {
-        // "ikey" falls in the range for this table.  Add the
-        // approximate offset of "ikey" within the table.
-        Table* tableptr;
-        Iterator* iter = table_cache_->NewIterator(
-            ReadOptions(), files[i]->number, files[i]->file_size, &tableptr);
-        if (tableptr != nullptr) {
-          result += tableptr->ApproximateOffsetOf(ikey.Encode());
-        }
-        delete iter;
+      if (level > 0 && icmp_.Compare(files[i]->smallest, ikey) > 0) {
+        // Files other than level 0 are sorted by meta->smallest, so
+        // no further files in this level will contain data for
+        // "ikey".
+        break;
       }
+      result += ApproximateOffsetOf(files[i], ikey);
     }
   }
   return result;
 }
 
+uint64_t VersionSet::ApproximateOffsetOf(const FileMetaData* f,
+                                         const InternalKey& ikey) {
+  if (icmp_.Compare(f->largest, ikey) <= 0) {
+    // Entire file is before "ikey", so just add the file size
+    return f->file_size;
+  } else if (icmp_.Compare(f->smallest, ikey) > 0) {
+    // Entire file is after "ikey", so ignore
+    return 0;
+  } else {
+    // "ikey" falls in the range for this table.  Add the
+    // approximate offset of "ikey" within the table.
+    uint64_t result = 0;
+    Table* tableptr;
+    Iterator* iter = table_cache_->NewIterator(ReadOptions(), f->number,
+                                               f->file_size, &tableptr);
+    if (tableptr != nullptr) {
+      result = tableptr->ApproximateOffsetOf(ikey.Encode());
+    }
+    delete iter;
+    return result;
+  }
+}
+
+void VersionSet::GetCompactionBoundaries(Compaction* c, int max_ranges,
+                                         std::vector<std::string>* boundaries) {
+  boundaries->clear();
+  if (max_ranges <= 1) {
+    return;
+  }
+
+  // Candidate split points: the first and last user key of every input.
+  const Comparator* user_cmp = icmp_.user_comparator();
+  std::vector<Slice> keys;
+  uint64_t total_bytes = 0;
+  for (int which = 0; which < 2; which++) {
+    for (FileMetaData* f : c->inputs_[which]) {
+      keys.push_back(f->smallest.user_key());
+      keys.push_back(f->largest.user_key());
+      total_bytes += f->file_size;
+    }
+  }
+  std::sort(keys.begin(), keys.end(), [user_cmp](const Slice& a, const Slice& b) {
+    return user_cmp->Compare(a, b) < 0;
+  });
+  keys.erase(std::unique(keys.begin(), keys.end(),
+                         [user_cmp](const Slice& a, const Slice& b) {
+                           return user_cmp->Compare(a, b) == 0;
+                         }),
+             keys.end());
+
+  const uint64_t bytes_per_range = total_bytes / max_ranges;
+  if (bytes_per_range == 0) {
+    return;
+  }
+
+  // Start a new range at the first candidate at or after every multiple
+  // of bytes_per_range.  The smallest key can never start a new range.
+  uint64_t next_range_start = bytes_per_range;
+  for (size_t i = 1; i < keys.size(); i++) {
+    if (static_cast<int>(boundaries->size()) + 1 >= max_ranges) {
+      break;
+    }
+    // Position before all entries for keys[i].
+    const InternalKey ikey(keys[i], kMaxSequenceNumber, kValueTypeForSeek);
+    uint64_t offset = 0;
+    for (int which = 0; which < 2; which++) {
+      for (FileMetaData* f : c->inputs_[which]) {
+        offset += ApproximateOffsetOf(f, ikey);
+      }
+    }
+    if (offset >= next_range_start) {
+      boundaries->push_back(keys[i].ToString());
+      next_range_start = (offset / bytes_per_range + 1) * bytes_per_range;
+    }
+  }
+}
+
 void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
   for (Version* v = dummy_versions_.next_; v != &dummy_versions_;
        v = v->next_) {
@@ -1245,45 +1545,67 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
 }
 
 Compaction* VersionSet::PickCompaction() {
-  Compaction* c;
-  int level;
-
   // We prefer compactions triggered by too much data in a level over
-  // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != nullptr);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
-    assert(level + 1 < config::kNumLevels);
-    c = new Compaction(options_, level);
-
-    // Pick the first file that comes after compact_pointer_[level]
-    for (size_t i = 0; i < current_->files_[level].size(); i++) {
-      FileMetaData* f = current_->files_[level][i];
+  // the compactions triggered by seeks.  Levels are tried from the
+  // highest score down, so that a level whose files are all busy does
+  // not hold up the others.
+  std::vector<int> levels;
+  for (int level = 0; level < config::kNumLevels - 1; level++) {
+    if (current_->level_scores_[level] >= 1) {
+      levels.push_back(level);
+    }
+  }
+  std::stable_sort(levels.begin(), levels.end(), [this](int a, int b) {
+    return current_->level_scores_[a] > current_->level_scores_[b];
+  });
+
+  for (int level : levels) {
+    const std::vector<FileMetaData*>& files = current_->files_[level];
+
+    // Start with the first file that comes after compact_pointer_[level],
+    // wrapping around to the beginning of the key space, and move on to
+    // the following files if it cannot be compacted right now.
+    size_t start = 0;
+    for (size_t i = 0; i < files.size(); i++) {
       if (compact_pointer_[level].empty() ||
-          icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0) {
-        c->inputs_[0].push_back(f);
+          icmp_.Compare(files[i]->largest.Encode(), compact_pointer_[level]) >
+              0) {
+        start = i;
         break;
       }
     }
-    if (c->inputs_[0].empty()) {
-      // Wrap-around to the beginning of the key space
-      c->inputs_[0].push_back(current_->files_[level][0]);
+    for (size_t n = 0; n < files.size(); n++) {
+      FileMetaData* f = files[(start + n) % files.size()];
+      if (f->being_compacted) {
+        continue;
+      }
+      Compaction* c = new Compaction(options_, level);
+      c->inputs_[0].push_back(f);
+      if (SetupCompaction(c)) {
+        return c;
+      }
+      delete c;
+    }
+  }
+
+  FileMetaData* f = current_->file_to_compact_;
+  if (f != nullptr && !f->being_compacted) {
+    Compaction* c = new Compaction(options_, current_->file_to_compact_level_);
+    c->inputs_[0].push_back(f);
+    if (SetupCompaction(c)) {
+      return c;
     }
-  } else if (seek_compaction) {
-    level = current_->file_to_compact_level_;
-    c = new Compaction(options_, level);
-    c->inputs_[0].push_back(current_->file_to_compact_);
-  } else {
-    return nullptr;
+    delete c;
   }
+  return nullptr;
+}
 
+bool VersionSet::SetupCompaction(Compaction* c) {
   c->input_version_ = current_;
   c->input_version_->Ref();
 
   // Files in level 0 may overlap each other, so pick up all overlapping ones
-  if (level == 0) {
+  if (c->level() == 0) {
     InternalKey smallest, largest;
     GetRange(c->inputs_[0], &smallest, &largest);
     // Note that the next call will discard the file we placed in
@@ -1294,8 +1616,95 @@ Compaction* VersionSet::PickCompaction() {
   }
 
   SetupOtherInputs(c);
+  return RegisterCompaction(c);
+}
 
-  return c;
+static bool AnyBeingCompacted(const std::vector<FileMetaData*>& files) {
+  for (FileMetaData* f : files) {
+    if (f->being_compacted) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool VersionSet::OutputRangeInUse(int level, const Slice& smallest_user_key,
+                                  const Slice& largest_user_key) const {
+  const Comparator* ucmp = icmp_.user_comparator();
+  for (Compaction* c : running_compactions_) {
+    if (c->level() + 1 == level &&
+        ucmp->Compare(largest_user_key, c->smallest_.user_key()) >= 0 &&
+        ucmp->Compare(smallest_user_key, c->largest_.user_key()) <= 0) {
+      return true;
+    }
+  }
+  return memtable_output_level_ == level &&
+         ucmp->Compare(largest_user_key,
+                       memtable_output_smallest_.user_key()) >= 0 &&
+         ucmp->Compare(smallest_user_key,
+                       memtable_output_largest_.user_key()) <= 0;
+}
+
+bool VersionSet::RegisterCompaction(Compaction* c) {
+  const int level = c->level();
+  if (AnyBeingCompacted(c->inputs_[0]) || AnyBeingCompacted(c->inputs_[1])) {
+    return false;
+  }
+  if (level == 0) {
+    // Level-0 files overlap each other, so only one compaction may take
+    // files from level-0 at a time.
+    for (Compaction* running : running_compactions_) {
+      if (running->level() == 0) {
+        return false;
+      }
+    }
+  }
+
+  // No two compactions may write overlapping key ranges to one level.
+  InternalKey all_start, all_limit;
+  GetRange2(c->inputs_[0], c->inputs_[1], &all_start, &all_limit);
+  if (OutputRangeInUse(level + 1, all_start.user_key(),
+                       all_limit.user_key())) {
+    return false;
+  }
+
+  for (int which = 0; which < 2; which++) {
+    for (FileMetaData* f : c->inputs_[which]) {
+      f->being_compacted = true;
+    }
+  }
+  c->smallest_ = all_start;
+  c->largest_ = all_limit;
+  running_compactions_.push_back(c);
+
+  // Update the place where we will do the next compaction for this level.
+  // We update this immediately instead of waiting for the VersionEdit
+  // to be applied so that if the compaction fails, we will try a different
+  // key range next time.
+  InternalKey smallest, largest;
+  GetRange(c->inputs_[0], &smallest, &largest);
+  compact_pointer_[level] = largest.Encode().ToString();
+  c->edit_.SetCompactPointer(level, largest);
+  return true;
+}
+
+void VersionSet::ReleaseCompaction(Compaction* c) {
+  for (int which = 0; which < 2; which++) {
+    for (FileMetaData* f : c->inputs_[which]) {
+      assert(f->being_compacted);
+      f->being_compacted = false;
+    }
+  }
+  running_compactions_.erase(std::find(running_compactions_.begin(),
+                                       running_compactions_.end(), c));
+}
+
+void VersionSet::RegisterMemTableOutput(int level, const InternalKey& smallest,
+                                        const InternalKey& largest) {
+  assert(memtable_output_level_ < 0);
+  memtable_output_level_ = level;
+  memtable_output_smallest_ = smallest;
+  memtable_output_largest_ = largest;
 }
 
 // Finds the largest key in a vector of files. Returns true if files it not
@@ -1392,7 +1801,8 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   GetRange2(c->inputs_[0], c->inputs_[1], &all_start, &all_limit);
 
   // See if we can grow the number of inputs in "level" without
-  // changing the number of "level+1" files we pick up.
+  // changing the number of "level+1" files we pick up.  Files that are
+  // already being compacted cannot be added.
   if (!c->inputs_[1].empty()) {
     std::vector<FileMetaData*> expanded0;
     current_->GetOverlappingInputs(level, &all_start, &all_limit, &expanded0);
@@ -1402,7 +1812,8 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
     const int64_t expanded0_size = TotalFileSize(expanded0);
     if (expanded0.size() > c->inputs_[0].size() &&
         inputs1_size + expanded0_size <
-            ExpandedCompactionByteSizeLimit(options_)) {
+            ExpandedCompactionByteSizeLimit(options_) &&
+        !AnyBeingCompacted(expanded0)) {
       InternalKey new_start, new_limit;
       GetRange(expanded0, &new_start, &new_limit);
       std::vector<FileMetaData*> expanded1;
@@ -1414,8 +1825,6 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
             level, int(c->inputs_[0].size()), int(c->inputs_[1].size()),
             long(inputs0_size), long(inputs1_size), int(expanded0.size()),
             int(expanded1.size()), long(expanded0_size), long(inputs1_size));
-        smallest = new_start;
-        largest = new_limit;
         c->inputs_[0] = expanded0;
         c->inputs_[1] = expanded1;
         GetRange2(c->inputs_[0], c->inputs_[1], &all_start, &all_limit);
@@ -1429,13 +1838,6 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
     current_->GetOverlappingInputs(level + 2, &all_start, &all_limit,
                                    &c->grandparents_);
   }
-
-  // Update the place where we will do the next compaction for this level.
-  // We update this immediately instead of waiting for the VersionEdit
-  // to be applied so that if the compaction fails, we will try a different
-  // key range next time.
-  compact_pointer_[level] = largest.Encode().ToString();
-  c->edit_.SetCompactPointer(level, largest);
 }
 
 Compaction* VersionSet::CompactRange(int level, const InternalKey* begin,
@@ -1468,18 +1870,21 @@ Compaction* VersionSet::CompactRange(int level, const InternalKey* begin,
   c->input_version_->Ref();
   c->inputs_[0] = inputs;
   SetupOtherInputs(c);
+  const bool registered = RegisterCompaction(c);
+  assert(registered);
+  (void)registered;
   return c;
 }
 
 Compaction::Compaction(const Options* options, int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
-      input_version_(nullptr),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
+      input_version_(nullptr) {}
+
+Compaction::KeyState::KeyState()
+    : grandparent_index(0), seen_key(false), overlapped_bytes(0) {
   for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
+    level_ptrs[i] = 0;
   }
 }
 
@@ -1507,13 +1912,14 @@ void Compaction::AddInputDeletions(VersionEdit* edit) {
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key,
+                                   KeyState* state) const {
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
   for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    while (level_ptrs_[lvl] < files.size()) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    while (state->level_ptrs[lvl] < files.size()) {
+      FileMetaData* f = files[state->level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1522,30 +1928,32 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      state->level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::ShouldStopBefore(const Slice& internal_key,
+                                  KeyState* state) const {
   const VersionSet* vset = input_version_->vset_;
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &vset->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
-         icmp->Compare(internal_key,
-                       grandparents_[grandparent_index_]->largest.Encode()) >
-             0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+  while (state->grandparent_index < grandparents_.size() &&
+         icmp->Compare(
+             internal_key,
+             grandparents_[state->grandparent_index]->largest.Encode()) > 0) {
+    if (state->seen_key) {
+      state->overlapped_bytes +=
+          grandparents_[state->grandparent_index]->file_size;
     }
-    grandparent_index_++;
+    state->grandparent_index++;
   }
-  seen_key_ = true;
+  state->seen_key = true;
 
-  if (overlapped_bytes_ > MaxGrandParentOverlapBytes(vset->options_)) {
+  if (state->overlapped_bytes > MaxGrandParentOverlapBytes(vset->options_)) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    state->overlapped_bytes = 0;
     return true;
   } else {
     return false;
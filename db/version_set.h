@@ -15,12 +15,14 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_SET_H_
 #define STORAGE_LEVELDB_DB_VERSION_SET_H_
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <vector>
 
 #include "db/dbformat.h"
 #include "db/version_edit.h"
+#include "leveldb/pinnable_slice.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
 
@@ -59,8 +61,9 @@ bool SomeFileOverlapsRange(const InternalKeyComparator& icmp,
 
 class Version {
  public:
-  // Lookup the value for key.  If found, store it in *val and
-  // return OK.  Else return a non-OK status.  Fills *stats.
+  // Lookup the value for key.  If found, store it in *val, pinning the
+  // block that holds it where possible, and return OK.  Else return a
+  // non-OK status.  Fills *stats.
   // REQUIRES: lock is not held
   struct GetStats {
     FileMetaData* seek_file;
@@ -68,13 +71,24 @@ class Version {
   };
 
   // Append to *iters a sequence of iterators that will
-  // yield the contents of this Version when merged together.
+  // yield the contents of this Version when merged together.  Files
+  // outside the iterate_lower_bound and iterate_upper_bound of the
+  // options are left out.
   // REQUIRES: This version has been saved (see VersionSet::SaveTo)
   void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
 
-  Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
+  Status Get(const ReadOptions&, const LookupKey& key, PinnableSlice* val,
              GetStats* stats);
 
+  // Does what Get(options, *keys[i], ..., &stats[i]) does for each of
+  // the n keys, which must be sorted by user key, copies the value found
+  // into *values[i] and stores the result in statuses[i].  Every file is
+  // searched once for all of the keys that may be in it.
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions&, size_t n, const LookupKey* const* keys,
+                std::string* const* values, Status* statuses,
+                GetStats* stats);
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
@@ -128,13 +142,20 @@ class Version {
         file_to_compact_(nullptr),
         file_to_compact_level_(-1),
         compaction_score_(-1),
-        compaction_level_(-1) {}
+        compaction_level_(-1),
+        pending_compaction_bytes_(0) {
+    for (int level = 0; level < config::kNumLevels; level++) {
+      level_scores_[level] = -1;
+    }
+  }
 
   Version(const Version&) = delete;
   Version& operator=(const Version&) = delete;
 
   ~Version();
 
+  // Return an iterator over the files of "level" that hold keys in the
+  // bounds of the options, or nullptr if none does.
   Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
 
   // Call func(arg, level, f) for every file that overlaps user_key in
@@ -162,6 +183,14 @@ class Version {
   // are initialized by Finalize().
   double compaction_score_;
   int compaction_level_;
+
+  // Compaction score of every level, so that another level can be picked
+  // while the best one is busy.  Initialized by Finalize().
+  double level_scores_[config::kNumLevels];
+
+  // Rough number of bytes that compactions must rewrite before every
+  // level is back within its size limit.  Initialized by Finalize().
+  uint64_t pending_compaction_bytes_;
 };
 
 class VersionSet {
@@ -208,13 +237,23 @@ class VersionSet {
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
-  // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  // Return an estimate of the number of bytes that compactions must
+  // rewrite before the current version needs no further compaction.
+  uint64_t EstimatedPendingCompactionBytes() const {
+    return current_->pending_compaction_bytes_;
+  }
+
+  // Return the last sequence number.  May be called without the lock,
+  // in which case the writes up to the sequence number are visible in the
+  // memtables of any SuperVersion (see db_impl.h) acquired before.
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
-    assert(s >= last_sequence_);
-    last_sequence_ = s;
+    assert(s >= LastSequence());
+    last_sequence_.store(s, std::memory_order_release);
   }
 
   // Mark the specified file number as used.
@@ -227,19 +266,42 @@ class VersionSet {
   // being compacted, or zero if there is no such log file.
   uint64_t PrevLogNumber() const { return prev_log_number_; }
 
-  // Pick level and inputs for a new compaction.
-  // Returns nullptr if there is no compaction to be done.
+  // Pick level and inputs for a new compaction that can run alongside
+  // the compactions that are already running.
+  // Returns nullptr if there is no such compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
-  // describes the compaction.  Caller should delete the result.
+  // describes the compaction.  Caller should pass the result to
+  // ReleaseCompaction() and then delete it.
   Compaction* PickCompaction();
 
   // Return a compaction object for compacting the range [begin,end] in
   // the specified level.  Returns nullptr if there is nothing in that
-  // level that overlaps the specified range.  Caller should delete
-  // the result.
+  // level that overlaps the specified range.  Caller should pass the
+  // result to ReleaseCompaction() and then delete it.
+  // REQUIRES: no other compaction is running and no memtable output is
+  // registered.
   Compaction* CompactRange(int level, const InternalKey* begin,
                            const InternalKey* end);
 
+  // Mark a compaction returned by PickCompaction() or CompactRange() as
+  // finished, making its input files and key range available to other
+  // compactions again.
+  void ReleaseCompaction(Compaction* c);
+
+  // Return the number of compactions that have been picked but not
+  // released yet.
+  int NumRunningCompactions() const {
+    return static_cast<int>(running_compactions_.size());
+  }
+
+  // Record that a memtable compaction is about to add a table spanning
+  // [smallest,largest] to "level", so that no compaction writing an
+  // overlapping range to that level is picked until the table has been
+  // installed and ReleaseMemTableOutput() is called.
+  void RegisterMemTableOutput(int level, const InternalKey& smallest,
+                              const InternalKey& largest);
+  void ReleaseMemTableOutput() { memtable_output_level_ = -1; }
+
   // Return the maximum overlapping data (in bytes) at next level for any
   // file at a level >= 1.
   int64_t MaxNextLevelOverlappingBytes();
@@ -262,6 +324,15 @@ class VersionSet {
   // "key" as of version "v".
   uint64_t ApproximateOffsetOf(Version* v, const InternalKey& key);
 
+  // Split the input key range of "*c" into at most "max_ranges" ranges of
+  // about the same input size.  Stores the user keys at which all but the
+  // first range start, in increasing order, in *boundaries.  Only the
+  // boundaries of input files are used as split points.
+  // May read table indexes, so call it without holding the DB mutex.  It
+  // only reads the inputs of *c, which do not change while *c runs.
+  void GetCompactionBoundaries(Compaction* c, int max_ranges,
+                               std::vector<std::string>* boundaries);
+
   // Return a human-readable short (single-line) summary of the number
   // of files per level.  Uses *scratch as backing store.
   struct LevelSummaryStorage {
@@ -288,6 +359,25 @@ class VersionSet {
 
   void SetupOtherInputs(Compaction* c);
 
+  // Return the approximate offset within the table of file "f" of the
+  // data for "key".
+  uint64_t ApproximateOffsetOf(const FileMetaData* f, const InternalKey& key);
+
+  // Fill in the rest of a compaction whose initial level inputs have been
+  // chosen and register it.  Returns false if it cannot run alongside the
+  // compactions that are already running.
+  bool SetupCompaction(Compaction* c);
+
+  // Return true iff some running compaction, or the registered memtable
+  // output, will write keys in [smallest,largest] to "level".
+  bool OutputRangeInUse(int level, const Slice& smallest_user_key,
+                        const Slice& largest_user_key) const;
+
+  // If "c" can run alongside the running compactions, register it as
+  // running, advance the compaction pointer of its level and return true.
+  // Otherwise return false.
+  bool RegisterCompaction(Compaction* c);
+
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
 
@@ -300,7 +390,7 @@ class VersionSet {
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  std::atomic<uint64_t> last_sequence_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
 
@@ -313,6 +403,15 @@ class VersionSet {
   // Per-level key at which the next compaction at that level should start.
   // Either an empty string, or a valid InternalKey.
   std::string compact_pointer_[config::kNumLevels];
+
+  // Compactions that have been picked and not released yet.
+  std::vector<Compaction*> running_compactions_;
+
+  // Level and key range of the table being added by a memtable
+  // compaction, if memtable_output_level_ >= 0.
+  int memtable_output_level_;
+  InternalKey memtable_output_smallest_;
+  InternalKey memtable_output_largest_;
 };
 
 // A Compaction encapsulates information about a compaction.
@@ -344,14 +443,37 @@ class Compaction {
   // Add all inputs to this compaction as delete operations to *edit.
   void AddInputDeletions(VersionEdit* edit);
 
+  // Position of one pass over (a key range of) the compaction's input.
+  // IsBaseLevelForKey() and ShouldStopBefore() must be called with
+  // increasing keys, so every thread that compacts a part of the key
+  // range needs a KeyState of its own.
+  struct KeyState {
+    KeyState();
+
+    // State used to check for number of overlapping grandparent files
+    // (parent == level_ + 1, grandparent == level_ + 2)
+    size_t grandparent_index;  // Index in grandparents_
+    bool seen_key;             // Some output key has been seen
+    int64_t overlapped_bytes;  // Bytes of overlap between current output
+                               // and grandparent files
+
+    // State for implementing IsBaseLevelForKey
+
+    // level_ptrs holds indices into input_version_->levels_: our state
+    // is that we are positioned at one of the file ranges for each
+    // higher level than the ones involved in this compaction (i.e. for
+    // all L >= level_ + 2).
+    size_t level_ptrs[config::kNumLevels];
+  };
+
   // Returns true if the information we have available guarantees that
   // the compaction is producing data in "level+1" for which no data exists
   // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  bool IsBaseLevelForKey(const Slice& user_key, KeyState* state) const;
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key, KeyState* state) const;
 
   // Release the input version for the compaction, once the compaction
   // is successful.
@@ -371,21 +493,13 @@ class Compaction {
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];  // The two sets of inputs
 
-  // State used to check for number of overlapping grandparent files
-  // (parent == level_ + 1, grandparent == level_ + 2)
+  // Range of internal keys covered by the inputs.  Set when the
+  // compaction is registered as running.
+  InternalKey smallest_;
+  InternalKey largest_;
+
+  // Files in level_ + 2 that overlap the inputs
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
 };
 
 }  // namespace leveldb
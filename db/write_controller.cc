@@ -0,0 +1,56 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include <algorithm>
+
+namespace leveldb {
+
+const uint64_t WriteController::kMinDelayedWriteRate;
+const uint64_t WriteController::kMinSleepMicros;
+const uint64_t WriteController::kMaxSleepMicros;
+
+WriteController::WriteController(uint64_t max_delayed_write_rate)
+    : max_rate_(std::max(max_delayed_write_rate, kMinDelayedWriteRate)),
+      delayed_(false),
+      rate_(max_rate_),
+      next_write_micros_(0) {}
+
+void WriteController::SetDelayedWriteRate(uint64_t rate) {
+  if (!delayed_) {
+    // Do not charge new writes for time that passed while unthrottled.
+    next_write_micros_ = 0;
+  }
+  delayed_ = true;
+  rate_ = std::min(std::max(rate, kMinDelayedWriteRate), max_rate_);
+}
+
+void WriteController::ClearDelay() { delayed_ = false; }
+
+uint64_t WriteController::GetDelay(uint64_t now_micros, uint64_t num_bytes) {
+  if (!delayed_) {
+    return 0;
+  }
+  // The debt never exceeds kMaxSleepMicros, so neither does the delay.
+  const uint64_t delay =
+      (next_write_micros_ > now_micros) ? next_write_micros_ - now_micros : 0;
+  AddDebt(now_micros, num_bytes);
+  return (delay >= kMinSleepMicros) ? delay : 0;
+}
+
+void WriteController::AddDebt(uint64_t now_micros, uint64_t num_bytes) {
+  if (!delayed_) {
+    return;
+  }
+  if (next_write_micros_ < now_micros) {
+    // Writers were idle; unused time is not banked for later bursts.
+    next_write_micros_ = now_micros;
+  }
+  next_write_micros_ += num_bytes * 1000000 / rate_;
+  next_write_micros_ =
+      std::min(next_write_micros_, now_micros + kMaxSleepMicros);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,75 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+#define STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
+
+#include <cstdint>
+
+namespace leveldb {
+
+// WriteController paces writes to a target rate (in bytes per second)
+// while compactions are falling behind.  Instead of making every write
+// sleep for a fixed amount of time, each write is assigned a slot on a
+// virtual timeline whose length is proportional to its size, so the
+// ingest rate converges to the target and per-write delays stay small
+// and predictable.
+//
+// External synchronization is required; DBImpl only uses it while
+// holding its mutex.
+class WriteController {
+ public:
+  // Writes are never throttled below this rate.
+  static const uint64_t kMinDelayedWriteRate = 16 << 10;
+
+  // Writes that fall behind schedule by less than this are let through
+  // without sleeping; the debt is paid off by a later write instead.
+  static const uint64_t kMinSleepMicros = 1000;
+
+  // No write sleeps for longer than this, and the debt carried over to
+  // later writes is capped at it, so that a large write at a low rate
+  // does not stall writers for minutes.
+  static const uint64_t kMaxSleepMicros = 1000000;
+
+  explicit WriteController(uint64_t max_delayed_write_rate);
+
+  WriteController(const WriteController&) = delete;
+  WriteController& operator=(const WriteController&) = delete;
+
+  // Start throttling writes at "rate" bytes per second, or change the
+  // rate if writes are already throttled.  The rate is clipped to
+  // [kMinDelayedWriteRate, max_delayed_write_rate()].
+  void SetDelayedWriteRate(uint64_t rate);
+
+  // Stop throttling writes.
+  void ClearDelay();
+
+  bool IsDelayed() const { return delayed_; }
+
+  // Return the current target rate, or zero if writes are not throttled.
+  uint64_t delayed_write_rate() const { return delayed_ ? rate_ : 0; }
+
+  uint64_t max_delayed_write_rate() const { return max_rate_; }
+
+  // Return the number of microseconds that a write of "num_bytes" issued
+  // at "now_micros" should sleep for, at most kMaxSleepMicros.  Returns
+  // zero if writes are not throttled.
+  uint64_t GetDelay(uint64_t now_micros, uint64_t num_bytes);
+
+  // Charge "num_bytes" written at "now_micros" without a call to
+  // GetDelay(), so that later writes sleep for them instead.
+  void AddDebt(uint64_t now_micros, uint64_t num_bytes);
+
+ private:
+  const uint64_t max_rate_;
+  bool delayed_;
+  uint64_t rate_;
+
+  // Time at which the writes admitted so far will have been paid for.
+  uint64_t next_write_micros_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_WRITE_CONTROLLER_H_
@@ -0,0 +1,102 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/write_controller.h"
+
+#include "gtest/gtest.h"
+
+namespace leveldb {
+
+static const uint64_t kMB = 1 << 20;
+
+TEST(WriteControllerTest, NoDelayByDefault) {
+  WriteController controller(16 * kMB);
+  ASSERT_FALSE(controller.IsDelayed());
+  ASSERT_EQ(0, controller.delayed_write_rate());
+  ASSERT_EQ(0, controller.GetDelay(1000, 100 * kMB));
+}
+
+TEST(WriteControllerTest, RateIsClipped) {
+  WriteController controller(16 * kMB);
+  controller.SetDelayedWriteRate(100 * kMB);
+  ASSERT_EQ(16 * kMB, controller.delayed_write_rate());
+  controller.SetDelayedWriteRate(1);
+  ASSERT_EQ(WriteController::kMinDelayedWriteRate,
+            controller.delayed_write_rate());
+  controller.ClearDelay();
+  ASSERT_EQ(0, controller.delayed_write_rate());
+}
+
+TEST(WriteControllerTest, PacesWritesToRate) {
+  WriteController controller(16 * kMB);
+  controller.SetDelayedWriteRate(1000000);  // 1 byte per microsecond
+
+  uint64_t now = 1000000;
+  // The first write goes through and is charged to the following ones.
+  ASSERT_EQ(0, controller.GetDelay(now, 10000));
+  ASSERT_EQ(10000, controller.GetDelay(now, 10000));
+  ASSERT_EQ(20000, controller.GetDelay(now, 10000));
+
+  // Once the writer has slept, the next write only waits for its
+  // predecessor's share.
+  now += 20000;
+  ASSERT_EQ(10000, controller.GetDelay(now, 10000));
+
+  // Idle time is not banked.
+  now += 1000000;
+  ASSERT_EQ(0, controller.GetDelay(now, 10000));
+  ASSERT_EQ(10000, controller.GetDelay(now, 10000));
+}
+
+TEST(WriteControllerTest, DebtIsPaidByLaterWrites) {
+  WriteController controller(16 * kMB);
+  ASSERT_EQ(0, controller.GetDelay(1000, 0));
+  controller.AddDebt(1000, 100 * kMB);  // Ignored while not throttled
+  controller.SetDelayedWriteRate(1000000);
+
+  // A batch group whose leader wrote 10000 bytes and whose followers
+  // added 30000 more.
+  uint64_t now = 1000000;
+  ASSERT_EQ(0, controller.GetDelay(now, 10000));
+  controller.AddDebt(now, 30000);
+  ASSERT_EQ(40000, controller.GetDelay(now, 10000));
+}
+
+TEST(WriteControllerTest, SmallDelaysAreDeferred) {
+  WriteController controller(16 * kMB);
+  controller.SetDelayedWriteRate(1000000);
+
+  uint64_t now = 1000000;
+  uint64_t slept = 0;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t delay = controller.GetDelay(now, 100);
+    ASSERT_TRUE(delay == 0 || delay >= WriteController::kMinSleepMicros);
+    now += delay;
+    slept += delay;
+  }
+  // 1000 writes of 100 bytes at 1 byte/us, less the last write's share
+  // and the debt that was not yet large enough to sleep for.
+  ASSERT_GE(slept, 99900 - WriteController::kMinSleepMicros);
+  ASSERT_LE(slept, 99900);
+}
+
+TEST(WriteControllerTest, DelayIsCapped) {
+  WriteController controller(16 * kMB);
+  controller.SetDelayedWriteRate(WriteController::kMinDelayedWriteRate);
+
+  // A 16MB write at 16KB/s would be paid for over 1000 seconds.
+  uint64_t now = 1000000;
+  ASSERT_EQ(0, controller.GetDelay(now, 16 * kMB));
+  ASSERT_EQ(WriteController::kMaxSleepMicros, controller.GetDelay(now, 100));
+  now += WriteController::kMaxSleepMicros;
+  ASSERT_LE(controller.GetDelay(now, 16 * kMB),
+            WriteController::kMaxSleepMicros);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
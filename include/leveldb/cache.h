@@ -10,15 +10,17 @@
 // length strings, may use the length of the string as the charge for
 // the string.
 //
-// A builtin cache implementation with a least-recently-used eviction
-// policy is provided.  Clients may use their own implementations if
-// they want something more sophisticated (like scan-resistance, a
-// custom eviction policy, variable cache sizing, etc.)
+// Builtin cache implementations with least-recently-used, segmented
+// least-recently-used (scan-resistant) and CLOCK eviction policies are
+// provided.  Clients may use their own implementations if they want
+// something more sophisticated (like a custom eviction policy, variable
+// cache sizing, etc.)
 
 #ifndef STORAGE_LEVELDB_INCLUDE_CACHE_H_
 #define STORAGE_LEVELDB_INCLUDE_CACHE_H_
 
 #include <cstdint>
+#include <vector>
 
 #include "leveldb/export.h"
 #include "leveldb/slice.h"
@@ -31,6 +33,55 @@ class LEVELDB_EXPORT Cache;
 // of Cache uses a least-recently-used eviction policy.
 LEVELDB_EXPORT Cache* NewLRUCache(size_t capacity);
 
+// Like NewLRUCache(capacity), but up to high_pri_pool_ratio of the
+// capacity is reserved for entries inserted with Cache::Priority::kHigh.
+// Those entries are only evicted once no low-priority entry is left to
+// evict, or once they no longer fit in the reserved part, in which case
+// the least recently used ones are treated as low-priority entries.
+LEVELDB_EXPORT Cache* NewLRUCache(size_t capacity, double high_pri_pool_ratio);
+
+// Like NewLRUCache(capacity), but splits the cache into 2^num_shard_bits
+// shards instead of 16.  Each shard has its own lock and an equal part of
+// the capacity, so more shards let more threads use the cache at once,
+// and fewer shards evict closer to a single LRU order.  num_shard_bits is
+// clamped to [0, 19].  This is not an overload of NewLRUCache() because
+// NewLRUCache(size_t, int) would make calls like NewLRUCache(capacity, 0)
+// ambiguous with NewLRUCache(size_t, double high_pri_pool_ratio).
+LEVELDB_EXPORT Cache* NewShardedLRUCache(size_t capacity, int num_shard_bits);
+
+// Like NewLRUCache(capacity, high_pri_pool_ratio), with 2^num_shard_bits
+// shards.
+LEVELDB_EXPORT Cache* NewShardedLRUCache(size_t capacity, int num_shard_bits,
+                                         double high_pri_pool_ratio);
+
+// Create a new scan-resistant cache with a fixed size capacity.  Entries
+// start in a probation segment and move to a protected segment, which
+// takes up to 80% of the capacity, once they are found by Lookup().
+// Entries are evicted from the probation segment first, so a scan that
+// reads a lot of data only once, even with ReadOptions::fill_cache set,
+// does not push out the entries that are used repeatedly.  Entries
+// inserted with Cache::Priority::kHigh start in the protected segment.
+LEVELDB_EXPORT Cache* NewSLRUCache(size_t capacity);
+
+// Like NewSLRUCache(capacity), but the protected segment takes up to
+// protected_ratio of the capacity.
+LEVELDB_EXPORT Cache* NewSLRUCache(size_t capacity, double protected_ratio);
+
+// Create a new cache with a fixed size capacity that evicts entries with
+// the CLOCK algorithm, an approximation of least-recently-used.  Unlike
+// the LRU cache, it looks up and releases entries without taking a lock,
+// so it scales better to many threads reading from the cache at once.
+//
+// The cache sizes its hash table for entries of about 4KB each, the
+// default Options::block_size, and holds at most about 1.5 times as many
+// entries as fit in the capacity at that size.
+LEVELDB_EXPORT Cache* NewClockCache(size_t capacity);
+
+// Like NewClockCache(capacity), but sizes the hash table for entries of
+// about estimated_entry_charge each.
+LEVELDB_EXPORT Cache* NewClockCache(size_t capacity,
+                                    size_t estimated_entry_charge);
+
 class LEVELDB_EXPORT Cache {
  public:
   Cache() = default;
@@ -45,6 +96,10 @@ class LEVELDB_EXPORT Cache {
   // Opaque handle to an entry stored in the cache.
   struct Handle {};
 
+  // Entries with high priority, like the index and filter blocks of
+  // tables, may be kept longer than entries with low priority.
+  enum class Priority { kHigh, kLow };
+
   // Insert a mapping from key->value into the cache and assign it
   // the specified charge against the total cache capacity.
   //
@@ -57,6 +112,14 @@ class LEVELDB_EXPORT Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) = 0;
 
+  // Like Insert() above, but with the specified priority.  The default
+  // implementation ignores the priority.
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
+    return Insert(key, value, charge, deleter);
+  }
+
   // If the cache has no mapping for "key", returns nullptr.
   //
   // Else return a handle that corresponds to the mapping.  The caller
@@ -97,6 +160,18 @@ class LEVELDB_EXPORT Cache {
   // cache.
   virtual size_t TotalCharge() const = 0;
 
+  // Counts of the calls on one shard of a cache.
+  struct ShardStats {
+    uint64_t hits = 0;       // Lookup() calls that found the key
+    uint64_t misses = 0;     // Lookup() calls that did not
+    uint64_t inserts = 0;    // Insert() calls
+    uint64_t evictions = 0;  // Entries removed to stay within the capacity
+  };
+
+  // Append the counts of each shard of the cache to *stats.  The default
+  // implementation, also used by the CLOCK cache, appends nothing.
+  virtual void GetShardStats(std::vector<ShardStats>* stats) const {}
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
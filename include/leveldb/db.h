@@ -7,10 +7,13 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <string>
+#include <vector>
 
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 
 namespace leveldb {
 
@@ -87,6 +90,26 @@ class LEVELDB_EXPORT DB {
   virtual Status Get(const ReadOptions& options, const Slice& key,
                      std::string* value) = 0;
 
+  // Like Get() above, but avoids copying the value where it can: if the
+  // value is found in a table, *value refers to it in the block that holds
+  // it, and pins that block and its table in memory until *value is reset
+  // or destroyed.
+  //
+  // The default implementation copies the value found by Get().
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     PinnableSlice* value);
+
+  // Look up all of "keys" as of the same state of the database, and
+  // return one status per key, with the meaning it has for Get().  On
+  // return values->size() == keys.size(), and (*values)[i] holds the value
+  // for keys[i] if the i-th status is OK, or is empty otherwise.
+  //
+  // This is faster than calling Get() for each key, since the lookups
+  // share the work of searching the same files and blocks.
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -119,8 +142,24 @@ class LEVELDB_EXPORT DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.num-immutable-mem-table" - returns the number of full write
+  //     buffers waiting to be compacted.
+  //  "leveldb.delayed-write-rate" - returns the rate, in bytes per second,
+  //     that writes are currently slowed down to, or 0 if they are not.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
+  //  "leveldb.compressed-block-cache" - returns the lookups that found a
+  //     block in options.compressed_block_cache (hits), the lookups that
+  //     did not (misses), and its usage in bytes, one "name: value" per
+  //     line.  Hits and misses are left out for caches that do not count
+  //     them, such as NewClockCache()'s (see Cache::GetShardStats()).  Not
+  //     valid without a compressed block cache.
+  //  "leveldb.block-cache-stats" - returns a table of the hits, misses and
+  //     inserts of the block cache lookups made by this DB for index,
+  //     filter and data blocks, followed by a table of the hits, misses,
+  //     inserts and evictions of each shard of options.block_cache, which
+  //     count the calls of all DBs sharing it.  Shards are only listed for
+  //     caches that count them (see Cache::GetShardStats()).
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -197,6 +197,24 @@ class LEVELDB_EXPORT Env {
   // serialized.
   virtual void Schedule(void (*function)(void* arg), void* arg) = 0;
 
+  // Background work runs in one of two thread pools.  Work scheduled
+  // with kHigh priority never waits behind kLow priority work, which is
+  // what Schedule() uses.
+  enum Priority { kLow, kHigh };
+
+  // Like Schedule(), but run "(*function)(arg)" in the thread pool for
+  // priority "pri".
+  //
+  // The default implementation ignores "pri" and calls Schedule().
+  virtual void ScheduleWithPriority(void (*function)(void* arg), void* arg,
+                                    Priority pri);
+
+  // Make sure that the thread pool for priority "pri" has at least
+  // "number" threads.  Thread pools never shrink.
+  //
+  // The default implementation does nothing.
+  virtual void EnsureBackgroundThreads(int number, Priority pri);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -248,6 +266,19 @@ class LEVELDB_EXPORT SequentialFile {
   virtual Status Skip(uint64_t n) = 0;
 };
 
+// One read of a RandomAccessFile::MultiRead() call.
+struct LEVELDB_EXPORT ReadRequest {
+  // Inputs: read up to "n" bytes at "offset", using "scratch[0..n-1]"
+  // as Read() does.
+  uint64_t offset;
+  size_t n;
+  char* scratch;
+
+  // Outputs: what Read() would have stored in *result and returned.
+  Slice result;
+  Status status;
+};
+
 // A file abstraction for randomly reading the contents of a file.
 class LEVELDB_EXPORT RandomAccessFile {
  public:
@@ -269,6 +300,15 @@ class LEVELDB_EXPORT RandomAccessFile {
   // Safe for concurrent use by multiple threads.
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
+
+  // Perform all n reads in reqs[], possibly in parallel, and store the
+  // outcome of each in its "result" and "status".  Returns OK if every
+  // read succeeded, or else the status of one that failed.
+  //
+  // The default implementation calls Read() for each request in turn.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual Status MultiRead(ReadRequest* reqs, size_t n) const;
 };
 
 // A file abstraction for sequential writing.  The implementation
@@ -386,6 +426,12 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) override {
     return target_->Schedule(f, a);
   }
+  void ScheduleWithPriority(void (*f)(void*), void* a, Priority pri) override {
+    return target_->ScheduleWithPriority(f, a, pri);
+  }
+  void EnsureBackgroundThreads(int number, Priority pri) override {
+    return target_->EnsureBackgroundThreads(number, pri);
+  }
   void StartThread(void (*f)(void*), void* a) override {
     return target_->StartThread(f, a);
   }
@@ -49,6 +49,20 @@ class LEVELDB_EXPORT FilterPolicy {
   // This method may return true or false if the key was not on the
   // list, but it should aim to return false with a high probability.
   virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const = 0;
+
+  // Like CreateFilter(keys, n, dst), but the filter must also summarize
+  // prefixes[0,m-1], the prefixes of the keys (see
+  // Options::prefix_extractor), for PrefixMayMatch().  The default
+  // implementation treats the prefixes as more keys.
+  virtual void CreateFilterWithPrefixes(const Slice* keys, int n,
+                                        const Slice* prefixes, int m,
+                                        std::string* dst) const;
+
+  // "filter" contains the data appended by a preceding call to
+  // CreateFilterWithPrefixes() on this class.  This method must return
+  // true if the prefix was in the list of prefixes passed to it.  The
+  // default implementation calls KeyMayMatch().
+  virtual bool PrefixMayMatch(const Slice& prefix, const Slice& filter) const;
 };
 
 // Return a new filter policy that uses a bloom filter with approximately
@@ -67,6 +81,19 @@ class LEVELDB_EXPORT FilterPolicy {
 // trailing spaces in keys.
 LEVELDB_EXPORT const FilterPolicy* NewBloomFilterPolicy(int bits_per_key);
 
+// Return a new filter policy that uses a bloom filter split into 64-byte
+// blocks, with all of the bits for a key in one block.  Checking a key
+// costs one cache miss regardless of the size of the filter, which makes
+// it a good choice for large filters (see Options::full_filter).  For the
+// same bits_per_key its false positive rate is slightly higher than that
+// of NewBloomFilterPolicy().
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.  The note above about custom comparators
+// applies here too.
+LEVELDB_EXPORT const FilterPolicy* NewBlockedBloomFilterPolicy(
+    int bits_per_key);
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_INCLUDE_FILTER_POLICY_H_
@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <cstddef>
+#include <cstdint>
 
 #include "leveldb/export.h"
 
@@ -16,6 +17,10 @@ class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class PersistentCache;
+class RateLimiter;
+class Slice;
+class SliceTransform;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -75,12 +80,73 @@ struct LEVELDB_EXPORT Options {
   // on disk) before converting to a sorted on-disk file.
   //
   // Larger values increase performance, especially during bulk loads.
-  // Up to two write buffers may be held in memory at the same time,
-  // so you may wish to adjust this parameter to control memory usage.
+  // Up to max_write_buffer_number write buffers may be held in memory at
+  // the same time, so you may wish to adjust this parameter to control
+  // memory usage.
   // Also, a larger write buffer will result in a longer recovery time
   // the next time the database is opened.
   size_t write_buffer_size = 4 * 1024 * 1024;
 
+  // Maximum number of write buffers held in memory at the same time: the
+  // one being written to plus the full ones waiting to be compacted.
+  // When several full buffers are waiting they are compacted together
+  // into a single table.  Writes only stall once this many buffers
+  // exist, so larger values absorb bursts better at the cost of memory.
+  //
+  // Default: 2 (minimum 2)
+  int max_write_buffer_number = 2;
+
+  // If true, the write path is split into a log stage and a memtable
+  // stage so that one batch group can append to the log while the
+  // previous group is still being applied to the memtable.  Writes only
+  // become visible to readers once their memtable insert has completed,
+  // so sequence number ordering is unchanged.  This mostly helps
+  // workloads with many concurrent writers.
+  bool enable_pipelined_write = false;
+
+  // If true, each writer in a batch group inserts its own batch into the
+  // memtable from its own thread, in parallel with the rest of the group,
+  // instead of the group leader applying the whole group serially.
+  bool allow_concurrent_memtable_write = false;
+
+  // When level-0 accumulates too many files, or compactions fall too far
+  // behind, writes are slowed down to at most this many bytes per second.
+  // The rate is lowered further while the compaction backlog keeps
+  // growing, and raised back towards this value as it shrinks.
+  uint64_t delayed_write_rate = 16 * 1024 * 1024;
+
+  // If non-zero, writes are also slowed down once the estimated number of
+  // bytes that compactions must rewrite to bring every level back within
+  // its size limit exceeds this value.
+  uint64_t soft_pending_compaction_bytes_limit = 0;
+
+  // Maximum number of table compactions that may run at the same time,
+  // in the Env's kLow priority thread pool.  Only compactions whose inputs
+  // and output key ranges do not overlap run concurrently.
+  int max_background_compactions = 1;
+
+  // Maximum number of memtable compactions that may run at the same time,
+  // in the Env's kHigh priority thread pool, so that they never wait
+  // behind table compactions.  Each memtable compaction writes all
+  // queued memtables, so at most one runs at a time and any value above
+  // 1 behaves like 1.  If zero, memtable compactions run in the table
+  // compaction threads instead.
+  int max_background_flushes = 0;
+
+  // Maximum number of threads that work on a single level-0 compaction.
+  // If greater than 1, a level-0 compaction is split at input file
+  // boundaries into key ranges of about the same size, and each range is
+  // compacted into its own output files.  The extra ranges are compacted
+  // in the Env's kLow priority thread pool, which grows to
+  // max_background_compactions + max_subcompactions - 1 threads.
+  int max_subcompactions = 1;
+
+  // If non-null, use the specified rate limiter to cap the bandwidth used
+  // to write the table files produced by memtable compactions (at high
+  // priority) and table compactions (at low priority).  The same limiter
+  // may be shared by several databases.
+  RateLimiter* rate_limiter = nullptr;
+
   // Number of open files that can be used by the DB.  You may need to
   // increase this if your database has a large working set (budget
   // one open file per 2MB of working set).
@@ -93,6 +159,33 @@ struct LEVELDB_EXPORT Options {
   // If null, leveldb will automatically create and use an 8MB internal cache.
   Cache* block_cache = nullptr;
 
+  // If non-null, use the specified cache as a second tier below
+  // block_cache, holding blocks as they are stored in the table files.
+  // Compressed blocks take less of its capacity than of block_cache's.
+  // A block that misses block_cache is looked up here before it is read
+  // from its file, and inserted into block_cache on a hit.  Blocks read
+  // from the files are inserted into both caches.  Its lookups are
+  // reported by DB::GetProperty("leveldb.compressed-block-cache") if it
+  // counts them, which NewLRUCache()'s does but NewClockCache()'s does not.
+  Cache* compressed_block_cache = nullptr;
+
+  // If non-null, use the specified cache as the last tier below
+  // block_cache and compressed_block_cache, on storage that is faster than
+  // that of the DB, like a local SSD.  It keeps blocks across restarts of
+  // the DB, named by their table file number and offset.  A block that
+  // misses the other caches is looked up here before it is read from its
+  // file.  Blocks read from the files are inserted into it unless
+  // ReadOptions::fill_cache is false, which keeps compactions out of it.
+  // The cache must hold the blocks of this DB only.
+  PersistentCache* persistent_cache = nullptr;
+
+  // If non-null, use the specified cache for the entries that point
+  // lookups (Get() and MultiGet()) find in each table file, keyed by the
+  // file number and the key.  A hit does not touch the table's filter,
+  // index or data blocks at all.  Lookups at a snapshot bypass it.  Rows
+  // of deleted files are never looked up again and age out of the cache.
+  Cache* row_cache = nullptr;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -104,6 +197,21 @@ struct LEVELDB_EXPORT Options {
   // leave this parameter alone.
   int block_restart_interval = 16;
 
+  // If true, the data blocks of new tables end with a small hash index of
+  // their user keys (about a byte per key), which point lookups use to
+  // find the restart interval that holds a key instead of searching the
+  // block, and to rule out keys the block does not hold.  Blocks with more
+  // than 253 restart points are built without it.  Tables built either
+  // way can be read, but only by releases that know about the index, and
+  // lookups only use the index while this parameter is set.  This
+  // parameter can be changed dynamically.
+  //
+  // NOTE: the index finds keys by hashing their bytes, which is only
+  // correct for comparators that treat keys as equal if and only if their
+  // bytes are equal.  A DB therefore ignores this parameter unless its
+  // comparator is BytewiseComparator().
+  bool data_block_hash_index = false;
+
   // Leveldb will write up to this amount of bytes to a file before
   // switching to a new one.
   // Most clients should leave this parameter alone.  However if your
@@ -140,6 +248,46 @@ struct LEVELDB_EXPORT Options {
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
   const FilterPolicy* filter_policy = nullptr;
+
+  // If true (and filter_policy is set), new tables store one filter for
+  // all of their keys instead of one filter per 2KB of data blocks.  A
+  // lookup checks that filter before searching the table's index, and
+  // the filter takes less space.  Policies whose filters cost one cache
+  // miss per lookup regardless of size, like NewBlockedBloomFilterPolicy(),
+  // suit it best.  Tables built either way can be read.
+  bool full_filter = false;
+
+  // If true, new tables split their index block, and their filter if
+  // filter_policy is set, into partitions under a small top-level index.
+  // Each filter partition covers the data blocks of one index partition.
+  // Only the top-level index stays in memory while a table is open; the
+  // partitions are read through block_cache like data blocks, so the
+  // memory used for indexes and filters stays bounded however large the
+  // database grows.  A lookup may have to read a filter partition and an
+  // index partition.  Takes precedence over full_filter.
+  bool partition_index_and_filters = false;
+
+  // Approximate size of the index partitions of new tables (see
+  // partition_index_and_filters).
+  size_t metadata_block_size = 4 * 1024;
+
+  // If true, the index and filter blocks of open tables are kept in
+  // block_cache, where they count against its capacity, instead of in
+  // memory of their own, and are read again after being evicted.  They
+  // are inserted with Cache::Priority::kHigh, as are index and filter
+  // partitions, so a cache made by NewLRUCache(capacity,
+  // high_pri_pool_ratio) evicts them after data blocks.  Blocks that the
+  // Env returns from memory-mapped files are never cached and stay
+  // pinned while the table is open.
+  bool cache_index_and_filter_blocks = false;
+
+  // If non-null, use the specified transform to extract a prefix from
+  // each key.  The prefixes are added to the filters of new tables (if
+  // filter_policy is set) and to a bloom filter in each memtable, so that
+  // iterators with ReadOptions::prefix_same_as_start skip the tables and
+  // memtables that hold no key with the prefix they seek to.
+  // NewFixedPrefixTransform() provides a simple transform.
+  const SliceTransform* prefix_extractor = nullptr;
 };
 
 // Options that control read operations
@@ -159,6 +307,35 @@ struct LEVELDB_EXPORT ReadOptions {
   // not have been released).  If "snapshot" is null, use an implicit
   // snapshot of the state at the beginning of this read operation.
   const Snapshot* snapshot = nullptr;
+
+  // If true and the DB has a prefix_extractor, an iterator's Seek(target)
+  // only finds keys with the same prefix as "target": the iterator becomes
+  // invalid at the end of the prefix.  This lets the seek skip tables and
+  // memtables whose filters rule out the prefix.  Targets without a prefix
+  // are not limited.  Prev() is not supported after such a Seek(), and
+  // makes the iterator invalid with a NotSupported status.
+  bool prefix_same_as_start = false;
+
+  // If non-null, an iterator only yields keys >= *iterate_lower_bound:
+  // SeekToFirst() and Seek() to a smaller target seek to the bound, and
+  // moving backwards stops at it.  Table files that hold only smaller keys
+  // are never opened.  The slice must outlive the iterator.
+  const Slice* iterate_lower_bound = nullptr;
+
+  // If non-null, an iterator only yields keys < *iterate_upper_bound:
+  // moving forward stops at the bound, without stepping over the deleted
+  // keys beyond it, and SeekToLast() seeks to the last key before it.
+  // Table files that hold only larger keys are never opened.  The slice
+  // must outlive the iterator.
+  const Slice* iterate_upper_bound = nullptr;
+
+  // If non-zero, an iterator reads table files this many bytes at a time
+  // and serves the blocks that follow from what it read.  If zero, an
+  // iterator starts reading ahead once it reads a few blocks in file
+  // order, 8KB at first and twice as much each time after, up to 256KB.
+  // Reading ahead cuts the number of reads of long scans.  Has no effect
+  // on memory-mapped files.
+  size_t readahead_size = 0;
 };
 
 // Options that control write operations
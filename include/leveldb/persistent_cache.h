@@ -0,0 +1,66 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A PersistentCache keeps copies of blocks on storage that is faster than
+// the storage of the table files, like a local SSD, and keeps them across
+// restarts.  It has internal synchronization and may be safely accessed
+// concurrently from multiple threads.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
+#define STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "leveldb/export.h"
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Env;
+
+class LEVELDB_EXPORT PersistentCache {
+ public:
+  PersistentCache() = default;
+
+  PersistentCache(const PersistentCache&) = delete;
+  PersistentCache& operator=(const PersistentCache&) = delete;
+
+  virtual ~PersistentCache();
+
+  // Store "data" under "key", replacing the data stored under it before.
+  // The cache may drop other entries to stay within its capacity.
+  virtual Status Insert(const Slice& key, const Slice& data) = 0;
+
+  // If the cache holds "key", store its data in *data and return OK.
+  // Otherwise return a NotFound status, also for entries that fail their
+  // checksums, which are dropped.
+  virtual Status Lookup(const Slice& key, std::string* data) = 0;
+
+  // Return the number of bytes of the files that hold the entries.
+  virtual uint64_t TotalSize() = 0;
+};
+
+// Create a persistent cache that stores up to "capacity" bytes of entries
+// in files under the directory "path", which is created if missing and
+// must not be used by anything else.  Entries are appended to files of
+// about capacity / 8 bytes, but no more than 4MB, each, and the oldest
+// file is dropped as a whole once the files take more than the capacity.
+// Every entry has a checksum of its own.  Deleting the cache writes an
+// index of the entries, which the next cache created for the same path
+// reads instead of scanning the files.  A cache holds the blocks of a
+// single DB.
+//
+// Insert() appends to the files synchronously while holding a lock shared
+// by all operations of the cache.  Since tables insert every block they
+// read from a table file while ReadOptions::fill_cache is set, each such
+// read also waits for that write.
+LEVELDB_EXPORT Status NewFilePersistentCache(Env* env, const std::string& path,
+                                             uint64_t capacity,
+                                             PersistentCache** result);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
@@ -0,0 +1,91 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A PinnableSlice is a Slice that may keep the storage it refers to
+// alive, e.g. a block in the block cache that holds a value returned by
+// DB::Get().  The storage is released when the PinnableSlice is Reset(),
+// assigned to or destroyed, so the caller must not hold on to the
+// PinnableSlice for long: a pinned block cannot be evicted.
+//
+// Like Slice, a PinnableSlice needs external synchronization if any
+// thread may call a non-const method.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+#define STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+
+#include <string>
+
+#include "leveldb/export.h"
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class LEVELDB_EXPORT PinnableSlice : public Slice {
+ public:
+  using CleanupFunction = void (*)(void* arg1, void* arg2);
+
+  // Create an empty slice that copies data into a buffer of its own.
+  PinnableSlice();
+
+  // Create an empty slice that copies data into "*buf", which must
+  // outlive it.
+  explicit PinnableSlice(std::string* buf);
+
+  PinnableSlice(const PinnableSlice&) = delete;
+  PinnableSlice& operator=(const PinnableSlice&) = delete;
+
+  // Take over the contents of "other", including whatever it pins, and
+  // leave "other" empty.
+  PinnableSlice& operator=(PinnableSlice&& other);
+
+  ~PinnableSlice();
+
+  // Refer to "s", whose storage stays valid until (*function)(arg1, arg2)
+  // is called.  The call is made when this slice is reset.  "function"
+  // may be null if "s" needs no cleanup.
+  void PinSlice(const Slice& s, CleanupFunction function, void* arg1,
+                void* arg2);
+
+  // Add another call to make when this slice is reset, for more storage
+  // that the pinned data depends on.
+  // REQUIRES: IsPinned()
+  void RegisterCleanup(CleanupFunction function, void* arg1, void* arg2);
+
+  // Copy "s" into this slice's buffer and refer to the copy.
+  void PinSelf(const Slice& s);
+
+  // Refer to the current contents of GetSelf().
+  void PinSelf();
+
+  // Return the buffer that PinSelf() copies into, so that a caller can
+  // fill it directly.  Call PinSelf() afterwards.
+  std::string* GetSelf() { return buf_; }
+
+  // Release whatever this slice pins and make it empty.
+  void Reset();
+
+  // Return true iff this slice refers to storage it does not own.
+  bool IsPinned() const { return pinned_; }
+
+ private:
+  // Cleanup functions are stored in a single-linked list, as they are
+  // in Iterator.  The list's head node is inlined in the slice.
+  struct CleanupNode {
+    CleanupFunction function;  // Null if the head node is unused
+    void* arg1;
+    void* arg2;
+    CleanupNode* next;
+  };
+
+  void Release();
+
+  std::string self_space_;
+  std::string* const buf_;
+  bool pinned_;
+  CleanupNode cleanup_head_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
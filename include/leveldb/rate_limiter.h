@@ -0,0 +1,65 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A RateLimiter caps the bandwidth used by background writes (memtable
+// compactions and table compactions).  A single RateLimiter may be shared
+// by several DB instances to bound their combined write bandwidth.  It
+// has internal synchronization and may be safely accessed concurrently
+// from multiple threads.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "leveldb/export.h"
+
+namespace leveldb {
+
+class Env;
+
+class LEVELDB_EXPORT RateLimiter {
+ public:
+  // Requests of higher priority are served first when several requests
+  // are waiting for bandwidth.  Memtable compactions use kHigh so that
+  // they are not starved by long-running table compactions, which use
+  // kLow.
+  enum IOPriority { kLow = 0, kHigh = 1, kNumPriorities = 2 };
+
+  RateLimiter() = default;
+
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  virtual ~RateLimiter();
+
+  // Block until "bytes" bytes may be written at priority "pri".
+  virtual void Request(size_t bytes, IOPriority pri) = 0;
+
+  // Return the maximum number of bytes per second that are let through.
+  virtual int64_t GetBytesPerSecond() const = 0;
+
+  // Return the total number of bytes that have been requested at
+  // priority "pri" since this limiter was created.
+  virtual int64_t GetTotalBytesThrough(IOPriority pri) const = 0;
+};
+
+// Create a token-bucket rate limiter that lets through at most
+// "bytes_per_second" bytes per second.  Tokens are refilled every
+// "refill_period_micros" microseconds; a smaller period smooths out the
+// writes at the cost of more frequent wakeups.
+LEVELDB_EXPORT RateLimiter* NewGenericRateLimiter(
+    int64_t bytes_per_second, int64_t refill_period_micros = 100 * 1000);
+
+// Like NewGenericRateLimiter(bytes_per_second, refill_period_micros), but
+// takes the time from "env", and sleeps through it, instead of
+// Env::Default().  "env" must outlive the rate limiter.
+LEVELDB_EXPORT RateLimiter* NewGenericRateLimiter(
+    Env* env, int64_t bytes_per_second,
+    int64_t refill_period_micros = 100 * 1000);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
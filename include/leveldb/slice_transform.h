@@ -0,0 +1,56 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A SliceTransform maps a key to its prefix.  A database configured with
+// a prefix extractor (see Options::prefix_extractor) adds the prefixes of
+// its keys to its filters, so that an iterator can skip the tables and
+// memtables that hold no key with the prefix it is seeking to.
+//
+// Most people will want to use the builtin fixed-length prefix support
+// (see NewFixedPrefixTransform() below).
+
+#ifndef STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
+#define STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
+
+#include <cstddef>
+
+#include "leveldb/export.h"
+
+namespace leveldb {
+
+class Slice;
+
+class LEVELDB_EXPORT SliceTransform {
+ public:
+  virtual ~SliceTransform();
+
+  // Return the name of this transform.  The name is stored in every
+  // table whose filter holds prefixes, and a table's prefixes are only
+  // used while the transform of the same name is configured.  So if the
+  // transform changes in an incompatible way, the name returned by this
+  // method must be changed.
+  virtual const char* Name() const = 0;
+
+  // Return true iff "key" has a prefix.  Keys without one are never
+  // skipped by prefix filtering.
+  virtual bool InDomain(const Slice& key) const = 0;
+
+  // Return the prefix of "key", which must be a prefix of "key" in the
+  // byte-wise sense.  The comparator must order all keys with the same
+  // prefix next to each other.
+  // REQUIRES: InDomain(key)
+  virtual Slice Transform(const Slice& key) const = 0;
+};
+
+// Return a new transform that maps keys to their first prefix_len bytes.
+// Shorter keys have no prefix.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+LEVELDB_EXPORT const SliceTransform* NewFixedPrefixTransform(
+    size_t prefix_len);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_SLICE_TRANSFORM_H_
@@ -6,16 +6,21 @@
 #define STORAGE_LEVELDB_INCLUDE_TABLE_H_
 
 #include <cstdint>
+#include <string>
 
+#include "leveldb/cache.h"
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
 
 namespace leveldb {
 
 class Block;
+struct BlockCacheStats;
+struct BlockContents;
 class BlockHandle;
 class Footer;
 struct Options;
+class PinnableSlice;
 class RandomAccessFile;
 struct ReadOptions;
 class TableCache;
@@ -40,6 +45,12 @@ class LEVELDB_EXPORT Table {
   static Status Open(const Options& options, RandomAccessFile* file,
                      uint64_t file_size, Table** table);
 
+  // Like Open(), for the table file numbered "file_number", which names
+  // the blocks of the table in options.persistent_cache.  Tables opened
+  // without a file number do not use the persistent cache.
+  static Status Open(const Options& options, RandomAccessFile* file,
+                     uint64_t file_size, uint64_t file_number, Table** table);
+
   Table(const Table&) = delete;
   Table& operator=(const Table&) = delete;
 
@@ -58,23 +69,132 @@ class LEVELDB_EXPORT Table {
   // be close to the file length.
   uint64_t ApproximateOffsetOf(const Slice& key) const;
 
+  // Return false if the table's filter shows that the table holds no key
+  // that is >= target and has the same prefix (see
+  // Options::prefix_extractor).  May return true even if there is none.
+  bool PrefixMayMatch(const Slice& target) const;
+
  private:
   friend class TableCache;
   struct Rep;
 
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
+  static Iterator* IndexPartitionReader(void*, const ReadOptions&,
+                                        const Slice&);
+
+  // Return an iterator over the block at "handle", read through the block
+  // cache from "file", which is the table's file or a wrapper of it.
+  // "index" says whether it is an index block (or index partition) rather
+  // than a data block, as in ReadDataBlock().
+  Iterator* NewBlockIterator(const ReadOptions&, const BlockHandle& handle,
+                             bool index, RandomAccessFile* file) const;
+
+  // Return an iterator over the index block, which is the top-level index
+  // if the index is partitioned.
+  Iterator* NewTopIndexIterator(const ReadOptions&) const;
+
+  // Return an iterator over the entries of the index, which come from the
+  // index partitions if the index is partitioned.
+  Iterator* NewIndexIterator(const ReadOptions&) const;
+
+  // Return false if the table's block-based filter shows that the data
+  // block at "block_offset" does not hold "key".  If "prefix" is true,
+  // "key" is a prefix of Options::prefix_extractor instead, and false
+  // means that the block holds no key with that prefix.
+  bool BlockFilterMayMatch(const ReadOptions&, uint64_t block_offset,
+                           const Slice& key, bool prefix) const;
+
+  // Return false if the table's full filter shows that it does not hold
+  // "key" (or, if "prefix" is true, a key with the prefix "key").
+  bool FullFilterMayMatch(const ReadOptions&, const Slice& key,
+                          bool prefix) const;
+
+  // Return false if the filter partition for the part of the table that
+  // "key" falls into shows that the table does not hold "key".
+  // REQUIRES: the table has partitioned filters
+  bool PartitionedFilterMayMatch(const ReadOptions&, const Slice& key) const;
+
+  // Return false if the filter partition referred to by "top_index_value",
+  // an entry of the top-level index, shows that "key" (or, if "prefix" is
+  // true, a key with the prefix "key") is not in it.
+  bool FilterPartitionMayMatch(const ReadOptions&, const Slice& top_index_value,
+                               const Slice& key, bool prefix) const;
+
+  // Return false if the filter block at "handle", read through the block
+  // cache, shows that the data block at "block_offset" does not hold
+  // "key" (or, if "prefix" is true, a key with the prefix "key").  "full"
+  // says whether it is a full filter (or a filter partition), which covers
+  // all blocks and ignores "block_offset".
+  bool CachedFilterMayMatch(const ReadOptions&, const BlockHandle& handle,
+                            bool full, uint64_t block_offset,
+                            const Slice& key, bool prefix) const;
 
   explicit Table(Rep* rep) : rep_(rep) {}
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
-  // that key is not present.
+  // that key is not present.  "v" pins the block that holds the value,
+  // and handle_result may move it elsewhere to keep the block.  A block
+  // may refer to memory of the file (see BlockContents::heap_allocated),
+  // so the table must also stay open for as long as "v" is kept.
   Status InternalGet(const ReadOptions&, const Slice& key, void* arg,
                      void (*handle_result)(void* arg, const Slice& k,
-                                           const Slice& v));
+                                           PinnableSlice* v));
+
+  // Sets *block to the data block (or, if "index" is true, index block) at
+  // "handle", and *cache_handle to the block cache handle that holds it,
+  // or to null if the caller owns *block.  A block that is not cached is
+  // read from "file" and inserted into the cache, with a high priority if
+  // it is an index block.
+  Status ReadDataBlock(const ReadOptions&, const BlockHandle& handle,
+                       bool index, RandomAccessFile* file, Block** block,
+                       Cache::Handle** cache_handle) const;
+
+  // Does what the Open() functions do.  "file_number" is null if the file
+  // number is not known.  If "stats" is non-null, the table counts its
+  // block cache lookups and inserts in *stats, which must outlive it.
+  static Status InternalOpen(const Options& options, RandomAccessFile* file,
+                             uint64_t file_size, const uint64_t* file_number,
+                             BlockCacheStats* stats, Table** table);
+
+  // Reads the contents of the block at "handle" from the secondary block
+  // caches (options.compressed_block_cache and options.persistent_cache),
+  // or else from "file", adding them to the secondary caches if
+  // options.fill_cache is set.
+  Status ReadUncachedBlock(const ReadOptions&, const BlockHandle& handle,
+                           RandomAccessFile* file,
+                           BlockContents* contents) const;
+
+  // Whether the table has secondary block caches.
+  bool HasSecondaryCache() const;
+
+  // Returns true and sets *contents and *s if a secondary block cache
+  // holds the block at "handle".  A block found in the persistent cache is
+  // added to the compressed block cache.
+  bool LookupSecondaryBlock(const BlockHandle& handle,
+                            BlockContents* contents, Status* s) const;
+
+  // Takes "raw", the block at "handle" as ReadBlock() stored it, and adds
+  // it to the persistent cache, and to the compressed block cache if
+  // "contents" may be cached.  Only called for reads with
+  // ReadOptions::fill_cache set, so that other reads need not keep "raw".
+  void InsertSecondaryBlock(const BlockHandle& handle,
+                            const BlockContents& contents,
+                            std::string* raw) const;
+
+  // Does what InternalGet(options, keys[i], args[i], handle_result) does
+  // for each of the n keys, which must be sorted, and stores its status in
+  // statuses[i].  Keys that fall into the same data block share a single
+  // read of that block, and the blocks that are not cached are read with
+  // a single RandomAccessFile::MultiRead() call.
+  void InternalMultiGet(const ReadOptions&, size_t n, const Slice* keys,
+                        void* const* args,
+                        void (*handle_result)(void* arg, const Slice& k,
+                                              const Slice& v),
+                        Status* statuses);
 
   void ReadMeta(const Footer& footer);
-  void ReadFilter(const Slice& filter_handle_value);
+  void ReadFilter(const Slice& filter_handle_value, bool full);
 
   Rep* const rep_;
 };
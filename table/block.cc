@@ -17,25 +17,34 @@
 
 namespace leveldb {
 
-inline uint32_t Block::NumRestarts() const {
-  assert(size_ >= sizeof(uint32_t));
-  return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
-}
-
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
-      owned_(contents.heap_allocated) {
+      num_restarts_(0),
+      owned_(contents.heap_allocated),
+      has_hash_index_(false) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
-  } else {
-    size_t max_restarts_allowed = (size_ - sizeof(uint32_t)) / sizeof(uint32_t);
-    if (NumRestarts() > max_restarts_allowed) {
-      // The size is too small for NumRestarts()
+    return;
+  }
+  num_restarts_ = DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+  const char* restarts_limit = data_ + size_ - sizeof(uint32_t);
+  if (num_restarts_ & DataBlockHashIndex::kNumRestartsFlag) {
+    num_restarts_ &= ~DataBlockHashIndex::kNumRestartsFlag;
+    restarts_limit = hash_index_.Initialize(data_, restarts_limit);
+    if (restarts_limit == nullptr) {
       size_ = 0;
-    } else {
-      restart_offset_ = size_ - (1 + NumRestarts()) * sizeof(uint32_t);
+      return;
     }
+    has_hash_index_ = true;
+  }
+  size_t max_restarts_allowed = (restarts_limit - data_) / sizeof(uint32_t);
+  if (num_restarts_ > max_restarts_allowed) {
+    // The size is too small for num_restarts_
+    size_ = 0;
+  } else {
+    restart_offset_ =
+        (restarts_limit - data_) - num_restarts_ * sizeof(uint32_t);
   }
 }
 
@@ -201,6 +210,26 @@ class Block::Iter : public Iterator {
     }
   }
 
+  // Like Seek(target), but starts the linear search at the restart point
+  // the hash index gives for target, and leaves the iterator invalid if
+  // the index shows that the block has no entry with target's key.
+  void SeekForGet(const DataBlockHashIndex& hash_index, const Slice& target) {
+    const uint8_t entry = hash_index.Lookup(target);
+    if (entry == DataBlockHashIndex::kNoEntry) {
+      current_ = restarts_;
+      restart_index_ = num_restarts_;
+      return;
+    }
+    if (entry == DataBlockHashIndex::kCollision || entry >= num_restarts_) {
+      Seek(target);
+      return;
+    }
+    SeekToRestartPoint(entry);
+    while (ParseNextKey() && Compare(key_, target) < 0) {
+      // Keep skipping
+    }
+  }
+
   void SeekToFirst() override {
     SeekToRestartPoint(0);
     ParseNextKey();
@@ -256,12 +285,23 @@ Iterator* Block::NewIterator(const Comparator* comparator) {
   if (size_ < sizeof(uint32_t)) {
     return NewErrorIterator(Status::Corruption("bad block contents"));
   }
-  const uint32_t num_restarts = NumRestarts();
-  if (num_restarts == 0) {
+  if (num_restarts_ == 0) {
     return NewEmptyIterator();
   } else {
-    return new Iter(comparator, data_, restart_offset_, num_restarts);
+    return new Iter(comparator, data_, restart_offset_, num_restarts_);
+  }
+}
+
+Iterator* Block::NewIteratorForGet(const Comparator* comparator,
+                                   const Slice& target) {
+  if (size_ < sizeof(uint32_t) || num_restarts_ == 0 || !has_hash_index_) {
+    Iterator* iter = NewIterator(comparator);
+    iter->Seek(target);
+    return iter;
   }
+  Iter* iter = new Iter(comparator, data_, restart_offset_, num_restarts_);
+  iter->SeekForGet(hash_index_, target);
+  return iter;
 }
 
 }  // namespace leveldb
@@ -9,6 +9,7 @@
 #include <cstdint>
 
 #include "leveldb/iterator.h"
+#include "table/data_block_hash_index.h"
 
 namespace leveldb {
 
@@ -28,15 +29,26 @@ class Block {
   size_t size() const { return size_; }
   Iterator* NewIterator(const Comparator* comparator);
 
+  // Return an iterator for a point lookup of "target", which must end with
+  // an 8-byte suffix like the internal keys of a DB.  If the block holds
+  // entries whose keys equal "target" without the suffix, the iterator is
+  // positioned where Seek(target) would position it.  Otherwise it is
+  // invalid or positioned at some entry whose key differs from "target"
+  // without the suffix.  Uses the block's hash index, if it has one, which
+  // is only correct if keys that compare equal have the same bytes.
+  Iterator* NewIteratorForGet(const Comparator* comparator,
+                              const Slice& target);
+
  private:
   class Iter;
 
-  uint32_t NumRestarts() const;
-
   const char* data_;
   size_t size_;
   uint32_t restart_offset_;  // Offset in data_ of restart array
+  uint32_t num_restarts_;
   bool owned_;               // Block owns data_[]
+  bool has_hash_index_;
+  DataBlockHashIndex hash_index_;
 };
 
 }  // namespace leveldb
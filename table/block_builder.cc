@@ -25,6 +25,10 @@
 //     restarts: uint32[num_restarts]
 //     num_restarts: uint32
 // restarts[i] contains the offset within the block of the ith restart point.
+//
+// If Options::data_block_hash_index is set, a hash index of the keys (see
+// table/data_block_hash_index.h) goes between the restart array and
+// num_restarts, whose high bit is then set.
 
 #include "table/block_builder.h"
 
@@ -33,6 +37,7 @@
 
 #include "leveldb/comparator.h"
 #include "leveldb/options.h"
+#include "table/data_block_hash_index.h"
 #include "util/coding.h"
 
 namespace leveldb {
@@ -50,12 +55,17 @@ void BlockBuilder::Reset() {
   counter_ = 0;
   finished_ = false;
   last_key_.clear();
+  hash_index_.Reset();
 }
 
 size_t BlockBuilder::CurrentSizeEstimate() const {
-  return (buffer_.size() +                       // Raw data buffer
-          restarts_.size() * sizeof(uint32_t) +  // Restart array
-          sizeof(uint32_t));                     // Restart array length
+  size_t estimate = buffer_.size() +                       // Raw data buffer
+                    restarts_.size() * sizeof(uint32_t) +  // Restart array
+                    sizeof(uint32_t);  // Restart array length
+  if (options_->data_block_hash_index && hash_index_.Valid()) {
+    estimate += hash_index_.EstimateSize();
+  }
+  return estimate;
 }
 
 Slice BlockBuilder::Finish() {
@@ -63,7 +73,12 @@ Slice BlockBuilder::Finish() {
   for (size_t i = 0; i < restarts_.size(); i++) {
     PutFixed32(&buffer_, restarts_[i]);
   }
-  PutFixed32(&buffer_, restarts_.size());
+  uint32_t num_restarts = restarts_.size();
+  if (options_->data_block_hash_index && hash_index_.Valid()) {
+    hash_index_.Finish(&buffer_);
+    num_restarts |= DataBlockHashIndex::kNumRestartsFlag;
+  }
+  PutFixed32(&buffer_, num_restarts);
   finished_ = true;
   return Slice(buffer_);
 }
@@ -97,6 +112,10 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   buffer_.append(key.data() + shared, non_shared);
   buffer_.append(value.data(), value.size());
 
+  if (options_->data_block_hash_index) {
+    hash_index_.Add(key, restarts_.size() - 1);
+  }
+
   // Update state
   last_key_.resize(shared);
   last_key_.append(key.data() + shared, non_shared);
@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "leveldb/slice.h"
+#include "table/data_block_hash_index.h"
 
 namespace leveldb {
 
@@ -47,6 +48,7 @@ class BlockBuilder {
   int counter_;                     // Number of entries emitted since restart
   bool finished_;                   // Has Finish() been called?
   std::string last_key_;
+  DataBlockHashIndexBuilder hash_index_;
 };
 
 }  // namespace leveldb
@@ -0,0 +1,53 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_BLOCK_CACHE_STATS_H_
+#define STORAGE_LEVELDB_TABLE_BLOCK_CACHE_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace leveldb {
+
+// Counts of the block cache lookups and inserts that the tables of a DB
+// make, by the type of the block.  Options::block_cache may be shared with
+// other DBs, and counts all of their calls by shard instead (see
+// Cache::GetShardStats()).  Safe for concurrent use.
+struct BlockCacheStats {
+  // Index blocks include index partitions, and filter blocks include
+  // filter partitions.
+  enum BlockType { kIndexBlock, kFilterBlock, kDataBlock, kNumBlockTypes };
+
+  struct Counts {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> inserts{0};
+  };
+
+  void RecordLookup(BlockType type, bool hit) {
+    std::atomic<uint64_t>& count = hit ? counts[type].hits : counts[type].misses;
+    count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void RecordInsert(BlockType type) {
+    counts[type].inserts.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static const char* BlockTypeName(BlockType type) {
+    switch (type) {
+      case kIndexBlock:
+        return "index";
+      case kFilterBlock:
+        return "filter";
+      default:
+        return "data";
+    }
+  }
+
+  Counts counts[kNumBlockTypes];
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_BLOCK_CACHE_STATS_H_
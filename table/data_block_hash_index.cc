@@ -0,0 +1,103 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/data_block_hash_index.h"
+
+#include <cassert>
+
+#include "util/hash.h"
+
+namespace leveldb {
+
+const uint8_t DataBlockHashIndex::kNoEntry;
+const uint8_t DataBlockHashIndex::kCollision;
+const uint8_t DataBlockHashIndex::kMaxRestartIndex;
+const uint32_t DataBlockHashIndex::kNumRestartsFlag;
+
+// Size of the suffix that is not hashed
+static const size_t kSuffixLength = 8;
+
+static uint32_t HashKey(const Slice& key) {
+  assert(key.size() >= kSuffixLength);
+  return Hash(key.data(), key.size() - kSuffixLength, 0x2f8c31d5);
+}
+
+// Use about four buckets for every three keys, so that few keys collide
+// while the index costs little more than a byte per key.
+static size_t NumBuckets(size_t num_keys) {
+  const size_t n = num_keys + num_keys / 3 + 1;
+  return n < 0xffff ? n : 0xffff;
+}
+
+DataBlockHashIndexBuilder::DataBlockHashIndexBuilder() : valid_(true) {}
+
+void DataBlockHashIndexBuilder::Add(const Slice& key, size_t restart_index) {
+  if (key.size() < kSuffixLength ||
+      restart_index > DataBlockHashIndex::kMaxRestartIndex) {
+    valid_ = false;
+  }
+  if (!valid_) {
+    return;
+  }
+  const uint32_t h = HashKey(key);
+  if (!hashes_.empty() && hashes_.back() == h &&
+      restart_indexes_.back() == restart_index) {
+    return;  // Another entry for the same key, like an older version
+  }
+  hashes_.push_back(h);
+  restart_indexes_.push_back(static_cast<uint8_t>(restart_index));
+}
+
+size_t DataBlockHashIndexBuilder::EstimateSize() const {
+  return NumBuckets(hashes_.size()) + sizeof(uint16_t);
+}
+
+void DataBlockHashIndexBuilder::Finish(std::string* dst) {
+  assert(Valid());
+  const size_t num_buckets = NumBuckets(hashes_.size());
+  std::vector<uint8_t> buckets(num_buckets, DataBlockHashIndex::kNoEntry);
+  for (size_t i = 0; i < hashes_.size(); i++) {
+    uint8_t& bucket = buckets[hashes_[i] % num_buckets];
+    if (bucket == DataBlockHashIndex::kNoEntry) {
+      bucket = restart_indexes_[i];
+    } else if (bucket != restart_indexes_[i]) {
+      bucket = DataBlockHashIndex::kCollision;
+    }
+  }
+  dst->append(reinterpret_cast<const char*>(buckets.data()), num_buckets);
+  char num_buckets_buf[sizeof(uint16_t)];
+  num_buckets_buf[0] = static_cast<char>(num_buckets & 0xff);
+  num_buckets_buf[1] = static_cast<char>(num_buckets >> 8);
+  dst->append(num_buckets_buf, sizeof(num_buckets_buf));
+}
+
+void DataBlockHashIndexBuilder::Reset() {
+  valid_ = true;
+  hashes_.clear();
+  restart_indexes_.clear();
+}
+
+const char* DataBlockHashIndex::Initialize(const char* start,
+                                           const char* limit) {
+  if (limit - start < static_cast<ptrdiff_t>(sizeof(uint16_t))) {
+    return nullptr;
+  }
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(limit) - 2;
+  num_buckets_ = static_cast<uint16_t>(p[0] | (p[1] << 8));
+  if (num_buckets_ == 0 ||
+      limit - start < static_cast<ptrdiff_t>(sizeof(uint16_t) + num_buckets_)) {
+    return nullptr;
+  }
+  buckets_ = p - num_buckets_;
+  return reinterpret_cast<const char*>(buckets_);
+}
+
+uint8_t DataBlockHashIndex::Lookup(const Slice& key) const {
+  if (key.size() < kSuffixLength) {
+    return kCollision;  // Not a key the index knows how to look up
+  }
+  return buckets_[HashKey(key) % num_buckets_];
+}
+
+}  // namespace leveldb
@@ -0,0 +1,88 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A data block may carry a hash index between its restart array and the
+// number of restarts, which then has kNumRestartsFlag set.  The index maps
+// the key of each entry, without the 8-byte suffix that the internal keys
+// of a DB end with (see db/dbformat.h), to the restart interval that holds
+// the entry, so that a point lookup can go straight to that interval
+// instead of searching the restart array.
+//
+// The index is an array of one-byte buckets followed by their number:
+//     buckets: uint8[num_buckets]
+//     num_buckets: uint16
+// A bucket holds the index of a restart interval, kNoEntry if no key
+// hashes to it, or kCollision if keys of different restart intervals do.
+
+#ifndef STORAGE_LEVELDB_TABLE_DATA_BLOCK_HASH_INDEX_H_
+#define STORAGE_LEVELDB_TABLE_DATA_BLOCK_HASH_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class DataBlockHashIndexBuilder {
+ public:
+  DataBlockHashIndexBuilder();
+
+  DataBlockHashIndexBuilder(const DataBlockHashIndexBuilder&) = delete;
+  DataBlockHashIndexBuilder& operator=(const DataBlockHashIndexBuilder&) =
+      delete;
+
+  // Record that the entry with "key" is in the restart interval with
+  // index "restart_index".
+  void Add(const Slice& key, size_t restart_index);
+
+  // Return true if the keys added since the last Reset() can be indexed:
+  // there is at least one, all of them have the 8-byte suffix, and all of
+  // their restart intervals have indexes that fit in a bucket.
+  bool Valid() const { return valid_ && !hashes_.empty(); }
+
+  // Return the number of bytes Finish() will append.
+  size_t EstimateSize() const;
+
+  // Append the index to *dst.
+  // REQUIRES: Valid()
+  void Finish(std::string* dst);
+
+  void Reset();
+
+ private:
+  bool valid_;
+  std::vector<uint32_t> hashes_;
+  std::vector<uint8_t> restart_indexes_;
+};
+
+class DataBlockHashIndex {
+ public:
+  static const uint8_t kNoEntry = 255;
+  static const uint8_t kCollision = 254;
+  static const uint8_t kMaxRestartIndex = 253;
+  static const uint32_t kNumRestartsFlag = 1u << 31;
+
+  DataBlockHashIndex() : buckets_(nullptr), num_buckets_(0) {}
+
+  // Initialize from the index that ends at "limit", no earlier than
+  // "start".  Returns the start of the index, or nullptr if it is corrupt.
+  const char* Initialize(const char* start, const char* limit);
+
+  // Return the index of the restart interval that holds the entries with
+  // the same key as "key" (without the suffix of either), kNoEntry if the
+  // block has none, or kCollision if the index cannot tell.  The block
+  // may have no such entry even if a restart index is returned.
+  uint8_t Lookup(const Slice& key) const;
+
+ private:
+  const uint8_t* buckets_;
+  uint16_t num_buckets_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_DATA_BLOCK_HASH_INDEX_H_
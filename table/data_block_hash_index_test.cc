@@ -0,0 +1,175 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/data_block_hash_index.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "db/dbformat.h"
+#include "leveldb/options.h"
+#include "table/block.h"
+#include "table/block_builder.h"
+#include "table/format.h"
+#include "util/coding.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+static std::string UserKey(int i) {
+  char buf[20];
+  std::snprintf(buf, sizeof(buf), "key%06d", i);
+  return buf;
+}
+
+class DataBlockHashIndexTest : public testing::Test {
+ public:
+  DataBlockHashIndexTest()
+      : icmp_(BytewiseComparator()), builder_(&options_), block_(nullptr) {
+    options_.comparator = &icmp_;
+    options_.data_block_hash_index = true;
+  }
+
+  ~DataBlockHashIndexTest() { delete block_; }
+
+  // Add "versions" entries for each of the user keys with even numbers
+  // below 2 * n, with sequence numbers versions, ..., 1.
+  void Build(int n, int versions, int restart_interval) {
+    options_.block_restart_interval = restart_interval;
+    builder_.Reset();
+    for (int i = 0; i < n; i++) {
+      for (int v = versions; v > 0; v--) {
+        InternalKey key(UserKey(2 * i), v, kTypeValue);
+        builder_.Add(key.Encode(), std::to_string(v));
+      }
+    }
+    const size_t estimate = builder_.CurrentSizeEstimate();
+    contents_ = builder_.Finish().ToString();
+    ASSERT_EQ(estimate, contents_.size());
+    delete block_;
+    BlockContents contents;
+    contents.data = contents_;
+    contents.cachable = false;
+    contents.heap_allocated = false;
+    block_ = new Block(contents);
+  }
+
+  bool HasHashIndex() const {
+    return DecodeFixed32(contents_.data() + contents_.size() - 4) &
+           DataBlockHashIndex::kNumRestartsFlag;
+  }
+
+  // Check that a lookup of user key i at sequence number "snapshot" finds
+  // what Seek() finds, if Seek() finds an entry for user key i.
+  void CheckGet(int i, SequenceNumber snapshot) {
+    InternalKey target(UserKey(i), snapshot, kValueTypeForSeek);
+    Iterator* seek_iter = block_->NewIterator(&icmp_);
+    seek_iter->Seek(target.Encode());
+    Iterator* get_iter = block_->NewIteratorForGet(&icmp_, target.Encode());
+    if (seek_iter->Valid() &&
+        ExtractUserKey(seek_iter->key()) == Slice(UserKey(i))) {
+      ASSERT_TRUE(get_iter->Valid()) << i;
+      ASSERT_EQ(seek_iter->key().ToString(), get_iter->key().ToString());
+      ASSERT_EQ(seek_iter->value().ToString(), get_iter->value().ToString());
+    } else if (get_iter->Valid()) {
+      ASSERT_NE(Slice(UserKey(i)), ExtractUserKey(get_iter->key())) << i;
+    }
+    ASSERT_LEVELDB_OK(get_iter->status());
+    delete seek_iter;
+    delete get_iter;
+  }
+
+  int Count() {
+    Iterator* iter = block_->NewIterator(&icmp_);
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      count++;
+    }
+    delete iter;
+    return count;
+  }
+
+  InternalKeyComparator icmp_;
+  Options options_;
+  BlockBuilder builder_;
+  std::string contents_;
+  Block* block_;
+};
+
+TEST_F(DataBlockHashIndexTest, Empty) {
+  Build(0, 1, 16);
+  ASSERT_FALSE(HasHashIndex());
+  ASSERT_EQ(0, Count());
+  CheckGet(0, kMaxSequenceNumber);
+}
+
+TEST_F(DataBlockHashIndexTest, Lookups) {
+  for (int versions : {1, 3}) {
+    for (int restart_interval : {1, 2, 16}) {
+      Build(100, versions, restart_interval);
+      if (100 * versions / restart_interval <= 253) {
+        ASSERT_TRUE(HasHashIndex());
+      }
+      ASSERT_EQ(100 * versions, Count());
+      for (int i = -1; i <= 201; i++) {
+        for (int s = 0; s <= versions + 1; s++) {
+          CheckGet(i, s);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(DataBlockHashIndexTest, TooManyRestarts) {
+  Build(300, 1, 1);
+  ASSERT_FALSE(HasHashIndex());
+  ASSERT_EQ(300, Count());
+  for (int i = 0; i < 600; i += 7) {
+    CheckGet(i, kMaxSequenceNumber);
+  }
+}
+
+TEST_F(DataBlockHashIndexTest, ShortKeys) {
+  // Keys without the suffix are not indexed
+  Options options;
+  options.data_block_hash_index = true;
+  BlockBuilder builder(&options);
+  builder.Add("a", "v");
+  builder.Add("b", "v");
+  Slice block = builder.Finish();
+  ASSERT_FALSE(DecodeFixed32(block.data() + block.size() - 4) &
+               DataBlockHashIndex::kNumRestartsFlag);
+
+  DataBlockHashIndexBuilder hash_builder;
+  hash_builder.Add("short", 0);
+  ASSERT_FALSE(hash_builder.Valid());
+  hash_builder.Reset();
+  hash_builder.Add("longer than eight bytes", 0);
+  ASSERT_TRUE(hash_builder.Valid());
+}
+
+TEST_F(DataBlockHashIndexTest, MissingKeysRuledOut) {
+  Build(100, 1, 16);
+  ASSERT_TRUE(HasHashIndex());
+  int invalid = 0;
+  for (int i = 1; i < 200; i += 2) {
+    InternalKey target(UserKey(i), kMaxSequenceNumber, kValueTypeForSeek);
+    Iterator* iter = block_->NewIteratorForGet(&icmp_, target.Encode());
+    if (!iter->Valid()) {
+      invalid++;
+    }
+    delete iter;
+  }
+  // With about four buckets for every three keys, most missing keys land
+  // in empty buckets
+  ASSERT_GT(invalid, 20);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
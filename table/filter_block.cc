@@ -5,6 +5,7 @@
 #include "table/filter_block.h"
 
 #include "leveldb/filter_policy.h"
+#include "leveldb/slice_transform.h"
 #include "util/coding.h"
 
 namespace leveldb {
@@ -15,8 +16,57 @@ namespace leveldb {
 static const size_t kFilterBaseLg = 11;
 static const size_t kFilterBase = 1 << kFilterBaseLg;
 
-FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy)
-    : policy_(policy) {}
+void FilterKeys::Add(const Slice& key) {
+  Slice k = key;
+  start_.push_back(keys_.size());
+  keys_.append(k.data(), k.size());
+
+  // The prefixes are kept apart from the keys, so that the policy sees
+  // the prefixes of adjacent keys next to each other.
+  if (prefix_extractor_ != nullptr && prefix_extractor_->InDomain(k)) {
+    Slice prefix = prefix_extractor_->Transform(k);
+    if (prefix_start_.empty() ||
+        prefix != Slice(prefixes_.data() + prefix_start_.back(),
+                        prefixes_.size() - prefix_start_.back())) {
+      prefix_start_.push_back(prefixes_.size());
+      prefixes_.append(prefix.data(), prefix.size());
+    }
+  }
+}
+
+void FilterKeys::CreateFilter(const FilterPolicy* policy, std::string* dst) {
+  // Make list of keys from flattened key structure, followed by the
+  // prefixes
+  const size_t num_keys = start_.size();
+  const size_t num_prefixes = prefix_start_.size();
+  start_.push_back(keys_.size());  // Simplify length computation
+  prefix_start_.push_back(prefixes_.size());
+  tmp_keys_.resize(num_keys + num_prefixes);
+  for (size_t i = 0; i < num_keys; i++) {
+    const char* base = keys_.data() + start_[i];
+    size_t length = start_[i + 1] - start_[i];
+    tmp_keys_[i] = Slice(base, length);
+  }
+  for (size_t i = 0; i < num_prefixes; i++) {
+    const char* base = prefixes_.data() + prefix_start_[i];
+    size_t length = prefix_start_[i + 1] - prefix_start_[i];
+    tmp_keys_[num_keys + i] = Slice(base, length);
+  }
+
+  policy->CreateFilterWithPrefixes(
+      tmp_keys_.data(), static_cast<int>(num_keys),
+      tmp_keys_.data() + num_keys, static_cast<int>(num_prefixes), dst);
+
+  tmp_keys_.clear();
+  keys_.clear();
+  start_.clear();
+  prefixes_.clear();
+  prefix_start_.clear();
+}
+
+FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy,
+                                       const SliceTransform* prefix_extractor)
+    : policy_(policy), keys_(prefix_extractor) {}
 
 void FilterBlockBuilder::StartBlock(uint64_t block_offset) {
   uint64_t filter_index = (block_offset / kFilterBase);
@@ -26,14 +76,10 @@ void FilterBlockBuilder::StartBlock(uint64_t block_offset) {
   }
 }
 
-void FilterBlockBuilder::AddKey(const Slice& key) {
-  Slice k = key;
-  start_.push_back(keys_.size());
-  keys_.append(k.data(), k.size());
-}
+void FilterBlockBuilder::AddKey(const Slice& key) { keys_.Add(key); }
 
 Slice FilterBlockBuilder::Finish() {
-  if (!start_.empty()) {
+  if (!keys_.empty()) {
     GenerateFilter();
   }
 
@@ -49,29 +95,14 @@ Slice FilterBlockBuilder::Finish() {
 }
 
 void FilterBlockBuilder::GenerateFilter() {
-  const size_t num_keys = start_.size();
-  if (num_keys == 0) {
+  filter_offsets_.push_back(result_.size());
+  if (keys_.empty()) {
     // Fast path if there are no keys for this filter
-    filter_offsets_.push_back(result_.size());
     return;
   }
 
-  // Make list of keys from flattened key structure
-  start_.push_back(keys_.size());  // Simplify length computation
-  tmp_keys_.resize(num_keys);
-  for (size_t i = 0; i < num_keys; i++) {
-    const char* base = keys_.data() + start_[i];
-    size_t length = start_[i + 1] - start_[i];
-    tmp_keys_[i] = Slice(base, length);
-  }
-
   // Generate filter for current set of keys and append to result_.
-  filter_offsets_.push_back(result_.size());
-  policy_->CreateFilter(&tmp_keys_[0], static_cast<int>(num_keys), &result_);
-
-  tmp_keys_.clear();
-  keys_.clear();
-  start_.clear();
+  keys_.CreateFilter(policy_, &result_);
 }
 
 FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
@@ -88,13 +119,24 @@ FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
 }
 
 bool FilterBlockReader::KeyMayMatch(uint64_t block_offset, const Slice& key) {
+  return MayMatch(block_offset, key, false);
+}
+
+bool FilterBlockReader::PrefixMayMatch(uint64_t block_offset,
+                                       const Slice& prefix) {
+  return MayMatch(block_offset, prefix, true);
+}
+
+bool FilterBlockReader::MayMatch(uint64_t block_offset, const Slice& key,
+                                 bool prefix) {
   uint64_t index = block_offset >> base_lg_;
   if (index < num_) {
     uint32_t start = DecodeFixed32(offset_ + index * 4);
     uint32_t limit = DecodeFixed32(offset_ + index * 4 + 4);
     if (start <= limit && limit <= static_cast<size_t>(offset_ - data_)) {
       Slice filter = Slice(data_ + start, limit - start);
-      return policy_->KeyMayMatch(key, filter);
+      return prefix ? policy_->PrefixMayMatch(key, filter)
+                    : policy_->KeyMayMatch(key, filter);
     } else if (start == limit) {
       // Empty filters do not match any keys
       return false;
@@ -103,4 +145,13 @@ bool FilterBlockReader::KeyMayMatch(uint64_t block_offset, const Slice& key) {
   return true;  // Errors are treated as potential matches
 }
 
+FullFilterBlockBuilder::FullFilterBlockBuilder(
+    const FilterPolicy* policy, const SliceTransform* prefix_extractor)
+    : policy_(policy), keys_(prefix_extractor) {}
+
+Slice FullFilterBlockBuilder::Finish() {
+  keys_.CreateFilter(policy_, &result_);
+  return Slice(result_);
+}
+
 }  // namespace leveldb
@@ -14,12 +14,39 @@
 #include <string>
 #include <vector>
 
+#include "leveldb/filter_policy.h"
 #include "leveldb/slice.h"
 #include "util/hash.h"
 
 namespace leveldb {
 
-class FilterPolicy;
+class SliceTransform;
+
+// Collects the keys that go into one filter, and the prefixes of the keys
+// that are in the domain of "prefix_extractor" (if non-null).  Adjacent
+// keys with the same prefix add it only once.
+class FilterKeys {
+ public:
+  explicit FilterKeys(const SliceTransform* prefix_extractor)
+      : prefix_extractor_(prefix_extractor) {}
+
+  FilterKeys(const FilterKeys&) = delete;
+  FilterKeys& operator=(const FilterKeys&) = delete;
+
+  void Add(const Slice& key);
+  bool empty() const { return start_.empty(); }
+
+  // Append a filter for the keys added so far to *dst, and forget them.
+  void CreateFilter(const FilterPolicy* policy, std::string* dst);
+
+ private:
+  const SliceTransform* const prefix_extractor_;
+  std::string keys_;                  // Flattened key contents
+  std::vector<size_t> start_;         // Starting index in keys_ of each key
+  std::string prefixes_;              // Flattened prefixes of the keys
+  std::vector<size_t> prefix_start_;  // Starting index in prefixes_
+  std::vector<Slice> tmp_keys_;       // policy->CreateFilter() argument
+};
 
 // A FilterBlockBuilder is used to construct all of the filters for a
 // particular Table.  It generates a single string which is stored as
@@ -27,9 +54,13 @@ class FilterPolicy;
 //
 // The sequence of calls to FilterBlockBuilder must match the regexp:
 //      (StartBlock AddKey*)* Finish
+//
+// If "prefix_extractor" is non-null, the prefixes of the keys in its
+// domain are added to the filters along with the keys themselves.
 class FilterBlockBuilder {
  public:
-  explicit FilterBlockBuilder(const FilterPolicy*);
+  explicit FilterBlockBuilder(const FilterPolicy*,
+                              const SliceTransform* prefix_extractor = nullptr);
 
   FilterBlockBuilder(const FilterBlockBuilder&) = delete;
   FilterBlockBuilder& operator=(const FilterBlockBuilder&) = delete;
@@ -42,10 +73,8 @@ class FilterBlockBuilder {
   void GenerateFilter();
 
   const FilterPolicy* policy_;
-  std::string keys_;             // Flattened key contents
-  std::vector<size_t> start_;    // Starting index in keys_ of each key
+  FilterKeys keys_;              // Keys for the current filter
   std::string result_;           // Filter data computed so far
-  std::vector<Slice> tmp_keys_;  // policy_->CreateFilter() argument
   std::vector<uint32_t> filter_offsets_;
 };
 
@@ -54,8 +83,11 @@ class FilterBlockReader {
   // REQUIRES: "contents" and *policy must stay live while *this is live.
   FilterBlockReader(const FilterPolicy* policy, const Slice& contents);
   bool KeyMayMatch(uint64_t block_offset, const Slice& key);
+  bool PrefixMayMatch(uint64_t block_offset, const Slice& prefix);
 
  private:
+  bool MayMatch(uint64_t block_offset, const Slice& key, bool prefix);
+
   const FilterPolicy* policy_;
   const char* data_;    // Pointer to filter data (at block-start)
   const char* offset_;  // Pointer to beginning of offset array (at block-end)
@@ -63,6 +95,48 @@ class FilterBlockReader {
   size_t base_lg_;      // Encoding parameter (see kFilterBaseLg in .cc file)
 };
 
+// A FullFilterBlockBuilder constructs a single filter for all of the keys
+// of a Table (see Options::full_filter).  Unlike the filters built by
+// FilterBlockBuilder, it can be checked without knowing which data block
+// may hold a key, so a lookup can skip the table before searching its
+// index.  The keys are buffered until Finish().
+//
+// The sequence of calls to FullFilterBlockBuilder must match the regexp:
+//      AddKey* Finish
+class FullFilterBlockBuilder {
+ public:
+  explicit FullFilterBlockBuilder(
+      const FilterPolicy*, const SliceTransform* prefix_extractor = nullptr);
+
+  FullFilterBlockBuilder(const FullFilterBlockBuilder&) = delete;
+  FullFilterBlockBuilder& operator=(const FullFilterBlockBuilder&) = delete;
+
+  void AddKey(const Slice& key) { keys_.Add(key); }
+  Slice Finish();
+
+ private:
+  const FilterPolicy* policy_;
+  FilterKeys keys_;
+  std::string result_;
+};
+
+class FullFilterBlockReader {
+ public:
+  // REQUIRES: "contents" and *policy must stay live while *this is live.
+  FullFilterBlockReader(const FilterPolicy* policy, const Slice& contents)
+      : policy_(policy), filter_(contents) {}
+  bool KeyMayMatch(const Slice& key) const {
+    return policy_->KeyMayMatch(key, filter_);
+  }
+  bool PrefixMayMatch(const Slice& prefix) const {
+    return policy_->PrefixMayMatch(prefix, filter_);
+  }
+
+ private:
+  const FilterPolicy* policy_;
+  const Slice filter_;
+};
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_TABLE_FILTER_BLOCK_H_
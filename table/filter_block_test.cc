@@ -4,8 +4,10 @@
 
 #include "table/filter_block.h"
 
+#include "db/dbformat.h"
 #include "gtest/gtest.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/slice_transform.h"
 #include "util/coding.h"
 #include "util/hash.h"
 #include "util/logging.h"
@@ -119,6 +121,76 @@ TEST_F(FilterBlockTest, MultiChunk) {
   ASSERT_TRUE(!reader.KeyMayMatch(9000, "bar"));
 }
 
+TEST_F(FilterBlockTest, Prefixes) {
+  const SliceTransform* prefix_extractor = NewFixedPrefixTransform(3);
+  FilterBlockBuilder builder(&policy_, prefix_extractor);
+  builder.StartBlock(0);
+  builder.AddKey("foo1");
+  builder.AddKey("foo2");
+  builder.AddKey("ba");  // No prefix
+  builder.StartBlock(3100);
+  builder.AddKey("hello");
+  Slice block = builder.Finish();
+  FilterBlockReader reader(&policy_, block);
+
+  ASSERT_TRUE(reader.KeyMayMatch(0, "foo1"));
+  ASSERT_TRUE(reader.PrefixMayMatch(0, "foo"));
+  ASSERT_TRUE(reader.KeyMayMatch(0, "ba"));
+  ASSERT_TRUE(!reader.PrefixMayMatch(0, "hel"));
+  ASSERT_TRUE(reader.PrefixMayMatch(3100, "hel"));
+  ASSERT_TRUE(reader.KeyMayMatch(3100, "hello"));
+  ASSERT_TRUE(!reader.PrefixMayMatch(3100, "foo"));
+  delete prefix_extractor;
+}
+
+TEST_F(FilterBlockTest, InternalKeyPrefixes) {
+  const SliceTransform* prefix_extractor = NewFixedPrefixTransform(3);
+  InternalFilterPolicy ipolicy(&policy_);
+  InternalKeySliceTransform iprefix(prefix_extractor);
+  FilterBlockBuilder builder(&ipolicy, &iprefix);
+  builder.StartBlock(0);
+  builder.AddKey(InternalKey("foo1", 200, kTypeValue).Encode());
+  builder.AddKey(InternalKey("foo1", 100, kTypeValue).Encode());
+  builder.AddKey(InternalKey("foo2", 300, kTypeValue).Encode());
+  Slice block = builder.Finish();
+  // One hash for each user key and one for the prefix they share, followed
+  // by one filter offset, the array offset and the encoding parameter
+  ASSERT_EQ(4 * (2 + 1) + 4 + 4 + 1, block.size());
+  FilterBlockReader reader(&ipolicy, block);
+
+  ASSERT_TRUE(
+      reader.KeyMayMatch(0, InternalKey("foo2", 1, kTypeValue).Encode()));
+  ASSERT_TRUE(reader.PrefixMayMatch(0, "foo"));
+  ASSERT_TRUE(!reader.PrefixMayMatch(0, "fo"));
+  ASSERT_TRUE(
+      !reader.KeyMayMatch(0, InternalKey("foo3", 1, kTypeValue).Encode()));
+  delete prefix_extractor;
+}
+
+TEST_F(FilterBlockTest, FullFilter) {
+  const SliceTransform* prefix_extractor = NewFixedPrefixTransform(3);
+  FullFilterBlockBuilder builder(&policy_, prefix_extractor);
+  builder.AddKey("foo1");
+  builder.AddKey("foo2");
+  builder.AddKey("ba");  // No prefix
+  builder.AddKey("hello");
+  Slice block = builder.Finish();
+  // One hash for each key, and for each of the prefixes "foo" and "hel"
+  ASSERT_EQ(4 * (4 + 2), block.size());
+  FullFilterBlockReader reader(&policy_, block);
+
+  ASSERT_TRUE(reader.KeyMayMatch("foo1"));
+  ASSERT_TRUE(reader.KeyMayMatch("foo2"));
+  ASSERT_TRUE(reader.KeyMayMatch("ba"));
+  ASSERT_TRUE(reader.KeyMayMatch("hello"));
+  ASSERT_TRUE(reader.PrefixMayMatch("foo"));
+  ASSERT_TRUE(reader.PrefixMayMatch("hel"));
+  ASSERT_TRUE(!reader.KeyMayMatch("foo3"));
+  ASSERT_TRUE(!reader.KeyMayMatch("bar"));
+  ASSERT_TRUE(!reader.KeyMayMatch("missing"));
+  delete prefix_extractor;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
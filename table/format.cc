@@ -4,6 +4,9 @@
 
 #include "table/format.h"
 
+#include <cstring>
+#include <vector>
+
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "table/block.h"
@@ -61,22 +64,31 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
-Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
-                 const BlockHandle& handle, BlockContents* result) {
-  result->data = Slice();
-  result->cachable = false;
-  result->heap_allocated = false;
-
-  // Read the block contents as well as the type/crc footer.
-  // See table_builder.cc for the code that built this structure.
-  size_t n = static_cast<size_t>(handle.size());
-  char* buf = new char[n + kBlockTrailerSize];
-  Slice contents;
-  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
-  if (!s.ok()) {
-    delete[] buf;
-    return s;
+// Fill *result with the uncompressed contents of the n bytes at "data",
+// which are compressed with Snappy.
+static Status SnappyUncompressBlock(const char* data, size_t n,
+                                    BlockContents* result) {
+  size_t ulength = 0;
+  if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  char* ubuf = new char[ulength];
+  if (!port::Snappy_Uncompress(data, n, ubuf)) {
+    delete[] ubuf;
+    return Status::Corruption("corrupted compressed block contents");
   }
+  result->data = Slice(ubuf, ulength);
+  result->heap_allocated = true;
+  result->cachable = true;
+  return Status::OK();
+}
+
+// Check the block of size n that was read into "contents", using "buf"
+// as scratch space, and fill *result with it.  Takes ownership of buf.
+// If "raw" is non-null, the block and its type byte are copied to *raw.
+static Status ParseBlockContents(const ReadOptions& options, size_t n,
+                                 char* buf, const Slice& contents,
+                                 BlockContents* result, std::string* raw) {
   if (contents.size() != n + kBlockTrailerSize) {
     delete[] buf;
     return Status::Corruption("truncated block read");
@@ -89,10 +101,12 @@ Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
     const uint32_t actual = crc32c::Value(data, n + 1);
     if (actual != crc) {
       delete[] buf;
-      s = Status::Corruption("block checksum mismatch");
-      return s;
+      return Status::Corruption("block checksum mismatch");
     }
   }
+  if (raw != nullptr) {
+    raw->assign(data, n + 1);
+  }
 
   switch (data[n]) {
     case kNoCompression:
@@ -113,22 +127,9 @@ Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
       // Ok
       break;
     case kSnappyCompression: {
-      size_t ulength = 0;
-      if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
-        delete[] buf;
-        return Status::Corruption("corrupted compressed block contents");
-      }
-      char* ubuf = new char[ulength];
-      if (!port::Snappy_Uncompress(data, n, ubuf)) {
-        delete[] buf;
-        delete[] ubuf;
-        return Status::Corruption("corrupted compressed block contents");
-      }
+      Status s = SnappyUncompressBlock(data, n, result);
       delete[] buf;
-      result->data = Slice(ubuf, ulength);
-      result->heap_allocated = true;
-      result->cachable = true;
-      break;
+      return s;
     }
     default:
       delete[] buf;
@@ -138,4 +139,75 @@ Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
   return Status::OK();
 }
 
+Status UncompressBlockContents(const Slice& raw, BlockContents* result) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+  if (raw.empty()) {
+    return Status::Corruption("truncated block contents");
+  }
+
+  const size_t n = raw.size() - 1;
+  switch (raw[n]) {
+    case kNoCompression: {
+      char* buf = new char[n];
+      std::memcpy(buf, raw.data(), n);
+      result->data = Slice(buf, n);
+      result->heap_allocated = true;
+      result->cachable = true;
+      return Status::OK();
+    }
+    case kSnappyCompression:
+      return SnappyUncompressBlock(raw.data(), n, result);
+    default:
+      return Status::Corruption("bad block type");
+  }
+}
+
+Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
+                 const BlockHandle& handle, BlockContents* result,
+                 std::string* raw) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+
+  // Read the block contents as well as the type/crc footer.
+  // See table_builder.cc for the code that built this structure.
+  size_t n = static_cast<size_t>(handle.size());
+  char* buf = new char[n + kBlockTrailerSize];
+  Slice contents;
+  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
+  if (!s.ok()) {
+    delete[] buf;
+    return s;
+  }
+  return ParseBlockContents(options, n, buf, contents, result, raw);
+}
+
+void ReadBlocks(RandomAccessFile* file, const ReadOptions& options, size_t n,
+                const BlockHandle* handles, BlockContents* results,
+                Status* statuses, std::string* raws) {
+  std::vector<ReadRequest> reqs(n);
+  for (size_t i = 0; i < n; i++) {
+    results[i].data = Slice();
+    results[i].cachable = false;
+    results[i].heap_allocated = false;
+    reqs[i].offset = handles[i].offset();
+    reqs[i].n = static_cast<size_t>(handles[i].size()) + kBlockTrailerSize;
+    reqs[i].scratch = new char[reqs[i].n];
+  }
+  file->MultiRead(reqs.data(), n);
+  for (size_t i = 0; i < n; i++) {
+    if (!reqs[i].status.ok()) {
+      delete[] reqs[i].scratch;
+      statuses[i] = reqs[i].status;
+    } else {
+      statuses[i] = ParseBlockContents(
+          options, static_cast<size_t>(handles[i].size()), reqs[i].scratch,
+          reqs[i].result, &results[i],
+          raws != nullptr ? &raws[i] : nullptr);
+    }
+  }
+}
+
 }  // namespace leveldb
@@ -85,9 +85,24 @@ struct BlockContents {
 };
 
 // Read the block identified by "handle" from "file".  On failure
-// return non-OK.  On success fill *result and return OK.
+// return non-OK.  On success fill *result and return OK.  If "raw" is
+// non-null, it is also set to the block as stored in the file, which may
+// be compressed, followed by its one byte compression type.
 Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
-                 const BlockHandle& handle, BlockContents* result);
+                 const BlockHandle& handle, BlockContents* result,
+                 std::string* raw = nullptr);
+
+// Read the n blocks identified by handles[] from "file" with a single
+// RandomAccessFile::MultiRead() call, and store the outcome for each
+// block in results[i], statuses[i] and, if "raws" is non-null, raws[i]
+// as ReadBlock() would.
+void ReadBlocks(RandomAccessFile* file, const ReadOptions& options, size_t n,
+                const BlockHandle* handles, BlockContents* results,
+                Status* statuses, std::string* raws = nullptr);
+
+// Fill *result with the uncompressed contents of a block that "raw" holds
+// in the form ReadBlock() stores in *raw.
+Status UncompressBlockContents(const Slice& raw, BlockContents* result);
 
 // Implementation details follow.  Clients should ignore,
 
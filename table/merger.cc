@@ -4,6 +4,8 @@
 
 #include "table/merger.h"
 
+#include <vector>
+
 #include "leveldb/comparator.h"
 #include "leveldb/iterator.h"
 #include "table/iterator_wrapper.h"
@@ -22,6 +24,7 @@ class MergingIterator : public Iterator {
     for (int i = 0; i < n; i++) {
       children_[i].Set(children[i]);
     }
+    heap_.reserve(n);
   }
 
   ~MergingIterator() override { delete[] children_; }
@@ -32,24 +35,24 @@ class MergingIterator : public Iterator {
     for (int i = 0; i < n_; i++) {
       children_[i].SeekToFirst();
     }
-    FindSmallest();
     direction_ = kForward;
+    BuildHeap();
   }
 
   void SeekToLast() override {
     for (int i = 0; i < n_; i++) {
       children_[i].SeekToLast();
     }
-    FindLargest();
     direction_ = kReverse;
+    BuildHeap();
   }
 
   void Seek(const Slice& target) override {
     for (int i = 0; i < n_; i++) {
       children_[i].Seek(target);
     }
-    FindSmallest();
     direction_ = kForward;
+    BuildHeap();
   }
 
   void Next() override {
@@ -72,10 +75,13 @@ class MergingIterator : public Iterator {
         }
       }
       direction_ = kForward;
+      // All children moved and the heap order changed, so rebuild it
+      current_->Next();
+      BuildHeap();
+    } else {
+      current_->Next();
+      UpdateTop();
     }
-
-    current_->Next();
-    FindSmallest();
   }
 
   void Prev() override {
@@ -101,10 +107,13 @@ class MergingIterator : public Iterator {
         }
       }
       direction_ = kReverse;
+      // All children moved and the heap order changed, so rebuild it
+      current_->Prev();
+      BuildHeap();
+    } else {
+      current_->Prev();
+      UpdateTop();
     }
-
-    current_->Prev();
-    FindLargest();
   }
 
   Slice key() const override {
@@ -132,47 +141,83 @@ class MergingIterator : public Iterator {
   // Which direction is the iterator moving?
   enum Direction { kForward, kReverse };
 
-  void FindSmallest();
-  void FindLargest();
+  // Return true if "a" comes before "b" in the current direction.  Equal
+  // keys come in the order of the children when moving forward, and in
+  // the reverse order when moving backwards.
+  bool Precedes(const IteratorWrapper* a, const IteratorWrapper* b) const {
+    const int r = comparator_->Compare(a->key(), b->key());
+    if (direction_ == kForward) {
+      return r < 0 || (r == 0 && a < b);
+    } else {
+      return r > 0 || (r == 0 && a > b);
+    }
+  }
+
+  // Make a heap of the valid children and point current_ at its top.
+  void BuildHeap();
+
+  // Restore the heap after current_, its top, moved.
+  void UpdateTop();
+
+  void SiftDown(size_t index);
 
-  // We might want to use a heap in case there are lots of children.
-  // For now we use a simple array since we expect a very small number
-  // of children in leveldb.
   const Comparator* comparator_;
   IteratorWrapper* children_;
   int n_;
   IteratorWrapper* current_;
   Direction direction_;
+
+  // The valid children, in a heap ordered by Precedes() whose top is the
+  // smallest child when moving forward and the largest when moving
+  // backwards.  A step costs about 2*log2(n) comparisons instead of n.
+  std::vector<IteratorWrapper*> heap_;
 };
 
-void MergingIterator::FindSmallest() {
-  IteratorWrapper* smallest = nullptr;
+void MergingIterator::BuildHeap() {
+  heap_.clear();
   for (int i = 0; i < n_; i++) {
-    IteratorWrapper* child = &children_[i];
-    if (child->Valid()) {
-      if (smallest == nullptr) {
-        smallest = child;
-      } else if (comparator_->Compare(child->key(), smallest->key()) < 0) {
-        smallest = child;
-      }
+    if (children_[i].Valid()) {
+      heap_.push_back(&children_[i]);
     }
   }
-  current_ = smallest;
+  for (size_t i = heap_.size() / 2; i > 0; i--) {
+    SiftDown(i - 1);
+  }
+  current_ = heap_.empty() ? nullptr : heap_[0];
 }
 
-void MergingIterator::FindLargest() {
-  IteratorWrapper* largest = nullptr;
-  for (int i = n_ - 1; i >= 0; i--) {
-    IteratorWrapper* child = &children_[i];
-    if (child->Valid()) {
-      if (largest == nullptr) {
-        largest = child;
-      } else if (comparator_->Compare(child->key(), largest->key()) > 0) {
-        largest = child;
-      }
+void MergingIterator::UpdateTop() {
+  assert(!heap_.empty() && heap_[0] == current_);
+  if (!current_->Valid()) {
+    heap_[0] = heap_.back();
+    heap_.pop_back();
+  }
+  if (heap_.empty()) {
+    current_ = nullptr;
+    return;
+  }
+  SiftDown(0);
+  current_ = heap_[0];
+}
+
+void MergingIterator::SiftDown(size_t index) {
+  IteratorWrapper* const child = heap_[index];
+  const size_t size = heap_.size();
+  while (true) {
+    size_t next = 2 * index + 1;
+    if (next >= size) {
+      break;
+    }
+    if (next + 1 < size && Precedes(heap_[next + 1], heap_[next])) {
+      next++;
+    }
+    if (!Precedes(heap_[next], child)) {
+      break;
     }
+    heap_[index] = heap_[next];
+    index = next;
   }
-  current_ = largest;
+  heap_[index] = child;
 }
 }  // namespace
 
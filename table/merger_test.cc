@@ -0,0 +1,237 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/merger.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "benchmark/benchmark.h"
+#include "leveldb/comparator.h"
+#include "leveldb/iterator.h"
+#include "util/random.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+typedef std::vector<std::pair<std::string, std::string>> Entries;
+
+// An iterator over sorted entries that it does not own.
+class EntriesIterator : public Iterator {
+ public:
+  explicit EntriesIterator(const Entries* entries)
+      : entries_(entries), index_(entries->size()) {}
+
+  bool Valid() const override { return index_ < entries_->size(); }
+  void SeekToFirst() override { index_ = 0; }
+  void SeekToLast() override {
+    index_ = entries_->empty() ? 0 : entries_->size() - 1;
+  }
+  void Seek(const Slice& target) override {
+    index_ = std::lower_bound(entries_->begin(), entries_->end(), target,
+                              [](const Entries::value_type& entry,
+                                 const Slice& target) {
+                                return Slice(entry.first).compare(target) < 0;
+                              }) -
+             entries_->begin();
+  }
+  void Next() override {
+    assert(Valid());
+    index_++;
+  }
+  void Prev() override {
+    assert(Valid());
+    index_ = (index_ == 0) ? entries_->size() : index_ - 1;
+  }
+  Slice key() const override { return (*entries_)[index_].first; }
+  Slice value() const override { return (*entries_)[index_].second; }
+  Status status() const override { return Status::OK(); }
+
+ private:
+  const Entries* const entries_;
+  size_t index_;
+};
+
+static std::string NumberKey(int i) {
+  char buf[20];
+  std::snprintf(buf, sizeof(buf), "%08d", i);
+  return buf;
+}
+
+class MergerTest : public testing::Test {
+ public:
+  // Spread keys 0, 2, ..., 2 * (num_keys - 1) over "n" children at random.
+  // The value of each entry is the index of its child.
+  void Build(int n, int num_keys, Random* rnd) {
+    children_.assign(n, Entries());
+    expected_.clear();
+    for (int i = 0; n > 0 && i < num_keys; i++) {
+      const int child = rnd->Uniform(n);
+      children_[child].emplace_back(NumberKey(2 * i), std::to_string(child));
+      expected_.push_back(children_[child].back());
+    }
+  }
+
+  Iterator* NewMerger() {
+    std::vector<Iterator*> list;
+    for (const Entries& entries : children_) {
+      list.push_back(new EntriesIterator(&entries));
+    }
+    return NewMergingIterator(BytewiseComparator(), list.data(), list.size());
+  }
+
+  std::string Entry(size_t index) const {
+    if (index >= expected_.size()) {
+      return "(invalid)";
+    }
+    return expected_[index].first + "->" + expected_[index].second;
+  }
+
+  static std::string Entry(Iterator* iter) {
+    if (!iter->Valid()) {
+      return "(invalid)";
+    }
+    return iter->key().ToString() + "->" + iter->value().ToString();
+  }
+
+  std::vector<Entries> children_;
+  Entries expected_;
+};
+
+TEST_F(MergerTest, Empty) {
+  for (int n : {0, 1, 3}) {
+    Random rnd(test::RandomSeed());
+    Build(n, 0, &rnd);
+    Iterator* iter = NewMerger();
+    iter->SeekToFirst();
+    ASSERT_TRUE(!iter->Valid());
+    iter->SeekToLast();
+    ASSERT_TRUE(!iter->Valid());
+    iter->Seek("a");
+    ASSERT_TRUE(!iter->Valid());
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+  }
+}
+
+TEST_F(MergerTest, Randomized) {
+  Random rnd(test::RandomSeed());
+  for (int n : {1, 2, 3, 8, 20}) {
+    Build(n, 500, &rnd);
+    Iterator* iter = NewMerger();
+
+    // Full scans in both directions
+    size_t index = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      ASSERT_EQ(Entry(index), Entry(iter));
+      index++;
+    }
+    ASSERT_EQ(expected_.size(), index);
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      index--;
+      ASSERT_EQ(Entry(index), Entry(iter));
+    }
+    ASSERT_EQ(0, index);
+
+    // Random moves, which switch direction often
+    index = expected_.size();
+    for (int i = 0; i < 2000; i++) {
+      switch (rnd.Uniform(5)) {
+        case 0: {
+          const int k = rnd.Uniform(2 * expected_.size() + 2);
+          iter->Seek(NumberKey(k));
+          index = (k + 1) / 2;
+          break;
+        }
+        case 1:
+          iter->SeekToFirst();
+          index = 0;
+          break;
+        case 2:
+          iter->SeekToLast();
+          index = expected_.size() - 1;
+          break;
+        case 3:
+          if (iter->Valid()) {
+            iter->Next();
+            index++;
+          }
+          break;
+        case 4:
+          if (iter->Valid()) {
+            iter->Prev();
+            index = (index == 0) ? expected_.size() : index - 1;
+          }
+          break;
+      }
+      ASSERT_EQ(Entry(index), Entry(iter)) << n << " children, step " << i;
+    }
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+  }
+}
+
+TEST_F(MergerTest, EqualKeys) {
+  // Equal keys come in the order of the children moving forward, and in
+  // the reverse order moving backwards
+  children_.assign(3, Entries());
+  for (int c = 0; c < 3; c++) {
+    children_[c].emplace_back("a", std::to_string(c));
+    children_[c].emplace_back("b" + std::to_string(c), std::to_string(c));
+  }
+  Iterator* iter = NewMerger();
+  std::string forward;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    forward += Entry(iter) + " ";
+  }
+  ASSERT_EQ("a->0 a->1 a->2 b0->0 b1->1 b2->2 ", forward);
+  std::string reverse;
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    reverse += Entry(iter) + " ";
+  }
+  ASSERT_EQ("b2->2 b1->1 b0->0 a->2 a->1 a->0 ", reverse);
+  delete iter;
+}
+
+// Scan 100000 keys spread round-robin over state.range(0) children, like
+// a DB with many level-0 files whose key ranges overlap.
+static void BM_MergingIteratorScan(benchmark::State& state) {
+  const int num_children = state.range(0);
+  const int num_keys = 100000;
+  std::vector<Entries> children(num_children);
+  for (int i = 0; i < num_keys; i++) {
+    children[i % num_children].emplace_back(NumberKey(i), "v");
+  }
+  std::vector<Iterator*> list;
+  for (const Entries& entries : children) {
+    list.push_back(new EntriesIterator(&entries));
+  }
+  Iterator* iter =
+      NewMergingIterator(BytewiseComparator(), list.data(), list.size());
+
+  for (auto _ : state) {
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      count++;
+    }
+    if (count != num_keys) {
+      state.SkipWithError("scan lost keys");
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_keys);
+  delete iter;
+}
+
+BENCHMARK(BM_MergingIteratorScan)->Arg(2)->Arg(8)->Arg(20)->Arg(40);
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return RUN_ALL_TESTS();
+}
@@ -4,39 +4,149 @@
 
 #include "leveldb/table.h"
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "leveldb/cache.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/persistent_cache.h"
+#include "leveldb/pinnable_slice.h"
+#include "leveldb/slice_transform.h"
 #include "table/block.h"
+#include "table/block_cache_stats.h"
 #include "table/filter_block.h"
 #include "table/format.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
+#include "util/crc32c.h"
 
 namespace leveldb {
 
 struct Table::Rep {
   ~Rep() {
     delete filter;
+    delete full_filter;
     delete[] filter_data;
     delete index_block;
   }
 
+  enum FilterType { kNoFilter, kBlockFilter, kFullFilter, kPartitionedFilter };
+
+  // Whether a metadata block read into "contents" is to be kept in
+  // options.block_cache instead of being pinned.
+  bool CachesMetaBlock(const BlockContents& contents) const {
+    return options.cache_index_and_filter_blocks &&
+           options.block_cache != nullptr && contents.cachable;
+  }
+
+  // Return an iterator over "block" for a point lookup of "key" (see
+  // Block::NewIteratorForGet()).  The block's hash index is only used if
+  // options.data_block_hash_index is set.
+  Iterator* NewBlockIteratorForGet(Block* block, const Slice& key) const {
+    if (options.data_block_hash_index) {
+      return block->NewIteratorForGet(options.comparator, key);
+    }
+    Iterator* iter = block->NewIterator(options.comparator);
+    iter->Seek(key);
+    return iter;
+  }
+
+  void RecordLookup(BlockCacheStats::BlockType type, bool hit) const {
+    if (block_cache_stats != nullptr) {
+      block_cache_stats->RecordLookup(type, hit);
+    }
+  }
+
+  void RecordInsert(BlockCacheStats::BlockType type) const {
+    if (block_cache_stats != nullptr) {
+      block_cache_stats->RecordInsert(type);
+    }
+  }
+
   Options options;
   Status status;
   RandomAccessFile* file;
+  uint64_t file_size;
   uint64_t cache_id;
+  uint64_t compressed_cache_id;
+  // Prefix of the keys of the table's blocks in options.persistent_cache,
+  // or empty if the table does not use it.
+  std::string persistent_cache_prefix;
+  BlockCacheStats* block_cache_stats;  // Null if not counted
+  FilterType filter_type;
+  // A block-based or full filter is pinned in filter or full_filter, or
+  // else kept in options.block_cache under filter_handle.
   FilterBlockReader* filter;
+  FullFilterBlockReader* full_filter;
+  BlockHandle filter_handle;
   const char* filter_data;
+  bool prefix_filtered;  // Filter holds prefixes of options.prefix_extractor
+
+  // If partitioned_index, the index block is the top-level index.  Its
+  // values are the handles of the index partitions, followed by the
+  // handles of their filter partitions if filter_type is
+  // kPartitionedFilter.
+  bool partitioned_index;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
-  Block* index_block;
+  BlockHandle index_handle;
+  Block* index_block;  // Null if kept in options.block_cache
+};
+
+static void DeleteBlock(void* arg, void* ignored) {
+  delete reinterpret_cast<Block*>(arg);
+}
+
+static void DeleteCachedBlock(const Slice& key, void* value) {
+  Block* block = reinterpret_cast<Block*>(value);
+  delete block;
+}
+
+static void DeleteCachedRawBlock(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+static void ReleaseBlock(void* arg, void* h) {
+  Cache* cache = reinterpret_cast<Cache*>(arg);
+  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
+  cache->Release(handle);
+}
+
+// A filter block or filter partition, as held by the block cache.
+struct CachedFilter {
+  ~CachedFilter() {
+    if (heap_allocated) {
+      delete[] data.data();
+    }
+  }
+
+  Slice data;
+  bool heap_allocated;
 };
 
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  delete reinterpret_cast<CachedFilter*>(value);
+}
+
 Status Table::Open(const Options& options, RandomAccessFile* file,
                    uint64_t size, Table** table) {
+  return InternalOpen(options, file, size, nullptr, nullptr, table);
+}
+
+Status Table::Open(const Options& options, RandomAccessFile* file,
+                   uint64_t size, uint64_t file_number, Table** table) {
+  return InternalOpen(options, file, size, &file_number, nullptr, table);
+}
+
+Status Table::InternalOpen(const Options& options, RandomAccessFile* file,
+                           uint64_t size, const uint64_t* file_number,
+                           BlockCacheStats* stats, Table** table) {
   *table = nullptr;
   if (size < Footer::kEncodedLength) {
     return Status::Corruption("file is too short to be an sstable");
@@ -67,11 +177,44 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     Rep* rep = new Table::Rep;
     rep->options = options;
     rep->file = file;
+    rep->file_size = size;
     rep->metaindex_handle = footer.metaindex_handle();
+    rep->index_handle = footer.index_handle();
     rep->index_block = index_block;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+    rep->compressed_cache_id = (options.compressed_block_cache
+                                    ? options.compressed_block_cache->NewId()
+                                    : 0);
+    if (options.persistent_cache != nullptr && file_number != nullptr) {
+      // File numbers are reused if the DB is destroyed and created again,
+      // so the checksum of the index block tells the tables apart.
+      PutFixed64(&rep->persistent_cache_prefix, *file_number);
+      PutFixed32(&rep->persistent_cache_prefix,
+                 crc32c::Value(index_block_contents.data.data(),
+                               index_block_contents.data.size()));
+    }
+    rep->block_cache_stats = stats;
+    rep->filter_type = Rep::kNoFilter;
     rep->filter_data = nullptr;
     rep->filter = nullptr;
+    rep->full_filter = nullptr;
+    rep->prefix_filtered = false;
+    rep->partitioned_index = false;
+    if (rep->CachesMetaBlock(index_block_contents)) {
+      // Hand the block over to the cache, which the first reads will find
+      // it in.
+      char cache_key_buffer[16];
+      EncodeFixed64(cache_key_buffer, rep->cache_id);
+      EncodeFixed64(cache_key_buffer + 8, rep->index_handle.offset());
+      Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+      Cache* block_cache = options.block_cache;
+      block_cache->Release(block_cache->Insert(key, index_block,
+                                               index_block->size(),
+                                               &DeleteCachedBlock,
+                                               Cache::Priority::kHigh));
+      rep->RecordInsert(BlockCacheStats::kIndexBlock);
+      rep->index_block = nullptr;
+    }
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   }
@@ -80,12 +223,12 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
 }
 
 void Table::ReadMeta(const Footer& footer) {
-  if (rep_->options.filter_policy == nullptr) {
-    return;  // Do not need any metadata
+  // An empty metaindex block holds nothing but its restart array: one
+  // restart point and the number of restart points.
+  if (footer.metaindex_handle().size() <= 2 * sizeof(uint32_t)) {
+    return;  // No metadata
   }
 
-  // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
-  // it is an empty block.
   ReadOptions opt;
   if (rep_->options.paranoid_checks) {
     opt.verify_checksums = true;
@@ -98,17 +241,45 @@ void Table::ReadMeta(const Footer& footer) {
   Block* meta = new Block(contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
-  key.append(rep_->options.filter_policy->Name());
+  std::string key = "partitionedindex";
   iter->Seek(key);
-  if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+  rep_->partitioned_index = iter->Valid() && iter->key() == Slice(key);
+  if (rep_->options.filter_policy != nullptr) {
+    if (rep_->partitioned_index) {
+      key = "partitionedfilter.";
+      key.append(rep_->options.filter_policy->Name());
+      iter->Seek(key);
+      if (iter->Valid() && iter->key() == Slice(key)) {
+        rep_->filter_type = Rep::kPartitionedFilter;
+      }
+    } else {
+      key = "filter.";
+      key.append(rep_->options.filter_policy->Name());
+      iter->Seek(key);
+      if (iter->Valid() && iter->key() == Slice(key)) {
+        ReadFilter(iter->value(), false);
+      } else {
+        key = "fullfilter.";
+        key.append(rep_->options.filter_policy->Name());
+        iter->Seek(key);
+        if (iter->Valid() && iter->key() == Slice(key)) {
+          ReadFilter(iter->value(), true);
+        }
+      }
+    }
+  }
+  if (rep_->filter_type != Rep::kNoFilter &&
+      rep_->options.prefix_extractor != nullptr) {
+    key = "prefix.";
+    key.append(rep_->options.prefix_extractor->Name());
+    iter->Seek(key);
+    rep_->prefix_filtered = iter->Valid() && iter->key() == Slice(key);
   }
   delete iter;
   delete meta;
 }
 
-void Table::ReadFilter(const Slice& filter_handle_value) {
+void Table::ReadFilter(const Slice& filter_handle_value, bool full) {
   Slice v = filter_handle_value;
   BlockHandle filter_handle;
   if (!filter_handle.DecodeFrom(&v).ok()) {
@@ -125,75 +296,332 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
     return;
   }
+  rep_->filter_type = full ? Rep::kFullFilter : Rep::kBlockFilter;
+  if (rep_->CachesMetaBlock(block)) {
+    CachedFilter* filter = new CachedFilter;
+    filter->data = block.data;
+    filter->heap_allocated = block.heap_allocated;
+    char cache_key_buffer[16];
+    EncodeFixed64(cache_key_buffer, rep_->cache_id);
+    EncodeFixed64(cache_key_buffer + 8, filter_handle.offset());
+    Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+    Cache* block_cache = rep_->options.block_cache;
+    block_cache->Release(block_cache->Insert(key, filter, filter->data.size(),
+                                             &DeleteCachedFilter,
+                                             Cache::Priority::kHigh));
+    rep_->RecordInsert(BlockCacheStats::kFilterBlock);
+    rep_->filter_handle = filter_handle;
+    return;
+  }
   if (block.heap_allocated) {
     rep_->filter_data = block.data.data();  // Will need to delete later
   }
-  rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
+  if (full) {
+    rep_->full_filter =
+        new FullFilterBlockReader(rep_->options.filter_policy, block.data);
+  } else {
+    rep_->filter =
+        new FilterBlockReader(rep_->options.filter_policy, block.data);
+  }
 }
 
 Table::~Table() { delete rep_; }
 
-static void DeleteBlock(void* arg, void* ignored) {
-  delete reinterpret_cast<Block*>(arg);
+namespace {
+
+const int kSequentialReads = 2;
+const size_t kInitialReadahead = 8 * 1024;
+const size_t kMaxReadahead = 256 * 1024;
+
+// Wraps the file of a table for a single iterator.  Once the iterator has
+// made kSequentialReads reads that each start where the one before ended,
+// a read that misses the buffer reads ahead kInitialReadahead bytes, and
+// each such read after that twice as much, up to kMaxReadahead.  Any other
+// read starts over.  With a fixed readahead size, every read that misses
+// the buffer reads ahead that much.  Reads ahead stop at the end of the
+// file.  Files whose Read() returns memory of their own, like
+// memory-mapped files, are read directly.
+//
+// Like the iterator, not safe for concurrent use.
+class ReadaheadFile : public RandomAccessFile {
+ public:
+  ReadaheadFile(RandomAccessFile* file, uint64_t file_size,
+                size_t readahead_size)
+      : file_(file),
+        file_size_(file_size),
+        fixed_(readahead_size > 0),
+        readahead_size_(fixed_ ? readahead_size : kInitialReadahead),
+        direct_(false),
+        buffer_(nullptr),
+        buffer_capacity_(0),
+        buffer_offset_(0),
+        buffer_size_(0),
+        next_offset_(~uint64_t{0}),
+        sequential_reads_(0) {}
+
+  ~ReadaheadFile() override { delete[] buffer_; }
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override {
+    if (offset == next_offset_) {
+      sequential_reads_++;
+    } else {
+      sequential_reads_ = 0;
+      if (!fixed_) {
+        readahead_size_ = kInitialReadahead;
+      }
+    }
+    next_offset_ = offset + n;
+
+    if (offset >= buffer_offset_ &&
+        offset + n <= buffer_offset_ + buffer_size_) {
+      std::memcpy(scratch, buffer_ + (offset - buffer_offset_), n);
+      *result = Slice(scratch, n);
+      return Status::OK();
+    }
+    const size_t size = static_cast<size_t>(
+        std::min<uint64_t>(readahead_size_, file_size_ - offset));
+    if (direct_ || offset >= file_size_ || n >= size ||
+        (!fixed_ && sequential_reads_ < kSequentialReads)) {
+      Status s = file_->Read(offset, n, result, scratch);
+      direct_ = direct_ || (s.ok() && result->data() != scratch);
+      return s;
+    }
+
+    if (buffer_capacity_ < size) {
+      delete[] buffer_;
+      buffer_ = new char[size];
+      buffer_capacity_ = size;
+    }
+    buffer_size_ = 0;
+    Slice data;
+    Status s = file_->Read(offset, size, &data, buffer_);
+    if (!s.ok()) {
+      return s;
+    }
+    if (data.data() != buffer_) {
+      direct_ = true;
+      return file_->Read(offset, n, result, scratch);
+    }
+    buffer_offset_ = offset;
+    buffer_size_ = data.size();
+    n = std::min(n, buffer_size_);
+    std::memcpy(scratch, buffer_, n);
+    *result = Slice(scratch, n);
+    if (!fixed_) {
+      readahead_size_ = std::min(2 * readahead_size_, kMaxReadahead);
+    }
+    return Status::OK();
+  }
+
+ private:
+  RandomAccessFile* const file_;
+  const uint64_t file_size_;
+  const bool fixed_;
+  mutable size_t readahead_size_;
+  mutable bool direct_;  // Whether to stop reading ahead
+  mutable char* buffer_;
+  mutable size_t buffer_capacity_;
+  mutable uint64_t buffer_offset_;  // Offset in the file of buffer_[0]
+  mutable size_t buffer_size_;      // Number of bytes of the file in buffer_
+  mutable uint64_t next_offset_;    // Offset just past the last read
+  mutable int sequential_reads_;
+};
+
+// What the data blocks of a table iterator are read through.
+struct DataBlockSource {
+  DataBlockSource(const Table* t, RandomAccessFile* f, uint64_t file_size,
+                  size_t readahead_size)
+      : table(t), file(f, file_size, readahead_size) {}
+
+  const Table* const table;
+  ReadaheadFile file;
+};
+
+void DeleteDataBlockSource(void* arg, void* ignored) {
+  delete reinterpret_cast<DataBlockSource*>(arg);
 }
 
-static void DeleteCachedBlock(const Slice& key, void* value) {
-  Block* block = reinterpret_cast<Block*>(value);
-  delete block;
+}  // namespace
+
+Status Table::ReadDataBlock(const ReadOptions& options,
+                            const BlockHandle& handle, bool index,
+                            RandomAccessFile* file, Block** block,
+                            Cache::Handle** cache_handle) const {
+  Cache* block_cache = rep_->options.block_cache;
+  *block = nullptr;
+  *cache_handle = nullptr;
+
+  Status s;
+  BlockContents contents;
+  if (block_cache != nullptr) {
+    char cache_key_buffer[16];
+    EncodeFixed64(cache_key_buffer, rep_->cache_id);
+    EncodeFixed64(cache_key_buffer + 8, handle.offset());
+    Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+    const BlockCacheStats::BlockType type =
+        index ? BlockCacheStats::kIndexBlock : BlockCacheStats::kDataBlock;
+    // Index blocks are inserted with a high priority
+    const Cache::Priority priority =
+        index ? Cache::Priority::kHigh : Cache::Priority::kLow;
+    *cache_handle = block_cache->Lookup(key);
+    rep_->RecordLookup(type, *cache_handle != nullptr);
+    if (*cache_handle != nullptr) {
+      *block = reinterpret_cast<Block*>(block_cache->Value(*cache_handle));
+    } else {
+      s = ReadUncachedBlock(options, handle, file, &contents);
+      if (s.ok()) {
+        *block = new Block(contents);
+        if (contents.cachable && options.fill_cache) {
+          *cache_handle = block_cache->Insert(key, *block, (*block)->size(),
+                                              &DeleteCachedBlock, priority);
+          rep_->RecordInsert(type);
+        }
+      }
+    }
+  } else {
+    s = ReadUncachedBlock(options, handle, file, &contents);
+    if (s.ok()) {
+      *block = new Block(contents);
+    }
+  }
+  return s;
 }
 
-static void ReleaseBlock(void* arg, void* h) {
-  Cache* cache = reinterpret_cast<Cache*>(arg);
-  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
-  cache->Release(handle);
+Status Table::ReadUncachedBlock(const ReadOptions& options,
+                                const BlockHandle& handle,
+                                RandomAccessFile* file,
+                                BlockContents* contents) const {
+  if (!HasSecondaryCache()) {
+    return ReadBlock(file, options, handle, contents);
+  }
+  Status s;
+  if (LookupSecondaryBlock(handle, contents, &s)) {
+    return s;
+  }
+  if (!options.fill_cache) {
+    return ReadBlock(file, options, handle, contents);
+  }
+  std::string* raw = new std::string;
+  s = ReadBlock(file, options, handle, contents, raw);
+  if (s.ok()) {
+    InsertSecondaryBlock(handle, *contents, raw);
+  } else {
+    delete raw;
+  }
+  return s;
+}
+
+bool Table::HasSecondaryCache() const {
+  return rep_->options.compressed_block_cache != nullptr ||
+         !rep_->persistent_cache_prefix.empty();
+}
+
+bool Table::LookupSecondaryBlock(const BlockHandle& handle,
+                                 BlockContents* contents, Status* s) const {
+  Cache* compressed_cache = rep_->options.compressed_block_cache;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->compressed_cache_id);
+  EncodeFixed64(cache_key_buffer + 8, handle.offset());
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  if (compressed_cache != nullptr) {
+    Cache::Handle* cache_handle = compressed_cache->Lookup(key);
+    if (cache_handle != nullptr) {
+      const std::string* raw =
+          reinterpret_cast<std::string*>(compressed_cache->Value(cache_handle));
+      *s = UncompressBlockContents(*raw, contents);
+      compressed_cache->Release(cache_handle);
+      return true;
+    }
+  }
+
+  if (rep_->persistent_cache_prefix.empty()) {
+    return false;
+  }
+  std::string persistent_key = rep_->persistent_cache_prefix;
+  PutFixed64(&persistent_key, handle.offset());
+  std::string* raw = new std::string;
+  if (!rep_->options.persistent_cache->Lookup(persistent_key, raw).ok()) {
+    delete raw;
+    return false;
+  }
+  *s = UncompressBlockContents(*raw, contents);
+  if (s->ok() && compressed_cache != nullptr) {
+    compressed_cache->Release(compressed_cache->Insert(
+        key, raw, raw->size(), &DeleteCachedRawBlock));
+  } else {
+    delete raw;
+  }
+  return true;
+}
+
+void Table::InsertSecondaryBlock(const BlockHandle& handle,
+                                 const BlockContents& contents,
+                                 std::string* raw) const {
+  if (!rep_->persistent_cache_prefix.empty()) {
+    // Blocks that may not be cached in memory, because they point into a
+    // memory-mapped file, are still worth keeping on faster storage.
+    std::string persistent_key = rep_->persistent_cache_prefix;
+    PutFixed64(&persistent_key, handle.offset());
+    rep_->options.persistent_cache->Insert(persistent_key, *raw);
+  }
+  Cache* compressed_cache = rep_->options.compressed_block_cache;
+  if (compressed_cache == nullptr || !contents.cachable) {
+    delete raw;
+    return;
+  }
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->compressed_cache_id);
+  EncodeFixed64(cache_key_buffer + 8, handle.offset());
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  compressed_cache->Release(compressed_cache->Insert(
+      key, raw, raw->size(), &DeleteCachedRawBlock));
 }
 
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
+// "arg" is the DataBlockSource of the table iterator.
 Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
                              const Slice& index_value) {
-  Table* table = reinterpret_cast<Table*>(arg);
-  Cache* block_cache = table->rep_->options.block_cache;
-  Block* block = nullptr;
-  Cache::Handle* cache_handle = nullptr;
-
+  DataBlockSource* source = reinterpret_cast<DataBlockSource*>(arg);
   BlockHandle handle;
   Slice input = index_value;
   Status s = handle.DecodeFrom(&input);
   // We intentionally allow extra stuff in index_value so that we
   // can add more features in the future.
 
-  if (s.ok()) {
-    BlockContents contents;
-    if (block_cache != nullptr) {
-      char cache_key_buffer[16];
-      EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
-      EncodeFixed64(cache_key_buffer + 8, handle.offset());
-      Slice key(cache_key_buffer, sizeof(cache_key_buffer));
-      cache_handle = block_cache->Lookup(key);
-      if (cache_handle != nullptr) {
-        block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
-      } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
-        if (s.ok()) {
-          block = new Block(contents);
-          if (contents.cachable && options.fill_cache) {
-            cache_handle = block_cache->Insert(key, block, block->size(),
-                                               &DeleteCachedBlock);
-          }
-        }
-      }
-    } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
-      if (s.ok()) {
-        block = new Block(contents);
-      }
-    }
+  if (!s.ok()) {
+    return NewErrorIterator(s);
   }
+  return source->table->NewBlockIterator(options, handle, false,
+                                         &source->file);
+}
+
+// Like BlockReader, but for the index partitions that the values of the
+// top-level index refer to.
+Iterator* Table::IndexPartitionReader(void* arg, const ReadOptions& options,
+                                      const Slice& index_value) {
+  Table* table = reinterpret_cast<Table*>(arg);
+  BlockHandle handle;
+  Slice input = index_value;
+  Status s = handle.DecodeFrom(&input);
+  if (!s.ok()) {
+    return NewErrorIterator(s);
+  }
+  return table->NewBlockIterator(options, handle, true, table->rep_->file);
+}
+
+Iterator* Table::NewBlockIterator(const ReadOptions& options,
+                                  const BlockHandle& handle, bool index,
+                                  RandomAccessFile* file) const {
+  Cache* block_cache = rep_->options.block_cache;
+  Block* block = nullptr;
+  Cache::Handle* cache_handle = nullptr;
+  Status s = ReadDataBlock(options, handle, index, file, &block, &cache_handle);
 
   Iterator* iter;
   if (block != nullptr) {
-    iter = block->NewIterator(table->rep_->options.comparator);
+    iter = block->NewIterator(rep_->options.comparator);
     if (cache_handle == nullptr) {
       iter->RegisterCleanup(&DeleteBlock, block, nullptr);
     } else {
@@ -205,33 +633,267 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
   return iter;
 }
 
+Iterator* Table::NewTopIndexIterator(const ReadOptions& options) const {
+  if (rep_->index_block != nullptr) {
+    return rep_->index_block->NewIterator(rep_->options.comparator);
+  }
+  return NewBlockIterator(options, rep_->index_handle, true, rep_->file);
+}
+
+Iterator* Table::NewIndexIterator(const ReadOptions& options) const {
+  Iterator* iter = NewTopIndexIterator(options);
+  if (rep_->partitioned_index) {
+    iter = NewTwoLevelIterator(iter, &Table::IndexPartitionReader,
+                               const_cast<Table*>(this), options);
+  }
+  return iter;
+}
+
+bool Table::BlockFilterMayMatch(const ReadOptions& options,
+                                uint64_t block_offset, const Slice& key,
+                                bool prefix) const {
+  if (rep_->filter != nullptr) {
+    return prefix ? rep_->filter->PrefixMayMatch(block_offset, key)
+                  : rep_->filter->KeyMayMatch(block_offset, key);
+  }
+  return CachedFilterMayMatch(options, rep_->filter_handle, false,
+                              block_offset, key, prefix);
+}
+
+bool Table::FullFilterMayMatch(const ReadOptions& options, const Slice& key,
+                               bool prefix) const {
+  if (rep_->full_filter != nullptr) {
+    return prefix ? rep_->full_filter->PrefixMayMatch(key)
+                  : rep_->full_filter->KeyMayMatch(key);
+  }
+  return CachedFilterMayMatch(options, rep_->filter_handle, true, 0, key,
+                              prefix);
+}
+
+bool Table::PartitionedFilterMayMatch(const ReadOptions& options,
+                                      const Slice& key) const {
+  Iterator* iter = NewTopIndexIterator(options);
+  iter->Seek(key);
+  // Leave errors and keys past the end to the index
+  const bool may_match =
+      !iter->Valid() ||
+      FilterPartitionMayMatch(options, iter->value(), key, false);
+  delete iter;
+  return may_match;
+}
+
+bool Table::FilterPartitionMayMatch(const ReadOptions& options,
+                                    const Slice& top_index_value,
+                                    const Slice& key, bool prefix) const {
+  Slice input = top_index_value;
+  BlockHandle partition_handle, filter_handle;
+  if (!partition_handle.DecodeFrom(&input).ok() ||
+      !filter_handle.DecodeFrom(&input).ok()) {
+    return true;  // Errors are treated as potential matches
+  }
+  return CachedFilterMayMatch(options, filter_handle, true, 0, key, prefix);
+}
+
+bool Table::CachedFilterMayMatch(const ReadOptions& options,
+                                 const BlockHandle& filter_handle, bool full,
+                                 uint64_t block_offset, const Slice& key,
+                                 bool prefix) const {
+  Cache* block_cache = rep_->options.block_cache;
+  Cache::Handle* cache_handle = nullptr;
+  CachedFilter* filter = nullptr;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->cache_id);
+  EncodeFixed64(cache_key_buffer + 8, filter_handle.offset());
+  Slice cache_key(cache_key_buffer, sizeof(cache_key_buffer));
+  if (block_cache != nullptr) {
+    cache_handle = block_cache->Lookup(cache_key);
+    rep_->RecordLookup(BlockCacheStats::kFilterBlock, cache_handle != nullptr);
+    if (cache_handle != nullptr) {
+      filter =
+          reinterpret_cast<CachedFilter*>(block_cache->Value(cache_handle));
+    }
+  }
+  if (filter == nullptr) {
+    BlockContents contents;
+    if (!ReadBlock(rep_->file, options, filter_handle, &contents).ok()) {
+      return true;  // Errors are treated as potential matches
+    }
+    filter = new CachedFilter;
+    filter->data = contents.data;
+    filter->heap_allocated = contents.heap_allocated;
+    if (block_cache != nullptr && contents.cachable && options.fill_cache) {
+      cache_handle = block_cache->Insert(cache_key, filter, filter->data.size(),
+                                         &DeleteCachedFilter,
+                                         Cache::Priority::kHigh);
+      rep_->RecordInsert(BlockCacheStats::kFilterBlock);
+    }
+  }
+
+  const FilterPolicy* policy = rep_->options.filter_policy;
+  bool may_match;
+  if (full) {
+    may_match = prefix ? policy->PrefixMayMatch(key, filter->data)
+                       : policy->KeyMayMatch(key, filter->data);
+  } else {
+    FilterBlockReader reader(policy, filter->data);
+    may_match = prefix ? reader.PrefixMayMatch(block_offset, key)
+                       : reader.KeyMayMatch(block_offset, key);
+  }
+  if (cache_handle != nullptr) {
+    block_cache->Release(cache_handle);
+  } else {
+    delete filter;
+  }
+  return may_match;
+}
+
+namespace {
+
+// Wraps the index iterator of a table for a prefix_same_as_start
+// iterator: a Seek() to a target whose prefix the table's filter rules
+// out leaves the iterator invalid, so that no data block is read.
+class PrefixSeekIndexIterator : public Iterator {
+ public:
+  PrefixSeekIndexIterator(const Table* table, Iterator* iter)
+      : table_(table), iter_(iter), filtered_(false) {}
+  ~PrefixSeekIndexIterator() override { delete iter_; }
+
+  bool Valid() const override { return !filtered_ && iter_->Valid(); }
+  void Seek(const Slice& target) override {
+    filtered_ = !table_->PrefixMayMatch(target);
+    if (!filtered_) {
+      iter_->Seek(target);
+    }
+  }
+  void SeekToFirst() override {
+    filtered_ = false;
+    iter_->SeekToFirst();
+  }
+  void SeekToLast() override {
+    filtered_ = false;
+    iter_->SeekToLast();
+  }
+  void Next() override { iter_->Next(); }
+  void Prev() override { iter_->Prev(); }
+  Slice key() const override { return iter_->key(); }
+  Slice value() const override { return iter_->value(); }
+  Status status() const override {
+    return filtered_ ? Status::OK() : iter_->status();
+  }
+
+ private:
+  const Table* const table_;
+  Iterator* const iter_;
+  bool filtered_;
+};
+
+}  // namespace
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  Iterator* index_iter = NewIndexIterator(options);
+  if (options.prefix_same_as_start && rep_->prefix_filtered) {
+    index_iter = new PrefixSeekIndexIterator(this, index_iter);
+  }
+  DataBlockSource* source =
+      new DataBlockSource(this, rep_->file, rep_->file_size,
+                          options.readahead_size);
+  Iterator* iter =
+      NewTwoLevelIterator(index_iter, &Table::BlockReader, source, options);
+  iter->RegisterCleanup(&DeleteDataBlockSource, source, nullptr);
+  return iter;
+}
+
+bool Table::PrefixMayMatch(const Slice& target) const {
+  const SliceTransform* prefix_extractor = rep_->options.prefix_extractor;
+  if (!rep_->prefix_filtered || !prefix_extractor->InDomain(target)) {
+    return true;
+  }
+  const Slice prefix = prefix_extractor->Transform(target);
+  if (rep_->filter_type == Rep::kFullFilter) {
+    return FullFilterMayMatch(ReadOptions(), prefix, true);
+  }
+
+  // Keys with the prefix are adjacent, so if there are any >= target, the
+  // first key >= target has the prefix.  It is in the block (or
+  // partition) Seek(target) lands in, or at the start of the next one.
+  bool may_match = false;
+  const bool partitioned = rep_->filter_type == Rep::kPartitionedFilter;
+  Iterator* iiter = partitioned ? NewTopIndexIterator(ReadOptions())
+                                : NewIndexIterator(ReadOptions());
+  iiter->Seek(target);
+  for (int i = 0; i < 2 && !may_match && iiter->Valid(); i++) {
+    if (partitioned) {
+      may_match = FilterPartitionMayMatch(ReadOptions(), iiter->value(),
+                                          prefix, true);
+    } else {
+      Slice handle_value = iiter->value();
+      BlockHandle handle;
+      may_match =
+          !handle.DecodeFrom(&handle_value).ok() ||
+          BlockFilterMayMatch(ReadOptions(), handle.offset(), prefix, true);
+    }
+    iiter->Next();
+  }
+  if (!iiter->status().ok()) {
+    may_match = true;  // Errors are reported by the data iterator
+  }
+  delete iiter;
+  return may_match;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
                           void (*handle_result)(void*, const Slice&,
-                                                const Slice&)) {
+                                                PinnableSlice*)) {
+  if (rep_->filter_type == Rep::kFullFilter &&
+      !FullFilterMayMatch(options, k, false)) {
+    return Status::OK();  // Not found, without searching the index
+  }
+  if (rep_->filter_type == Rep::kPartitionedFilter &&
+      !PartitionedFilterMayMatch(options, k)) {
+    return Status::OK();  // Not found
+  }
+
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* iiter = NewIndexIterator(options);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
-    FilterBlockReader* filter = rep_->filter;
     BlockHandle handle;
-    if (filter != nullptr && handle.DecodeFrom(&handle_value).ok() &&
-        !filter->KeyMayMatch(handle.offset(), k)) {
+    s = handle.DecodeFrom(&handle_value);
+    if (s.ok() && rep_->filter_type == Rep::kBlockFilter &&
+        !BlockFilterMayMatch(options, handle.offset(), k, false)) {
       // Not found
-    } else {
-      Iterator* block_iter = BlockReader(this, options, iiter->value());
-      block_iter->Seek(k);
-      if (block_iter->Valid()) {
-        (*handle_result)(arg, block_iter->key(), block_iter->value());
+    } else if (s.ok()) {
+      Block* block;
+      Cache::Handle* cache_handle;
+      s = ReadDataBlock(options, handle, false, rep_->file, &block,
+                        &cache_handle);
+      if (s.ok()) {
+        // The value holds on to the block until handle_result is done
+        // with it, or for as long as handle_result keeps it.
+        PinnableSlice value;
+        bool block_pinned = false;
+        Iterator* block_iter = rep_->NewBlockIteratorForGet(block, k);
+        if (block_iter->Valid()) {
+          if (cache_handle != nullptr) {
+            value.PinSlice(block_iter->value(), &ReleaseBlock,
+                           rep_->options.block_cache, cache_handle);
+          } else {
+            value.PinSlice(block_iter->value(), &DeleteBlock, block, nullptr);
+          }
+          block_pinned = true;
+          (*handle_result)(arg, block_iter->key(), &value);
+        }
+        s = block_iter->status();
+        delete block_iter;
+        if (!block_pinned) {
+          if (cache_handle != nullptr) {
+            rep_->options.block_cache->Release(cache_handle);
+          } else {
+            delete block;
+          }
+        }
       }
-      s = block_iter->status();
-      delete block_iter;
     }
   }
   if (s.ok()) {
@@ -241,9 +903,149 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
   return s;
 }
 
+void Table::InternalMultiGet(const ReadOptions& options, size_t n,
+                             const Slice* keys, void* const* args,
+                             void (*handle_result)(void*, const Slice&,
+                                                   const Slice&),
+                             Status* statuses) {
+  // Find the data block that may hold each key.  Sorted keys that share a
+  // block are next to each other, so each block is listed once.
+  std::vector<BlockHandle> handles;
+  std::vector<int> key_block(n, -1);  // Index in handles, or -1 if none
+  Iterator* iiter = NewIndexIterator(options);
+  for (size_t i = 0; i < n; i++) {
+    const Slice& k = keys[i];
+    statuses[i] = Status::OK();
+    if (rep_->filter_type == Rep::kFullFilter &&
+        !FullFilterMayMatch(options, k, false)) {
+      continue;  // Not found
+    }
+    if (rep_->filter_type == Rep::kPartitionedFilter &&
+        !PartitionedFilterMayMatch(options, k)) {
+      continue;  // Not found
+    }
+    iiter->Seek(k);
+    if (!iiter->Valid()) {
+      statuses[i] = iiter->status();
+      continue;
+    }
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    if (!handle.DecodeFrom(&handle_value).ok()) {
+      statuses[i] = Status::Corruption("bad block handle");
+    } else if (rep_->filter_type == Rep::kBlockFilter &&
+               !BlockFilterMayMatch(options, handle.offset(), k, false)) {
+      // Not found
+    } else {
+      if (handles.empty() || handles.back().offset() != handle.offset()) {
+        handles.push_back(handle);
+      }
+      key_block[i] = static_cast<int>(handles.size()) - 1;
+    }
+  }
+  delete iiter;
+
+  // Take the blocks that are cached from the block cache, or else from the
+  // secondary block caches, and read all of the others together.
+  Cache* block_cache = rep_->options.block_cache;
+  const bool secondary_cache = HasSecondaryCache();
+  const bool fill_secondary_cache = secondary_cache && options.fill_cache;
+  std::vector<Block*> blocks(handles.size(), nullptr);
+  std::vector<Cache::Handle*> cache_handles(handles.size(), nullptr);
+  std::vector<Status> block_statuses(handles.size());
+  std::vector<size_t> misses;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->cache_id);
+  const Slice cache_key(cache_key_buffer, sizeof(cache_key_buffer));
+  for (size_t b = 0; b < handles.size(); b++) {
+    if (block_cache != nullptr) {
+      EncodeFixed64(cache_key_buffer + 8, handles[b].offset());
+      cache_handles[b] = block_cache->Lookup(cache_key);
+      rep_->RecordLookup(BlockCacheStats::kDataBlock,
+                         cache_handles[b] != nullptr);
+      if (cache_handles[b] != nullptr) {
+        blocks[b] =
+            reinterpret_cast<Block*>(block_cache->Value(cache_handles[b]));
+        continue;
+      }
+    }
+    misses.push_back(b);
+  }
+  if (!misses.empty()) {
+    std::vector<BlockContents> contents(misses.size());
+    std::vector<Status> read_statuses(misses.size());
+    std::vector<size_t> reads;  // Indexes into misses of the file reads
+    std::vector<BlockHandle> read_handles;
+    for (size_t j = 0; j < misses.size(); j++) {
+      if (!secondary_cache ||
+          !LookupSecondaryBlock(handles[misses[j]], &contents[j],
+                                &read_statuses[j])) {
+        reads.push_back(j);
+        read_handles.push_back(handles[misses[j]]);
+      }
+    }
+    if (!reads.empty()) {
+      std::vector<BlockContents> read_contents(reads.size());
+      std::vector<Status> read_results(reads.size());
+      std::vector<std::string> raws(fill_secondary_cache ? reads.size() : 0);
+      ReadBlocks(rep_->file, options, reads.size(), read_handles.data(),
+                 read_contents.data(), read_results.data(),
+                 fill_secondary_cache ? raws.data() : nullptr);
+      for (size_t r = 0; r < reads.size(); r++) {
+        contents[reads[r]] = read_contents[r];
+        read_statuses[reads[r]] = read_results[r];
+        if (fill_secondary_cache && read_results[r].ok()) {
+          InsertSecondaryBlock(read_handles[r], read_contents[r],
+                               new std::string(std::move(raws[r])));
+        }
+      }
+    }
+    for (size_t j = 0; j < misses.size(); j++) {
+      const size_t b = misses[j];
+      block_statuses[b] = read_statuses[j];
+      if (!read_statuses[j].ok()) {
+        continue;
+      }
+      blocks[b] = new Block(contents[j]);
+      if (block_cache != nullptr && contents[j].cachable &&
+          options.fill_cache) {
+        EncodeFixed64(cache_key_buffer + 8, handles[b].offset());
+        cache_handles[b] = block_cache->Insert(cache_key, blocks[b],
+                                               blocks[b]->size(),
+                                               &DeleteCachedBlock);
+        rep_->RecordInsert(BlockCacheStats::kDataBlock);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (key_block[i] < 0) {
+      continue;
+    }
+    const size_t b = key_block[i];
+    if (!block_statuses[b].ok()) {
+      statuses[i] = block_statuses[b];
+      continue;
+    }
+    Iterator* block_iter = rep_->NewBlockIteratorForGet(blocks[b], keys[i]);
+    if (block_iter->Valid()) {
+      (*handle_result)(args[i], block_iter->key(), block_iter->value());
+    }
+    statuses[i] = block_iter->status();
+    delete block_iter;
+  }
+
+  for (size_t b = 0; b < handles.size(); b++) {
+    if (cache_handles[b] != nullptr) {
+      block_cache->Release(cache_handles[b]);
+    } else {
+      delete blocks[b];
+    }
+  }
+}
+
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
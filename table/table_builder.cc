@@ -10,6 +10,7 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/slice_transform.h"
 #include "table/block_builder.h"
 #include "table/filter_block.h"
 #include "table/format.h"
@@ -28,11 +29,24 @@ struct TableBuilder::Rep {
         index_block(&index_block_options),
         num_entries(0),
         closed(false),
-        filter_block(opt.filter_policy == nullptr
+        filter_block(opt.filter_policy == nullptr || opt.full_filter ||
+                             opt.partition_index_and_filters
                          ? nullptr
-                         : new FilterBlockBuilder(opt.filter_policy)),
+                         : new FilterBlockBuilder(opt.filter_policy,
+                                                  opt.prefix_extractor)),
+        full_filter_block(opt.filter_policy == nullptr || !opt.full_filter ||
+                                  opt.partition_index_and_filters
+                              ? nullptr
+                              : new FullFilterBlockBuilder(
+                                    opt.filter_policy, opt.prefix_extractor)),
+        top_index_block(&index_block_options),
+        partition_filter_keys(opt.filter_policy == nullptr ||
+                                      !opt.partition_index_and_filters
+                                  ? nullptr
+                                  : new FilterKeys(opt.prefix_extractor)),
         pending_index_entry(false) {
     index_block_options.block_restart_interval = 1;
+    index_block_options.data_block_hash_index = false;
   }
 
   Options options;
@@ -46,6 +60,16 @@ struct TableBuilder::Rep {
   int64_t num_entries;
   bool closed;  // Either Finish() or Abandon() has been called.
   FilterBlockBuilder* filter_block;
+  FullFilterBlockBuilder* full_filter_block;
+
+  // If options.partition_index_and_filters, index_block holds the entries
+  // of the current index partition and top_index_block the top-level
+  // index.  partition_filter_keys collects the keys for the filter of the
+  // current partition, if there is a filter_policy.
+  BlockBuilder top_index_block;
+  FilterKeys* partition_filter_keys;
+  std::string last_index_key;  // Last key added to index_block
+  std::string partition_filter;
 
   // We do not emit the index entry for a block until we have seen the
   // first key for the next data block.  This allows us to use shorter
@@ -72,6 +96,8 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
   delete rep_->filter_block;
+  delete rep_->full_filter_block;
+  delete rep_->partition_filter_keys;
   delete rep_;
 }
 
@@ -82,12 +108,18 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.partition_index_and_filters !=
+      rep_->options.partition_index_and_filters) {
+    return Status::InvalidArgument(
+        "changing index partitioning while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
   rep_->options = options;
   rep_->index_block_options = options;
   rep_->index_block_options.block_restart_interval = 1;
+  rep_->index_block_options.data_block_hash_index = false;
   return Status::OK();
 }
 
@@ -102,15 +134,19 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   if (r->pending_index_entry) {
     assert(r->data_block.empty());
     r->options.comparator->FindShortestSeparator(&r->last_key, key);
-    std::string handle_encoding;
-    r->pending_handle.EncodeTo(&handle_encoding);
-    r->index_block.Add(r->last_key, Slice(handle_encoding));
+    AddIndexEntry(r->last_key, r->pending_handle);
     r->pending_index_entry = false;
   }
 
   if (r->filter_block != nullptr) {
     r->filter_block->AddKey(key);
   }
+  if (r->full_filter_block != nullptr) {
+    r->full_filter_block->AddKey(key);
+  }
+  if (r->partition_filter_keys != nullptr) {
+    r->partition_filter_keys->Add(key);
+  }
 
   r->last_key.assign(key.data(), key.size());
   r->num_entries++;
@@ -138,6 +174,47 @@ void TableBuilder::Flush() {
   }
 }
 
+void TableBuilder::AddIndexEntry(const Slice& key, const BlockHandle& handle) {
+  Rep* r = rep_;
+  std::string handle_encoding;
+  handle.EncodeTo(&handle_encoding);
+  r->index_block.Add(key, Slice(handle_encoding));
+  if (r->options.partition_index_and_filters) {
+    r->last_index_key.assign(key.data(), key.size());
+    if (r->index_block.CurrentSizeEstimate() >= r->options.metadata_block_size) {
+      FlushIndexPartition();
+    }
+  }
+}
+
+void TableBuilder::FlushIndexPartition() {
+  Rep* r = rep_;
+  if (!ok() || r->index_block.empty()) return;
+
+  // The filter of a partition holds the keys of the data blocks it
+  // indexes, which are all of the keys added since the last partition.
+  BlockHandle filter_handle;
+  if (r->partition_filter_keys != nullptr) {
+    r->partition_filter.clear();
+    r->partition_filter_keys->CreateFilter(r->options.filter_policy,
+                                           &r->partition_filter);
+    WriteRawBlock(r->partition_filter, kNoCompression, &filter_handle);
+    if (!ok()) return;
+  }
+  BlockHandle partition_handle;
+  WriteBlock(&r->index_block, &partition_handle);
+  if (!ok()) return;
+
+  // The top-level index maps the last key of each partition to the
+  // partition, followed by its filter if there is one.
+  std::string handle_encoding;
+  partition_handle.EncodeTo(&handle_encoding);
+  if (r->partition_filter_keys != nullptr) {
+    filter_handle.EncodeTo(&handle_encoding);
+  }
+  r->top_index_block.Add(r->last_index_key, Slice(handle_encoding));
+}
+
 void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   // File format contains a sequence of blocks where each block has:
   //    block_data: uint8[n]
@@ -207,19 +284,46 @@ Status TableBuilder::Finish() {
   if (ok() && r->filter_block != nullptr) {
     WriteRawBlock(r->filter_block->Finish(), kNoCompression,
                   &filter_block_handle);
+  } else if (ok() && r->full_filter_block != nullptr) {
+    WriteRawBlock(r->full_filter_block->Finish(), kNoCompression,
+                  &filter_block_handle);
   }
 
   // Write metaindex block
   if (ok()) {
-    BlockBuilder meta_index_block(&r->options);
-    if (r->filter_block != nullptr) {
-      // Add mapping from "filter.Name" to location of filter data
-      std::string key = "filter.";
+    // The metaindex keys are names, which Table::ReadMeta() looks up
+    // bytewise, whatever the comparator of the table.
+    Options meta_index_options = r->options;
+    meta_index_options.comparator = BytewiseComparator();
+    meta_index_options.data_block_hash_index = false;
+    BlockBuilder meta_index_block(&meta_index_options);
+    if (r->filter_block != nullptr || r->full_filter_block != nullptr) {
+      // Add mapping from "filter.Name" (or "fullfilter.Name") to location
+      // of filter data
+      std::string key =
+          r->full_filter_block != nullptr ? "fullfilter." : "filter.";
       key.append(r->options.filter_policy->Name());
       std::string handle_encoding;
       filter_block_handle.EncodeTo(&handle_encoding);
       meta_index_block.Add(key, handle_encoding);
     }
+    if (r->partition_filter_keys != nullptr) {
+      // Record that the top-level index refers to filter partitions
+      std::string key = "partitionedfilter.";
+      key.append(r->options.filter_policy->Name());
+      meta_index_block.Add(key, Slice());
+    }
+    if (r->options.partition_index_and_filters) {
+      // Record that the index block is the top-level index
+      meta_index_block.Add("partitionedindex", Slice());
+    }
+    if (r->options.filter_policy != nullptr &&
+        r->options.prefix_extractor != nullptr) {
+      // Record that the filter holds the prefixes of this transform
+      std::string key = "prefix.";
+      key.append(r->options.prefix_extractor->Name());
+      meta_index_block.Add(key, Slice());
+    }
 
     // TODO(postrelease): Add stats and other meta blocks
     WriteBlock(&meta_index_block, &metaindex_block_handle);
@@ -229,12 +333,17 @@ Status TableBuilder::Finish() {
   if (ok()) {
     if (r->pending_index_entry) {
       r->options.comparator->FindShortSuccessor(&r->last_key);
-      std::string handle_encoding;
-      r->pending_handle.EncodeTo(&handle_encoding);
-      r->index_block.Add(r->last_key, Slice(handle_encoding));
+      AddIndexEntry(r->last_key, r->pending_handle);
       r->pending_index_entry = false;
     }
-    WriteBlock(&r->index_block, &index_block_handle);
+    if (r->options.partition_index_and_filters) {
+      FlushIndexPartition();
+      if (ok()) {
+        WriteBlock(&r->top_index_block, &index_block_handle);
+      }
+    } else {
+      WriteBlock(&r->index_block, &index_block_handle);
+    }
   }
 
   // Write footer
@@ -11,8 +11,10 @@
 #include "db/dbformat.h"
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
 #include "leveldb/iterator.h"
 #include "leveldb/table_builder.h"
 #include "table/block.h"
@@ -109,14 +111,18 @@ class StringSink : public WritableFile {
 class StringSource : public RandomAccessFile {
  public:
   StringSource(const Slice& contents)
-      : contents_(contents.data(), contents.size()) {}
+      : contents_(contents.data(), contents.size()), num_reads_(0) {}
 
   ~StringSource() override = default;
 
   uint64_t Size() const { return contents_.size(); }
 
+  // Number of Read() calls so far.
+  int num_reads() const { return num_reads_; }
+
   Status Read(uint64_t offset, size_t n, Slice* result,
               char* scratch) const override {
+    num_reads_++;
     if (offset >= contents_.size()) {
       return Status::InvalidArgument("invalid Read offset");
     }
@@ -130,6 +136,7 @@ class StringSource : public RandomAccessFile {
 
  private:
   std::string contents_;
+  mutable int num_reads_;
 };
 
 typedef std::map<std::string, std::string, STLLessThan> KVMap;
@@ -230,6 +237,10 @@ class TableConstructor : public Constructor {
     source_ = new StringSource(sink.contents());
     Options table_options;
     table_options.comparator = options.comparator;
+    table_options.block_cache = options.block_cache;
+    table_options.filter_policy = options.filter_policy;
+    table_options.cache_index_and_filter_blocks =
+        options.cache_index_and_filter_blocks;
     return Table::Open(table_options, source_, sink.contents().size(), &table_);
   }
 
@@ -237,10 +248,16 @@ class TableConstructor : public Constructor {
     return table_->NewIterator(ReadOptions());
   }
 
+  Iterator* NewIterator(const ReadOptions& options) const {
+    return table_->NewIterator(options);
+  }
+
   uint64_t ApproximateOffsetOf(const Slice& key) const {
     return table_->ApproximateOffsetOf(key);
   }
 
+  int NumReads() const { return source_->num_reads(); }
+
  private:
   void Reset() {
     delete table_;
@@ -370,7 +387,14 @@ class DBConstructor : public Constructor {
   DB* db_;
 };
 
-enum TestType { TABLE_TEST, BLOCK_TEST, MEMTABLE_TEST, DB_TEST };
+enum TestType {
+  TABLE_TEST,
+  PARTITIONED_TABLE_TEST,
+  CACHED_INDEX_TABLE_TEST,
+  BLOCK_TEST,
+  MEMTABLE_TEST,
+  DB_TEST
+};
 
 struct TestArgs {
   TestType type;
@@ -386,6 +410,13 @@ static const TestArgs kTestArgList[] = {
     {TABLE_TEST, true, 1},
     {TABLE_TEST, true, 1024},
 
+    {PARTITIONED_TABLE_TEST, false, 16},
+    {PARTITIONED_TABLE_TEST, false, 1},
+    {PARTITIONED_TABLE_TEST, true, 16},
+
+    {CACHED_INDEX_TABLE_TEST, false, 16},
+    {CACHED_INDEX_TABLE_TEST, true, 16},
+
     {BLOCK_TEST, false, 16},
     {BLOCK_TEST, false, 1},
     {BLOCK_TEST, false, 1024},
@@ -405,11 +436,13 @@ static const int kNumTestArgs = sizeof(kTestArgList) / sizeof(kTestArgList[0]);
 
 class Harness : public testing::Test {
  public:
-  Harness() : constructor_(nullptr) {}
+  Harness() : constructor_(nullptr), block_cache_(nullptr) {}
 
   void Init(const TestArgs& args) {
     delete constructor_;
     constructor_ = nullptr;
+    delete block_cache_;
+    block_cache_ = nullptr;
     options_ = Options();
 
     options_.block_restart_interval = args.restart_interval;
@@ -423,6 +456,22 @@ class Harness : public testing::Test {
       case TABLE_TEST:
         constructor_ = new TableConstructor(options_.comparator);
         break;
+      case PARTITIONED_TABLE_TEST:
+        // Use tiny partitions to have many of them
+        options_.partition_index_and_filters = true;
+        options_.metadata_block_size = 64;
+        constructor_ = new TableConstructor(options_.comparator);
+        break;
+      case CACHED_INDEX_TABLE_TEST:
+        // Use a cache too small to hold the index partitions, so that
+        // they are read again and again
+        block_cache_ = NewLRUCache(1024, 0.5);
+        options_.block_cache = block_cache_;
+        options_.cache_index_and_filter_blocks = true;
+        options_.partition_index_and_filters = true;
+        options_.metadata_block_size = 64;
+        constructor_ = new TableConstructor(options_.comparator);
+        break;
       case BLOCK_TEST:
         constructor_ = new BlockConstructor(options_.comparator);
         break;
@@ -435,7 +484,10 @@ class Harness : public testing::Test {
     }
   }
 
-  ~Harness() { delete constructor_; }
+  ~Harness() {
+    delete constructor_;
+    delete block_cache_;
+  }
 
   void Add(const std::string& key, const std::string& value) {
     constructor_->Add(key, value);
@@ -606,6 +658,7 @@ class Harness : public testing::Test {
  private:
   Options options_;
   Constructor* constructor_;
+  Cache* block_cache_;
 };
 
 // Test empty table/block.
@@ -784,6 +837,111 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 610000, 612000));
 }
 
+TEST(TableTest, CacheIndexAndFilterBlocks) {
+  const FilterPolicy* policy = NewBloomFilterPolicy(10);
+  for (int config = 0; config < 4; config++) {
+    Cache* cache = NewLRUCache(1 << 20, 0.5);
+    {
+      TableConstructor c(BytewiseComparator());
+      for (int i = 0; i < 1000; i++) {
+        char key[20];
+        std::snprintf(key, sizeof(key), "k%06d", i);
+        c.Add(key, std::string(100, 'v'));
+      }
+      std::vector<std::string> keys;
+      KVMap kvmap;
+      Options options;
+      options.block_size = 1024;
+      options.compression = kNoCompression;
+      options.block_cache = cache;
+      options.filter_policy = policy;
+      options.full_filter = (config == 1);
+      options.partition_index_and_filters = (config == 2);
+      options.cache_index_and_filter_blocks = (config != 3);
+      c.Finish(options, &keys, &kvmap);
+
+      // Opening the table put its index into the cache, unless told not to
+      if (options.cache_index_and_filter_blocks) {
+        ASSERT_GT(cache->TotalCharge(), 0);
+      } else {
+        ASSERT_EQ(0, cache->TotalCharge());
+      }
+
+      // The table reads what was evicted again
+      for (int pass = 0; pass < 2; pass++) {
+        cache->Prune();
+        Iterator* iter = c.NewIterator();
+        iter->Seek("k000500");
+        ASSERT_TRUE(iter->Valid());
+        ASSERT_EQ("k000500", iter->key().ToString());
+        iter->Seek("k000500a");
+        ASSERT_TRUE(iter->Valid());
+        ASSERT_EQ("k000501", iter->key().ToString());
+        int count = 0;
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+          count++;
+        }
+        ASSERT_EQ(1000, count);
+        ASSERT_LEVELDB_OK(iter->status());
+        delete iter;
+      }
+    }
+    delete cache;
+  }
+  delete policy;
+}
+
+TEST(TableTest, Readahead) {
+  TableConstructor c(BytewiseComparator());
+  const int kNumKeys = 2000;
+  for (int i = 0; i < kNumKeys; i++) {
+    char key[20];
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    c.Add(key, std::string(100, 'v'));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  c.Finish(options, &keys, &kvmap);
+  const int kNumBlocks = kNumKeys * 100 / 1024;
+
+  for (size_t readahead_size : {0, 64 * 1024, 1 << 20}) {
+    ReadOptions read_options;
+    read_options.readahead_size = readahead_size;
+    const int reads_before = c.NumReads();
+    Iterator* iter = c.NewIterator(read_options);
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      ASSERT_EQ(keys[count], iter->key().ToString());
+      count++;
+    }
+    ASSERT_LEVELDB_OK(iter->status());
+    ASSERT_EQ(kNumKeys, count);
+    delete iter;
+    const int reads = c.NumReads() - reads_before;
+    std::fprintf(stderr, "readahead %d: %d blocks => %d reads\n",
+                 static_cast<int>(readahead_size), kNumBlocks, reads);
+    if (readahead_size == 0) {
+      ASSERT_LE(reads, kNumBlocks / 10);
+    } else {
+      ASSERT_LE(reads, kNumBlocks * 1024 / readahead_size + 2);
+    }
+  }
+
+  // Seeks that do not read blocks in order do not read ahead
+  const int reads_before = c.NumReads();
+  Iterator* iter = c.NewIterator(ReadOptions());
+  for (int i = kNumKeys - 1; i >= 0; i -= 100) {
+    iter->Seek(keys[i]);
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(keys[i], iter->key().ToString());
+  }
+  delete iter;
+  ASSERT_EQ(kNumKeys / 100, c.NumReads() - reads_before);
+}
+
 static bool SnappyCompressionSupported() {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
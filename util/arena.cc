@@ -4,6 +4,10 @@
 
 #include "util/arena.h"
 
+#include <new>
+
+#include "util/mutexlock.h"
+
 namespace leveldb {
 // 定义的内存块大小
 static const int kBlockSize = 4096;
@@ -67,6 +71,65 @@ char* Arena::AllocateAligned(size_t bytes) {
   assert((reinterpret_cast<uintptr_t>(result) & (align - 1)) == 0);
   return result;
 }
+char* Arena::AllocateConcurrently(size_t bytes) {
+  return AllocateConcurrentlyWithAlignment(bytes, 1);
+}
+
+char* Arena::AllocateAlignedConcurrently(size_t bytes) {
+  const int align = (sizeof(void*) > 8) ? sizeof(void*) : 8;
+  return AllocateConcurrentlyWithAlignment(bytes, align);
+}
+
+char* Arena::AllocateConcurrentlyWithAlignment(size_t bytes, size_t align) {
+  assert(bytes > 0);
+  assert((align & (align - 1)) == 0);
+  if (bytes > kBlockSize / 4) {
+    // Large objects get a block of their own, as in AllocateFallback()
+    MutexLock l(&mu_);
+    return AllocateNewBlock(bytes);
+  }
+
+  // Threads are assigned to shards round-robin the first time they get
+  // here, so a few threads inserting at once rarely share a shard.
+  static std::atomic<uint32_t> next_shard(0);
+  static thread_local const uint32_t thread_shard =
+      next_shard.fetch_add(1, std::memory_order_relaxed);
+  Shard* const shard = &shards_[thread_shard % kNumShards];
+
+  while (true) {
+    ConcurrentBlock* block = shard->block.load(std::memory_order_acquire);
+    if (block != nullptr) {
+      size_t used = block->used.load(std::memory_order_relaxed);
+      while (true) {
+        // block->base is aligned for any "align" we are asked for
+        const size_t start = (used + align - 1) & ~(align - 1);
+        if (start + bytes > block->size) {
+          break;
+        }
+        if (block->used.compare_exchange_weak(used, start + bytes,
+                                              std::memory_order_relaxed)) {
+          return block->base + start;
+        }
+      }
+    }
+
+    // The block is full.  Unless another thread of the shard already did
+    // so, install a new one; the rest of the full block is wasted.
+    MutexLock l(&mu_);
+    if (shard->block.load(std::memory_order_relaxed) == block) {
+      const size_t header_size =
+          (sizeof(ConcurrentBlock) + alignof(std::max_align_t) - 1) &
+          ~(alignof(std::max_align_t) - 1);
+      char* memory = AllocateNewBlock(kBlockSize);
+      ConcurrentBlock* new_block = new (memory) ConcurrentBlock;
+      new_block->base = memory + header_size;
+      new_block->size = kBlockSize - header_size;
+      new_block->used.store(0, std::memory_order_relaxed);
+      shard->block.store(new_block, std::memory_order_release);
+    }
+  }
+}
+
 // 申请新内存
 char* Arena::AllocateNewBlock(size_t block_bytes) {
   // 申请内存块
@@ -15,6 +15,9 @@ Arena负责管理内存使用，把内存分配出去，但是不负责重复利
 #include <cstdint>
 #include <vector>
 
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
 namespace leveldb {
 
 class Arena {
@@ -32,6 +35,14 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc.
   char* AllocateAligned(size_t bytes);
 
+  // Thread-safe variants of Allocate() and AllocateAligned().  They may be
+  // called from several threads at once, but not at the same time as the
+  // unsynchronized variants above.  Threads are spread over a few shards
+  // that each carve allocations out of a block of their own with a
+  // compare-and-swap, so mu_ is only taken to hand a shard a new block.
+  char* AllocateConcurrently(size_t bytes) LOCKS_EXCLUDED(mu_);
+  char* AllocateAlignedConcurrently(size_t bytes) LOCKS_EXCLUDED(mu_);
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena.
   // 返回所分配数据的总内存使用量的估计值
@@ -40,8 +51,29 @@ class Arena {
   }
 
  private:
+  // A block used by the *Concurrently() paths.  The header is stored at
+  // the start of the block it describes.
+  struct ConcurrentBlock {
+    char* base;                // First byte available for allocations
+    size_t size;               // Number of bytes available at base
+    std::atomic<size_t> used;  // Number of bytes handed out from base
+  };
+
+  // Each shard sits on a cache line of its own so that threads of
+  // different shards do not contend on it.
+  struct Shard {
+    Shard() : block(nullptr) {}
+
+    std::atomic<ConcurrentBlock*> block;  // Null until first used
+    char padding[64 - sizeof(std::atomic<ConcurrentBlock*>)];
+  };
+
+  static const int kNumShards = 8;
+
   char* AllocateFallback(size_t bytes);
   char* AllocateNewBlock(size_t block_bytes);
+  char* AllocateConcurrentlyWithAlignment(size_t bytes, size_t align)
+      LOCKS_EXCLUDED(mu_);
 
   // Allocation state
   // 指向最新内存块剩余空间的首地址
@@ -59,6 +91,12 @@ class Arena {
   //               accessed without any locking. Is this OK?
   // TODO: 内存使用量, 为什么要用原子操作?
   std::atomic<size_t> memory_usage_;
+
+  // Serializes the changes to blocks_ and to the shards' blocks made by
+  // the *Concurrently() allocation paths.
+  port::Mutex mu_;
+
+  Shard shards_[kNumShards];
 };
 
 inline char* Arena::Allocate(size_t bytes) {
@@ -14,6 +14,11 @@ static uint32_t BloomHash(const Slice& key) {
   return Hash(key.data(), key.size(), 0xbc9f1d34);
 }
 
+// A hash of "key" that is independent of BloomHash(key).
+static uint32_t ProbeHash(const Slice& key) {
+  return Hash(key.data(), key.size(), 0x5bd1e995);
+}
+
 class BloomFilterPolicy : public FilterPolicy {
  public:
   explicit BloomFilterPolicy(int bits_per_key) : bits_per_key_(bits_per_key) {
@@ -83,10 +88,98 @@ class BloomFilterPolicy : public FilterPolicy {
   size_t bits_per_key_;
   size_t k_;
 };
+
+// A bloom filter made of 64-byte blocks.  All of the probes for a key go
+// to one block, picked by the key's hash, so that a lookup touches one
+// cache line however large the filter is.  The price is a slightly
+// higher false positive rate for the same number of bits per key.
+class BlockedBloomFilterPolicy : public FilterPolicy {
+ public:
+  explicit BlockedBloomFilterPolicy(int bits_per_key)
+      : bits_per_key_(bits_per_key) {
+    k_ = static_cast<size_t>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
+    if (k_ < 1) k_ = 1;
+    if (k_ > 30) k_ = 30;
+  }
+
+  const char* Name() const override { return "leveldb.BlockedBloomFilter2"; }
+
+  void CreateFilter(const Slice* keys, int n, std::string* dst) const override {
+    // Compute the number of blocks.  A single block is big enough to keep
+    // the false positive rate low for small n.
+    size_t blocks = (n * bits_per_key_ + kBlockBits - 1) / kBlockBits;
+    if (blocks == 0) blocks = 1;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + blocks * kBlockBytes, 0);
+    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
+    char* array = &(*dst)[init_size];
+    for (int i = 0; i < n; i++) {
+      char* block =
+          array + BlockIndex(BloomHash(keys[i]), blocks) * kBlockBytes;
+      // The probes come from a hash of their own, so that they do not
+      // depend on the bits that picked the block.
+      uint32_t h = ProbeHash(keys[i]);
+      for (size_t j = 0; j < k_; j++) {
+        const uint32_t bitpos = ProbeBit(h);
+        block[bitpos / 8] |= (1 << (bitpos % 8));
+        h *= 0x9e3779b9u;
+      }
+    }
+  }
+
+  bool KeyMayMatch(const Slice& key, const Slice& bloom_filter) const override {
+    const size_t len = bloom_filter.size();
+    if (len < 2) return false;
+    if ((len - 1) % kBlockBytes != 0) {
+      return true;  // Not a filter of ours.  Consider it a match.
+    }
+
+    const char* array = bloom_filter.data();
+    const size_t blocks = (len - 1) / kBlockBytes;
+    const size_t k = array[len - 1];
+    if (k > 30) {
+      // Reserved for potentially new encodings.  Consider it a match.
+      return true;
+    }
+
+    const char* block =
+        array + BlockIndex(BloomHash(key), blocks) * kBlockBytes;
+    uint32_t h = ProbeHash(key);
+    for (size_t j = 0; j < k; j++) {
+      const uint32_t bitpos = ProbeBit(h);
+      if ((block[bitpos / 8] & (1 << (bitpos % 8))) == 0) return false;
+      h *= 0x9e3779b9u;
+    }
+    return true;
+  }
+
+ private:
+  static constexpr size_t kBlockBytes = 64;  // A typical cache line
+  static constexpr int kBlockBitsLg = 9;
+  static constexpr size_t kBlockBits = size_t{1} << kBlockBitsLg;
+  static_assert(kBlockBits == kBlockBytes * 8, "kBlockBitsLg is off");
+
+  // Map h to [0, blocks) using its high bits, without a division.
+  static size_t BlockIndex(uint32_t h, size_t blocks) {
+    return static_cast<size_t>((static_cast<uint64_t>(h) * blocks) >> 32);
+  }
+
+  // Map h to a bit of a block.  Each probe multiplies h by an odd
+  // constant, which mixes all of its bits into the high ones used here.
+  static uint32_t ProbeBit(uint32_t h) { return h >> (32 - kBlockBitsLg); }
+
+  size_t bits_per_key_;
+  size_t k_;
+};
 }  // namespace
 
 const FilterPolicy* NewBloomFilterPolicy(int bits_per_key) {
   return new BloomFilterPolicy(bits_per_key);
 }
 
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key) {
+  return new BlockedBloomFilterPolicy(bits_per_key);
+}
+
 }  // namespace leveldb
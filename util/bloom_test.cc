@@ -19,7 +19,8 @@ static Slice Key(int i, char* buffer) {
 
 class BloomTest : public testing::Test {
  public:
-  BloomTest() : policy_(NewBloomFilterPolicy(10)) {}
+  BloomTest() : BloomTest(NewBloomFilterPolicy(10)) {}
+  explicit BloomTest(const FilterPolicy* policy) : policy_(policy) {}
 
   ~BloomTest() { delete policy_; }
 
@@ -73,6 +74,10 @@ class BloomTest : public testing::Test {
     return result / 10000.0;
   }
 
+  // Check filters for many numbers of keys, whose sizes must not exceed
+  // 10 bits per key by more than "slack" bytes.
+  void CheckVaryingLengths(size_t slack);
+
  private:
   const FilterPolicy* policy_;
   std::string filter_;
@@ -106,7 +111,7 @@ static int NextLength(int length) {
   return length;
 }
 
-TEST_F(BloomTest, VaryingLengths) {
+void BloomTest::CheckVaryingLengths(size_t slack) {
   char buffer[sizeof(int)];
 
   // Count number of filters that significantly exceed the false positive rate
@@ -120,7 +125,7 @@ TEST_F(BloomTest, VaryingLengths) {
     }
     Build();
 
-    ASSERT_LE(FilterSize(), static_cast<size_t>((length * 10 / 8) + 40))
+    ASSERT_LE(FilterSize(), static_cast<size_t>((length * 10 / 8) + slack))
         << length;
 
     // All added keys must match
@@ -149,6 +154,51 @@ TEST_F(BloomTest, VaryingLengths) {
   ASSERT_LE(mediocre_filters, good_filters / 5);
 }
 
+TEST_F(BloomTest, VaryingLengths) { CheckVaryingLengths(40); }
+
+class BlockedBloomTest : public BloomTest {
+ public:
+  BlockedBloomTest() : BloomTest(NewBlockedBloomFilterPolicy(10)) {}
+};
+
+TEST_F(BlockedBloomTest, EmptyFilter) {
+  ASSERT_TRUE(!Matches("hello"));
+  ASSERT_TRUE(!Matches("world"));
+}
+
+TEST_F(BlockedBloomTest, Small) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(!Matches("x"));
+  ASSERT_TRUE(!Matches("foo"));
+}
+
+TEST_F(BlockedBloomTest, VaryingLengths) {
+  // Rounded up to whole 64-byte blocks
+  CheckVaryingLengths(64 + 1);
+}
+
+TEST_F(BlockedBloomTest, LargeFilter) {
+  // Spread over many blocks, so that the probes within a block must not
+  // depend on the bits that picked the block.
+  char buffer[sizeof(int)];
+  const int kKeys = 100000;
+  for (int i = 0; i < kKeys; i++) {
+    Add(Key(i, buffer));
+  }
+  Build();
+  double rate = FalsePositiveRate();
+  if (kVerbose >= 1) {
+    std::fprintf(stderr, "False positives: %5.2f%% @ length = %6d\n",
+                 rate * 100.0, kKeys);
+  }
+  // A standard bloom filter with 10 bits per key gets about 0.8%; limiting
+  // the probes to a cache line costs a little on top of that.
+  ASSERT_LE(rate, 0.0125);
+}
+
 // Different bits-per-byte
 
 }  // namespace leveldb
@@ -4,6 +4,7 @@
 
 #include "leveldb/cache.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -37,6 +38,20 @@ namespace {
 // Elements are moved between these lists by the Ref() and Unref() methods,
 // when they detect an element in the cache acquiring or losing its only
 // external reference.
+//
+// If part of the capacity is reserved for high-priority items, the items
+// not referenced by clients that were inserted with high priority are kept
+// in a third list, high-pri LRU, as long as their charges fit in the
+// reserved part.  The least recently used ones that do not fit are moved
+// to the newest end of the LRU list.  Items are evicted from the LRU list
+// first.
+//
+// A scan-resistant (segmented LRU) cache uses the reserved part as its
+// protected segment and the LRU list as its probation segment: items that
+// are found by Lookup() while in the cache are treated as high-priority.
+// Items that are used only once, like the blocks read by a long scan, never
+// leave the probation segment, so they cannot evict the items that are used
+// again and again.
 
 // An entry is a variable length heap-allocated structure.  Entries
 // are kept in a circular doubly linked list ordered by access time.
@@ -48,7 +63,9 @@ struct LRUHandle {
   LRUHandle* prev;
   size_t charge;  // TODO(opt): Only allow uint32_t?
   size_t key_length;
-  bool in_cache;     // Whether entry is in the cache.
+  bool in_cache;          // Whether entry is in the cache.
+  bool high_pri;          // Whether entry was inserted with high priority.
+  bool in_high_pri_pool;  // Whether entry is in the high-pri LRU list.
   uint32_t refs;     // References, including cache reference, if present.
   uint32_t hash;     // Hash of key(); used for fast sharding and comparisons
   char key_data[1];  // Beginning of key
@@ -154,12 +171,18 @@ class LRUCache {
   ~LRUCache();
 
   // Separate from constructor so caller can easily make an array of LRUCache
-  void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  void SetCapacity(size_t capacity, double high_pri_pool_ratio,
+                   bool promote_on_hit) {
+    capacity_ = capacity;
+    high_pri_capacity_ = static_cast<size_t>(capacity * high_pri_pool_ratio);
+    promote_on_hit_ = promote_on_hit;
+  }
 
   // Like Cache methods, but with an extra "hash" parameter.
   Cache::Handle* Insert(const Slice& key, uint32_t hash, void* value,
                         size_t charge,
-                        void (*deleter)(const Slice& key, void* value));
+                        void (*deleter)(const Slice& key, void* value),
+                        Cache::Priority priority);
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
@@ -168,26 +191,40 @@ class LRUCache {
     MutexLock l(&mutex_);
     return usage_;
   }
+  Cache::ShardStats GetStats() const {
+    MutexLock l(&mutex_);
+    return stats_;
+  }
 
  private:
   void LRU_Remove(LRUHandle* e);
   void LRU_Append(LRUHandle* list, LRUHandle* e);
+  void LRU_Release(LRUHandle* e) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  LRUHandle* LRU_Oldest() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void Ref(LRUHandle* e);
   void Unref(LRUHandle* e);
   bool FinishErase(LRUHandle* e) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   // Initialized before use.
   size_t capacity_;
+  size_t high_pri_capacity_;  // Part of capacity_ reserved for high_pri
+  bool promote_on_hit_;       // Whether Lookup() makes entries high_pri
 
   // mutex_ protects the following state.
   mutable port::Mutex mutex_;
   size_t usage_ GUARDED_BY(mutex_);
+  size_t high_pri_usage_ GUARDED_BY(mutex_);  // Charges of high_pri_lru_
+  Cache::ShardStats stats_ GUARDED_BY(mutex_);
 
   // Dummy head of LRU list.
   // lru.prev is newest entry, lru.next is oldest entry.
   // Entries have refs==1 and in_cache==true.
   LRUHandle lru_ GUARDED_BY(mutex_);
 
+  // Dummy head of high-pri LRU list, ordered like lru_.
+  // Entries have refs==1, in_cache==true and in_high_pri_pool==true.
+  LRUHandle high_pri_lru_ GUARDED_BY(mutex_);
+
   // Dummy head of in-use list.
   // Entries are in use by clients, and have refs >= 2 and in_cache==true.
   LRUHandle in_use_ GUARDED_BY(mutex_);
@@ -195,23 +232,32 @@ class LRUCache {
   HandleTable table_ GUARDED_BY(mutex_);
 };
 
-LRUCache::LRUCache() : capacity_(0), usage_(0) {
+LRUCache::LRUCache()
+    : capacity_(0),
+      high_pri_capacity_(0),
+      promote_on_hit_(false),
+      usage_(0),
+      high_pri_usage_(0) {
   // Make empty circular linked lists.
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  high_pri_lru_.next = &high_pri_lru_;
+  high_pri_lru_.prev = &high_pri_lru_;
   in_use_.next = &in_use_;
   in_use_.prev = &in_use_;
 }
 
 LRUCache::~LRUCache() {
   assert(in_use_.next == &in_use_);  // Error if caller has an unreleased handle
-  for (LRUHandle* e = lru_.next; e != &lru_;) {
-    LRUHandle* next = e->next;
-    assert(e->in_cache);
-    e->in_cache = false;
-    assert(e->refs == 1);  // Invariant of lru_ list.
-    Unref(e);
-    e = next;
+  for (LRUHandle* list : {&lru_, &high_pri_lru_}) {
+    for (LRUHandle* e = list->next; e != list;) {
+      LRUHandle* next = e->next;
+      assert(e->in_cache);
+      e->in_cache = false;
+      assert(e->refs == 1);  // Invariant of lru_ and high_pri_lru_ lists.
+      Unref(e);
+      e = next;
+    }
   }
 }
 
@@ -231,15 +277,45 @@ void LRUCache::Unref(LRUHandle* e) {
     (*e->deleter)(e->key(), e->value);
     free(e);
   } else if (e->in_cache && e->refs == 1) {
-    // No longer in use; move to lru_ list.
+    // No longer in use; move to lru_ or high_pri_lru_ list.
     LRU_Remove(e);
-    LRU_Append(&lru_, e);
+    LRU_Release(e);
   }
 }
 
 void LRUCache::LRU_Remove(LRUHandle* e) {
   e->next->prev = e->prev;
   e->prev->next = e->next;
+  if (e->in_high_pri_pool) {
+    e->in_high_pri_pool = false;
+    high_pri_usage_ -= e->charge;
+  }
+}
+
+void LRUCache::LRU_Release(LRUHandle* e) {
+  if (!e->high_pri || high_pri_capacity_ == 0) {
+    LRU_Append(&lru_, e);
+    return;
+  }
+  LRU_Append(&high_pri_lru_, e);
+  e->in_high_pri_pool = true;
+  high_pri_usage_ += e->charge;
+
+  // Move the oldest entries that no longer fit to the newest end of lru_
+  while (high_pri_usage_ > high_pri_capacity_) {
+    LRUHandle* old = high_pri_lru_.next;
+    LRU_Remove(old);
+    LRU_Append(&lru_, old);
+  }
+}
+
+LRUHandle* LRUCache::LRU_Oldest() {
+  if (lru_.next != &lru_) {
+    return lru_.next;
+  } else if (high_pri_lru_.next != &high_pri_lru_) {
+    return high_pri_lru_.next;
+  }
+  return nullptr;
 }
 
 void LRUCache::LRU_Append(LRUHandle* list, LRUHandle* e) {
@@ -254,7 +330,13 @@ Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
   MutexLock l(&mutex_);
   LRUHandle* e = table_.Lookup(key, hash);
   if (e != nullptr) {
+    stats_.hits++;
+    if (promote_on_hit_) {
+      e->high_pri = true;
+    }
     Ref(e);
+  } else {
+    stats_.misses++;
   }
   return reinterpret_cast<Cache::Handle*>(e);
 }
@@ -267,7 +349,8 @@ void LRUCache::Release(Cache::Handle* handle) {
 Cache::Handle* LRUCache::Insert(const Slice& key, uint32_t hash, void* value,
                                 size_t charge,
                                 void (*deleter)(const Slice& key,
-                                                void* value)) {
+                                                void* value),
+                                Cache::Priority priority) {
   MutexLock l(&mutex_);
 
   LRUHandle* e =
@@ -278,8 +361,11 @@ Cache::Handle* LRUCache::Insert(const Slice& key, uint32_t hash, void* value,
   e->key_length = key.size();
   e->hash = hash;
   e->in_cache = false;
+  e->high_pri = (priority == Cache::Priority::kHigh);
+  e->in_high_pri_pool = false;
   e->refs = 1;  // for the returned handle.
   std::memcpy(e->key_data, key.data(), key.size());
+  stats_.inserts++;
 
   if (capacity_ > 0) {
     e->refs++;  // for the cache's reference.
@@ -291,13 +377,14 @@ Cache::Handle* LRUCache::Insert(const Slice& key, uint32_t hash, void* value,
     // next is read by key() in an assert, so it must be initialized
     e->next = nullptr;
   }
-  while (usage_ > capacity_ && lru_.next != &lru_) {
-    LRUHandle* old = lru_.next;
+  LRUHandle* old;
+  while (usage_ > capacity_ && (old = LRU_Oldest()) != nullptr) {
     assert(old->refs == 1);
     bool erased = FinishErase(table_.Remove(old->key(), old->hash));
     if (!erased) {  // to avoid unused variable when compiled NDEBUG
       assert(erased);
     }
+    stats_.evictions++;
   }
 
   return reinterpret_cast<Cache::Handle*>(e);
@@ -323,8 +410,8 @@ void LRUCache::Erase(const Slice& key, uint32_t hash) {
 
 void LRUCache::Prune() {
   MutexLock l(&mutex_);
-  while (lru_.next != &lru_) {
-    LRUHandle* e = lru_.next;
+  LRUHandle* e;
+  while ((e = LRU_Oldest()) != nullptr) {
     assert(e->refs == 1);
     bool erased = FinishErase(table_.Remove(e->key(), e->hash));
     if (!erased) {  // to avoid unused variable when compiled NDEBUG
@@ -333,12 +420,13 @@ void LRUCache::Prune() {
   }
 }
 
-static const int kNumShardBits = 4;
-static const int kNumShards = 1 << kNumShardBits;
+static const int kDefaultNumShardBits = 4;
+static const int kMaxNumShardBits = 19;
 
 class ShardedLRUCache : public Cache {
  private:
-  LRUCache shard_[kNumShards];
+  const int num_shard_bits_;
+  LRUCache* const shard_;
   port::Mutex id_mutex_;
   uint64_t last_id_;
 
@@ -346,20 +434,35 @@ class ShardedLRUCache : public Cache {
     return Hash(s.data(), s.size(), 0);
   }
 
-  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+  uint32_t Shard(uint32_t hash) const {
+    return num_shard_bits_ > 0 ? hash >> (32 - num_shard_bits_) : 0;
+  }
+
+  int NumShards() const { return 1 << num_shard_bits_; }
 
  public:
-  explicit ShardedLRUCache(size_t capacity) : last_id_(0) {
-    const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
-    for (int s = 0; s < kNumShards; s++) {
-      shard_[s].SetCapacity(per_shard);
+  ShardedLRUCache(size_t capacity, int num_shard_bits,
+                  double high_pri_pool_ratio, bool promote_on_hit)
+      : num_shard_bits_(std::min(std::max(num_shard_bits, 0),
+                                 kMaxNumShardBits)),
+        shard_(new LRUCache[NumShards()]),
+        last_id_(0) {
+    const size_t per_shard = (capacity + (NumShards() - 1)) / NumShards();
+    for (int s = 0; s < NumShards(); s++) {
+      shard_[s].SetCapacity(per_shard, high_pri_pool_ratio, promote_on_hit);
     }
   }
-  ~ShardedLRUCache() override {}
+  ~ShardedLRUCache() override { delete[] shard_; }
   Handle* Insert(const Slice& key, void* value, size_t charge,
                  void (*deleter)(const Slice& key, void* value)) override {
+    return Insert(key, value, charge, deleter, Priority::kLow);
+  }
+  Handle* Insert(const Slice& key, void* value, size_t charge,
+                 void (*deleter)(const Slice& key, void* value),
+                 Priority priority) override {
     const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                      priority);
   }
   Handle* Lookup(const Slice& key) override {
     const uint32_t hash = HashSlice(key);
@@ -381,21 +484,50 @@ class ShardedLRUCache : public Cache {
     return ++(last_id_);
   }
   void Prune() override {
-    for (int s = 0; s < kNumShards; s++) {
+    for (int s = 0; s < NumShards(); s++) {
       shard_[s].Prune();
     }
   }
   size_t TotalCharge() const override {
     size_t total = 0;
-    for (int s = 0; s < kNumShards; s++) {
+    for (int s = 0; s < NumShards(); s++) {
       total += shard_[s].TotalCharge();
     }
     return total;
   }
+  void GetShardStats(std::vector<ShardStats>* stats) const override {
+    for (int s = 0; s < NumShards(); s++) {
+      stats->push_back(shard_[s].GetStats());
+    }
+  }
 };
 
 }  // end anonymous namespace
 
-Cache* NewLRUCache(size_t capacity) { return new ShardedLRUCache(capacity); }
+Cache* NewLRUCache(size_t capacity) {
+  return new ShardedLRUCache(capacity, kDefaultNumShardBits, 0.0, false);
+}
+
+Cache* NewLRUCache(size_t capacity, double high_pri_pool_ratio) {
+  return new ShardedLRUCache(capacity, kDefaultNumShardBits,
+                             high_pri_pool_ratio, false);
+}
+
+Cache* NewShardedLRUCache(size_t capacity, int num_shard_bits) {
+  return new ShardedLRUCache(capacity, num_shard_bits, 0.0, false);
+}
+
+Cache* NewShardedLRUCache(size_t capacity, int num_shard_bits,
+                          double high_pri_pool_ratio) {
+  return new ShardedLRUCache(capacity, num_shard_bits, high_pri_pool_ratio,
+                             false);
+}
+
+Cache* NewSLRUCache(size_t capacity) { return NewSLRUCache(capacity, 0.8); }
+
+Cache* NewSLRUCache(size_t capacity, double protected_ratio) {
+  return new ShardedLRUCache(capacity, kDefaultNumShardBits, protected_ratio,
+                             true);
+}
 
 }  // namespace leveldb
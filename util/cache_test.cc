@@ -4,10 +4,13 @@
 
 #include "leveldb/cache.h"
 
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include "gtest/gtest.h"
 #include "util/coding.h"
+#include "util/random.h"
 
 namespace leveldb {
 
@@ -54,6 +57,12 @@ class CacheTest : public testing::Test {
                                    &CacheTest::Deleter));
   }
 
+  void InsertHighPri(int key, int value, int charge = 1) {
+    cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(value), charge,
+                                   &CacheTest::Deleter,
+                                   Cache::Priority::kHigh));
+  }
+
   Cache::Handle* InsertAndReturnHandle(int key, int value, int charge = 1) {
     return cache_->Insert(EncodeKey(key), EncodeValue(value), charge,
                           &CacheTest::Deleter);
@@ -221,6 +230,360 @@ TEST_F(CacheTest, ZeroSizeCache) {
   ASSERT_EQ(-1, Lookup(1));
 }
 
+TEST_F(CacheTest, HighPriorityPool) {
+  delete cache_;
+  cache_ = NewLRUCache(kCacheSize, 0.5);
+
+  // High-priority entries that fit in the pool outlive any number of
+  // low-priority ones.
+  for (int i = 0; i < 10; i++) {
+    InsertHighPri(i, 100 + i);
+  }
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000 + i, 2000 + i);
+  }
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(100 + i, Lookup(i));
+  }
+  ASSERT_EQ(-1, Lookup(1000));
+}
+
+TEST_F(CacheTest, HighPriorityPoolOverflow) {
+  delete cache_;
+  cache_ = NewLRUCache(kCacheSize, 0.5);
+
+  // The high-priority entries that do not fit in the pool are evicted
+  // like low-priority ones.
+  for (int i = 0; i < kCacheSize; i++) {
+    InsertHighPri(i, 100 + i);
+  }
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(10000 + i, 20000 + i);
+  }
+  int cached = 0;
+  for (int i = 0; i < kCacheSize; i++) {
+    if (Lookup(i) >= 0) {
+      cached++;
+    }
+  }
+  ASSERT_LE(cached, kCacheSize / 2);
+  ASSERT_GE(cached, kCacheSize / 4);
+}
+
+TEST_F(CacheTest, PriorityIgnoredWithoutPool) {
+  InsertHighPri(1, 100);
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000 + i, 2000 + i);
+  }
+  ASSERT_EQ(-1, Lookup(1));
+}
+
+TEST_F(CacheTest, ScanResistance) {
+  delete cache_;
+  cache_ = NewSLRUCache(kCacheSize);
+
+  // Entries that were looked up again outlive a scan of entries that are
+  // used only once.
+  for (int i = 0; i < 100; i++) {
+    Insert(i, 100 + i);
+    ASSERT_EQ(100 + i, Lookup(i));
+  }
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000 + i, 2000 + i);
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(100 + i, Lookup(i));
+  }
+  ASSERT_EQ(-1, Lookup(1000));
+}
+
+TEST_F(CacheTest, ScanResistanceProtectedOverflow) {
+  delete cache_;
+  cache_ = NewSLRUCache(kCacheSize, 0.5);
+
+  // Only the entries that fit in the protected segment outlive the scan
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(i, 100 + i);
+    Lookup(i);
+  }
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(10000 + i, 20000 + i);
+  }
+  int cached = 0;
+  for (int i = 0; i < kCacheSize; i++) {
+    if (Lookup(i) >= 0) {
+      cached++;
+    }
+  }
+  ASSERT_LE(cached, kCacheSize / 2);
+  ASSERT_GE(cached, kCacheSize / 4);
+}
+
+TEST_F(CacheTest, ShardStats) {
+  Insert(1, 101);
+  Insert(2, 201);
+  Lookup(1);
+  Lookup(1);
+  Lookup(2);
+  Lookup(3);
+  Lookup(4);
+
+  std::vector<Cache::ShardStats> stats;
+  cache_->GetShardStats(&stats);
+  ASSERT_EQ(16, stats.size());
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t inserts = 0;
+  uint64_t evictions = 0;
+  for (const Cache::ShardStats& shard : stats) {
+    hits += shard.hits;
+    misses += shard.misses;
+    inserts += shard.inserts;
+    evictions += shard.evictions;
+  }
+  ASSERT_EQ(3, hits);
+  ASSERT_EQ(2, misses);
+  ASSERT_EQ(2, inserts);
+  ASSERT_EQ(0, evictions);
+}
+
+TEST_F(CacheTest, ShardBits) {
+  for (int bits : {0, 2, 6}) {
+    delete cache_;
+    cache_ = NewShardedLRUCache(kCacheSize, bits);
+    std::vector<Cache::ShardStats> stats;
+    cache_->GetShardStats(&stats);
+    ASSERT_EQ(1 << bits, stats.size());
+  }
+
+  // With a single shard, the least recently used entries are evicted first
+  // regardless of their keys.
+  delete cache_;
+  cache_ = NewShardedLRUCache(kCacheSize, 0);
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(i, 1000 + i);
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(-1, Lookup(i));
+  }
+  for (int i = 100; i < kCacheSize + 100; i++) {
+    ASSERT_EQ(1000 + i, Lookup(i));
+  }
+  std::vector<Cache::ShardStats> stats;
+  cache_->GetShardStats(&stats);
+  ASSERT_EQ(1, stats.size());
+  ASSERT_EQ(kCacheSize + 100, stats[0].inserts);
+  ASSERT_EQ(100, stats[0].evictions);
+  ASSERT_EQ(static_cast<uint64_t>(kCacheSize), stats[0].hits);
+  ASSERT_EQ(100, stats[0].misses);
+
+  // The high-priority pool works with any number of shards
+  delete cache_;
+  cache_ = NewShardedLRUCache(kCacheSize, 0, 0.5);
+  InsertHighPri(1, 101);
+  for (int i = 100; i < kCacheSize + 100; i++) {
+    Insert(i, 1000 + i);
+  }
+  ASSERT_EQ(101, Lookup(1));
+}
+
+class ClockCacheTest : public CacheTest {
+ public:
+  ClockCacheTest() {
+    delete cache_;
+    cache_ = NewClockCache(kCacheSize, 1);
+  }
+};
+
+TEST_F(ClockCacheTest, HitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+
+  Insert(200, 201);
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(200);
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(2, deleted_keys_.size());
+  Erase(200);
+  ASSERT_EQ(2, deleted_keys_.size());
+}
+
+TEST_F(ClockCacheTest, EntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+
+  Insert(100, 102);
+  Cache::Handle* h2 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(102, DecodeValue(cache_->Value(h2)));
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+
+  cache_->Release(h2);
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(102, deleted_values_[1]);
+}
+
+TEST_F(ClockCacheTest, EvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+  Insert(300, 301);
+  Cache::Handle* h = cache_->Lookup(EncodeKey(300));
+
+  // An entry that is looked up between two sweeps of the clock hand is
+  // kept, as are entries that are still in use.
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(1000 + i, 2000 + i);
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(301, Lookup(300));
+  cache_->Release(h);
+}
+
+TEST_F(ClockCacheTest, UseExceedsCacheSize) {
+  std::vector<Cache::Handle*> h;
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    h.push_back(InsertAndReturnHandle(1000 + i, 2000 + i));
+  }
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    ASSERT_EQ(2000 + i, Lookup(1000 + i));
+  }
+  for (size_t i = 0; i < h.size(); i++) {
+    cache_->Release(h[i]);
+  }
+}
+
+TEST_F(ClockCacheTest, UncachedInsertHidesOldEntry) {
+  // Pin far more entries than there are slots for.
+  std::vector<Cache::Handle*> h;
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    h.push_back(InsertAndReturnHandle(1000 + i, 2000 + i));
+  }
+  ASSERT_EQ(2000, Lookup(1000));
+
+  // The new value is not cached, but the old one must not be returned
+  // any more either.
+  Insert(1000, 3000);
+  ASSERT_EQ(-1, Lookup(1000));
+  ASSERT_EQ(2001, Lookup(1001));
+
+  for (size_t i = 0; i < h.size(); i++) {
+    cache_->Release(h[i]);
+  }
+  ASSERT_EQ(-1, Lookup(1000));
+}
+
+TEST_F(ClockCacheTest, HeavyEntries) {
+  const int kLight = 1;
+  const int kHeavy = 10;
+  int added = 0;
+  int index = 0;
+  while (added < 2 * kCacheSize) {
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000 + index, weight);
+    added += weight;
+    index++;
+  }
+
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    const int weight = (i & 1 ? kLight : kHeavy);
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += weight;
+      ASSERT_EQ(1000 + i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
+  ASSERT_EQ(cached_weight, cache_->TotalCharge());
+}
+
+TEST_F(ClockCacheTest, Prune) {
+  Insert(1, 100);
+  Insert(2, 200);
+
+  Cache::Handle* handle = cache_->Lookup(EncodeKey(1));
+  ASSERT_TRUE(handle);
+  cache_->Prune();
+  cache_->Release(handle);
+
+  ASSERT_EQ(100, Lookup(1));
+  ASSERT_EQ(-1, Lookup(2));
+}
+
+TEST_F(ClockCacheTest, ZeroSizeCache) {
+  delete cache_;
+  cache_ = NewClockCache(0);
+
+  Insert(1, 100);
+  ASSERT_EQ(-1, Lookup(1));
+  ASSERT_EQ(1, deleted_keys_.size());
+}
+
+static std::atomic<int> concurrent_deletes(0);
+
+static void CountingDeleter(const Slice& key, void* v) {
+  ASSERT_EQ(DecodeKey(key), DecodeValue(v));
+  concurrent_deletes.fetch_add(1);
+}
+
+TEST_F(ClockCacheTest, Concurrent) {
+  // Entries of charge 10, so that about 100 of the 200 keys fit
+  const int kThreads = 4;
+  const int kKeys = 200;
+  concurrent_deletes.store(0);
+  std::atomic<int> inserts(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([this, t, &inserts] {
+      Random rnd(301 + t);
+      for (int i = 0; i < 20000; i++) {
+        const int k = rnd.Uniform(kKeys);
+        const std::string key = EncodeKey(k);
+        if (rnd.OneIn(20)) {
+          cache_->Erase(key);
+        } else if (Cache::Handle* h = cache_->Lookup(key)) {
+          ASSERT_EQ(k, DecodeValue(cache_->Value(h)));
+          cache_->Release(h);
+        } else {
+          inserts.fetch_add(1);
+          cache_->Release(
+              cache_->Insert(key, EncodeValue(k), 10, &CountingDeleter));
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  // Entries pinned by other threads may have kept an Insert() from making
+  // room
+  ASSERT_LE(cache_->TotalCharge(), 2 * kCacheSize);
+
+  delete cache_;
+  cache_ = nullptr;
+  ASSERT_EQ(inserts.load(), concurrent_deletes.load());
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
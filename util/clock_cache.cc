@@ -0,0 +1,443 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "leveldb/cache.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+// CLOCK cache implementation
+//
+// Each shard keeps its entries in a fixed array of slots, an open addressing
+// hash table with linear probing.  The state of a slot, the number of
+// references that clients hold on its entry and a usage bit are packed in
+// one atomic word, "meta":
+// - empty:  the slot holds no entry.
+// - visible:  the slot holds an entry of the cache, which Lookup() finds.
+// - invisible:  the entry was erased, replaced or evicted.  Lookup() no
+//   longer finds it, and it is freed once its last reference is released.
+//
+// Lookup() and Release() only use atomic operations: a Lookup() takes a
+// reference with a compare-and-swap that succeeds only on visible slots and
+// sets the usage bit at the same time, and Release() drops it again.  The
+// slots are never freed while the cache exists, so a Lookup() racing with an
+// eviction at worst misses.  All the other changes of the table, including
+// freeing entries, are made while holding the mutex of the shard.
+//
+// To make room, the CLOCK hand sweeps the slots.  It evicts the visible
+// entries that are not referenced and whose usage bit is clear, and clears
+// the usage bit of the others, so an entry that was looked up since the last
+// sweep gets one more.
+//
+// Every slot also counts the entries that had to probe past it when they
+// were inserted, so a Lookup() stops at the first slot that no entry was
+// displaced beyond.
+
+// An entry is a slot of the table of a shard, or a heap-allocated
+// "detached" handle that was never in the cache.
+struct ClockHandle {
+  std::atomic<uint32_t> meta;
+  std::atomic<uint32_t> hash;           // Hash of key()
+  std::atomic<uint32_t> displacements;  // Entries probed past this slot
+  bool detached;                        // Not a slot of the table
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  size_t charge;
+  size_t key_length;
+  char* key_data;
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+static const uint32_t kRefMask = (1u << 28) - 1;
+static const uint32_t kUsageBit = 1u << 28;
+static const uint32_t kStateShift = 30;
+static const uint32_t kStateMask = 3u << kStateShift;
+static const uint32_t kEmpty = 0;
+static const uint32_t kVisible = 1u << kStateShift;
+static const uint32_t kInvisible = 2u << kStateShift;
+
+// A single shard of sharded cache.
+class ClockCache {
+ public:
+  ClockCache();
+  ~ClockCache();
+
+  // Separate from constructor so caller can easily make an array of
+  // ClockCache.  Sizes the table for entries of about "entry_charge".
+  void SetCapacity(size_t capacity, size_t entry_charge);
+
+  // Like Cache methods, but with an extra "hash" parameter.
+  Cache::Handle* Insert(const Slice& key, uint32_t hash, void* value,
+                        size_t charge,
+                        void (*deleter)(const Slice& key, void* value));
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+  void Prune();
+  size_t TotalCharge() const {
+    MutexLock l(&mutex_);
+    return usage_;
+  }
+
+ private:
+  // Return the visible slot with "key", if any.
+  ClockHandle* FindVisible(const Slice& key, uint32_t hash)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Make "e" invisible, and free it if it is not referenced.
+  void MakeInvisible(ClockHandle* e) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Pass the entry of "e", which is invisible and no longer referenced, to
+  // its deleter and empty the slot.
+  void Free(ClockHandle* e) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Sweep the CLOCK hand until an entry of "charge" fits, or until every
+  // entry was passed twice.
+  void Evict(size_t charge) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Evict the entry of "e" if it is visible, not referenced and, unless
+  // "ignore_usage", its usage bit is clear.  Otherwise clear the usage bit.
+  void TryEvict(ClockHandle* e, bool ignore_usage)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  size_t capacity_;
+
+  // Table of mask_ + 1 slots, a power of two.  Only the mutex holder fills
+  // and empties slots, but Lookup() and Release() touch them without it.
+  ClockHandle* slots_;
+  uint32_t mask_;
+  size_t max_occupancy_;
+
+  mutable port::Mutex mutex_;
+  size_t usage_ GUARDED_BY(mutex_);
+  size_t occupancy_ GUARDED_BY(mutex_);
+  uint32_t hand_ GUARDED_BY(mutex_);
+};
+
+ClockCache::ClockCache()
+    : capacity_(0),
+      slots_(nullptr),
+      mask_(0),
+      max_occupancy_(0),
+      usage_(0),
+      occupancy_(0),
+      hand_(0) {}
+
+ClockCache::~ClockCache() {
+  MutexLock l(&mutex_);
+  for (uint32_t i = 0; slots_ != nullptr && i <= mask_; i++) {
+    ClockHandle* e = &slots_[i];
+    const uint32_t meta = e->meta.load(std::memory_order_acquire);
+    // Error if caller has an unreleased handle
+    assert((meta & kRefMask) == 0);
+    if ((meta & kStateMask) == kVisible) {
+      e->meta.store(kInvisible, std::memory_order_relaxed);
+      Free(e);
+    }
+  }
+  delete[] slots_;
+}
+
+void ClockCache::SetCapacity(size_t capacity, size_t entry_charge) {
+  assert(slots_ == nullptr);
+  capacity_ = capacity;
+
+  // Keep the table at most half full when the cache is, so that probes stay
+  // short, and let entries that are pinned beyond the capacity take up to
+  // three quarters of it.
+  const size_t entries =
+      capacity / (entry_charge > 0 ? entry_charge : 1) + 1;
+  uint32_t length = 16;
+  while (length < 2 * entries) {
+    length *= 2;
+  }
+  mask_ = length - 1;
+  max_occupancy_ = (size_t{mask_} + 1) * 3 / 4;
+  slots_ = new ClockHandle[mask_ + 1];
+  for (uint32_t i = 0; i <= mask_; i++) {
+    slots_[i].meta.store(kEmpty, std::memory_order_relaxed);
+    slots_[i].hash.store(0, std::memory_order_relaxed);
+    slots_[i].displacements.store(0, std::memory_order_relaxed);
+    slots_[i].detached = false;
+  }
+}
+
+Cache::Handle* ClockCache::Lookup(const Slice& key, uint32_t hash) {
+  uint32_t index = hash & mask_;
+  for (uint32_t probes = 0; probes <= mask_; probes++) {
+    ClockHandle* e = &slots_[index];
+    uint32_t meta = e->meta.load(std::memory_order_relaxed);
+    while ((meta & kStateMask) == kVisible &&
+           e->hash.load(std::memory_order_relaxed) == hash) {
+      if (e->meta.compare_exchange_weak(meta, (meta + 1) | kUsageBit,
+                                        std::memory_order_acquire,
+                                        std::memory_order_relaxed)) {
+        // The reference keeps the slot from being refilled, so its key can
+        // be compared now.
+        if (e->hash.load(std::memory_order_relaxed) == hash &&
+            e->key() == key) {
+          return reinterpret_cast<Cache::Handle*>(e);
+        }
+        Release(reinterpret_cast<Cache::Handle*>(e));
+        break;
+      }
+    }
+    if (e->displacements.load(std::memory_order_relaxed) == 0) {
+      break;
+    }
+    index = (index + 1) & mask_;
+  }
+  return nullptr;
+}
+
+void ClockCache::Release(Cache::Handle* handle) {
+  ClockHandle* e = reinterpret_cast<ClockHandle*>(handle);
+  const uint32_t old = e->meta.fetch_sub(1, std::memory_order_acq_rel);
+  assert((old & kRefMask) > 0);
+  if ((old & kStateMask) == kInvisible && (old & kRefMask) == 1) {
+    // Lookup() never references an invisible entry, so no one else can
+    // reach it any more.
+    MutexLock l(&mutex_);
+    Free(e);
+  }
+}
+
+Cache::Handle* ClockCache::Insert(const Slice& key, uint32_t hash,
+                                  void* value, size_t charge,
+                                  void (*deleter)(const Slice& key,
+                                                  void* value)) {
+  ClockHandle* e = nullptr;
+  char* key_data = static_cast<char*>(malloc(key.size() > 0 ? key.size() : 1));
+  std::memcpy(key_data, key.data(), key.size());
+
+  MutexLock l(&mutex_);
+  if (capacity_ > 0) {  // capacity_==0 is supported and turns off caching.
+    Evict(charge);
+    ClockHandle* old = FindVisible(key, hash);
+    if (occupancy_ < max_occupancy_) {
+      // Displace the entry past the occupied slots, counting it in each of
+      // them.
+      uint32_t index = hash & mask_;
+      while ((slots_[index].meta.load(std::memory_order_relaxed) &
+              kStateMask) != kEmpty) {
+        slots_[index].displacements.fetch_add(1, std::memory_order_relaxed);
+        index = (index + 1) & mask_;
+      }
+      e = &slots_[index];
+      e->hash.store(hash, std::memory_order_relaxed);
+      e->value = value;
+      e->deleter = deleter;
+      e->charge = charge;
+      e->key_length = key.size();
+      e->key_data = key_data;
+      // Publish the entry with a reference for the returned handle.
+      e->meta.store(kVisible | 1, std::memory_order_release);
+      usage_ += charge;
+      occupancy_++;
+
+      if (old != nullptr) {
+        MakeInvisible(old);
+      }
+      return reinterpret_cast<Cache::Handle*>(e);
+    }
+
+    // The old entry must not be found any more, even though the new one
+    // cannot take its place.
+    if (old != nullptr) {
+      MakeInvisible(old);
+    }
+  }
+
+  // Don't cache, because caching is off or every slot that could take the
+  // entry holds one that is still referenced.
+  e = new ClockHandle;
+  e->meta.store(kInvisible | 1, std::memory_order_relaxed);
+  e->hash.store(hash, std::memory_order_relaxed);
+  e->displacements.store(0, std::memory_order_relaxed);
+  e->detached = true;
+  e->value = value;
+  e->deleter = deleter;
+  e->charge = charge;
+  e->key_length = key.size();
+  e->key_data = key_data;
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+ClockHandle* ClockCache::FindVisible(const Slice& key, uint32_t hash) {
+  uint32_t index = hash & mask_;
+  for (uint32_t probes = 0; probes <= mask_; probes++) {
+    ClockHandle* e = &slots_[index];
+    // Only the mutex holder changes the state and the key of a slot.
+    if ((e->meta.load(std::memory_order_relaxed) & kStateMask) == kVisible &&
+        e->hash.load(std::memory_order_relaxed) == hash && e->key() == key) {
+      return e;
+    }
+    if (e->displacements.load(std::memory_order_relaxed) == 0) {
+      break;
+    }
+    index = (index + 1) & mask_;
+  }
+  return nullptr;
+}
+
+void ClockCache::MakeInvisible(ClockHandle* e) {
+  uint32_t meta = e->meta.load(std::memory_order_relaxed);
+  assert((meta & kStateMask) == kVisible);
+  while (!e->meta.compare_exchange_weak(meta, (meta & ~kStateMask) | kInvisible,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed)) {
+  }
+  if ((meta & kRefMask) == 0) {
+    Free(e);
+  }
+}
+
+void ClockCache::Free(ClockHandle* e) {
+  assert((e->meta.load(std::memory_order_relaxed) & ~kUsageBit) == kInvisible);
+  (*e->deleter)(e->key(), e->value);
+  free(e->key_data);
+  if (e->detached) {
+    delete e;
+    return;
+  }
+
+  const uint32_t slot = static_cast<uint32_t>(e - slots_);
+  for (uint32_t index = e->hash.load(std::memory_order_relaxed) & mask_;
+       index != slot; index = (index + 1) & mask_) {
+    slots_[index].displacements.fetch_sub(1, std::memory_order_relaxed);
+  }
+  usage_ -= e->charge;
+  occupancy_--;
+  e->meta.store(kEmpty, std::memory_order_release);
+}
+
+void ClockCache::TryEvict(ClockHandle* e, bool ignore_usage) {
+  uint32_t meta = e->meta.load(std::memory_order_relaxed);
+  while ((meta & kStateMask) == kVisible && (meta & kRefMask) == 0) {
+    if ((meta & kUsageBit) != 0 && !ignore_usage) {
+      // Give the entry another sweep.  If a Lookup() got in first, it set
+      // the bit again anyway.
+      e->meta.compare_exchange_strong(meta, meta & ~kUsageBit,
+                                      std::memory_order_relaxed);
+      return;
+    }
+    if (e->meta.compare_exchange_weak(meta, kInvisible,
+                                      std::memory_order_acquire,
+                                      std::memory_order_relaxed)) {
+      Free(e);
+      return;
+    }
+  }
+}
+
+void ClockCache::Evict(size_t charge) {
+  for (uint32_t steps = 0; steps < 2 * (mask_ + 1); steps++) {
+    if (usage_ + charge <= capacity_ && occupancy_ < max_occupancy_) {
+      break;
+    }
+    ClockHandle* e = &slots_[hand_];
+    hand_ = (hand_ + 1) & mask_;
+    TryEvict(e, false);
+  }
+}
+
+void ClockCache::Erase(const Slice& key, uint32_t hash) {
+  MutexLock l(&mutex_);
+  ClockHandle* e = FindVisible(key, hash);
+  if (e != nullptr) {
+    MakeInvisible(e);
+  }
+}
+
+void ClockCache::Prune() {
+  MutexLock l(&mutex_);
+  for (uint32_t i = 0; i <= mask_; i++) {
+    TryEvict(&slots_[i], true);
+  }
+}
+
+static const int kNumShardBits = 4;
+static const int kNumShards = 1 << kNumShardBits;
+
+class ShardedClockCache : public Cache {
+ private:
+  ClockCache shard_[kNumShards];
+  port::Mutex id_mutex_;
+  uint64_t last_id_;
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+
+ public:
+  ShardedClockCache(size_t capacity, size_t estimated_entry_charge)
+      : last_id_(0) {
+    const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
+    for (int s = 0; s < kNumShards; s++) {
+      shard_[s].SetCapacity(per_shard, estimated_entry_charge);
+    }
+  }
+  ~ShardedClockCache() override {}
+  Handle* Insert(const Slice& key, void* value, size_t charge,
+                 void (*deleter)(const Slice& key, void* value)) override {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+  }
+  Handle* Lookup(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Lookup(key, hash);
+  }
+  void Release(Handle* handle) override {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+    shard_[Shard(h->hash.load(std::memory_order_relaxed))].Release(handle);
+  }
+  void Erase(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    shard_[Shard(hash)].Erase(key, hash);
+  }
+  void* Value(Handle* handle) override {
+    return reinterpret_cast<ClockHandle*>(handle)->value;
+  }
+  uint64_t NewId() override {
+    MutexLock l(&id_mutex_);
+    return ++(last_id_);
+  }
+  void Prune() override {
+    for (int s = 0; s < kNumShards; s++) {
+      shard_[s].Prune();
+    }
+  }
+  size_t TotalCharge() const override {
+    size_t total = 0;
+    for (int s = 0; s < kNumShards; s++) {
+      total += shard_[s].TotalCharge();
+    }
+    return total;
+  }
+};
+
+}  // end anonymous namespace
+
+Cache* NewClockCache(size_t capacity) {
+  return new ShardedClockCache(capacity, 4096);
+}
+
+Cache* NewClockCache(size_t capacity, size_t estimated_entry_charge) {
+  return new ShardedClockCache(capacity, estimated_entry_charge);
+}
+
+}  // namespace leveldb
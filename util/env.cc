@@ -28,10 +28,29 @@ Status Env::DeleteDir(const std::string& dirname) { return RemoveDir(dirname); }
 Status Env::RemoveFile(const std::string& fname) { return DeleteFile(fname); }
 Status Env::DeleteFile(const std::string& fname) { return RemoveFile(fname); }
 
+void Env::ScheduleWithPriority(void (*function)(void* arg), void* arg,
+                               Priority pri) {
+  Schedule(function, arg);
+}
+
+void Env::EnsureBackgroundThreads(int number, Priority pri) {}
+
 SequentialFile::~SequentialFile() = default;
 
 RandomAccessFile::~RandomAccessFile() = default;
 
+Status RandomAccessFile::MultiRead(ReadRequest* reqs, size_t n) const {
+  Status result;
+  for (size_t i = 0; i < n; i++) {
+    ReadRequest* req = &reqs[i];
+    req->status = Read(req->offset, req->n, &req->result, req->scratch);
+    if (result.ok()) {
+      result = req->status;
+    }
+  }
+  return result;
+}
+
 WritableFile::~WritableFile() = default;
 
 Logger::~Logger() = default;
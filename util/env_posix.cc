@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <cstddef>
@@ -19,6 +20,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <limits>
 #include <queue>
 #include <set>
@@ -33,6 +35,7 @@
 #include "port/port.h"
 #include "port/thread_annotations.h"
 #include "util/env_posix_test_helper.h"
+#include "util/no_destructor.h"
 #include "util/posix_logger.h"
 
 namespace leveldb {
@@ -140,6 +143,109 @@ class PosixSequentialFile final : public SequentialFile {
   const std::string filename_;
 };
 
+// Performs the reads of a RandomAccessFile::MultiRead() call in parallel,
+// so that the device sees them together instead of one after the other.
+//
+// The thread calling ReadAll() takes part in the reads, so a call makes
+// progress even if all of the reader threads are busy with other calls.
+//
+// This class is thread-safe.
+class ParallelReader {
+ public:
+  // Maximum number of reads of a single call in flight at the same time.
+  static constexpr int kMaxThreads = 8;
+
+  static ParallelReader* Default() {
+    static NoDestructor<ParallelReader> reader;
+    return reader.get();
+  }
+
+  ParallelReader() : work_cv_(&mu_), done_cv_(&mu_), started_threads_(0) {}
+
+  ParallelReader(const ParallelReader&) = delete;
+  ParallelReader& operator=(const ParallelReader&) = delete;
+
+  // Run file->Read() for all n requests in reqs[].
+  void ReadAll(const RandomAccessFile* file, ReadRequest* reqs, size_t n) {
+    Batch batch(file, reqs, n);
+    const int num_helpers =
+        static_cast<int>(std::min<size_t>(n - 1, kMaxThreads));
+
+    mu_.Lock();
+    while (started_threads_ < num_helpers) {
+      started_threads_++;
+      std::thread reader_thread(&ParallelReader::ReaderThreadMain, this);
+      reader_thread.detach();
+    }
+    for (int i = 0; i < num_helpers; i++) {
+      queue_.push_back(&batch);
+    }
+    work_cv_.SignalAll();
+    mu_.Unlock();
+
+    RunRequests(&batch);
+
+    mu_.Lock();
+    // Withdraw the copies of the batch that no thread has picked up, and
+    // wait for the threads that did to finish their reads.
+    queue_.erase(std::remove(queue_.begin(), queue_.end(), &batch),
+                 queue_.end());
+    while (batch.num_helpers > 0) {
+      done_cv_.Wait();
+    }
+    mu_.Unlock();
+  }
+
+ private:
+  struct Batch {
+    Batch(const RandomAccessFile* file, ReadRequest* reqs, size_t n)
+        : file(file), reqs(reqs), n(n), next(0), num_helpers(0) {}
+
+    const RandomAccessFile* const file;
+    ReadRequest* const reqs;
+    const size_t n;
+    std::atomic<size_t> next;  // Index of the next request to claim
+    int num_helpers;  // Reader threads working on the batch, guarded by mu_
+  };
+
+  static void RunRequests(Batch* batch) {
+    size_t i;
+    while ((i = batch->next.fetch_add(1, std::memory_order_relaxed)) <
+           batch->n) {
+      ReadRequest* req = &batch->reqs[i];
+      req->status =
+          batch->file->Read(req->offset, req->n, &req->result, req->scratch);
+    }
+  }
+
+  void ReaderThreadMain() {
+    mu_.Lock();
+    while (true) {
+      while (queue_.empty()) {
+        work_cv_.Wait();
+      }
+      Batch* batch = queue_.front();
+      queue_.pop_front();
+      batch->num_helpers++;
+      mu_.Unlock();
+
+      RunRequests(batch);
+
+      mu_.Lock();
+      batch->num_helpers--;
+      if (batch->num_helpers == 0) {
+        done_cv_.SignalAll();
+      }
+    }
+  }
+
+  port::Mutex mu_;
+  port::CondVar work_cv_ GUARDED_BY(mu_);
+  port::CondVar done_cv_ GUARDED_BY(mu_);
+  int started_threads_ GUARDED_BY(mu_);
+  std::deque<Batch*> queue_ GUARDED_BY(mu_);
+};
+
 // Implements random read access in a file using pread().
 //
 // Instances of this class are thread-safe, as required by the RandomAccessFile
@@ -195,6 +301,19 @@ class PosixRandomAccessFile final : public RandomAccessFile {
     return status;
   }
 
+  Status MultiRead(ReadRequest* reqs, size_t n) const override {
+    if (n <= 1) {
+      return RandomAccessFile::MultiRead(reqs, n);
+    }
+    ParallelReader::Default()->ReadAll(this, reqs, n);
+    for (size_t i = 0; i < n; i++) {
+      if (!reqs[i].status.ok()) {
+        return reqs[i].status;
+      }
+    }
+    return Status::OK();
+  }
+
  private:
   const bool has_permanent_fd_;  // If false, the file is opened on every read.
   const int fd_;                 // -1 if has_permanent_fd_ is false.
@@ -663,7 +782,15 @@ class PosixEnv : public Env {
   }
 
   void Schedule(void (*background_work_function)(void* background_work_arg),
-                void* background_work_arg) override;
+                void* background_work_arg) override {
+    ScheduleWithPriority(background_work_function, background_work_arg, kLow);
+  }
+
+  void ScheduleWithPriority(
+      void (*background_work_function)(void* background_work_arg),
+      void* background_work_arg, Priority pri) override;
+
+  void EnsureBackgroundThreads(int number, Priority pri) override;
 
   void StartThread(void (*thread_main)(void* thread_main_arg),
                    void* thread_main_arg) override {
@@ -719,11 +846,9 @@ class PosixEnv : public Env {
   }
 
  private:
-  void BackgroundThreadMain();
+  struct BackgroundPool;
 
-  static void BackgroundThreadEntryPoint(PosixEnv* env) {
-    env->BackgroundThreadMain();
-  }
+  static void BackgroundThreadMain(BackgroundPool* pool);
 
   // Stores the work item data in a Schedule() call.
   //
@@ -739,12 +864,19 @@ class PosixEnv : public Env {
     void* const arg;
   };
 
-  port::Mutex background_work_mutex_;
-  port::CondVar background_work_cv_ GUARDED_BY(background_work_mutex_);
-  bool started_background_thread_ GUARDED_BY(background_work_mutex_);
+  // The threads and queued work of one priority.  Threads are started
+  // lazily, on the first Schedule() call after the pool has grown.
+  struct BackgroundPool {
+    BackgroundPool() : cv(&mu), num_threads(1), started_threads(0) {}
 
-  std::queue<BackgroundWorkItem> background_work_queue_
-      GUARDED_BY(background_work_mutex_);
+    port::Mutex mu;
+    port::CondVar cv GUARDED_BY(mu);
+    int num_threads GUARDED_BY(mu);
+    int started_threads GUARDED_BY(mu);
+    std::queue<BackgroundWorkItem> queue GUARDED_BY(mu);
+  };
+
+  BackgroundPool background_pools_[2];  // Indexed by Priority
 
   PosixLockTable locks_;  // Thread-safe.
   Limiter mmap_limiter_;  // Thread-safe.
@@ -775,47 +907,52 @@ int MaxOpenFiles() {
 }  // namespace
 
 PosixEnv::PosixEnv()
-    : background_work_cv_(&background_work_mutex_),
-      started_background_thread_(false),
-      mmap_limiter_(MaxMmaps()),
-      fd_limiter_(MaxOpenFiles()) {}
+    : mmap_limiter_(MaxMmaps()), fd_limiter_(MaxOpenFiles()) {}
 
-void PosixEnv::Schedule(
+void PosixEnv::ScheduleWithPriority(
     void (*background_work_function)(void* background_work_arg),
-    void* background_work_arg) {
-  background_work_mutex_.Lock();
-
-  // Start the background thread, if we haven't done so already.
-  if (!started_background_thread_) {
-    started_background_thread_ = true;
-    std::thread background_thread(PosixEnv::BackgroundThreadEntryPoint, this);
+    void* background_work_arg, Priority pri) {
+  BackgroundPool* pool = &background_pools_[pri];
+  pool->mu.Lock();
+
+  // Start the background threads, if we haven't done so already.
+  while (pool->started_threads < pool->num_threads) {
+    pool->started_threads++;
+    std::thread background_thread(PosixEnv::BackgroundThreadMain, pool);
     background_thread.detach();
   }
 
-  // If the queue is empty, the background thread may be waiting for work.
-  if (background_work_queue_.empty()) {
-    background_work_cv_.Signal();
-  }
+  // Some background thread may be waiting for work.
+  pool->cv.Signal();
 
-  background_work_queue_.emplace(background_work_function, background_work_arg);
-  background_work_mutex_.Unlock();
+  pool->queue.emplace(background_work_function, background_work_arg);
+  pool->mu.Unlock();
+}
+
+void PosixEnv::EnsureBackgroundThreads(int number, Priority pri) {
+  BackgroundPool* pool = &background_pools_[pri];
+  pool->mu.Lock();
+  if (number > pool->num_threads) {
+    pool->num_threads = number;
+  }
+  pool->mu.Unlock();
 }
 
-void PosixEnv::BackgroundThreadMain() {
+void PosixEnv::BackgroundThreadMain(BackgroundPool* pool) {
   while (true) {
-    background_work_mutex_.Lock();
+    pool->mu.Lock();
 
     // Wait until there is work to be done.
-    while (background_work_queue_.empty()) {
-      background_work_cv_.Wait();
+    while (pool->queue.empty()) {
+      pool->cv.Wait();
     }
 
-    assert(!background_work_queue_.empty());
-    auto background_work_function = background_work_queue_.front().function;
-    void* background_work_arg = background_work_queue_.front().arg;
-    background_work_queue_.pop();
+    assert(!pool->queue.empty());
+    auto background_work_function = pool->queue.front().function;
+    void* background_work_arg = pool->queue.front().arg;
+    pool->queue.pop();
 
-    background_work_mutex_.Unlock();
+    pool->mu.Unlock();
     background_work_function(background_work_arg);
   }
 }
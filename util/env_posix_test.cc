@@ -212,6 +212,45 @@ TEST_F(EnvPosixTest, TestOpenOnRead) {
   ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
 }
 
+TEST_F(EnvPosixTest, TestMultiRead) {
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/multi_read.txt";
+  std::string data;
+  for (int i = 0; i < 1000; i++) {
+    data += std::to_string(i) + ",";
+  }
+  ASSERT_LEVELDB_OK(WriteStringToFile(env_, data, test_file));
+
+  // Open the file more times than the two limits allow, so that the last
+  // instances read with pread().
+  const int kNumFiles = kReadOnlyFileLimit + kMMapLimit + 5;
+  leveldb::RandomAccessFile* files[kNumFiles] = {0};
+  for (int i = 0; i < kNumFiles; i++) {
+    ASSERT_LEVELDB_OK(env_->NewRandomAccessFile(test_file, &files[i]));
+  }
+  for (int i = 0; i < kNumFiles; i++) {
+    const int kNumReads = 20;
+    ReadRequest reqs[kNumReads];
+    char scratch[kNumReads][100];
+    for (int r = 0; r < kNumReads; r++) {
+      reqs[r].offset = (r * 997 + i) % data.size();
+      reqs[r].n = sizeof(scratch[r]);
+      reqs[r].scratch = scratch[r];
+    }
+    ASSERT_LEVELDB_OK(files[i]->MultiRead(reqs, kNumReads));
+    for (int r = 0; r < kNumReads; r++) {
+      ASSERT_LEVELDB_OK(reqs[r].status);
+      ASSERT_EQ(data.substr(reqs[r].offset, reqs[r].n),
+                reqs[r].result.ToString());
+    }
+  }
+  for (int i = 0; i < kNumFiles; i++) {
+    delete files[i];
+  }
+  ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
+}
+
 #if HAVE_O_CLOEXEC
 
 TEST_F(EnvPosixTest, TestCloseOnExecSequentialFile) {
@@ -4,8 +4,29 @@
 
 #include "leveldb/filter_policy.h"
 
+#include <vector>
+
+#include "leveldb/slice.h"
+
 namespace leveldb {
 
 FilterPolicy::~FilterPolicy() {}
 
+void FilterPolicy::CreateFilterWithPrefixes(const Slice* keys, int n,
+                                            const Slice* prefixes, int m,
+                                            std::string* dst) const {
+  if (m == 0) {
+    CreateFilter(keys, n, dst);
+    return;
+  }
+  std::vector<Slice> all(keys, keys + n);
+  all.insert(all.end(), prefixes, prefixes + m);
+  CreateFilter(all.data(), static_cast<int>(all.size()), dst);
+}
+
+bool FilterPolicy::PrefixMayMatch(const Slice& prefix,
+                                  const Slice& filter) const {
+  return KeyMayMatch(prefix, filter);
+}
+
 }  // namespace leveldb
@@ -0,0 +1,511 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/persistent_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/logging.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+PersistentCache::~PersistentCache() = default;
+
+namespace {
+
+// File-backed persistent cache implementation
+//
+// Entries are appended as records to the active segment file, and a new
+// one is started once it is full.  Segment files are never changed after
+// that, and are removed oldest first to make room.  A record is
+//    masked crc32c of the rest of the record  (4 bytes)
+//    key length                                (4 bytes)
+//    data length                               (4 bytes)
+//    key
+//    data
+// Lookups read the record of the key and check it.  Records of the active
+// segment are read through a file opened for the lookup, because a
+// RandomAccessFile need not see data appended after it was opened.
+//
+// On deletion, the cache writes the locations of all entries to the INDEX
+// file, followed by the masked crc32c of its contents, after the number of
+// the newest segment file it covers.  A new cache reads the entries of the
+// segment files that the INDEX file does not cover, or of all of them if it
+// is missing or corrupt, from the files themselves.  It then removes the
+// INDEX file, so that a cache that is not deleted cleanly leaves none, and
+// numbers its new segment files above the ones the INDEX file covered.
+
+const char kIndexFileName[] = "/INDEX";
+const char kSegmentFileSuffix[] = ".cache";
+const size_t kRecordHeaderSize = 12;
+const uint64_t kMaxSegmentSize = 4 << 20;
+
+std::string SegmentFileName(const std::string& path, uint64_t number) {
+  char buf[100];
+  std::snprintf(buf, sizeof(buf), "/%06llu%s",
+                static_cast<unsigned long long>(number), kSegmentFileSuffix);
+  return path + buf;
+}
+
+void EncodeRecord(const Slice& key, const Slice& data, std::string* dst) {
+  dst->resize(4);
+  PutFixed32(dst, static_cast<uint32_t>(key.size()));
+  PutFixed32(dst, static_cast<uint32_t>(data.size()));
+  dst->append(key.data(), key.size());
+  dst->append(data.data(), data.size());
+  EncodeFixed32(&(*dst)[0], crc32c::Mask(crc32c::Value(dst->data() + 4,
+                                                       dst->size() - 4)));
+}
+
+// Parse the record at the start of "input".  On success, point *key and
+// *data into it, and set *size to the size of the record.
+bool DecodeRecord(const Slice& input, Slice* key, Slice* data, size_t* size) {
+  if (input.size() < kRecordHeaderSize) {
+    return false;
+  }
+  const uint32_t key_length = DecodeFixed32(input.data() + 4);
+  const uint32_t data_length = DecodeFixed32(input.data() + 8);
+  const uint64_t record_size =
+      uint64_t{kRecordHeaderSize} + key_length + data_length;
+  if (record_size > input.size()) {
+    return false;
+  }
+  const uint32_t crc = crc32c::Unmask(DecodeFixed32(input.data()));
+  if (crc32c::Value(input.data() + 4, record_size - 4) != crc) {
+    return false;
+  }
+  *key = Slice(input.data() + kRecordHeaderSize, key_length);
+  *data = Slice(key->data() + key_length, data_length);
+  *size = record_size;
+  return true;
+}
+
+struct Segment {
+  explicit Segment(uint64_t n)
+      : number(n), size(0), writer(nullptr), file(nullptr), refs(1) {}
+
+  uint64_t number;
+  uint64_t size;                  // Bytes of its records
+  WritableFile* writer;           // Non-null while records are appended
+  RandomAccessFile* file;         // Null until the segment is full
+  std::vector<std::string> keys;  // Keys of its records
+  int refs;                       // One for the cache, one per reader
+};
+
+struct Location {
+  Segment* segment;
+  uint64_t offset;
+  uint32_t size;
+};
+
+class FilePersistentCache : public PersistentCache {
+ public:
+  FilePersistentCache(Env* env, const std::string& path, uint64_t capacity)
+      : env_(env),
+        path_(path),
+        capacity_(capacity),
+        segment_size_(std::min(capacity / 8, kMaxSegmentSize)),
+        active_(nullptr),
+        active_flushed_(0),
+        total_size_(0),
+        next_number_(1) {}
+
+  ~FilePersistentCache() override;
+
+  // Find the entries of the existing segment files.
+  Status Recover();
+
+  Status Insert(const Slice& key, const Slice& data) override;
+  Status Lookup(const Slice& key, std::string* data) override;
+  uint64_t TotalSize() override {
+    MutexLock l(&mutex_);
+    return total_size_;
+  }
+
+ private:
+  void AddEntry(const Slice& key, Segment* segment, uint64_t offset,
+                uint32_t size) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Add the entries that the INDEX file holds for existing segments, and
+  // set *covered to the number of the newest segment file it covers.
+  // Return false if it is missing or corrupt.
+  bool LoadIndex(uint64_t* covered) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Add the entries of the records of a segment file, up to the first one
+  // that is corrupt.  The records are read one at a time.
+  void ScanSegment(Segment* segment) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  Status WriteIndex() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Close the active segment file, open it for reading, and start a new
+  // active segment.  On failure, the entries of the segment are dropped.
+  Status SealActive() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Drop the active segment and start a new one.
+  void ResetActive() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Remove the entries of "segment" and its file.
+  void Drop(Segment* segment) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  void Unref(Segment* segment) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  Env* const env_;
+  const std::string path_;
+  const uint64_t capacity_;
+  const uint64_t segment_size_;
+
+  port::Mutex mutex_;
+  std::map<uint64_t, Segment*> segments_ GUARDED_BY(mutex_);  // Written ones
+  Segment* active_ GUARDED_BY(mutex_);     // Segment appended to
+  uint64_t active_flushed_ GUARDED_BY(mutex_);  // Bytes of it in the file
+  std::unordered_map<std::string, Location> index_ GUARDED_BY(mutex_);
+  uint64_t total_size_ GUARDED_BY(mutex_);
+  uint64_t next_number_ GUARDED_BY(mutex_);
+};
+
+FilePersistentCache::~FilePersistentCache() {
+  MutexLock l(&mutex_);
+  if (active_ != nullptr) {
+    SealActive();
+    WriteIndex();
+    Unref(active_);
+  }
+  for (const auto& entry : segments_) {
+    assert(entry.second->refs == 1);  // Error if a Lookup() is still running
+    Unref(entry.second);
+  }
+}
+
+Status FilePersistentCache::Recover() {
+  MutexLock l(&mutex_);
+  env_->CreateDir(path_);  // Ignore error, the directory may exist
+  std::vector<std::string> children;
+  Status s = env_->GetChildren(path_, &children);
+  if (!s.ok()) {
+    return s;
+  }
+  for (const std::string& child : children) {
+    Slice name(child);
+    uint64_t number;
+    if (!ConsumeDecimalNumber(&name, &number) || name != kSegmentFileSuffix) {
+      continue;
+    }
+    const std::string fname = SegmentFileName(path_, number);
+    Segment* segment = new Segment(number);
+    s = env_->GetFileSize(fname, &segment->size);
+    if (s.ok()) {
+      s = env_->NewRandomAccessFile(fname, &segment->file);
+    }
+    if (!s.ok()) {
+      delete segment;
+      return s;
+    }
+    segments_[number] = segment;
+    total_size_ += segment->size;
+    next_number_ = std::max(next_number_, number + 1);
+  }
+
+  uint64_t covered;
+  if (!LoadIndex(&covered)) {
+    covered = 0;
+  }
+  env_->RemoveFile(path_ + kIndexFileName);  // Ignore error, may be missing
+  // Segment files covered by the INDEX file may be gone.  New ones must not
+  // take their numbers, or an INDEX file left behind would cover them too.
+  next_number_ = std::max(next_number_, covered + 1);
+  for (const auto& entry : segments_) {
+    if (entry.first > covered) {
+      ScanSegment(entry.second);
+    }
+  }
+  while (total_size_ > capacity_ && !segments_.empty()) {
+    Drop(segments_.begin()->second);
+  }
+  active_ = new Segment(next_number_++);
+  return Status::OK();
+}
+
+void FilePersistentCache::AddEntry(const Slice& key, Segment* segment,
+                                   uint64_t offset, uint32_t size) {
+  std::string k = key.ToString();
+  index_[k] = Location{segment, offset, size};
+  segment->keys.push_back(std::move(k));
+}
+
+bool FilePersistentCache::LoadIndex(uint64_t* covered) {
+  std::string contents;
+  if (!ReadFileToString(env_, path_ + kIndexFileName, &contents).ok() ||
+      contents.size() < 4) {
+    return false;
+  }
+  Slice input(contents.data(), contents.size() - 4);
+  const uint32_t crc = crc32c::Unmask(DecodeFixed32(input.data() + input.size()));
+  if (crc32c::Value(input.data(), input.size()) != crc ||
+      !GetVarint64(&input, covered)) {
+    return false;
+  }
+  while (!input.empty()) {
+    Slice key;
+    uint64_t number, offset;
+    uint32_t size;
+    if (!GetLengthPrefixedSlice(&input, &key) ||
+        !GetVarint64(&input, &number) || !GetVarint64(&input, &offset) ||
+        !GetVarint32(&input, &size)) {
+      return false;
+    }
+    auto it = segments_.find(number);
+    if (it != segments_.end() && offset + size <= it->second->size) {
+      AddEntry(key, it->second, offset, size);
+    }
+  }
+  return true;
+}
+
+void FilePersistentCache::ScanSegment(Segment* segment) {
+  SequentialFile* file;
+  if (!env_->NewSequentialFile(SegmentFileName(path_, segment->number), &file)
+           .ok()) {
+    return;
+  }
+  char header[kRecordHeaderSize];
+  std::string record;
+  uint64_t offset = 0;
+  while (true) {
+    Slice input;
+    if (!file->Read(kRecordHeaderSize, &input, header).ok() ||
+        input.size() != kRecordHeaderSize) {
+      break;
+    }
+    const uint64_t record_size = uint64_t{kRecordHeaderSize} +
+                                 DecodeFixed32(input.data() + 4) +
+                                 DecodeFixed32(input.data() + 8);
+    if (offset + record_size > segment->size) {
+      break;  // Corrupt lengths
+    }
+    record.assign(input.data(), input.size());
+    record.resize(record_size);
+    const size_t rest = record_size - kRecordHeaderSize;
+    if (!file->Read(rest, &input, &record[kRecordHeaderSize]).ok() ||
+        input.size() != rest) {
+      break;
+    }
+    if (input.data() != &record[kRecordHeaderSize]) {
+      std::memcpy(&record[kRecordHeaderSize], input.data(), rest);
+    }
+    Slice key, data;
+    size_t size;
+    if (!DecodeRecord(record, &key, &data, &size)) {
+      break;
+    }
+    AddEntry(key, segment, offset, static_cast<uint32_t>(size));
+    offset += size;
+  }
+  delete file;
+}
+
+Status FilePersistentCache::WriteIndex() {
+  std::string contents;
+  PutVarint64(&contents, segments_.empty() ? 0 : segments_.rbegin()->first);
+  for (const auto& entry : index_) {
+    PutLengthPrefixedSlice(&contents, entry.first);
+    PutVarint64(&contents, entry.second.segment->number);
+    PutVarint64(&contents, entry.second.offset);
+    PutVarint32(&contents, entry.second.size);
+  }
+  PutFixed32(&contents,
+             crc32c::Mask(crc32c::Value(contents.data(), contents.size())));
+
+  const std::string tmp = path_ + kIndexFileName + ".tmp";
+  WritableFile* file;
+  Status s = env_->NewWritableFile(tmp, &file);
+  if (!s.ok()) {
+    return s;
+  }
+  s = file->Append(contents);
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  delete file;
+  if (s.ok()) {
+    s = env_->RenameFile(tmp, path_ + kIndexFileName);
+  } else {
+    env_->RemoveFile(tmp);
+  }
+  return s;
+}
+
+Status FilePersistentCache::SealActive() {
+  if (active_->writer == nullptr) {
+    return Status::OK();
+  }
+  Status s = active_->writer->Close();
+  delete active_->writer;
+  active_->writer = nullptr;
+  if (s.ok()) {
+    s = env_->NewRandomAccessFile(SegmentFileName(path_, active_->number),
+                                  &active_->file);
+  }
+  if (!s.ok()) {
+    ResetActive();
+    return s;
+  }
+  segments_[active_->number] = active_;
+  active_ = new Segment(next_number_++);
+  active_flushed_ = 0;
+  return s;
+}
+
+void FilePersistentCache::ResetActive() {
+  Drop(active_);
+  active_ = new Segment(next_number_++);
+  active_flushed_ = 0;
+}
+
+void FilePersistentCache::Drop(Segment* segment) {
+  for (const std::string& key : segment->keys) {
+    auto it = index_.find(key);
+    if (it != index_.end() && it->second.segment == segment) {
+      index_.erase(it);
+    }
+  }
+  total_size_ -= segment->size;
+  segments_.erase(segment->number);
+  env_->RemoveFile(SegmentFileName(path_, segment->number));
+  Unref(segment);
+}
+
+void FilePersistentCache::Unref(Segment* segment) {
+  assert(segment->refs > 0);
+  if (--segment->refs == 0) {
+    delete segment->writer;
+    delete segment->file;
+    delete segment;
+  }
+}
+
+Status FilePersistentCache::Insert(const Slice& key, const Slice& data) {
+  std::string record;
+  EncodeRecord(key, data, &record);
+
+  MutexLock l(&mutex_);
+  Status s;
+  if (active_->size > 0 && active_->size + record.size() > segment_size_) {
+    s = SealActive();
+  }
+  Status write_status;
+  if (active_->writer == nullptr) {
+    write_status = env_->NewWritableFile(
+        SegmentFileName(path_, active_->number), &active_->writer);
+  }
+  if (write_status.ok()) {
+    write_status = active_->writer->Append(record);
+  }
+  if (!write_status.ok()) {
+    ResetActive();
+    return write_status;
+  }
+  AddEntry(key, active_, active_->size, static_cast<uint32_t>(record.size()));
+  active_->size += record.size();
+  total_size_ += record.size();
+  while (total_size_ > capacity_ && !segments_.empty()) {
+    Drop(segments_.begin()->second);
+  }
+  return s;
+}
+
+Status FilePersistentCache::Lookup(const Slice& key, std::string* data) {
+  Location location;
+  RandomAccessFile* file;
+  Status s;
+  {
+    MutexLock l(&mutex_);
+    auto it = index_.find(key.ToString());
+    if (it == index_.end()) {
+      return Status::NotFound(Slice());
+    }
+    location = it->second;
+    location.segment->refs++;
+    file = location.segment->file;
+    if (location.segment == active_ &&
+        location.offset + location.size > active_flushed_) {
+      s = active_->writer->Flush();
+      active_flushed_ = active_->size;
+    }
+  }
+
+  // Read outside the lock.  The reference keeps the file open even if
+  // the segment is dropped meanwhile.
+  std::string record(location.size, '\0');
+  Slice contents;
+  const bool own_file = (file == nullptr);
+  if (s.ok() && own_file) {
+    s = env_->NewRandomAccessFile(
+        SegmentFileName(path_, location.segment->number), &file);
+  }
+  if (s.ok()) {
+    s = file->Read(location.offset, location.size, &contents, &record[0]);
+  }
+  if (s.ok() && contents.data() != record.data()) {
+    // The file may have returned a pointer into memory of its own, which
+    // goes away with it.
+    record.assign(contents.data(), contents.size());
+    contents = record;
+  }
+  if (own_file) {
+    delete file;
+  }
+  {
+    MutexLock l(&mutex_);
+    Unref(location.segment);
+  }
+
+  Slice record_key, record_data;
+  size_t size;
+  if (s.ok() && DecodeRecord(contents, &record_key, &record_data, &size) &&
+      record_key == key) {
+    data->assign(record_data.data(), record_data.size());
+    return Status::OK();
+  }
+
+  // Drop the entry, unless it was replaced meanwhile
+  MutexLock l(&mutex_);
+  auto it = index_.find(key.ToString());
+  if (it != index_.end() && it->second.segment == location.segment &&
+      it->second.offset == location.offset) {
+    index_.erase(it);
+  }
+  return s.ok() ? Status::NotFound("corrupted entry") : s;
+}
+
+}  // namespace
+
+Status NewFilePersistentCache(Env* env, const std::string& path,
+                              uint64_t capacity, PersistentCache** result) {
+  *result = nullptr;
+  FilePersistentCache* cache = new FilePersistentCache(env, path, capacity);
+  Status s = cache->Recover();
+  if (!s.ok()) {
+    delete cache;
+    return s;
+  }
+  *result = cache;
+  return s;
+}
+
+}  // namespace leveldb
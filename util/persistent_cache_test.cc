@@ -0,0 +1,213 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/persistent_cache.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "leveldb/env.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+static const uint64_t kCapacity = 8000;
+
+class PersistentCacheTest : public testing::Test {
+ public:
+  PersistentCacheTest() : env_(Env::Default()), cache_(nullptr) {
+    EXPECT_LEVELDB_OK(env_->GetTestDirectory(&path_));
+    path_ += "/persistent_cache_test";
+    DeleteFiles();
+    Reopen();
+  }
+
+  ~PersistentCacheTest() {
+    delete cache_;
+    DeleteFiles();
+  }
+
+  void DeleteFiles() {
+    std::vector<std::string> children;
+    env_->GetChildren(path_, &children);
+    for (const std::string& child : children) {
+      env_->RemoveFile(path_ + "/" + child);
+    }
+    env_->RemoveDir(path_);
+  }
+
+  void Reopen() {
+    delete cache_;
+    cache_ = nullptr;
+    ASSERT_LEVELDB_OK(NewFilePersistentCache(env_, path_, kCapacity, &cache_));
+  }
+
+  static std::string Value(int k) { return std::string(100, 'a' + k % 26); }
+
+  void Insert(int k) {
+    ASSERT_LEVELDB_OK(cache_->Insert(std::to_string(k), Value(k)));
+  }
+
+  std::string Lookup(int k) {
+    std::string data;
+    Status s = cache_->Lookup(std::to_string(k), &data);
+    if (s.IsNotFound()) {
+      return "NOT_FOUND";
+    }
+    return s.ok() ? data : s.ToString();
+  }
+
+  std::vector<std::string> SegmentFiles() {
+    std::vector<std::string> children, result;
+    env_->GetChildren(path_, &children);
+    for (const std::string& child : children) {
+      if (child.size() > 6 && child.substr(child.size() - 6) == ".cache") {
+        result.push_back(child);
+      }
+    }
+    return result;
+  }
+
+  Env* env_;
+  std::string path_;
+  PersistentCache* cache_;
+};
+
+TEST_F(PersistentCacheTest, InsertAndLookup) {
+  ASSERT_EQ("NOT_FOUND", Lookup(1));
+  Insert(1);
+  Insert(2);
+  ASSERT_EQ(Value(1), Lookup(1));
+  ASSERT_EQ(Value(2), Lookup(2));
+  ASSERT_EQ("NOT_FOUND", Lookup(3));
+
+  // Entries stay readable once their segment is written to a file
+  for (int i = 3; i < 30; i++) {
+    Insert(i);
+  }
+  ASSERT_FALSE(SegmentFiles().empty());
+  ASSERT_EQ(Value(1), Lookup(1));
+  ASSERT_EQ(Value(29), Lookup(29));
+}
+
+TEST_F(PersistentCacheTest, ReadsActiveSegment) {
+  // Entries are written to the newest segment file as they are inserted,
+  // and are readable in between.
+  Insert(1);
+  ASSERT_EQ(1, SegmentFiles().size());
+  ASSERT_EQ(Value(1), Lookup(1));
+  Insert(2);
+  ASSERT_EQ(Value(2), Lookup(2));
+  ASSERT_EQ(Value(1), Lookup(1));
+  ASSERT_EQ(1, SegmentFiles().size());
+}
+
+TEST_F(PersistentCacheTest, Replace) {
+  Insert(1);
+  ASSERT_LEVELDB_OK(cache_->Insert("1", "new"));
+  ASSERT_EQ("new", Lookup(1));
+  Reopen();
+  ASSERT_EQ("new", Lookup(1));
+}
+
+TEST_F(PersistentCacheTest, SurvivesRestart) {
+  for (int i = 0; i < 40; i++) {
+    Insert(i);
+  }
+  Reopen();
+  for (int i = 0; i < 40; i++) {
+    ASSERT_EQ(Value(i), Lookup(i)) << i;
+  }
+}
+
+TEST_F(PersistentCacheTest, RecoversWithoutIndex) {
+  for (int i = 0; i < 40; i++) {
+    Insert(i);
+  }
+  delete cache_;
+  cache_ = nullptr;
+  ASSERT_LEVELDB_OK(env_->RemoveFile(path_ + "/INDEX"));
+  Reopen();
+  for (int i = 0; i < 40; i++) {
+    ASSERT_EQ(Value(i), Lookup(i)) << i;
+  }
+}
+
+TEST_F(PersistentCacheTest, RecoversSegmentsNewerThanIndex) {
+  for (int i = 0; i < 40; i++) {
+    Insert(i);
+  }
+  delete cache_;
+  cache_ = nullptr;
+  std::string stale_index;
+  ASSERT_LEVELDB_OK(ReadFileToString(env_, path_ + "/INDEX", &stale_index));
+  for (const std::string& segment : SegmentFiles()) {
+    ASSERT_LEVELDB_OK(env_->RemoveFile(path_ + "/" + segment));
+  }
+
+  // The INDEX file is removed once it is read
+  Reopen();
+  ASSERT_FALSE(env_->FileExists(path_ + "/INDEX"));
+  for (int i = 100; i < 140; i++) {
+    Insert(i);
+  }
+
+  // Even with the old INDEX file put back, as if a crash had left it
+  // behind, the new segment files are scanned.
+  delete cache_;
+  cache_ = nullptr;
+  ASSERT_LEVELDB_OK(WriteStringToFile(env_, stale_index, path_ + "/INDEX"));
+  Reopen();
+  for (int i = 100; i < 140; i++) {
+    ASSERT_EQ(Value(i), Lookup(i)) << i;
+  }
+  ASSERT_EQ("NOT_FOUND", Lookup(0));
+}
+
+TEST_F(PersistentCacheTest, EvictsOldestSegments) {
+  for (int i = 0; i < 1000; i++) {
+    Insert(i);
+    ASSERT_LE(cache_->TotalSize(), kCapacity);
+  }
+  // The recent entries are kept and the old ones are gone
+  ASSERT_EQ(Value(999), Lookup(999));
+  ASSERT_EQ("NOT_FOUND", Lookup(0));
+  ASSERT_LE(SegmentFiles().size(), 8u);
+  Reopen();
+  ASSERT_EQ(Value(999), Lookup(999));
+  ASSERT_EQ("NOT_FOUND", Lookup(0));
+  ASSERT_LE(cache_->TotalSize(), kCapacity);
+}
+
+TEST_F(PersistentCacheTest, DetectsCorruption) {
+  for (int i = 0; i < 40; i++) {
+    Insert(i);
+  }
+  delete cache_;
+  cache_ = nullptr;
+
+  // Flip a byte in the data of the first entry of the oldest segment
+  std::vector<std::string> segments = SegmentFiles();
+  ASSERT_FALSE(segments.empty());
+  std::sort(segments.begin(), segments.end());
+  const std::string fname = path_ + "/" + segments[0];
+  std::string contents;
+  ASSERT_LEVELDB_OK(ReadFileToString(env_, fname, &contents));
+  contents[20] ^= 0x1;
+  ASSERT_LEVELDB_OK(WriteStringToFile(env_, contents, fname));
+
+  Reopen();
+  ASSERT_EQ("NOT_FOUND", Lookup(0));
+  ASSERT_EQ(Value(1), Lookup(1));
+  ASSERT_EQ(Value(39), Lookup(39));
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
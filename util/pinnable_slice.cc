@@ -0,0 +1,105 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/pinnable_slice.h"
+
+#include <cassert>
+#include <utility>
+
+namespace leveldb {
+
+PinnableSlice::PinnableSlice() : PinnableSlice(&self_space_) {}
+
+PinnableSlice::PinnableSlice(std::string* buf) : buf_(buf), pinned_(false) {
+  cleanup_head_.function = nullptr;
+  cleanup_head_.next = nullptr;
+}
+
+PinnableSlice::~PinnableSlice() { Release(); }
+
+PinnableSlice& PinnableSlice::operator=(PinnableSlice&& other) {
+  if (this == &other) {
+    return *this;
+  }
+  Release();
+  if (other.pinned_) {
+    Slice::operator=(other);
+    pinned_ = true;
+    cleanup_head_ = other.cleanup_head_;
+    other.pinned_ = false;
+    other.cleanup_head_.function = nullptr;
+    other.cleanup_head_.next = nullptr;
+    other.clear();
+  } else {
+    // The data lives in other's buffer, which may not be its own.
+    if (buf_ == &self_space_ && other.buf_ == &other.self_space_) {
+      std::swap(self_space_, other.self_space_);
+      PinSelf();
+    } else {
+      PinSelf(other);
+    }
+    other.Reset();
+  }
+  return *this;
+}
+
+void PinnableSlice::Release() {
+  if (cleanup_head_.function != nullptr) {
+    (*cleanup_head_.function)(cleanup_head_.arg1, cleanup_head_.arg2);
+    for (CleanupNode* node = cleanup_head_.next; node != nullptr;) {
+      (*node->function)(node->arg1, node->arg2);
+      CleanupNode* next_node = node->next;
+      delete node;
+      node = next_node;
+    }
+    cleanup_head_.function = nullptr;
+    cleanup_head_.next = nullptr;
+  }
+  pinned_ = false;
+}
+
+void PinnableSlice::PinSlice(const Slice& s, CleanupFunction function,
+                             void* arg1, void* arg2) {
+  Release();
+  Slice::operator=(s);
+  pinned_ = true;
+  if (function != nullptr) {
+    RegisterCleanup(function, arg1, arg2);
+  }
+}
+
+void PinnableSlice::RegisterCleanup(CleanupFunction function, void* arg1,
+                                    void* arg2) {
+  assert(pinned_);
+  assert(function != nullptr);
+  CleanupNode* node;
+  if (cleanup_head_.function == nullptr) {
+    node = &cleanup_head_;
+  } else {
+    node = new CleanupNode();
+    node->next = cleanup_head_.next;
+    cleanup_head_.next = node;
+  }
+  node->function = function;
+  node->arg1 = arg1;
+  node->arg2 = arg2;
+}
+
+void PinnableSlice::PinSelf(const Slice& s) {
+  Release();
+  buf_->assign(s.data(), s.size());
+  Slice::operator=(*buf_);
+}
+
+void PinnableSlice::PinSelf() {
+  Release();
+  Slice::operator=(*buf_);
+}
+
+void PinnableSlice::Reset() {
+  Release();
+  clear();
+}
+
+}  // namespace leveldb
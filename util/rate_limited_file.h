@@ -0,0 +1,50 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_RATE_LIMITED_FILE_H_
+#define STORAGE_LEVELDB_UTIL_RATE_LIMITED_FILE_H_
+
+#include "leveldb/env.h"
+#include "leveldb/rate_limiter.h"
+
+namespace leveldb {
+
+// A WritableFile that asks a RateLimiter for permission before every
+// Append() to the file it wraps.
+class RateLimitedWritableFile : public WritableFile {
+ public:
+  // Takes ownership of "base".
+  RateLimitedWritableFile(WritableFile* base, RateLimiter* limiter,
+                          RateLimiter::IOPriority pri)
+      : base_(base), limiter_(limiter), pri_(pri) {}
+
+  ~RateLimitedWritableFile() override { delete base_; }
+
+  Status Append(const Slice& data) override {
+    limiter_->Request(data.size(), pri_);
+    return base_->Append(data);
+  }
+  Status Close() override { return base_->Close(); }
+  Status Flush() override { return base_->Flush(); }
+  Status Sync() override { return base_->Sync(); }
+
+ private:
+  WritableFile* const base_;
+  RateLimiter* const limiter_;
+  const RateLimiter::IOPriority pri_;
+};
+
+// Return "file" itself if "limiter" is null, or else a wrapper that
+// limits its writes and takes ownership of "file".
+inline WritableFile* MaybeRateLimit(WritableFile* file, RateLimiter* limiter,
+                                    RateLimiter::IOPriority pri) {
+  if (limiter == nullptr) {
+    return file;
+  }
+  return new RateLimitedWritableFile(file, limiter, pri);
+}
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_RATE_LIMITED_FILE_H_
@@ -0,0 +1,174 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include <algorithm>
+#include <deque>
+
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
+
+namespace leveldb {
+
+RateLimiter::~RateLimiter() {}
+
+namespace {
+
+// Token bucket refilled with bytes_per_second * refill_period worth of
+// tokens once per refill period.  Requests that cannot be satisfied
+// immediately are queued per priority.  One of the queued requests acts
+// as the leader: it sleeps until the next refill and hands the new
+// tokens out, highest priority first.
+class GenericRateLimiter : public RateLimiter {
+ public:
+  GenericRateLimiter(int64_t bytes_per_second, int64_t refill_period_micros,
+                     Env* env)
+      : env_(env),
+        bytes_per_second_(std::max<int64_t>(bytes_per_second, 1)),
+        refill_period_micros_(std::max<int64_t>(refill_period_micros, 1)),
+        refill_bytes_per_period_(std::max<int64_t>(
+            bytes_per_second_ * refill_period_micros_ / 1000000, 1)),
+        rnd_(0xdeadbeef),
+        available_bytes_(0),
+        next_refill_micros_(0),
+        leader_(nullptr) {
+    for (int i = 0; i < kNumPriorities; i++) {
+      total_bytes_through_[i] = 0;
+    }
+  }
+
+  ~GenericRateLimiter() override {
+    MutexLock l(&mu_);
+    for (int i = 0; i < kNumPriorities; i++) {
+      assert(queue_[i].empty());
+    }
+  }
+
+  void Request(size_t bytes, IOPriority pri) override {
+    // Requests are served in chunks of at most one refill period's worth
+    // of tokens so that large writes do not wait forever.
+    int64_t remaining = static_cast<int64_t>(bytes);
+    while (remaining > 0) {
+      const int64_t chunk = std::min(remaining, refill_bytes_per_period_);
+      RequestChunk(chunk, pri);
+      remaining -= chunk;
+    }
+  }
+
+  int64_t GetBytesPerSecond() const override { return bytes_per_second_; }
+
+  int64_t GetTotalBytesThrough(IOPriority pri) const override {
+    MutexLock l(&mu_);
+    return total_bytes_through_[pri];
+  }
+
+ private:
+  struct Req {
+    Req(int64_t b, port::Mutex* mu) : bytes(b), granted(false), cv(mu) {}
+    int64_t bytes;
+    bool granted;
+    port::CondVar cv;
+  };
+
+  void RequestChunk(int64_t bytes, IOPriority pri) {
+    MutexLock l(&mu_);
+    total_bytes_through_[pri] += bytes;
+
+    if (queue_[kHigh].empty() && queue_[kLow].empty() &&
+        available_bytes_ >= bytes) {
+      available_bytes_ -= bytes;
+      return;
+    }
+
+    Req r(bytes, &mu_);
+    queue_[pri].push_back(&r);
+    while (!r.granted) {
+      if (leader_ != nullptr) {
+        r.cv.Wait();
+        continue;
+      }
+
+      // Become the leader and wait for the next refill.
+      leader_ = &r;
+      const uint64_t now = env_->NowMicros();
+      if (next_refill_micros_ > now) {
+        const uint64_t wait = next_refill_micros_ - now;
+        mu_.Unlock();
+        env_->SleepForMicroseconds(static_cast<int>(wait));
+        mu_.Lock();
+      }
+      Refill();
+      leader_ = nullptr;
+
+      if (r.granted) {
+        // Pass leadership on to the next waiting request, if any.
+        for (int i = kNumPriorities - 1; i >= 0; i--) {
+          if (!queue_[i].empty()) {
+            queue_[i].front()->cv.Signal();
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  void Refill() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    next_refill_micros_ = env_->NowMicros() + refill_period_micros_;
+    // Idle periods do not build up a burst larger than one period's worth.
+    available_bytes_ =
+        std::min(available_bytes_ + refill_bytes_per_period_,
+                 refill_bytes_per_period_);
+
+    // Serve low priority requests first once in a while so that they
+    // cannot be starved by a steady stream of high priority requests.
+    const bool low_first = rnd_.OneIn(10);
+    for (int i = 0; i < kNumPriorities; i++) {
+      std::deque<Req*>* queue = &queue_[low_first ? i : kNumPriorities - 1 - i];
+      while (!queue->empty()) {
+        Req* next = queue->front();
+        if (next->bytes > available_bytes_) {
+          return;
+        }
+        available_bytes_ -= next->bytes;
+        next->granted = true;
+        queue->pop_front();
+        if (next != leader_) {
+          next->cv.Signal();
+        }
+      }
+    }
+  }
+
+  Env* const env_;
+  const int64_t bytes_per_second_;
+  const int64_t refill_period_micros_;
+  const int64_t refill_bytes_per_period_;
+
+  mutable port::Mutex mu_;
+  Random rnd_ GUARDED_BY(mu_);
+  int64_t available_bytes_ GUARDED_BY(mu_);
+  uint64_t next_refill_micros_ GUARDED_BY(mu_);
+  Req* leader_ GUARDED_BY(mu_);
+  std::deque<Req*> queue_[kNumPriorities] GUARDED_BY(mu_);
+  int64_t total_bytes_through_[kNumPriorities] GUARDED_BY(mu_);
+};
+
+}  // namespace
+
+RateLimiter* NewGenericRateLimiter(int64_t bytes_per_second,
+                                   int64_t refill_period_micros) {
+  return NewGenericRateLimiter(Env::Default(), bytes_per_second,
+                               refill_period_micros);
+}
+
+RateLimiter* NewGenericRateLimiter(Env* env, int64_t bytes_per_second,
+                                   int64_t refill_period_micros) {
+  return new GenericRateLimiter(bytes_per_second, refill_period_micros, env);
+}
+
+}  // namespace leveldb
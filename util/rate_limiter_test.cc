@@ -0,0 +1,125 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include <atomic>
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "leveldb/env.h"
+
+namespace leveldb {
+
+TEST(RateLimiterTest, LimitsThroughput) {
+  // 1MB/s, refilled with 10KB every 10ms.
+  std::unique_ptr<RateLimiter> limiter(NewGenericRateLimiter(1000000, 10000));
+  ASSERT_EQ(1000000, limiter->GetBytesPerSecond());
+
+  Env* env = Env::Default();
+  const uint64_t start = env->NowMicros();
+  for (int i = 0; i < 50; i++) {
+    limiter->Request(4000, RateLimiter::kLow);
+  }
+  const uint64_t elapsed = env->NowMicros() - start;
+
+  // 200KB at 1MB/s, minus the initial burst of one refill period.
+  ASSERT_GE(elapsed, 150000);
+  ASSERT_LT(elapsed, 2000000);
+  ASSERT_EQ(200000, limiter->GetTotalBytesThrough(RateLimiter::kLow));
+  ASSERT_EQ(0, limiter->GetTotalBytesThrough(RateLimiter::kHigh));
+}
+
+// An Env whose clock only moves when a thread sleeps.
+class FakeClockEnv : public EnvWrapper {
+ public:
+  FakeClockEnv() : EnvWrapper(Env::Default()), now_micros_(1000000) {}
+
+  uint64_t NowMicros() override { return now_micros_.load(); }
+  void SleepForMicroseconds(int micros) override {
+    now_micros_.fetch_add(micros);
+  }
+
+ private:
+  std::atomic<uint64_t> now_micros_;
+};
+
+TEST(RateLimiterTest, UsesGivenEnv) {
+  FakeClockEnv env;
+  std::unique_ptr<RateLimiter> limiter(
+      NewGenericRateLimiter(&env, 1000000, 10000));
+  const uint64_t start = env.NowMicros();
+  for (int i = 0; i < 50; i++) {
+    limiter->Request(4000, RateLimiter::kLow);
+  }
+  // 200KB at 1MB/s takes at least 200ms of the fake clock, without any
+  // real sleeping.  Two 4KB requests fit in each 10KB refill.
+  const uint64_t elapsed = env.NowMicros() - start;
+  ASSERT_GE(elapsed, 200000);
+  ASSERT_LE(elapsed, 250000);
+}
+
+TEST(RateLimiterTest, LargeRequestsAreSplit) {
+  std::unique_ptr<RateLimiter> limiter(NewGenericRateLimiter(1000000, 10000));
+  Env* env = Env::Default();
+  const uint64_t start = env->NowMicros();
+  limiter->Request(100000, RateLimiter::kHigh);  // Ten refill periods
+  ASSERT_GE(env->NowMicros() - start, 50000);
+  ASSERT_EQ(100000, limiter->GetTotalBytesThrough(RateLimiter::kHigh));
+}
+
+namespace {
+
+struct PriorityState {
+  RateLimiter* limiter;
+  RateLimiter::IOPriority pri;
+  std::atomic<bool>* stop;
+  std::atomic<int>* running;
+  std::atomic<int64_t> requests{0};
+};
+
+void RequestUntilStopped(void* arg) {
+  PriorityState* state = reinterpret_cast<PriorityState*>(arg);
+  while (!state->stop->load(std::memory_order_acquire)) {
+    // A full refill period's worth, so only one request is served at a
+    // time.
+    state->limiter->Request(10000, state->pri);
+    state->requests.fetch_add(1, std::memory_order_relaxed);
+  }
+  state->running->fetch_sub(1, std::memory_order_release);
+}
+
+}  // namespace
+
+TEST(RateLimiterTest, HighPriorityServedFirst) {
+  std::unique_ptr<RateLimiter> limiter(NewGenericRateLimiter(1000000, 10000));
+  std::atomic<bool> stop(false);
+  std::atomic<int> running(2);
+  PriorityState low, high;
+  low.limiter = high.limiter = limiter.get();
+  low.pri = RateLimiter::kLow;
+  high.pri = RateLimiter::kHigh;
+  low.stop = high.stop = &stop;
+  low.running = high.running = &running;
+
+  Env* env = Env::Default();
+  env->StartThread(RequestUntilStopped, &low);
+  env->StartThread(RequestUntilStopped, &high);
+  env->SleepForMicroseconds(500000);
+  stop.store(true, std::memory_order_release);
+  while (running.load(std::memory_order_acquire) > 0) {
+    env->SleepForMicroseconds(10000);
+  }
+
+  // Low priority requests are only let through first once in a while.
+  ASSERT_GT(high.requests.load(), 2 * low.requests.load());
+  ASSERT_GT(low.requests.load(), 0);
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
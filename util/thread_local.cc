@@ -0,0 +1,191 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/thread_local.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/mutexlock.h"
+#include "util/no_destructor.h"
+
+namespace leveldb {
+
+namespace {
+
+// The pointers of one thread, indexed by the ids of the ThreadLocalPtrs.
+// Only the thread itself grows "entries", while holding the registry
+// lock, so it reads them without the lock.
+struct ThreadData {
+  ThreadData() : entries(nullptr), size(0), next(this), prev(this) {}
+
+  std::atomic<void*>* entries;
+  size_t size;
+
+  // Circular list of the data of all threads
+  ThreadData* next;
+  ThreadData* prev;
+};
+
+class Registry {
+ public:
+  Registry() : next_id_(0) {}
+
+  uint32_t AcquireId(ThreadLocalPtr::UnrefHandler handler);
+
+  // Hand the pointers that the threads still have for "id" to its handler
+  // and make the id available for reuse.
+  void ReleaseId(uint32_t id);
+
+  // Return the pointer for "id" of the calling thread.
+  std::atomic<void*>* Entry(uint32_t id);
+
+  void Scrape(uint32_t id, std::vector<void*>* ptrs, void* replacement);
+
+  void OnThreadExit(ThreadData* data);
+
+ private:
+  port::Mutex mutex_;
+  ThreadData head_ GUARDED_BY(mutex_);
+  uint32_t next_id_ GUARDED_BY(mutex_);
+  std::vector<uint32_t> free_ids_ GUARDED_BY(mutex_);
+  std::vector<ThreadLocalPtr::UnrefHandler> handlers_ GUARDED_BY(mutex_);
+};
+
+Registry* GetRegistry() {
+  static NoDestructor<Registry> registry;
+  return registry.get();
+}
+
+// Hands the pointers of a thread to their handlers when it exits.
+struct ThreadDataHolder {
+  ~ThreadDataHolder() {
+    if (data != nullptr) {
+      GetRegistry()->OnThreadExit(data);
+    }
+  }
+
+  ThreadData* data = nullptr;
+};
+
+thread_local ThreadDataHolder thread_data;
+
+uint32_t Registry::AcquireId(ThreadLocalPtr::UnrefHandler handler) {
+  MutexLock l(&mutex_);
+  uint32_t id;
+  if (!free_ids_.empty()) {
+    id = free_ids_.back();
+    free_ids_.pop_back();
+  } else {
+    id = next_id_++;
+    handlers_.resize(next_id_);
+  }
+  handlers_[id] = handler;
+  return id;
+}
+
+void Registry::ReleaseId(uint32_t id) {
+  MutexLock l(&mutex_);
+  for (ThreadData* t = head_.next; t != &head_; t = t->next) {
+    if (id < t->size) {
+      void* ptr = t->entries[id].exchange(nullptr, std::memory_order_acq_rel);
+      if (ptr != nullptr && handlers_[id] != nullptr) {
+        (*handlers_[id])(ptr);
+      }
+    }
+  }
+  handlers_[id] = nullptr;
+  free_ids_.push_back(id);
+}
+
+std::atomic<void*>* Registry::Entry(uint32_t id) {
+  ThreadData* data = thread_data.data;
+  if (data != nullptr && id < data->size) {
+    return &data->entries[id];
+  }
+
+  MutexLock l(&mutex_);
+  if (data == nullptr) {
+    data = new ThreadData;
+    data->next = &head_;
+    data->prev = head_.prev;
+    data->prev->next = data;
+    head_.prev = data;
+    thread_data.data = data;
+  }
+  if (id >= data->size) {
+    const size_t new_size = std::max<size_t>(id + 1, 2 * data->size);
+    std::atomic<void*>* entries = new std::atomic<void*>[new_size];
+    for (size_t i = 0; i < new_size; i++) {
+      entries[i].store(
+          i < data->size ? data->entries[i].load(std::memory_order_relaxed)
+                         : nullptr,
+          std::memory_order_relaxed);
+    }
+    delete[] data->entries;
+    data->entries = entries;
+    data->size = new_size;
+  }
+  return &data->entries[id];
+}
+
+void Registry::Scrape(uint32_t id, std::vector<void*>* ptrs,
+                      void* replacement) {
+  MutexLock l(&mutex_);
+  for (ThreadData* t = head_.next; t != &head_; t = t->next) {
+    if (id < t->size) {
+      void* ptr = t->entries[id].exchange(replacement, std::memory_order_acq_rel);
+      if (ptr != nullptr) {
+        ptrs->push_back(ptr);
+      }
+    }
+  }
+}
+
+void Registry::OnThreadExit(ThreadData* data) {
+  MutexLock l(&mutex_);
+  for (size_t id = 0; id < data->size; id++) {
+    void* ptr = data->entries[id].load(std::memory_order_acquire);
+    if (ptr != nullptr && handlers_[id] != nullptr) {
+      (*handlers_[id])(ptr);
+    }
+  }
+  data->prev->next = data->next;
+  data->next->prev = data->prev;
+  delete[] data->entries;
+  delete data;
+}
+
+}  // namespace
+
+ThreadLocalPtr::ThreadLocalPtr(UnrefHandler handler)
+    : id_(GetRegistry()->AcquireId(handler)) {}
+
+ThreadLocalPtr::~ThreadLocalPtr() { GetRegistry()->ReleaseId(id_); }
+
+void* ThreadLocalPtr::Get() const {
+  return GetRegistry()->Entry(id_)->load(std::memory_order_acquire);
+}
+
+void ThreadLocalPtr::Reset(void* ptr) {
+  GetRegistry()->Entry(id_)->store(ptr, std::memory_order_release);
+}
+
+void* ThreadLocalPtr::Swap(void* ptr) {
+  return GetRegistry()->Entry(id_)->exchange(ptr, std::memory_order_acq_rel);
+}
+
+bool ThreadLocalPtr::CompareAndSwap(void* ptr, void*& expected) {
+  return GetRegistry()->Entry(id_)->compare_exchange_strong(
+      expected, ptr, std::memory_order_acq_rel);
+}
+
+void ThreadLocalPtr::Scrape(std::vector<void*>* ptrs, void* replacement) {
+  GetRegistry()->Scrape(id_, ptrs, replacement);
+}
+
+}  // namespace leveldb
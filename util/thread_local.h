@@ -0,0 +1,57 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_THREAD_LOCAL_H_
+#define STORAGE_LEVELDB_UTIL_THREAD_LOCAL_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace leveldb {
+
+// A ThreadLocalPtr holds a separate pointer for every thread, which only
+// that thread reads and updates, except that Scrape() takes the pointers
+// of all threads at once.  Unlike a thread_local variable, there may be
+// any number of ThreadLocalPtr objects, each with its own pointers.
+//
+// Get(), Reset(), Swap() and CompareAndSwap() take no lock.
+class ThreadLocalPtr {
+ public:
+  // Called with the non-null pointer of a thread when the thread exits or
+  // the ThreadLocalPtr is deleted.  It runs while an internal lock is
+  // held, so it must not wait for another thread that may use a
+  // ThreadLocalPtr.
+  typedef void (*UnrefHandler)(void* ptr);
+
+  explicit ThreadLocalPtr(UnrefHandler handler = nullptr);
+
+  ThreadLocalPtr(const ThreadLocalPtr&) = delete;
+  ThreadLocalPtr& operator=(const ThreadLocalPtr&) = delete;
+
+  ~ThreadLocalPtr();
+
+  // Return the pointer of the calling thread, initially nullptr.
+  void* Get() const;
+
+  // Set the pointer of the calling thread.
+  void Reset(void* ptr);
+
+  // Set the pointer of the calling thread and return its old value.
+  void* Swap(void* ptr);
+
+  // If the pointer of the calling thread is "expected", set it to "ptr"
+  // and return true.  Otherwise store it in "expected" and return false.
+  bool CompareAndSwap(void* ptr, void*& expected);
+
+  // Replace the pointers of all threads with "replacement" and append
+  // the old ones that are not nullptr to *ptrs.
+  void Scrape(std::vector<void*>* ptrs, void* replacement);
+
+ private:
+  const uint32_t id_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_THREAD_LOCAL_H_
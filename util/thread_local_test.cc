@@ -0,0 +1,121 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/thread_local.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace leveldb {
+
+static std::atomic<int> unref_count(0);
+
+static void CountUnref(void* ptr) { unref_count.fetch_add(1); }
+
+static int values[4];
+
+TEST(ThreadLocalTest, PerThread) {
+  ThreadLocalPtr tls;
+  ASSERT_EQ(nullptr, tls.Get());
+  tls.Reset(&values[0]);
+  ASSERT_EQ(&values[0], tls.Get());
+
+  std::thread t([&tls] {
+    ASSERT_EQ(nullptr, tls.Get());
+    tls.Reset(&values[1]);
+    ASSERT_EQ(&values[1], tls.Get());
+  });
+  t.join();
+  ASSERT_EQ(&values[0], tls.Get());
+
+  // Each ThreadLocalPtr has pointers of its own
+  ThreadLocalPtr other;
+  ASSERT_EQ(nullptr, other.Get());
+  other.Reset(&values[2]);
+  ASSERT_EQ(&values[0], tls.Get());
+  ASSERT_EQ(&values[2], other.Get());
+}
+
+TEST(ThreadLocalTest, SwapAndCompareAndSwap) {
+  ThreadLocalPtr tls;
+  ASSERT_EQ(nullptr, tls.Swap(&values[0]));
+  ASSERT_EQ(&values[0], tls.Swap(&values[1]));
+
+  void* expected = &values[0];
+  ASSERT_TRUE(!tls.CompareAndSwap(&values[2], expected));
+  ASSERT_EQ(&values[1], expected);
+  ASSERT_TRUE(tls.CompareAndSwap(&values[2], expected));
+  ASSERT_EQ(&values[2], tls.Get());
+}
+
+TEST(ThreadLocalTest, Scrape) {
+  ThreadLocalPtr tls;
+  const int kThreads = 4;
+  std::atomic<int> ready(0);
+  std::atomic<bool> scraped(false);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; i++) {
+    threads.emplace_back([&, i] {
+      tls.Reset(&values[i]);
+      ready.fetch_add(1);
+      while (!scraped.load()) {
+        std::this_thread::yield();
+      }
+      ASSERT_EQ(&values[3], tls.Get());
+    });
+  }
+  while (ready.load() < kThreads) {
+    std::this_thread::yield();
+  }
+
+  std::vector<void*> ptrs;
+  tls.Scrape(&ptrs, &values[3]);
+  scraped.store(true);
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(kThreads, ptrs.size());
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT_TRUE(std::find(ptrs.begin(), ptrs.end(), &values[i]) != ptrs.end());
+  }
+}
+
+TEST(ThreadLocalTest, UnrefOnThreadExit) {
+  unref_count.store(0);
+  ThreadLocalPtr tls(&CountUnref);
+  std::thread t1([&tls] { tls.Reset(&values[0]); });
+  t1.join();
+  ASSERT_EQ(1, unref_count.load());
+
+  // Threads that leave a null pointer are not counted
+  std::thread t2([&tls] {
+    tls.Reset(&values[0]);
+    tls.Reset(nullptr);
+  });
+  t2.join();
+  ASSERT_EQ(1, unref_count.load());
+}
+
+TEST(ThreadLocalTest, UnrefOnDelete) {
+  unref_count.store(0);
+  ThreadLocalPtr* tls = new ThreadLocalPtr(&CountUnref);
+  tls->Reset(&values[0]);
+  delete tls;
+  ASSERT_EQ(1, unref_count.load());
+
+  // The id of a deleted ThreadLocalPtr is reused with its pointers cleared
+  ThreadLocalPtr reused;
+  ASSERT_EQ(nullptr, reused.Get());
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}